@@ -215,4 +215,10 @@ void object::copy_local_tls(void* to_addr)
     memset(to_addr + _tls_init_size, 0, _tls_uninit_size);
 }
 
+// Not implemented: system calls of applications always go through the
+// svc exception handler.
+void object::arch_patch_syscalls()
+{
+}
+
 }
@@ -170,6 +170,21 @@ inline void arch_cpu::set_interrupt_stack(arch_thread* t)
     set_ist_entry(2, s, sizeof(s));
 }
 
+// Enables the FPU and vector register state xsave saves and restores,
+// needs cr4_osxsave set
+inline void init_xcr0()
+{
+    using namespace processor;
+
+    if (features().xsave) {
+        auto bits = xcr0_x87 | xcr0_sse;
+        if (features().avx) {
+            bits |= xcr0_avx;
+        }
+        write_xcr(xcr0, bits);
+    }
+}
+
 inline void arch_cpu::init_on_cpu()
 {
     using namespace processor;
@@ -186,14 +201,7 @@ inline void arch_cpu::init_on_cpu()
         cr4 |= cr4_osxsave;
     }
     write_cr4(cr4);
-
-    if (features().xsave) {
-        auto bits = xcr0_x87 | xcr0_sse;
-        if (features().avx) {
-            bits |= xcr0_avx;
-        }
-        write_xcr(xcr0, bits);
-    }
+    init_xcr0();
 
     // We can't trust the FPU and the MXCSR to be always initialized to default values.
     // In at least one particular version of Xen it is not, leading to SIMD exceptions.
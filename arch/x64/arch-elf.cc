@@ -9,6 +9,10 @@
 
 #include <osv/elf.hh>
 #include <osv/sched.hh>
+#include <osv/mmu.hh>
+#include <osv/align.hh>
+#include <osv/syscalls.hh>
+#include <new>
 #include <osv/kernel_config_elf_debug.h>
 
 #if CONF_elf_debug
@@ -18,6 +22,8 @@
 #endif
 
 extern "C" size_t __tlsdesc_static(size_t *);
+extern "C" void syscall_direct_entry();
+
 namespace elf {
 
 // This function is solely used to relocate symbols in OSv kernel ELF
@@ -253,4 +259,118 @@ void object::copy_local_tls(void* to_addr)
     memset(to_addr + _tls_init_size, 0, _tls_uninit_size);
 }
 
+// What a patched "mov $number, %eax; syscall" jumps to instead of the
+// mov. syscall_direct_entry expects rcx and r11 set up as by the syscall
+// instruction, and rflags cannot be read into r11 without a push, so the
+// stub first moves the stack pointer past the red zone the application may
+// be using below it.
+struct [[gnu::packed]] syscall_stub {
+    explicit syscall_stub(const syscall_desc* d, const void* ret_addr)
+        : desc(reinterpret_cast<u64>(d))
+        , ret(static_cast<const u8*>(ret_addr) - reinterpret_cast<u8*>(&ret + 1))
+        , entry(reinterpret_cast<u64>(syscall_direct_entry))
+    {
+    }
+    u8 lea_sub_rsp[5] = { 0x48, 0x8d, 0x64, 0x24, 0x80 }; // lea -128(%rsp),%rsp
+    u8 pushfq = 0x9c;
+    u8 pop_r11[2] = { 0x41, 0x5b };
+    u8 lea_add_rsp[8] = { 0x48, 0x8d, 0xa4, 0x24, 0x80, 0, 0, 0 }; // lea 128(%rsp),%rsp
+    u8 movabs_rax[2] = { 0x48, 0xb8 };
+    u64 desc;
+    u8 lea_rcx[3] = { 0x48, 0x8d, 0x0d };  // lea ret(%rip),%rcx
+    s32 ret;
+    u8 jmp_entry[6] = { 0xff, 0x25, 0, 0, 0, 0 }; // jmp *entry(%rip)
+    u64 entry;
+    u8 int3 = 0xcc;
+};
+static_assert(sizeof(syscall_stub) == 48, "syscall_stub size");
+
+struct syscall_site {
+    u8* mov;
+    unsigned mov_len;
+    const syscall_desc* desc;
+};
+
+// Finds "mov $number, %eax" (b8 imm32) or "mov $number, %rax" (48 c7 c0
+// imm32) followed by syscall (0f 05), for system calls we implement.
+// A match right after a REX or operand size prefix is the tail of another
+// instruction, e.g. 41 b8 imm32 is "mov $imm32, %r8d", and is skipped.
+static bool is_prefix(u8 b)
+{
+    return (b & 0xf0) == 0x40 || b == 0x66;
+}
+
+static void find_syscalls(u8* start, u8* end, std::vector<syscall_site>& sites)
+{
+    for (u8* p = start; p + 9 <= end; p++) {
+        unsigned mov_len;
+        u32 number;
+        if (p > start && is_prefix(p[-1])) {
+            continue;
+        }
+        if (p[0] == 0xb8 && p[5] == 0x0f && p[6] == 0x05) {
+            mov_len = 5;
+            memcpy(&number, p + 1, 4);
+        } else if (p[0] == 0x48 && p[1] == 0xc7 && p[2] == 0xc0 &&
+                   p[7] == 0x0f && p[8] == 0x05) {
+            mov_len = 7;
+            memcpy(&number, p + 3, 4);
+        } else {
+            continue;
+        }
+        if (auto desc = syscall_lookup(number)) {
+            sites.push_back({p, mov_len, desc});
+        }
+        p += mov_len + 1;
+    }
+}
+
+// Replaces the mov of each site found with a jump to a stub entering the
+// system call's syscall_desc directly, see syscall_direct_entry. The
+// syscall instruction itself is kept, so a jump straight to it still
+// works, and the stubs return past it. This is a heuristic: the byte patterns are not
+// known to be instructions, which is why it has to be asked for with
+// --patch-syscalls. Only done before the object runs, so no thread can be
+// executing the bytes being replaced.
+void object::arch_patch_syscalls()
+{
+    std::vector<syscall_site> sites;
+    for (auto&& phdr : _phdrs) {
+        if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+            auto start = static_cast<u8*>(_base + phdr.p_vaddr);
+            find_syscalls(start, start + phdr.p_filesz, sites);
+        }
+    }
+    if (sites.empty()) {
+        return;
+    }
+
+    // The stubs have to be within reach of a rel32 jump, so ask for them
+    // right after the object
+    size_t size = align_up<size_t>(sites.size() * sizeof(syscall_stub), mmu::page_size);
+    auto stubs = static_cast<syscall_stub*>(mmu::map_anon(
+            align_up(_end, mmu::page_size), size, mmu::mmap_populate, mmu::perm_rw));
+    unsigned patched = 0;
+    for (auto& site : sites) {
+        auto stub = &stubs[patched];
+        s64 rel = reinterpret_cast<u8*>(stub) - (site.mov + 5);
+        if (rel != static_cast<s32>(rel)) {
+            continue;
+        }
+        new (stub) syscall_stub(site.desc, site.mov + site.mov_len + 2);
+        site.mov[0] = 0xe9; // jmp rel32
+        s32 rel32 = rel;
+        memcpy(site.mov + 1, &rel32, 4);
+        if (site.mov_len == 7) {
+            site.mov[5] = 0x66; // 2-byte nop
+            site.mov[6] = 0x90;
+        }
+        patched++;
+    }
+    mmu::mprotect(stubs, size, mmu::perm_read | mmu::perm_exec);
+    _syscall_stubs = stubs;
+    _syscall_stubs_size = size;
+    elf_debug("Patched %u of %zu system calls, stubs at %018p\n", patched, sites.size(), stubs);
+}
+
 }
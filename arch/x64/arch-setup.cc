@@ -274,6 +274,13 @@ void arch_init_premain()
 #endif
 
     disable_pic();
+
+    // The memcpy() and friends the kernel's ifuncs are about to pick may use
+    // AVX (see arch/x64/string.cc), and run before init_on_cpu() enables it
+    if (processor::features().xsave) {
+        processor::write_cr4(processor::read_cr4() | processor::cr4_osxsave);
+        sched::init_xcr0();
+    }
 }
 
 #include "drivers/driver.hh"
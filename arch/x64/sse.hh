@@ -52,4 +52,12 @@ __m128i& xmm(sse_register_file<Regs>& sse)
 
 void ssse3_unaligned_copy(void* dest, const void* src, size_t n);
 
+// In string-avx2.cc, for cpus with AVX2 only. avx2_copy() and avx2_set()
+// need n >= 32.
+void avx2_copy(void* dest, const void* src, size_t n, bool nontemporal);
+void avx2_set(void* dest, int c, size_t n, bool nontemporal);
+int memcmp_avx2(const void* l, const void* r, size_t n);
+void* memchr_avx2(const void* src, int c, size_t n);
+size_t strlen_avx2(const char* s);
+
 #endif /* SSE_HH_ */
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// AVX2 versions of the string and memory functions, picked by the
+// resolvers in string.cc on cpus that have AVX2. This file is built with
+// -mavx2, so nothing here may be called on other cpus, and it includes no
+// headers with inline functions or templates, whose out of line copies
+// could end up used everywhere else.
+
+#include "sse.hh"
+#include <x86intrin.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef __m256i vec;
+static constexpr size_t vec_size = sizeof(vec);
+
+static inline vec loadu(const void* p)
+{
+    return _mm256_loadu_si256(static_cast<const vec*>(p));
+}
+
+static inline vec load(const void* p)
+{
+    return _mm256_load_si256(static_cast<const vec*>(p));
+}
+
+static inline void storeu(void* p, vec v)
+{
+    _mm256_storeu_si256(static_cast<vec*>(p), v);
+}
+
+static inline void store(void* p, vec v)
+{
+    _mm256_store_si256(static_cast<vec*>(p), v);
+}
+
+static inline unsigned match(vec a, vec b)
+{
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+}
+
+// Bytes to the next vec_size aligned address past p, 1 to vec_size
+static inline size_t to_aligned(const void* p)
+{
+    return vec_size - (reinterpret_cast<uintptr_t>(p) & (vec_size - 1));
+}
+
+// Like memcpy() in string.cc, also used for overlapping dest and src when
+// dest < src. So the first and last vectors, which the aligned stores of
+// the loop overlap, are loaded before and stored after the loop, and each
+// part of src is loaded before anything overlapping it is stored.
+void avx2_copy(void* dest, const void* src, size_t n, bool nontemporal)
+{
+    auto d = static_cast<char*>(dest);
+    auto s = static_cast<const char*>(src);
+    vec head = loadu(s);
+    vec tail = loadu(s + n - vec_size);
+    if (n <= 2 * vec_size) {
+        storeu(d, head);
+        storeu(d + n - vec_size, tail);
+        return;
+    }
+
+    size_t i = to_aligned(d);
+    size_t end = n - vec_size;
+    if (nontemporal) {
+        for (; i + 4 * vec_size <= end; i += 4 * vec_size) {
+            vec v0 = loadu(s + i);
+            vec v1 = loadu(s + i + vec_size);
+            vec v2 = loadu(s + i + 2 * vec_size);
+            vec v3 = loadu(s + i + 3 * vec_size);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i), v0);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i + vec_size), v1);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i + 2 * vec_size), v2);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i + 3 * vec_size), v3);
+        }
+        // Order the streaming stores before the stores of whoever sees
+        // the copy next
+        _mm_sfence();
+    } else {
+        for (; i + 4 * vec_size <= end; i += 4 * vec_size) {
+            vec v0 = loadu(s + i);
+            vec v1 = loadu(s + i + vec_size);
+            vec v2 = loadu(s + i + 2 * vec_size);
+            vec v3 = loadu(s + i + 3 * vec_size);
+            store(d + i, v0);
+            store(d + i + vec_size, v1);
+            store(d + i + 2 * vec_size, v2);
+            store(d + i + 3 * vec_size, v3);
+        }
+    }
+    for (; i < end; i += vec_size) {
+        store(d + i, loadu(s + i));
+    }
+    storeu(d, head);
+    storeu(d + end, tail);
+}
+
+void avx2_set(void* dest, int c, size_t n, bool nontemporal)
+{
+    auto d = static_cast<char*>(dest);
+    vec v = _mm256_set1_epi8(c);
+    storeu(d, v);
+    storeu(d + n - vec_size, v);
+    if (n <= 2 * vec_size) {
+        return;
+    }
+
+    size_t i = to_aligned(d);
+    size_t end = n - vec_size;
+    if (nontemporal) {
+        for (; i + 4 * vec_size <= end; i += 4 * vec_size) {
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i), v);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i + vec_size), v);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i + 2 * vec_size), v);
+            _mm256_stream_si256(reinterpret_cast<vec*>(d + i + 3 * vec_size), v);
+        }
+        _mm_sfence();
+    } else {
+        for (; i + 4 * vec_size <= end; i += 4 * vec_size) {
+            store(d + i, v);
+            store(d + i + vec_size, v);
+            store(d + i + 2 * vec_size, v);
+            store(d + i + 3 * vec_size, v);
+        }
+    }
+    for (; i < end; i += vec_size) {
+        store(d + i, v);
+    }
+}
+
+static inline int byte_diff(const unsigned char* a, const unsigned char* b,
+                            unsigned mismatch)
+{
+    auto i = __builtin_ctz(mismatch);
+    return a[i] - b[i];
+}
+
+int memcmp_avx2(const void* vl, const void* vr, size_t n)
+{
+    auto l = static_cast<const unsigned char*>(vl);
+    auto r = static_cast<const unsigned char*>(vr);
+    if (n < vec_size) {
+        if (n >= 16) {
+            // The two halves overlap when n < 32, which is fine as the
+            // overlap compared equal in the first
+            unsigned m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(l)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(r)))) & 0xffff;
+            if (m) {
+                return byte_diff(l, r, m);
+            }
+            l += n - 16;
+            r += n - 16;
+            m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(l)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(r)))) & 0xffff;
+            return m ? byte_diff(l, r, m) : 0;
+        }
+        for (; n && *l == *r; n--, l++, r++);
+        return n ? *l - *r : 0;
+    }
+
+    size_t i = 0;
+    for (; i + 4 * vec_size <= n; i += 4 * vec_size) {
+        vec e0 = _mm256_cmpeq_epi8(loadu(l + i), loadu(r + i));
+        vec e1 = _mm256_cmpeq_epi8(loadu(l + i + vec_size), loadu(r + i + vec_size));
+        vec e2 = _mm256_cmpeq_epi8(loadu(l + i + 2 * vec_size), loadu(r + i + 2 * vec_size));
+        vec e3 = _mm256_cmpeq_epi8(loadu(l + i + 3 * vec_size), loadu(r + i + 3 * vec_size));
+        vec all = _mm256_and_si256(_mm256_and_si256(e0, e1), _mm256_and_si256(e2, e3));
+        if (unsigned(_mm256_movemask_epi8(all)) != 0xffffffff) {
+            break;
+        }
+    }
+    for (; i + vec_size <= n; i += vec_size) {
+        unsigned m = ~match(loadu(l + i), loadu(r + i));
+        if (m) {
+            return byte_diff(l + i, r + i, m);
+        }
+    }
+    if (i < n) {
+        // Compare the last vector, overlapping what compared equal
+        i = n - vec_size;
+        unsigned m = ~match(loadu(l + i), loadu(r + i));
+        if (m) {
+            return byte_diff(l + i, r + i, m);
+        }
+    }
+    return 0;
+}
+
+// memchr() and strlen() only ever load aligned vectors, which cannot
+// cross into a page past the one with the last byte they must look at.
+// The bytes they load before the start of the string are masked off.
+
+void* memchr_avx2(const void* src, int c, size_t n)
+{
+    if (!n) {
+        return nullptr;
+    }
+    auto s = static_cast<const char*>(src);
+    vec v = _mm256_set1_epi8(c);
+    size_t off = reinterpret_cast<uintptr_t>(s) & (vec_size - 1);
+    auto p = s - off;
+    unsigned m = match(load(p), v) >> off;
+    if (m) {
+        size_t i = __builtin_ctz(m);
+        return i < n ? const_cast<char*>(s + i) : nullptr;
+    }
+    if (n <= vec_size - off) {
+        return nullptr;
+    }
+    n -= vec_size - off;
+    p += vec_size;
+
+    for (; n > 4 * vec_size; n -= 4 * vec_size, p += 4 * vec_size) {
+        vec e0 = _mm256_cmpeq_epi8(load(p), v);
+        vec e1 = _mm256_cmpeq_epi8(load(p + vec_size), v);
+        vec e2 = _mm256_cmpeq_epi8(load(p + 2 * vec_size), v);
+        vec e3 = _mm256_cmpeq_epi8(load(p + 3 * vec_size), v);
+        vec any = _mm256_or_si256(_mm256_or_si256(e0, e1), _mm256_or_si256(e2, e3));
+        if (_mm256_movemask_epi8(any)) {
+            break;
+        }
+    }
+    for (;; n -= vec_size, p += vec_size) {
+        m = match(load(p), v);
+        if (m) {
+            size_t i = __builtin_ctz(m);
+            return i < n ? const_cast<char*>(p + i) : nullptr;
+        }
+        if (n <= vec_size) {
+            return nullptr;
+        }
+    }
+}
+
+size_t strlen_avx2(const char* s)
+{
+    vec zero = _mm256_setzero_si256();
+    size_t off = reinterpret_cast<uintptr_t>(s) & (vec_size - 1);
+    auto p = s - off;
+    unsigned m = match(load(p), zero) >> off;
+    if (m) {
+        return __builtin_ctz(m);
+    }
+    p += vec_size;
+
+    // Four vectors at a time only once they are within one page
+    for (; reinterpret_cast<uintptr_t>(p) & (4 * vec_size - 1); p += vec_size) {
+        m = match(load(p), zero);
+        if (m) {
+            return p - s + __builtin_ctz(m);
+        }
+    }
+    for (;; p += 4 * vec_size) {
+        vec v0 = load(p);
+        vec v1 = load(p + vec_size);
+        vec v2 = load(p + 2 * vec_size);
+        vec v3 = load(p + 3 * vec_size);
+        // The minimum byte is zero where any of the four has a zero
+        vec min = _mm256_min_epu8(_mm256_min_epu8(v0, v1), _mm256_min_epu8(v2, v3));
+        if (match(min, zero)) {
+            break;
+        }
+    }
+    for (;; p += vec_size) {
+        m = match(load(p), zero);
+        if (m) {
+            return p - s + __builtin_ctz(m);
+        }
+    }
+}
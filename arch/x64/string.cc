@@ -16,11 +16,30 @@
 #include <osv/initialize.hh>
 #include "sse.hh"
 #include <x86intrin.h>
+#include <osv/mempool.hh>
+#include <osv/kernel_config_memory_jvm_balloon.h>
 
 extern "C"
 void *memcpy_base(void *__restrict dest, const void *__restrict src, size_t n);
 extern "C"
 void *memset_base(void *__restrict dest, int c, size_t n);
+// musl's, renamed (see the Makefile)
+extern "C" void *memchr_base(const void *src, int c, size_t n);
+extern "C" int memcmp_base(const void *l, const void *r, size_t n);
+extern "C" size_t strlen_base(const char *s);
+
+// Whether the AVX2 versions in string-avx2.cc can be used: besides the cpu
+// supporting it, the ymm registers have to be enabled in xcr0, which
+// init_xcr0() does when the cpu has xsave and avx.
+static bool avx2()
+{
+    auto& f = processor::features();
+    return f.avx2 && f.avx && f.xsave;
+}
+
+// Copies and memset()s at least this big would only evict everything else
+// from the caches, so they use non-temporal stores instead.
+static constexpr size_t nontemporal_threshold = 4 << 20;
 
 extern "C" void memcpy_fixup_byte(exception_frame *ef, size_t fixup)
 {
@@ -310,9 +329,59 @@ void *memcpy_repmov_ssse3(void *__restrict dest, const void *__restrict src, siz
     }
 }
 
+// The JVM balloon moves itself when a memcpy() faults on it, for which it
+// needs the memcpy_decoder of rep movs (see memcpy_find_decoder()), so
+// leave big copies to rep movs while there is one.
+static bool nontemporal_copy(const void* dest, const void* src, size_t n)
+{
+#if CONF_memory_jvm_balloon
+    if (memory::balloon_api) {
+        return false;
+    }
+#endif
+    return n >= nontemporal_threshold && (dest + n <= src || src + n <= dest);
+}
+
+extern "C"
+[[gnu::optimize("omit-frame-pointer")]]
+void *memcpy_repmov_avx2(void *__restrict dest, const void *__restrict src, size_t n)
+{
+    if (n < 32) {
+        return small_memcpy(dest, src, n);
+    } else if (n < 4096) {
+        avx2_copy(dest, src, n, false);
+        return dest;
+    } else if (nontemporal_copy(dest, src, n)) {
+        avx2_copy(dest, src, n, true);
+        return dest;
+    } else {
+        auto ret = dest;
+        repmovsb(dest, src, n);
+        return ret;
+    }
+}
+
+extern "C"
+[[gnu::optimize("omit-frame-pointer")]]
+void *memcpy_avx2(void *__restrict dest, const void *__restrict src, size_t n)
+{
+    if (n < 32) {
+        return small_memcpy(dest, src, n);
+    }
+    avx2_copy(dest, src, n, nontemporal_copy(dest, src, n));
+    return dest;
+}
+
 extern "C"
 void *(*resolve_memcpy())(void *__restrict dest, const void *__restrict src, size_t n)
 {
+    if (avx2()) {
+        if (processor::features().repmovsb) {
+            return memcpy_repmov_avx2;
+        } else {
+            return memcpy_avx2;
+        }
+    }
     if (processor::features().repmovsb) {
         if (processor::features().ssse3) {
             return memcpy_repmov_ssse3;
@@ -525,9 +594,23 @@ void *memset_repstosb(void *__restrict dest, int c, size_t n)
     return ret;
 }
 
+extern "C"
+void *memset_avx2(void *__restrict dest, int c, size_t n)
+{
+    if (n < 32) {
+        small_memset(dest, c, n);
+    } else {
+        avx2_set(dest, c, n, n >= nontemporal_threshold);
+    }
+    return dest;
+}
+
 extern "C"
 void *(*resolve_memset())(void *__restrict dest, int c, size_t n)
 {
+    if (avx2()) {
+        return memset_avx2;
+    }
     if (processor::features().repmovsb) {
         return memset_repstosb;
     }
@@ -537,4 +620,31 @@ void *(*resolve_memset())(void *__restrict dest, int c, size_t n)
 void *memset(void *__restrict dest, int c, size_t n)
     __attribute__((ifunc("resolve_memset")));
 
+extern "C"
+int (*resolve_memcmp())(const void *l, const void *r, size_t n)
+{
+    return avx2() ? memcmp_avx2 : memcmp_base;
+}
+
+int memcmp(const void *l, const void *r, size_t n)
+    __attribute__((ifunc("resolve_memcmp")));
+
+extern "C"
+void *(*resolve_memchr())(const void *src, int c, size_t n)
+{
+    return avx2() ? memchr_avx2 : memchr_base;
+}
+
+void *memchr(const void *src, int c, size_t n)
+    __attribute__((ifunc("resolve_memchr")));
+
+extern "C"
+size_t (*resolve_strlen())(const char *s)
+{
+    return avx2() ? strlen_avx2 : strlen_base;
+}
+
+size_t strlen(const char *s)
+    __attribute__((ifunc("resolve_strlen")));
+
 
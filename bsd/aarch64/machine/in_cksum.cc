@@ -39,6 +39,9 @@
 
 #include <sys/cdefs.h>			/* RCS ID & Copyright macro defns */
 
+#include <arm_neon.h>
+#include <string.h>
+
 #include <bsd/porting/netport.h>
 
 #include <bsd/sys/sys/param.h>
@@ -89,7 +92,7 @@ union q_util {
 };
 
 static u_int64_t
-in_cksumdata(const void *buf, int len)
+in_cksumdata_base(const void *buf, int len)
 {
 	const u_int32_t *lw = (const u_int32_t *) buf;
 	u_int64_t sum = 0;
@@ -169,6 +172,72 @@ in_cksumdata(const void *buf, int len)
 	return sum;
 }
 
+/*
+ * Sums the 32-bit words of the len bytes at src into a 64-bit sum, copying
+ * them to dst unless it is NULL.  len is a multiple of 64.  NEON is part of
+ * the base architecture, so unlike on x64 there is no other version.
+ */
+static u_int64_t
+in_cksum_bulk(const void *src, void *dst, size_t len)
+{
+	const u_int8_t *s = (const u_int8_t *) src;
+	u_int8_t *d = (u_int8_t *) dst;
+	uint64x2_t a0 = vdupq_n_u64(0), a1 = a0, a2 = a0, a3 = a0;
+	uint8x16_t v0, v1, v2, v3;
+	size_t i;
+
+	/* Byte loads and stores, which need no alignment */
+	for (i = 0; i < len; i += 64) {
+		v0 = vld1q_u8(s + i);
+		v1 = vld1q_u8(s + i + 16);
+		v2 = vld1q_u8(s + i + 32);
+		v3 = vld1q_u8(s + i + 48);
+		if (d) {
+			vst1q_u8(d + i, v0);
+			vst1q_u8(d + i + 16, v1);
+			vst1q_u8(d + i + 32, v2);
+			vst1q_u8(d + i + 48, v3);
+		}
+		/* Adds each pair of 32-bit words to a 64-bit lane */
+		a0 = vpadalq_u32(a0, vreinterpretq_u32_u8(v0));
+		a1 = vpadalq_u32(a1, vreinterpretq_u32_u8(v1));
+		a2 = vpadalq_u32(a2, vreinterpretq_u32_u8(v2));
+		a3 = vpadalq_u32(a3, vreinterpretq_u32_u8(v3));
+	}
+	a0 = vaddq_u64(vaddq_u64(a0, a1), vaddq_u64(a2, a3));
+	return (vgetq_lane_u64(a0, 0) + vgetq_lane_u64(a0, 1));
+}
+
+/*
+ * Leaves data shorter than a few cache lines, and the bytes before the
+ * first and after the last 64 byte block, to in_cksumdata_base().  Its
+ * words are the aligned ones too, so the sums add up.
+ */
+static u_int64_t
+in_cksumdata(const void *buf, int len)
+{
+	const char *p = (const char *) buf;
+	u_int64_t sum = 0;
+	union q_util q_util;
+	int n;
+
+	if (len < 256)
+		return (in_cksumdata_base(buf, len));
+	if ((n = 3 & -(long) p) != 0) {
+		sum = in_cksumdata_base(p, n);
+		p += n;
+		len -= n;
+	}
+	n = len & ~63;
+	sum += in_cksum_bulk(p, NULL, n);
+	p += n;
+	len -= n;
+	if (len)
+		sum += in_cksumdata_base(p, len);
+	REDUCE32;
+	return (sum);
+}
+
 u_short
 in_addword(u_short a, u_short b)
 {
@@ -231,6 +300,48 @@ skip_start:
 	return (~sum & 0xffff);
 }
 
+/*
+ * Copies len bytes from src to dst, which is what sosend does with the
+ * data of a datagram anyway, summing them on the way instead of reading
+ * them again in in_delayed_cksum().  prev is the sum of the off bytes of
+ * data before these, to which theirs is added.  Returns the 16-bit sum,
+ * not complemented.
+ */
+u_short
+in_cksum_copy(const void *src, void *dst, int len, u_short prev, int off)
+{
+	const char *s = (const char *) src;
+	char *d = (char *) dst;
+	u_int64_t sum = 0, w;
+	union q_util q_util;
+	union l_util l_util;
+	int n;
+
+	/* Unlike in_cksumdata(), the words are relative to src */
+	if ((n = len & ~63) != 0) {
+		sum = in_cksum_bulk(s, d, n);
+		s += n;
+		d += n;
+		len -= n;
+	}
+	for (; len >= 8; len -= 8, s += 8, d += 8) {
+		memcpy(&w, s, 8);
+		memcpy(d, &w, 8);
+		sum += (w & 0xffffffff) + (w >> 32);
+	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, s, len);
+		memcpy(d, s, len);
+		sum += (w & 0xffffffff) + (w >> 32);
+	}
+	REDUCE16;
+	/* Bytes at odd offsets into the data are the high ones of its words */
+	if (off & 1)
+		sum = ((sum & 0xff) << 8) | (sum >> 8);
+	return (in_addword(prev, sum));
+}
+
 u_int in_cksum_hdr(const struct ip *ip)
 {
     u_int64_t sum = in_cksumdata(ip, sizeof(struct ip));
@@ -1078,6 +1078,10 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * transfer freed_map (this txg's frees) to defer_map.
 	 */
 	space_map_load_wait(sm);
+#ifdef __OSV__
+	if (vd->vdev_ops == &vdev_disk_ops)
+		vdev_disk_trim(vd, defer_map);
+#endif
 	space_map_vacate(defer_map, sm->sm_loaded ? space_map_free : NULL, sm);
 	space_map_vacate(freed_map, space_map_add, defer_map);
 
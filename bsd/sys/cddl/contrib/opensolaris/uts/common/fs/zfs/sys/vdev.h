@@ -46,6 +46,8 @@ typedef enum vdev_dtl_type {
 } vdev_dtl_type_t;
 
 extern boolean_t zfs_nocacheflush;
+extern bool zfs_trim_enabled;
+extern uint64_t zfs_trimmed_bytes;
 
 extern int vdev_open(vdev_t *);
 extern void vdev_open_children(vdev_t *);
@@ -217,6 +217,81 @@ vdev_ops_t vdev_disk_ops = {
 	B_TRUE			/* leaf vdev */
 };
 
+/*
+ * Discard the segments of the given space map, in vdev offsets, and wait
+ * for the discards to complete. The metaslab calls this for deferred frees
+ * right before they go back into circulation: they can no longer be needed
+ * to roll back to an earlier txg, and waiting ensures no discard can race
+ * with a new write to the same blocks. All segments are issued at once and
+ * the driver packs each into as few requests as the device allows.
+ *
+ * Only done when enabled with --zfs-trim (zfs_trim_enabled, defined in the
+ * kernel): the wait happens in syncing context with the metaslab lock
+ * held, which delays each txg by as long as the device takes to discard
+ * the space freed. Segments are shrunk to the device's discard alignment,
+ * the device would likely ignore their unaligned ends anyway.
+ */
+void
+vdev_disk_trim(vdev_t *vd, space_map_t *sm)
+{
+	struct vdev_disk *dvd = vd->vdev_tsd;
+	struct device *dev;
+	struct bio **bios;
+	uint64_t *lens;
+	space_seg_t *ss;
+	uint64_t align, start, end;
+	int i, n, error;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+
+	if (!zfs_trim_enabled || vd->vdev_notrim || dvd == NULL ||
+	    sm->sm_space == 0)
+		return;
+
+	dev = dvd->device;
+	align = MAX(dev->discard_alignment, DEV_BSIZE);
+	n = avl_numnodes(&sm->sm_root);
+	bios = kmem_alloc(n * sizeof (struct bio *), KM_SLEEP);
+	lens = kmem_alloc(n * sizeof (uint64_t), KM_SLEEP);
+
+	i = 0;
+	for (ss = avl_first(&sm->sm_root); ss; ss = AVL_NEXT(&sm->sm_root, ss)) {
+		struct bio *bio;
+
+		/* The alignment is that of the whole disk, not the partition */
+		start = roundup(dev->offset + VDEV_LABEL_START_SIZE + ss->ss_start,
+		    align) - dev->offset;
+		end = rounddown(dev->offset + VDEV_LABEL_START_SIZE + ss->ss_end,
+		    align) - dev->offset;
+		if (start >= end)
+			continue;
+
+		bio = alloc_bio();
+		bio->bio_cmd = BIO_DISCARD;
+		bio->bio_dev = dev;
+		bio->bio_offset = start;
+		bio->bio_bcount = end - start;
+
+		dev->driver->devops->strategy(bio);
+		lens[i] = end - start;
+		bios[i++] = bio;
+	}
+
+	while (i--) {
+		error = bio_wait(bios[i]);
+		/* Discards are advisory, only stop asking if unsupported */
+		if (error == EOPNOTSUPP)
+			vd->vdev_notrim = B_TRUE;
+		/* Drivers may scale bio_bcount, count what was asked for */
+		else if (error == 0)
+			atomic_add_64(&zfs_trimmed_bytes, lens[i]);
+		destroy_bio(bios[i]);
+	}
+
+	kmem_free(lens, n * sizeof (uint64_t));
+	kmem_free(bios, n * sizeof (struct bio *));
+}
+
 static int
 vdev_disk_physio(struct device *dev, caddr_t data, size_t size,
     uint64_t offset, int write)
@@ -386,6 +386,8 @@ linux_to_bsd_msg_flags(int flags)
 		ret_flags |= MSG_WAITALL;
 	if (flags & LINUX_MSG_NOSIGNAL)
 		ret_flags |= MSG_NOSIGNAL;
+	if (flags & LINUX_MSG_WAITFORONE)
+		ret_flags |= MSG_WAITFORONE;
 #if 0 /* not handled */
 	if (flags & LINUX_MSG_PROXY)
 		;
@@ -403,6 +405,23 @@ linux_to_bsd_msg_flags(int flags)
 	return ret_flags;
 }
 
+/* Flags returned in msg_flags by recvmsg() */
+static int
+bsd_to_linux_msg_flags(int flags)
+{
+	int ret_flags = 0;
+
+	if (flags & MSG_OOB)
+		ret_flags |= LINUX_MSG_OOB;
+	if (flags & MSG_EOR)
+		ret_flags |= LINUX_MSG_EOR;
+	if (flags & MSG_TRUNC)
+		ret_flags |= LINUX_MSG_TRUNC;
+	if (flags & MSG_CTRUNC)
+		ret_flags |= LINUX_MSG_CTRUNC;
+	return ret_flags;
+}
+
 static int
 bsd_to_linux_sockaddr(struct bsd_sockaddr *sa)
 {
@@ -471,15 +490,79 @@ bsd_to_linux_cmsg_type(int cmsg_type)
 
 #endif
 
+/* msg_control is handled by the callers, see linux_to_bsd_cmsgs() */
 static int
 linux_to_bsd_msghdr(struct msghdr *hdr)
 {
-	/* Ignore msg_control in OSv */
-	hdr->msg_control = NULL;
 	hdr->msg_flags = linux_to_bsd_msg_flags(hdr->msg_flags);
 	return (0);
 }
 
+/*
+ * Control messages have the same layout in Linux and in our BSD stack,
+ * but only the UDP ones (UDP_SEGMENT, UDP_GRO) also share their levels
+ * and types.  Pass those through and ignore the others, as we always did.
+ */
+static int
+linux_to_bsd_cmsgs(const struct msghdr *msg, struct mbuf **controlp)
+{
+	static const char pad[sizeof(long)] = {};
+	struct cmsghdr *cm;
+	struct mbuf *control = NULL;
+	caddr_t p = (caddr_t)msg->msg_control;
+	caddr_t end = p + msg->msg_controllen;
+	int len;
+
+	*controlp = NULL;
+	for (; p != NULL && p + sizeof(*cm) <= end; p += CMSG_ALIGN(len)) {
+		cm = (struct cmsghdr *)p;
+		len = cm->cmsg_len;
+		if (len < (int)sizeof(*cm) || len > end - p) {
+			m_freem(control);
+			return (EINVAL);
+		}
+		if (cm->cmsg_level != IPPROTO_UDP)
+			continue;
+		if (control == NULL)
+			control = m_get(M_WAIT, MT_CONTROL);
+		if (!m_append(control, len, p) ||
+		    !m_append(control, CMSG_ALIGN(len) - len, pad)) {
+			m_freem(control);
+			return (ENOBUFS);
+		}
+	}
+	*controlp = control;
+	return (0);
+}
+
+/*
+ * The reverse of linux_to_bsd_cmsgs(): drop all but the UDP control
+ * messages the BSD layer copied out to msg_control.
+ */
+static void
+bsd_to_linux_cmsgs(struct msghdr *msg)
+{
+	struct cmsghdr *cm;
+	caddr_t p = (caddr_t)msg->msg_control;
+	caddr_t end = p + msg->msg_controllen;
+	caddr_t out = p;
+	int len;
+
+	for (; p != NULL && p + sizeof(*cm) <= end; p += CMSG_ALIGN(len)) {
+		cm = (struct cmsghdr *)p;
+		len = cm->cmsg_len;
+		if (len < (int)sizeof(*cm) || len > end - p)
+			break;
+		if (cm->cmsg_level != IPPROTO_UDP)
+			continue;
+		len = MIN((int)CMSG_ALIGN(len), end - p);
+		memmove(out, p, len);
+		out += len;
+	}
+	if (msg->msg_control != NULL)
+		msg->msg_controllen = out - (caddr_t)msg->msg_control;
+}
+
 static int
 bsd_to_linux_msghdr(const struct msghdr *hdr)
 {
@@ -519,12 +602,15 @@ linux_sendit(int s, struct msghdr *mp, int flags,
     struct mbuf *control, ssize_t *bytes)
 {
 	struct bsd_sockaddr *to;
+	void *name = mp->msg_name;
 	int error, bsd_flags;
 
 	if (mp->msg_name != NULL) {
 		error = linux_getsockaddr(&to, (const bsd_osockaddr*)mp->msg_name, mp->msg_namelen);
-		if (error)
+		if (error) {
+			m_freem(control);
 			return (error);
+		}
 		mp->msg_name = to;
 	} else
 		to = NULL;
@@ -532,6 +618,7 @@ linux_sendit(int s, struct msghdr *mp, int flags,
 	bsd_flags = linux_to_bsd_msg_flags(flags);
 	error = kern_sendit(s, mp, bsd_flags, control, bytes);
 
+	mp->msg_name = name;
 	if (to)
 		free(to);
 	return (error);
@@ -925,6 +1012,7 @@ linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
 	void *data;
 #endif
 
+	struct mbuf *control;
 	int error;
 
 	/*
@@ -937,12 +1025,15 @@ linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
 	if (msg->msg_control != NULL && msg->msg_controllen == 0)
 		msg->msg_control = NULL;
 
-	/* FIXME: Translate msg control */
-	assert(msg->msg_control == NULL);
+	error = linux_to_bsd_cmsgs(msg, &control);
+	if (error)
+		return (error);
 
 	error = linux_to_bsd_msghdr(msg);
-	if (error)
+	if (error) {
+		m_freem(control);
 		return (error);
+	}
 
 	/* FIXME: OSv - cmsgs translation is done credentials and rights,
 	   we ignore those in OSv. */
@@ -1026,7 +1117,7 @@ linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
 	}
 #endif
 
-	error = linux_sendit(s, msg, flags, NULL, bytes);
+	error = linux_sendit(s, msg, flags, control, bytes);
 
 #if 0
 bad:
@@ -1068,8 +1159,6 @@ linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
 			goto bad;
 	}
 
-	assert(msg->msg_control == NULL);
-
 	error = kern_recvit(s, msg, NULL, bytes);
 	if (error)
 		goto bad;
@@ -1077,6 +1166,8 @@ linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
 	error = bsd_to_linux_msghdr(msg);
 	if (error)
 		goto bad;
+	msg->msg_flags = bsd_to_linux_msg_flags(msg->msg_flags);
+	bsd_to_linux_cmsgs(msg);
 
 	if (msg->msg_name) {
 		error = bsd_to_linux_sockaddr((struct bsd_sockaddr *)msg->msg_name);
@@ -1089,12 +1180,6 @@ linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
 			goto bad;
 	}
 
-	//TODO: Implement handling of ancillary data - see http://www.masterraghu.com/subjects/np/introduction/unix_network_programming_v1.3/ch14lev1sec6.html
-	if (msg->msg_controllen != 0) {
-		WARN_ONCE("linux_recvmsg: ignoring ancillary data (control message)!\n");
-	}
-	assert(msg->msg_control == NULL);
-
 #if 0
 	if (control) {
 		linux_cmsg = malloc(L_CMSG_HDRSZ, M_TEMP, M_WAITOK | M_ZERO);
@@ -1200,6 +1285,99 @@ bad:
 	return (error);
 }
 
+/*
+ * linux_sendmsg() for a vector of messages: translate the addresses and
+ * control data of all of them first, then send them with a single
+ * kern_sendmmsg().  Messages before one which fails translation are still
+ * sent, as Linux does.
+ */
+int
+linux_sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+	unsigned int *count)
+{
+	struct bsd_sockaddr *to;
+	struct msghdr *msg;
+	struct mbuf **controls;
+	void **names;
+	unsigned int i, n;
+	int error = 0;
+
+	*count = 0;
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+	if (vlen == 0)
+		return (0);
+
+	controls = (struct mbuf **)calloc(vlen, sizeof(*controls));
+	names = (void **)malloc(vlen * sizeof(*names));
+	if (controls == NULL || names == NULL) {
+		free(controls);
+		free(names);
+		return (ENOMEM);
+	}
+
+	for (n = 0; n < vlen; n++) {
+		msg = &msgvec[n].msg_hdr;
+		names[n] = msg->msg_name;
+		error = linux_to_bsd_cmsgs(msg, &controls[n]);
+		if (error)
+			break;
+		if (msg->msg_name != NULL) {
+			error = linux_getsockaddr(&to,
+			    (const bsd_osockaddr*)msg->msg_name,
+			    msg->msg_namelen);
+			if (error) {
+				m_freem(controls[n]);
+				break;
+			}
+			msg->msg_name = to;
+		}
+	}
+
+	if (n > 0)
+		error = kern_sendmmsg(s, msgvec, controls, n,
+		    linux_to_bsd_msg_flags(flags), count);
+
+	for (i = 0; i < n; i++) {
+		msg = &msgvec[i].msg_hdr;
+		if (msg->msg_name != names[i]) {
+			free(msg->msg_name);
+			msg->msg_name = names[i];
+		}
+	}
+	free(controls);
+	free(names);
+	return (error);
+}
+
+int
+linux_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+	const struct timespec *timeout, unsigned int *count)
+{
+	struct msghdr *msg;
+	unsigned int i;
+	int error;
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+	error = kern_recvmmsg(s, msgvec, vlen, linux_to_bsd_msg_flags(flags),
+	    timeout, count);
+	if (error)
+		return (error);
+
+	for (i = 0; i < *count; i++) {
+		msg = &msgvec[i].msg_hdr;
+		msg->msg_flags = bsd_to_linux_msg_flags(msg->msg_flags);
+		bsd_to_linux_cmsgs(msg);
+		if (msg->msg_name && msg->msg_namelen > 0) {
+			bsd_to_linux_sockaddr((struct bsd_sockaddr *)msg->msg_name);
+			if (msg->msg_namelen > 2)
+				linux_sa_put((bsd_osockaddr*)msg->msg_name);
+		}
+	}
+	return (0);
+}
+
 int
 linux_shutdown(int s, int how)
 {
@@ -1230,6 +1408,16 @@ int linux_to_bsd_tcp_sockopt(int name)
 	return -1;
 }
 
+int linux_to_bsd_udp_sockopt(int name)
+{
+	switch (name) {
+	case 103: // UDP_SEGMENT
+	case 104: // UDP_GRO
+		return name;
+	}
+	return -1;
+}
+
 int
 linux_setsockopt(int s, int level, int name, caddr_t val, int valsize)
 {
@@ -1245,6 +1433,9 @@ linux_setsockopt(int s, int level, int name, caddr_t val, int valsize)
 	case IPPROTO_TCP:
 		name = linux_to_bsd_tcp_sockopt(name);
 		break;
+	case IPPROTO_UDP:
+		name = linux_to_bsd_udp_sockopt(name);
+		break;
 	default:
 		name = -1;
 		break;
@@ -1281,6 +1472,9 @@ linux_getsockopt(int s, int level, int name, void *val, socklen_t *valsize)
 	case IPPROTO_TCP:
 		name = linux_to_bsd_tcp_sockopt(name);
 		break;
+	case IPPROTO_UDP:
+		name = linux_to_bsd_udp_sockopt(name);
+		break;
 	default:
 		name = -1;
 		break;
@@ -621,6 +621,8 @@ ena_setup_rx_resources(struct ena_adapter *adapter, unsigned int qid)
 			ena_log(pdev, DBG, "RX Soft LRO[%d] Initialized",
 			    qid);
 			rx_ring->lro.ifp = adapter->ifp;
+			/* Coalesced packets go to net channels too */
+			rx_ring->lro.lro_net_channels = true;
 		}
 	}
 
@@ -276,8 +276,9 @@ xb_strategy(struct bio *bp)
         return;
     }
 
-    if ((bp->bio_cmd == BIO_FLUSH) &&
-            !((sc->xb_flags & XB_BARRIER) || (sc->xb_flags & XB_FLUSH))) {
+    if ((bp->bio_cmd != BIO_READ && bp->bio_cmd != BIO_WRITE && bp->bio_cmd != BIO_FLUSH) ||
+        ((bp->bio_cmd == BIO_FLUSH) &&
+            !((sc->xb_flags & XB_BARRIER) || (sc->xb_flags & XB_FLUSH)))) {
         bp->bio_error = EOPNOTSUPP;
         bp->bio_resid = bp->bio_bcount;
         biodone(bp, false);
@@ -78,8 +78,9 @@ int
 socket_file::read(struct uio *uio, int flags)
 {
     int error;
+    int rflags = (flags & FOF_NONBLOCK) ? MSG_NBIO : 0;
 
-    error = soreceive(so, 0, uio, 0, 0, 0);
+    error = soreceive(so, 0, uio, 0, 0, &rflags);
     return (error);
 }
 
@@ -88,7 +89,7 @@ socket_file::write(struct uio *uio, int flags)
 {
     int error;
 
-    error = sosend(so, 0, uio, 0, 0, 0, 0);
+    error = sosend(so, 0, uio, 0, 0, (flags & FOF_NONBLOCK) ? MSG_NBIO : 0, 0);
 #if 0
     if (error == EPIPE && (so->so_options & SO_NOSIGPIPE) == 0) {
         PROC_LOCK(uio->uio_td->td_proc);
@@ -255,6 +256,7 @@ socket_file::bsd_ioctl(u_long cmd, void *data)
 int
 socket_file::poll(int events)
 {
+    soflush_syn_net_channel(so);
     SOCK_LOCK(so);
     if (so->so_nc) {
         so->so_nc->process_queue();
@@ -307,6 +309,9 @@ void socket_file::epoll_add(epoll_ptr ep)
         if (so->so_nc) {
             so->so_nc->add_epoll(ep);
         }
+        if (auto nc = so->so_syn_nc.load()) {
+            nc->add_epoll(ep);
+        }
     }
     SOCK_UNLOCK(so);
 }
@@ -320,6 +325,9 @@ void socket_file::epoll_del(epoll_ptr ep)
         if (so->so_nc) {
             so->so_nc->del_epoll(ep);
         }
+        if (auto nc = so->so_syn_nc.load()) {
+            nc->del_epoll(ep);
+        }
     }
     SOCK_UNLOCK(so);
 }
@@ -331,6 +339,9 @@ socket_file::poll_install(pollreq& pr)
     if (so->so_nc) {
         so->so_nc->add_poller(pr);
     }
+    if (auto nc = so->so_syn_nc.load()) {
+        nc->add_poller(pr);
+    }
     SOCK_UNLOCK(so);
 }
 
@@ -341,6 +352,9 @@ socket_file::poll_uninstall(pollreq& pr)
     if (so->so_nc) {
         so->so_nc->del_poller(pr);
     }
+    if (auto nc = so->so_syn_nc.load()) {
+        nc->del_poller(pr);
+    }
     SOCK_UNLOCK(so);
 }
 
@@ -35,6 +35,7 @@
 #include <bsd/porting/uma_stub.h>
 #include <bsd/sys/sys/mbuf.h>
 #include <machine/atomic.h>
+#include <machine/in_cksum.h>
 #include <osv/mmu.hh>
 #include <bsd/sys/sys/socket.h>
 #include <osv/zcopy.hh>
@@ -257,6 +258,62 @@ m_getm2_zcopy(struct mbuf *m, struct uio *uio, int len, int how, short type,
 	return (m);
 }
 
+static void
+zbuf_release(void *arg1, void *arg2)
+{
+	reinterpret_cast<zbuf_handle *>(arg1)->release();
+}
+
+/*
+ * Build a packet header mbuf chain referring to len bytes at buf, which must
+ * be mapped and stay so until zb is released. Every mbuf covers physically
+ * contiguous memory only, so drivers can hand it to the device as a single
+ * segment.
+ */
+struct mbuf *
+m_getm_zbuf(const void *buf, size_t len, int how, struct zbuf_handle *zb)
+{
+	struct mbuf *m = NULL, *mtail = NULL, *mb;
+	auto p = reinterpret_cast<uintptr_t>(buf);
+	auto end = p + len;
+
+	while (p < end) {
+		auto pa = mmu::virt_to_phys(reinterpret_cast<void *>(p));
+		auto next = align_down(p, mmu::page_size) + mmu::page_size;
+		while (next < end && mmu::virt_to_phys(reinterpret_cast<void *>(next))
+		    == pa + (next - p))
+			next += mmu::page_size;
+		size_t cnt = bsd_min(next, end) - p;
+
+		mb = (m == NULL) ? m_gethdr(how, MT_DATA) : m_get(how, MT_DATA);
+		if (mb == NULL)
+			goto fail;
+		zb->hold();
+		MEXTADD(mb, p, cnt, zbuf_release, zb, NULL, M_RDONLY, EXT_MOD_TYPE);
+		if ((mb->m_hdr.mh_flags & M_EXT) == 0) {
+			zb->release();
+			m_free(mb);
+			goto fail;
+		}
+		mb->m_hdr.mh_len = cnt;
+
+		if (mtail != NULL)
+			mtail->m_hdr.mh_next = mb;
+		else
+			m = mb;
+		mtail = mb;
+		p += cnt;
+	}
+	if (m != NULL)
+		m->M_dat.MH.MH_pkthdr.len = len;
+	return (m);
+
+fail:
+	if (m != NULL)
+		m_freem(m);
+	return (NULL);
+}
+
 int zcopy_rxgc(struct zmsghdr *zm)
 {
     auto m = reinterpret_cast<mbuf *>(zm->zm_rxhandle);
@@ -1804,16 +1861,45 @@ nospace:
 #endif
 
 /*
- * Copy the contents of uio into a properly sized mbuf chain.
+ * uiomove() of user data into cp, also adding its sum to *sum, as
+ * in_cksum_copy() does.  off is how much data was summed before.
  */
-struct mbuf *
-m_uiotombuf(struct uio *uio, int how, int len, int align, int min_size,
-		    int flags)
+static int
+uiomove_csum(void *cp, int n, struct uio *uio, u_short *sum, int off)
+{
+	while (n > 0 && uio->uio_resid) {
+		struct iovec *iov = uio->uio_iov;
+		size_t cnt = iov->iov_len;
+
+		if (cnt == 0) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		if (cnt > (size_t)n)
+			cnt = n;
+		*sum = in_cksum_copy(iov->iov_base, cp, cnt, *sum, off);
+
+		iov->iov_base = (char *)iov->iov_base + cnt;
+		iov->iov_len -= cnt;
+		uio->uio_resid -= cnt;
+		uio->uio_offset += cnt;
+		cp = (char *)cp + cnt;
+		n -= cnt;
+		off += cnt;
+	}
+	return (0);
+}
+
+static struct mbuf *
+m_uiotombuf_common(struct uio *uio, int how, int len, int align, int min_size,
+		    int flags, bool csum)
 {
 	struct mbuf *m, *mb;
 	int error, length;
 	ssize_t total;
 	int progress = 0;
+	u_short sum = 0;
 
 	/*
 	 * len can be zero or an arbitrary large value bound by
@@ -1844,7 +1930,11 @@ m_uiotombuf(struct uio *uio, int how, int len, int align, int min_size,
 	for (mb = m; mb != NULL; mb = mb->m_hdr.mh_next) {
 		length = bsd_min(M_TRAILINGSPACE(mb), total - progress);
 
-		error = uiomove(mtod(mb, void *), length, uio);
+		if (csum)
+			error = uiomove_csum(mtod(mb, void *), length, uio,
+			    &sum, progress);
+		else
+			error = uiomove(mtod(mb, void *), length, uio);
 		if (error) {
 			m_freem(m);
 			return (NULL);
@@ -1857,9 +1947,37 @@ m_uiotombuf(struct uio *uio, int how, int len, int align, int min_size,
 	}
 	KASSERT(progress == total, ("%s: progress != total", __func__));
 
+	if (csum) {
+		m->M_dat.MH.MH_pkthdr.csum_flags |= CSUM_DATA_SUM;
+		m->M_dat.MH.MH_pkthdr.csum_sum = sum;
+	}
 	return (m);
 }
 
+/*
+ * Copy the contents of uio into a properly sized mbuf chain.
+ */
+struct mbuf *
+m_uiotombuf(struct uio *uio, int how, int len, int align, int min_size,
+		    int flags)
+{
+	return (m_uiotombuf_common(uio, how, len, align, min_size, flags,
+	    false));
+}
+
+/*
+ * Like m_uiotombuf(), also summing the data while copying it, into the
+ * csum_sum of the packet header (see in_delayed_cksum()).
+ */
+struct mbuf *
+m_uiotombuf_csum(struct uio *uio, int how, int len, int align, int min_size,
+		    int flags)
+{
+	KASSERT(flags & M_PKTHDR, ("%s: no packet header", __func__));
+	return (m_uiotombuf_common(uio, how, len, align, min_size, flags,
+	    true));
+}
+
 struct mbuf *
 m_uiotombuf_zcopy(struct uio *uio, int how, int len, int align, int min_size,
 		    int flags, struct zmsghdr *zm)
@@ -593,6 +593,20 @@ static void flush_net_channel(struct socket *so)
 	}
 }
 
+/*
+ * Handle the SYNs classified to a listening socket.  Must be called without
+ * the socket lock: tcp_input() takes the pcbinfo lock before it.
+ */
+void soflush_syn_net_channel(struct socket *so)
+{
+	auto nc = so->so_syn_nc.load(std::memory_order_acquire);
+	if (nc) {
+		WITH_LOCK(so->so_syn_nc_mtx) {
+			nc->process_queue();
+		}
+	}
+}
+
 /*
  * Close a socket on last file table reference removal.  Initiate disconnect
  * if connected.  Free socket when disconnect complete.
@@ -786,7 +800,7 @@ sosend_dgram(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
 {
 	long space;
 	ssize_t resid;
-	int clen = 0, error, dontroute;
+	int clen = 0, error, dontroute, csum;
 
 	KASSERT(so->so_type == SOCK_DGRAM, ("sodgram_send: !SOCK_DGRAM"));
 	KASSERT(so->so_proto->pr_flags & PR_ATOMIC,
@@ -857,6 +871,7 @@ sosend_dgram(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
 	if (flags & MSG_OOB)
 		space += 1024;
 	space -= clen;
+	csum = so->so_snd.sb_flags & SB_CSUM;
 	SOCK_UNLOCK(so);
 	if (resid > space) {
 		error = EMSGSIZE;
@@ -870,10 +885,15 @@ sosend_dgram(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
 		/*
 		 * Copy the data from userland into a mbuf chain.
 		 * If no data is to be copied in, a single empty mbuf
-		 * is returned.
+		 * is returned.  If the protocol has to checksum it
+		 * in software (SB_CSUM), sum it on the way.
 		 */
-		top = m_uiotombuf(uio, M_WAITOK, space, max_hdr, 1,
-		    (M_PKTHDR | ((flags & MSG_EOR) ? M_EOR : 0)));
+		if (csum)
+			top = m_uiotombuf_csum(uio, M_WAITOK, space, max_hdr,
+			    1, (M_PKTHDR | ((flags & MSG_EOR) ? M_EOR : 0)));
+		else
+			top = m_uiotombuf(uio, M_WAITOK, space, max_hdr, 1,
+			    (M_PKTHDR | ((flags & MSG_EOR) ? M_EOR : 0)));
 		if (top == NULL) {
 			error = EFAULT;	/* only possible error */
 			goto out;
@@ -2352,82 +2372,51 @@ out:
 }
 
 /*
- * Optimized version of soreceive() for simple datagram cases from userspace.
- * Unlike in the stream case, we're able to drop a datagram if copyout()
- * fails, and because we handle datagrams atomically, we don't need to use a
- * sleep lock to prevent I/O interlacing.
+ * Wait for a datagram to arrive on a socket using soreceive_dgram().
+ * Called and returns with the socket lock held; the caller finds the
+ * datagram, if any, at the head of so_rcv.
  */
-int
-soreceive_dgram(struct socket *so, struct bsd_sockaddr **psa, struct uio *uio,
-    struct mbuf **mp0, struct mbuf **controlp, int *flagsp)
+static int
+soreceive_dgram_wait(struct socket *so, ssize_t resid, int flags)
 {
-	struct mbuf *m, *m2;
-	int flags, error;
-	ssize_t len;
-	struct protosw *pr = so->so_proto;
-	struct mbuf *nextrecord;
-
-	if (psa != NULL)
-		*psa = NULL;
-	if (controlp != NULL)
-		*controlp = NULL;
-	if (flagsp != NULL)
-		flags = *flagsp &~ MSG_EOR;
-	else
-		flags = 0;
-
-	/*
-	 * For any complicated cases, fall back to the full
-	 * soreceive_generic().
-	 */
-	if (mp0 != NULL || (flags & MSG_PEEK) || (flags & MSG_OOB))
-		return (soreceive_generic(so, psa, uio, mp0, controlp,
-		    flagsp));
-
-	/*
-	 * Enforce restrictions on use.
-	 */
-	KASSERT((pr->pr_flags & PR_WANTRCVD) == 0,
-	    ("soreceive_dgram: wantrcvd"));
-	KASSERT(pr->pr_flags & PR_ATOMIC, ("soreceive_dgram: !atomic"));
-	KASSERT((so->so_rcv.sb_state & SBS_RCVATMARK) == 0,
-	    ("soreceive_dgram: SBS_RCVATMARK"));
-	KASSERT((so->so_proto->pr_flags & PR_CONNREQUIRED) == 0,
-	    ("soreceive_dgram: P_CONNREQUIRED"));
+	int error;
 
-	/*
-	 * Loop blocking while waiting for a datagram.
-	 */
-	SOCK_LOCK(so);
-	while ((m = so->so_rcv.sb_mb) == NULL) {
+	SOCK_LOCK_ASSERT(so);
+	flush_net_channel(so);
+	while (so->so_rcv.sb_mb == NULL) {
 		KASSERT(so->so_rcv.sb_cc == 0,
 		    ("soreceive_dgram: sb_mb NULL but sb_cc %u",
 		    so->so_rcv.sb_cc));
 		if (so->so_error) {
 			error = so->so_error;
 			so->so_error = 0;
-			SOCK_UNLOCK(so);
 			return (error);
 		}
-		if (so->so_rcv.sb_state & SBS_CANTRCVMORE ||
-		    uio->uio_resid == 0) {
-			SOCK_UNLOCK(so);
+		if (so->so_rcv.sb_state & SBS_CANTRCVMORE || resid == 0)
 			return (0);
-		}
 		if ((so->so_state & SS_NBIO) ||
-		    (flags & (MSG_DONTWAIT|MSG_NBIO))) {
-			SOCK_UNLOCK(so);
+		    (flags & (MSG_DONTWAIT|MSG_NBIO)))
 			return (EWOULDBLOCK);
-		}
 		SBLASTRECORDCHK(&so->so_rcv);
 		SBLASTMBUFCHK(&so->so_rcv);
 		error = sbwait(so, &so->so_rcv);
-		if (error) {
-			SOCK_UNLOCK(so);
+		if (error)
 			return (error);
-		}
 	}
+	return (0);
+}
+
+/*
+ * Pull the first record and its chain off the front of the packet queue.
+ */
+static struct mbuf *
+soreceive_dgram_dequeue(struct socket *so)
+{
+	struct mbuf *m, *m2;
+	struct mbuf *nextrecord;
+
 	SOCK_LOCK_ASSERT(so);
+	m = so->so_rcv.sb_mb;
 
 	SBLASTRECORDCHK(&so->so_rcv);
 	SBLASTMBUFCHK(&so->so_rcv);
@@ -2440,9 +2429,6 @@ soreceive_dgram(struct socket *so, struct bsd_sockaddr **psa, struct uio *uio,
 	KASSERT(so->so_rcv.sb_mb->m_hdr.mh_nextpkt == nextrecord,
 	    ("soreceive_dgram: m_hdr.mh_nextpkt != nextrecord"));
 
-	/*
-	 * Pull 'm' and its chain off the front of the packet queue.
-	 */
 	so->so_rcv.sb_mb = NULL;
 	sockbuf_pushsync(so, &so->so_rcv, nextrecord);
 
@@ -2452,12 +2438,30 @@ soreceive_dgram(struct socket *so, struct bsd_sockaddr **psa, struct uio *uio,
 	for (m2 = m; m2 != NULL; m2 = m2->m_hdr.mh_next)
 		sbfree(&so->so_rcv, m2);
 
-	/*
-	 * Do a few last checks before we let go of the lock.
-	 */
 	SBLASTRECORDCHK(&so->so_rcv);
 	SBLASTMBUFCHK(&so->so_rcv);
-	SOCK_UNLOCK(so);
+	m->m_hdr.mh_nextpkt = NULL;
+	return (m);
+}
+
+/*
+ * Copy out a record taken off the receive buffer of a socket using
+ * soreceive_dgram(), and free it.  Called without the socket lock.
+ */
+int
+soreceive_dgram_record(struct socket *so, struct mbuf *m,
+    struct bsd_sockaddr **psa, struct uio *uio, struct mbuf **controlp,
+    int *flagsp)
+{
+	struct mbuf *m2;
+	int error;
+	ssize_t len;
+	struct protosw *pr = so->so_proto;
+
+	if (psa != NULL)
+		*psa = NULL;
+	if (controlp != NULL)
+		*controlp = NULL;
 
 	if (pr->pr_flags & PR_ADDR) {
 		KASSERT(m->m_hdr.mh_type == MT_SONAME,
@@ -2527,14 +2531,132 @@ soreceive_dgram(struct socket *so, struct bsd_sockaddr **psa, struct uio *uio,
 			m->m_hdr.mh_len -= len;
 		}
 	}
-	if (m != NULL)
-		flags |= MSG_TRUNC;
+	if (m != NULL && flagsp != NULL)
+		*flagsp |= MSG_TRUNC;
 	m_freem(m);
-	if (flagsp != NULL)
-		*flagsp |= flags;
 	return (0);
 }
 
+/*
+ * Optimized version of soreceive() for simple datagram cases from userspace.
+ * Unlike in the stream case, we're able to drop a datagram if copyout()
+ * fails, and because we handle datagrams atomically, we don't need to use a
+ * sleep lock to prevent I/O interlacing.
+ */
+int
+soreceive_dgram(struct socket *so, struct bsd_sockaddr **psa, struct uio *uio,
+    struct mbuf **mp0, struct mbuf **controlp, int *flagsp)
+{
+	struct mbuf *m;
+	int flags, error;
+	struct protosw *pr = so->so_proto;
+
+	if (psa != NULL)
+		*psa = NULL;
+	if (controlp != NULL)
+		*controlp = NULL;
+	if (flagsp != NULL)
+		flags = *flagsp &~ MSG_EOR;
+	else
+		flags = 0;
+
+	/*
+	 * For any complicated cases, fall back to the full
+	 * soreceive_generic().
+	 */
+	if (mp0 != NULL || (flags & MSG_PEEK) || (flags & MSG_OOB))
+		return (soreceive_generic(so, psa, uio, mp0, controlp,
+		    flagsp));
+
+	/*
+	 * Enforce restrictions on use.
+	 */
+	KASSERT((pr->pr_flags & PR_WANTRCVD) == 0,
+	    ("soreceive_dgram: wantrcvd"));
+	KASSERT(pr->pr_flags & PR_ATOMIC, ("soreceive_dgram: !atomic"));
+	KASSERT((so->so_rcv.sb_state & SBS_RCVATMARK) == 0,
+	    ("soreceive_dgram: SBS_RCVATMARK"));
+	KASSERT((so->so_proto->pr_flags & PR_CONNREQUIRED) == 0,
+	    ("soreceive_dgram: P_CONNREQUIRED"));
+
+	/*
+	 * Loop blocking while waiting for a datagram.
+	 */
+	SOCK_LOCK(so);
+	error = soreceive_dgram_wait(so, uio->uio_resid, flags);
+	if (error || so->so_rcv.sb_mb == NULL) {
+		SOCK_UNLOCK(so);
+		return (error);
+	}
+	m = soreceive_dgram_dequeue(so);
+	SOCK_UNLOCK(so);
+
+	return (soreceive_dgram_record(so, m, psa, uio, controlp, flagsp));
+}
+
+/*
+ * Batched soreceive_dgram() for recvmmsg(): wait like it for the first
+ * datagram, then take up to *nrecords of the queued ones off the receive
+ * buffer while holding the socket lock once.  The records are returned in
+ * records[] and copied out with soreceive_dgram_record().
+ */
+int
+soreceive_dgram_batch(struct socket *so, struct mbuf **records,
+    int *nrecords, int flags)
+{
+	int error, n = 0;
+
+	KASSERT(so->so_proto->pr_usrreqs->pru_soreceive == soreceive_dgram,
+	    ("soreceive_dgram_batch: !soreceive_dgram"));
+	KASSERT(!(flags & (MSG_PEEK|MSG_OOB)),
+	    ("soreceive_dgram_batch: MSG_PEEK|MSG_OOB"));
+
+	CURVNET_SET(so->so_vnet);
+	SOCK_LOCK(so);
+	error = soreceive_dgram_wait(so, 1, flags);
+	while (!error && n < *nrecords && so->so_rcv.sb_mb != NULL)
+		records[n++] = soreceive_dgram_dequeue(so);
+	SOCK_UNLOCK(so);
+	CURVNET_RESTORE();
+
+	*nrecords = n;
+	return (error);
+}
+
+/*
+ * Put records taken off the receive buffer by soreceive_dgram_batch() and
+ * not copied out back at its head, oldest first, so that they are not lost
+ * when copying out an earlier one fails.
+ */
+void
+soreceive_dgram_requeue(struct socket *so, struct mbuf **records,
+    int nrecords)
+{
+	struct sockbuf *sb = &so->so_rcv;
+	struct mbuf *m, *m2;
+
+	SOCK_LOCK(so);
+	SBLASTRECORDCHK(sb);
+	SBLASTMBUFCHK(sb);
+	while (nrecords > 0) {
+		m = records[--nrecords];
+		for (m2 = m; ; m2 = m2->m_hdr.mh_next) {
+			sballoc(sb, m2);
+			if (m2->m_hdr.mh_next == NULL)
+				break;
+		}
+		if (sb->sb_mb == NULL) {
+			sb->sb_lastrecord = m;
+			sb->sb_mbtail = m2;
+		}
+		m->m_hdr.mh_nextpkt = sb->sb_mb;
+		sb->sb_mb = m;
+	}
+	SBLASTRECORDCHK(sb);
+	SBLASTMBUFCHK(sb);
+	SOCK_UNLOCK(so);
+}
+
 int
 soreceive(struct socket *so, struct bsd_sockaddr **psa, struct uio *uio,
     struct mbuf **mp0, struct mbuf **controlp, int *flagsp)
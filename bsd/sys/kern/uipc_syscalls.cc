@@ -61,10 +61,14 @@
 #include <osv/mempool.hh>
 #include <osv/pagealloc.hh>
 #include <osv/zcopy.hh>
+#include <osv/clock.hh>
 #include <sys/eventfd.h>
 
 using namespace std;
 
+/* Messages sendmmsg() and recvmmsg() handle per socket lock acquisition */
+#define	MMSG_BATCH	64
+
 /* FIXME: OSv - implement... */
 #if 0
 static int do_sendfile(struct thread *td, struct sendfile_args *uap, int compat);
@@ -229,6 +233,7 @@ kern_accept(int s, struct bsd_sockaddr *name,
 		error = EINVAL;
 		goto done;
 	}
+	soflush_syn_net_channel(head);
 	ACCEPT_LOCK();
 	if ((head->so_state & SS_NBIO) && TAILQ_EMPTY(&head->so_comp)) {
 		ACCEPT_UNLOCK();
@@ -473,26 +478,22 @@ bad:
 	return (error);
 }
 
-int
-kern_sendit(int s,
-            struct msghdr *mp,
-            int flags,
-            struct mbuf *control,
-            ssize_t *bytes)
+/*
+ * Send a message on a socket already looked up by the caller.
+ */
+static int
+sosendit(struct socket *so,
+         struct msghdr *mp,
+         int flags,
+         struct mbuf *control,
+         ssize_t *bytes)
 {
-	struct file *fp;
 	struct uio auio = {};
 	struct iovec *iov;
-	struct socket *so;
 	struct bsd_sockaddr *from = 0;
 	int i, error;
 	ssize_t len;
 
-	error = getsock_cap(s, &fp, NULL);
-	if (error)
-		return (error);
-	so = (struct socket *)file_data(fp);
-
 	// Create a local copy of the user's iovec - sosend() is going to change it!
 	assert(mp->msg_iovlen <= UIO_MAXIOV);
 	struct iovec uio_iov[mp->msg_iovlen];
@@ -506,6 +507,7 @@ kern_sendit(int s,
 	iov = mp->msg_iov;
 	for (i = 0; i < mp->msg_iovlen; i++, iov++) {
 		if ((auio.uio_resid += iov->iov_len) < 0) {
+			m_freem(control);
 			error = EINVAL;
 			goto bad;
 		}
@@ -531,7 +533,78 @@ kern_sendit(int s,
 	if (error == 0)
 	    *bytes = len - auio.uio_resid;
 bad:
+	return (error);
+}
+
+int
+kern_sendit(int s,
+            struct msghdr *mp,
+            int flags,
+            struct mbuf *control,
+            ssize_t *bytes)
+{
+	struct file *fp;
+	int error;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	error = sosendit((struct socket *)file_data(fp), mp, flags, control,
+	    bytes);
+	fdrop(fp);
+	return (error);
+}
+
+/*
+ * sendmmsg(): send the messages of msgvec in order, looking the socket up
+ * only once.  controls[], if not NULL, holds the control data of each
+ * message and is consumed.  A datagram socket is kept locked over up to
+ * MMSG_BATCH messages, so that sosend() and the protocol only take the
+ * lock recursively for each of them.  Stops at the first error, which is
+ * only returned if no message was sent at all.
+ */
+int
+kern_sendmmsg(int s, struct mmsghdr *msgvec, struct mbuf **controls,
+    unsigned int vlen, int flags, unsigned int *count)
+{
+	struct file *fp;
+	struct socket *so;
+	ssize_t bytes;
+	unsigned int n;
+	bool batch;
+	int error;
+
+	*count = 0;
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		goto out;
+	so = (struct socket *)file_data(fp);
+	batch = so->so_proto->pr_usrreqs->pru_sosend == sosend_dgram;
+
+	for (n = 0; n < vlen; n++) {
+		if (batch && n % MMSG_BATCH == 0) {
+			if (n)
+				SOCK_UNLOCK(so);
+			SOCK_LOCK(so);
+		}
+		error = sosendit(so, &msgvec[n].msg_hdr, flags,
+		    controls ? controls[n] : NULL, &bytes);
+		if (controls)
+			controls[n] = NULL;
+		if (error)
+			break;
+		msgvec[n].msg_len = bytes;
+	}
+	if (batch && vlen)
+		SOCK_UNLOCK(so);
 	fdrop(fp);
+
+	*count = n;
+	if (n)
+		error = 0;
+out:
+	for (n = 0; controls && n < vlen; n++)
+		m_freem(controls[n]);
 	return (error);
 }
 
@@ -564,8 +637,14 @@ sys_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes)
 	return (error);
 }
 
-int
-kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
+/*
+ * Receive a message from a socket already looked up by the caller.  If
+ * record is not NULL, it is a datagram the caller took off the receive
+ * buffer with soreceive_dgram_batch(), which is consumed.
+ */
+static int
+sorecvit(struct socket *so, struct msghdr *mp, struct mbuf *record,
+    struct mbuf **controlp, ssize_t* bytes)
 {
 	struct uio auio;
 	struct iovec *iov;
@@ -574,18 +653,11 @@ kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
 	int error;
 	struct mbuf *m, *control = 0;
 	caddr_t ctlbuf;
-	struct file *fp;
-	struct socket *so;
 	struct bsd_sockaddr *fromsa = 0;
 
 	if (controlp != NULL)
 		*controlp = NULL;
 
-	error = getsock_cap(s, &fp, NULL);
-	if (error)
-		return (error);
-	so = (socket*)file_data(fp);
-
 	// Create a local copy of the user's iovec - sorecieve() is going to change it!
 	assert(mp->msg_iovlen <= UIO_MAXIOV);
 	struct iovec uio_iov[mp->msg_iovlen];
@@ -599,14 +671,19 @@ kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
 	iov = mp->msg_iov;
 	for (i = 0; i < mp->msg_iovlen; i++, iov++) {
 		if ((auio.uio_resid += iov->iov_len) < 0) {
-			fdrop(fp);
+			m_freem(record);
 			return (EINVAL);
 		}
 	}
 	len = auio.uio_resid;
-	error = soreceive(so, &fromsa, &auio, (struct mbuf **)0,
-	    (mp->msg_control || controlp) ? &control : (struct mbuf **)0,
-	    &mp->msg_flags);
+	if (record)
+		error = soreceive_dgram_record(so, record, &fromsa, &auio,
+		    (mp->msg_control || controlp) ? &control : (struct mbuf **)0,
+		    &mp->msg_flags);
+	else
+		error = soreceive(so, &fromsa, &auio, (struct mbuf **)0,
+		    (mp->msg_control || controlp) ? &control : (struct mbuf **)0,
+		    &mp->msg_flags);
 	if (error) {
 		if (auio.uio_resid != len && (error == ERESTART ||
 		    error == EINTR || error == EWOULDBLOCK))
@@ -653,7 +730,6 @@ kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
 		mp->msg_controllen = ctlbuf - (caddr_t)mp->msg_control;
 	}
 out:
-	fdrop(fp);
 	if (fromsa)
 		free(fromsa);
 
@@ -665,6 +741,115 @@ out:
 	return (error);
 }
 
+int
+kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes)
+{
+	struct file *fp;
+	int error;
+
+	if (controlp != NULL)
+		*controlp = NULL;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	error = sorecvit((struct socket *)file_data(fp), mp, NULL, controlp,
+	    bytes);
+	fdrop(fp);
+	return (error);
+}
+
+/*
+ * recvmmsg(): receive up to vlen messages into msgvec, looking the socket
+ * up only once.  On sockets using soreceive_dgram(), the datagrams already
+ * queued are taken off the receive buffer MMSG_BATCH at a time, with a
+ * single acquisition of the socket lock for each batch rather than one per
+ * datagram.
+ *
+ * Like on Linux, MSG_WAITFORONE only blocks for the first message and
+ * the timeout is only checked between messages.  An error after some
+ * messages were received is left in so_error for the next call.
+ */
+int
+kern_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+    const struct timespec *timeout, unsigned int *count)
+{
+	struct mbuf *records[MMSG_BATCH];
+	struct file *fp;
+	struct socket *so;
+	ssize_t bytes;
+	unsigned int n = 0;
+	int i, nrecords, error;
+	bool batch;
+	osv::clock::uptime::time_point deadline{};
+
+	*count = 0;
+	if (timeout) {
+		if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+		    timeout->tv_nsec >= 1000000000)
+			return (EINVAL);
+		deadline = osv::clock::uptime::now() +
+		    std::chrono::seconds(timeout->tv_sec) +
+		    std::chrono::nanoseconds(timeout->tv_nsec);
+	}
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	so = (struct socket *)file_data(fp);
+	batch = so->so_proto->pr_usrreqs->pru_soreceive == soreceive_dgram &&
+	    !(flags & (MSG_PEEK | MSG_OOB));
+
+	while (n < vlen) {
+		if (batch) {
+			nrecords = MIN(vlen - n, MMSG_BATCH);
+			error = soreceive_dgram_batch(so, records, &nrecords,
+			    flags);
+			for (i = 0; i < nrecords && !error; i++) {
+				msgvec[n].msg_hdr.msg_flags = flags;
+				error = sorecvit(so, &msgvec[n].msg_hdr,
+				    records[i], NULL, &bytes);
+				if (!error)
+					msgvec[n++].msg_len = bytes;
+			}
+			/*
+			 * Like recvmsg(), drop the datagram which could not be
+			 * copied out, but keep the ones after it for the next
+			 * call.
+			 */
+			if (i < nrecords)
+				soreceive_dgram_requeue(so, records + i,
+				    nrecords - i);
+			if (!error && nrecords == 0)
+				break;
+		} else {
+			msgvec[n].msg_hdr.msg_flags = flags;
+			error = sorecvit(so, &msgvec[n].msg_hdr, NULL, NULL,
+			    &bytes);
+			if (!error)
+				msgvec[n++].msg_len = bytes;
+		}
+		if (error)
+			break;
+		if (flags & MSG_WAITFORONE)
+			flags |= MSG_DONTWAIT;
+		if (timeout && osv::clock::uptime::now() >= deadline)
+			break;
+	}
+
+	if (n && error) {
+		if (error != EWOULDBLOCK && error != EINTR) {
+			SOCK_LOCK(so);
+			so->so_error = error;
+			SOCK_UNLOCK(so);
+		}
+		error = 0;
+	}
+	fdrop(fp);
+	*count = n;
+	return (error);
+}
+
 static int
 recvit(int s, struct msghdr *mp, void *namelenp, ssize_t* bytes)
 {
@@ -1083,6 +1268,61 @@ zcopy_txclose(struct zmsghdr *zm)
 	close(zm->zm_txfd);
 }
 
+int
+zcopy_sendbuf(int s, const void *buf, size_t len, struct zbuf_handle *zb,
+    bool nonblock, size_t *sent)
+{
+	struct file *fp;
+	struct socket *so;
+	struct mbuf *m;
+	size_t chunk;
+	int error;
+
+	*sent = 0;
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	so = (struct socket *)file_data(fp);
+	if (so->so_type != SOCK_STREAM) {
+		fdrop(fp);
+		return (EOPNOTSUPP);
+	}
+
+	while (*sent < len) {
+		/*
+		 * sosend() queues a ready-made chain all at once, so hand it
+		 * pieces the send buffer can take without waiting for it to
+		 * drain completely.
+		 */
+		chunk = bsd_min(len - *sent,
+		    bsd_max((size_t)so->so_snd.sb_hiwat / 2, (size_t)PAGE_SIZE));
+		if ((so->so_state & SS_NBIO) || nonblock) {
+			long space = sbspace(&so->so_snd);
+			if (space <= 0) {
+				error = EWOULDBLOCK;
+				break;
+			}
+			chunk = bsd_min(chunk, (size_t)space);
+		}
+		m = m_getm_zbuf((const char *)buf + *sent, chunk, M_WAITOK, zb);
+		if (m == NULL) {
+			error = ENOBUFS;
+			break;
+		}
+		error = sosend(so, NULL, NULL, m, NULL,
+		    nonblock ? MSG_DONTWAIT | MSG_NBIO : 0, NULL);
+		if (error)
+			break;
+		*sent += chunk;
+	}
+	fdrop(fp);
+
+	if (*sent && (error == ERESTART || error == EINTR ||
+	    error == EWOULDBLOCK))
+		error = 0;
+	return (error);
+}
+
 ssize_t
 zcopy_rx(int s, struct zmsghdr *zm)
 {
@@ -208,6 +208,26 @@ ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
 	return bytes;
 }
 
+extern "C" OSV_LIBC_API
+int recvmmsg(int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+    struct timespec *timeout)
+{
+	unsigned int count;
+	int error;
+
+	sock_d("recvmmsg(fd=%d, msgvec=..., vlen=%u, flags=0x%x)", fd, vlen,
+		flags);
+
+	error = linux_recvmmsg(fd, msgvec, vlen, flags, timeout, &count);
+	if (error) {
+		sock_d("recvmmsg() failed, errno=%d", error);
+		errno = error;
+		return -1;
+	}
+
+	return count;
+}
+
 extern "C" OSV_LIBC_API
 ssize_t sendto(int fd, const void *buf, size_t len, int flags,
     const struct bsd_sockaddr *addr, socklen_t alen)
@@ -264,6 +284,25 @@ ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
 	return bytes;
 }
 
+extern "C" OSV_LIBC_API
+int sendmmsg(int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	unsigned int count;
+	int error;
+
+	sock_d("sendmmsg(fd=%d, msgvec=..., vlen=%u, flags=0x%x)", fd, vlen,
+		flags);
+
+	error = linux_sendmmsg(fd, msgvec, vlen, flags, &count);
+	if (error) {
+		sock_d("sendmmsg() failed, errno=%d", error);
+		errno = error;
+		return -1;
+	}
+
+	return count;
+}
+
 extern "C" OSV_LIBC_API
 int getsockopt(int fd, int level, int optname, void *__restrict optval,
 		socklen_t *__restrict optlen)
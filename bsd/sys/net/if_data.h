@@ -62,6 +62,10 @@ struct if_data {
                                 * be sent due to a lack of free space
                                 * on a HW ring
                                 */
+    u_long  ifi_ilro_queued;/* Rx packets queued for software LRO */
+    u_long  ifi_ilro_flushed;/* packets passed up by software LRO, each
+                              * made of one or more queued ones
+                              */
     wakeup_stats ifi_iwakeup_stats; /* Rx BH wakeup statistics */
     wakeup_stats ifi_owakeup_stats; /* Tx BH wakeup statistics */
 };
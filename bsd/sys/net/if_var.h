@@ -217,6 +217,10 @@ struct ifnet {
 
 	void add_net_channel(net_channel* nc, ipv4_tcp_conn_id id) { if_classifier.add(id, nc); }
 	void del_net_channel(ipv4_tcp_conn_id id) { if_classifier.remove(id); }
+	bool add_udp_net_channel(net_channel* nc, ipv4_udp_conn_id id) { return if_classifier.add_udp(id, nc); }
+	void del_udp_net_channel(ipv4_udp_conn_id id) { if_classifier.remove_udp(id); }
+	bool add_listen_net_channel(net_channel* nc, ipv4_tcp_conn_id id) { return if_classifier.add_listener(id, nc); }
+	void del_listen_net_channel(ipv4_tcp_conn_id id) { if_classifier.remove_listener(id); }
 };
 
 typedef void if_init_f_t(void *);
@@ -57,6 +57,7 @@
 #include <bsd/sys/netinet/in_var.h>
 #include <bsd/sys/netinet/ip_var.h>
 #include <bsd/sys/netinet/ip_options.h>
+#include <bsd/sys/netinet/udp.h>
 
 #include <bsd/sys/net/routecache.hh>
 
@@ -570,6 +571,13 @@ passout:
 
 	m->M_dat.MH.MH_pkthdr.csum_flags |= CSUM_IP;
 	sw_csum = m->M_dat.MH.MH_pkthdr.csum_flags & ~ifp->if_hwassist;
+	/*
+	 * Have sosend sum the data of the socket's next datagrams while
+	 * copying them in, which saves in_delayed_cksum() reading it again.
+	 * It costs little when it turns out unneeded, so it is never undone.
+	 */
+	if ((sw_csum & CSUM_UDP) && inp != NULL)
+		inp->inp_socket->so_snd.sb_flags |= SB_CSUM;
 	if (sw_csum & CSUM_DELAY_DATA) {
 		in_delayed_cksum(m);
 		sw_csum &= ~CSUM_DELAY_DATA;
@@ -852,7 +860,13 @@ in_delayed_cksum(struct mbuf *m)
 
 	ip = mtod(m, struct ip *);
 	offset = ip->ip_hl << 2 ;
-	csum = in_cksum_skip(m, ip->ip_len, offset);
+	if ((m->M_dat.MH.MH_pkthdr.csum_flags & (CSUM_UDP | CSUM_DATA_SUM)) ==
+	    (CSUM_UDP | CSUM_DATA_SUM)) {
+		/* sosend summed the data, only the header is left */
+		csum = in_cksum_skip(m, offset + sizeof(struct udphdr), offset);
+		csum = ~in_addword(~csum, m->M_dat.MH.MH_pkthdr.csum_sum);
+	} else
+		csum = in_cksum_skip(m, ip->ip_len, offset);
 	if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_UDP && csum == 0)
 		csum = 0xffff;
 	offset += m->M_dat.MH.MH_pkthdr.csum_data;	/* checksum offset */
@@ -937,6 +937,13 @@ relocked:
 			tcp_trace(TA_INPUT, ostate, tp,
 			    (void *)tcp_saveipgen, &tcp_savetcp, 0);
 #endif
+		/*
+		 * Let the following SYNs for this socket go to the
+		 * application polling on it.
+		 */
+		if (!tp->syn_nc_intf && !(inp->inp_vflag & INP_IPV6) &&
+		    !(m->M_dat.MH.MH_pkthdr.rcvif->if_flags & IFF_LOOPBACK))
+			tcp_setup_syn_net_channel(tp, m->M_dat.MH.MH_pkthdr.rcvif);
 		tcp_dooptions(&to, optp, optlen, TO_SYN);
 		syncache_add(&inc, &to, th, inp, &so, m);
 		/*
@@ -3235,16 +3242,7 @@ tcp_setup_net_channel(tcpcb* tp, struct ifnet* intf)
 	auto so = tp->t_inpcb->inp_socket;
 	so->so_nc = nc;
 	if (so->fp) {
-		WITH_LOCK(so->fp->f_lock) {
-			for (auto&& pl : so->fp->f_poll_list) {
-				so->so_nc->add_poller(*pl._req);
-			}
-			if (so->fp->f_epolls) {
-				for (auto&& ep : *so->fp->f_epolls) {
-					so->so_nc->add_epoll(ep);
-				}
-			}
-		}
+		nc->add_file_pollers(so->fp);
 	}
 }
 
@@ -3258,18 +3256,76 @@ void tcp_teardown_net_channel(tcpcb *tp)
 	// keep tp->nc around since it might still contain packets
 }
 
+// Listening socket, no locks held
+static void
+tcp_syn_net_channel_packet(mbuf* m)
+{
+	log_packet_handling(m, NETISR_ETHER);
+	m_adj(m, ETHER_HDR_LEN);
+	ip_input(m);
+}
+
+static ipv4_tcp_conn_id tcp_listen_id(tcpcb* tp)
+{
+	auto inp = tp->t_inpcb;
+	return {
+		in_addr{INADDR_ANY},
+		inp->inp_laddr,
+		0,
+		ntohs(inp->inp_lport)
+	};
+}
+
+// INP_LOCK held
+void
+tcp_setup_syn_net_channel(tcpcb* tp, struct ifnet* intf)
+{
+	auto so = tp->t_inpcb->inp_socket;
+	if (!tp->syn_nc) {
+		tp->syn_nc = aligned_new<net_channel>(tcp_syn_net_channel_packet);
+		if (so->fp) {
+			tp->syn_nc->add_file_pollers(so->fp);
+		}
+		so->so_syn_nc.store(tp->syn_nc, std::memory_order_release);
+	}
+	// Several listeners may share a port, the first one gets its SYNs
+	if (intf->add_listen_net_channel(tp->syn_nc, tcp_listen_id(tp))) {
+		tp->syn_nc_intf = intf;
+	}
+}
+
+static void
+tcp_free_syn_net_channel(tcpcb* tp)
+{
+	if (!tp->syn_nc) {
+		return;
+	}
+	if (tp->syn_nc_intf) {
+		tp->syn_nc_intf->del_listen_net_channel(tcp_listen_id(tp));
+		tp->syn_nc_intf = nullptr;
+	}
+	auto so = tp->t_inpcb->inp_socket;
+	if (so) {
+		so->so_syn_nc.store(nullptr);
+		if (so->fp) {
+			tp->syn_nc->del_file_pollers(so->fp);
+		}
+	}
+	osv::rcu_dispose(tp->syn_nc);
+	tp->syn_nc = nullptr;
+}
+
 void
 tcp_free_net_channel(tcpcb* tp)
 {
+	tcp_free_syn_net_channel(tp);
 	if (!tp->nc) {
 		return;
 	}
 	tcp_teardown_net_channel(tp);
 	auto so = tp->t_inpcb->inp_socket;
 	if (so && so->fp) {
-		for (auto&& pl : so->fp->f_poll_list) {
-			so->so_nc->del_poller(*pl._req);
-		}
+		so->so_nc->del_file_pollers(so->fp);
 		so->so_nc = nullptr;
 	}
 	if (tp->nc_intf) {
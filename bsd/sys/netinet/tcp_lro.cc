@@ -78,6 +78,7 @@ tcp_lro_init(struct lro_ctrl *lc)
 	lc->lro_queued = 0;
 	lc->lro_flushed = 0;
 	lc->lro_cnt = 0;
+	lc->lro_net_channels = false;
 	SLIST_INIT(&lc->lro_free);
 	SLIST_INIT(&lc->lro_active);
 
@@ -282,7 +283,14 @@ tcp_lro_flush(struct lro_ctrl *lc, struct lro_entry *le)
 #endif
 	}
 
-	(*lc->ifp->if_input)(lc->ifp, le->m_head);
+	/*
+	 * OSv: drivers which offer received packets to net channels must do
+	 * so for coalesced ones too, or packets of a connection would take
+	 * two paths and could overtake each other.
+	 */
+	if (!lc->lro_net_channels ||
+	    !lc->ifp->if_classifier.post_packet(le->m_head))
+		(*lc->ifp->if_input)(lc->ifp, le->m_head);
 	lc->lro_queued += le->append_cnt + 1;
 	lc->lro_flushed++;
 	bzero(le, sizeof(*le));
@@ -615,4 +623,75 @@ tcp_lro_rx(struct lro_ctrl *lc, struct mbuf *m, uint32_t csum)
 	return (0);
 }
 
+void
+tcp_lro_flush_all(struct lro_ctrl *lc)
+{
+	struct lro_entry *le;
+
+	while ((le = SLIST_FIRST(&lc->lro_active)) != NULL) {
+		SLIST_REMOVE_HEAD(&lc->lro_active, next);
+		tcp_lro_flush(lc, le);
+	}
+}
+
+/*
+ * OSv: software GRO, for drivers of devices which do not coalesce
+ * received TCP segments themselves. Unlike tcp_lro_rx() this takes any
+ * packet: it makes sure the headers are contiguous and verifies the TCP
+ * checksum if the device has not, since a coalesced packet is passed up
+ * as verified. If the packet can not be queued, everything queued so far
+ * is flushed so that the caller can pass the packet up without it
+ * overtaking earlier segments of its connection.
+ *
+ * Returns 0 if the packet was queued.
+ */
+int
+tcp_lro_queue(struct lro_ctrl *lc, struct mbuf *m)
+{
+	struct ether_header *eh;
+	struct ip *ip4;
+	struct tcphdr *th;
+	int error, hlen, ip_len;
+	uint16_t csum;
+
+	error = TCP_LRO_NOT_SUPPORTED;
+	hlen = ETHER_HDR_LEN + sizeof(*ip4) + sizeof(*th);
+	if (m->m_hdr.mh_len < hlen)
+		goto out;
+	eh = mtod(m, struct ether_header *);
+	if (eh->ether_type != htons(ETHERTYPE_IP))
+		goto out;
+	ip4 = (struct ip *)(eh + 1);
+	if (ip4->ip_p != IPPROTO_TCP || (ip4->ip_hl << 2) != sizeof(*ip4))
+		goto out;
+	th = (struct tcphdr *)(ip4 + 1);
+	ip_len = ntohs(ip4->ip_len);
+	hlen = sizeof(*ip4) + (th->th_off << 2);
+	error = TCP_LRO_CANNOT;
+	if (m->m_hdr.mh_len < ETHER_HDR_LEN + hlen || ip_len < hlen ||
+	    ETHER_HDR_LEN + ip_len > m->M_dat.MH.MH_pkthdr.len)
+		goto out;
+
+	if ((m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) == 0) {
+		csum = ~in_cksum_skip(m, ETHER_HDR_LEN + ip_len,
+		    ETHER_HDR_LEN + sizeof(*ip4));
+		csum = in_pseudo(ip4->ip_src.s_addr, ip4->ip_dst.s_addr,
+		    htonl(ip_len - sizeof(*ip4) + IPPROTO_TCP) + csum);
+		if (csum != 0xffff) {
+			/* Let the stack drop it and count it */
+			lc->lro_bad_csum++;
+			goto out;
+		}
+		m->M_dat.MH.MH_pkthdr.csum_flags |= CSUM_DATA_VALID |
+		    CSUM_PSEUDO_HDR;
+		m->M_dat.MH.MH_pkthdr.csum_data = 0xffff;
+	}
+
+	error = tcp_lro_rx(lc, m, 0);
+out:
+	if (error != 0)
+		tcp_lro_flush_all(lc);
+	return (error);
+}
+
 /* end */
@@ -77,10 +77,11 @@ SLIST_HEAD(lro_head, lro_entry);
 /* NB: This is part of driver structs. */
 struct lro_ctrl {
 	struct ifnet	*ifp;
-	int		lro_queued;
-	int		lro_flushed;
-	int		lro_bad_csum;
+	uint64_t	lro_queued;
+	uint64_t	lro_flushed;
+	uint64_t	lro_bad_csum;
 	int		lro_cnt;
+	bool		lro_net_channels;	/* OSv: flush to the classifier */
 
 	struct lro_head	lro_active;
 	struct lro_head	lro_free;
@@ -92,6 +93,8 @@ int tcp_lro_init(struct lro_ctrl *);
 void tcp_lro_free(struct lro_ctrl *);
 void tcp_lro_flush(struct lro_ctrl *, struct lro_entry *);
 int tcp_lro_rx(struct lro_ctrl *, struct mbuf *, uint32_t);
+int tcp_lro_queue(struct lro_ctrl *, struct mbuf *);
+void tcp_lro_flush_all(struct lro_ctrl *);
 
 __END_DECLS
 
@@ -223,6 +223,9 @@ public:
 
 	net_channel* nc;
 	struct ifnet* nc_intf;
+	/* SYNs for a listening socket */
+	net_channel* syn_nc;
+	struct ifnet* syn_nc_intf;
 
 	uint32_t t_ispare[8];		/* 5 UTO, 3 TBD */
 	void	*t_pspare2[4];		/* 4 TBD */
@@ -702,6 +705,7 @@ void	 tcp_flush_net_channel(tcpcb* tp);
 void	 tcp_setup_net_channel(tcpcb* tp, struct ifnet* intf);
 void	 tcp_teardown_net_channel(tcpcb* tp);
 void	 tcp_free_net_channel(tcpcb* tp);
+void	 tcp_setup_syn_net_channel(tcpcb* tp, struct ifnet* intf);
 u_long	 tcp_maxmtu(struct in_conninfo *, int *);
 u_long	 tcp_maxmtu6(struct in_conninfo *, int *);
 void	 tcp_mss_update(struct tcpcb *, int, int, struct hc_metrics_lite *,
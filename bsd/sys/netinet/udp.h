@@ -49,6 +49,8 @@ struct udphdr {
  * User-settable options (used with setsockopt).
  */
 #define	UDP_ENCAP			0x01
+#define	UDP_SEGMENT			103	/* same values as Linux */
+#define	UDP_GRO				104
 
 
 /*
@@ -69,6 +69,11 @@
 #endif
 #include <bsd/sys/netinet/udp.h>
 #include <bsd/sys/netinet/udp_var.h>
+#include <bsd/sys/net/ethernet.h>
+#include <bsd/sys/net/netisr.h>
+
+#include <osv/net_trace.hh>
+#include <osv/aligned_new.hh>
 
 /*
  * UDP protocol implementation.
@@ -194,6 +199,53 @@ udp_discardcb(struct udpcb *up)
 }
 
 #ifdef INET
+/*
+ * UDP_GRO: rather than queueing a datagram as a record of its own, append
+ * it to the last record in the receive buffer if that holds a run of
+ * datagrams of the same size from the same sender, so the application
+ * reads them all at once.  Like on Linux, a shorter datagram ends the run.
+ * The records carry a UDP_GRO control message with the datagram size, see
+ * udp_gro_control().
+ */
+static bool
+udp_gro_merge(struct socket *so, struct udpcb *up, struct bsd_sockaddr *sa,
+    struct mbuf *n)
+{
+	struct sockbuf *sb = &so->so_rcv;
+	struct mbuf *rec = up->u_gro_rec;
+	u_int len = n->M_dat.MH.MH_pkthdr.len;
+
+	/*
+	 * u_gro_rec is reset whenever a record is queued, so it can only be
+	 * the last record if it is the one we left growing.
+	 */
+	if (rec == NULL || rec != sb->sb_lastrecord ||
+	    len == 0 || len > up->u_gro_size ||
+	    up->u_gro_len + len > IP_MAXPACKET ||
+	    up->u_gro_len / up->u_gro_size >= UDP_MAX_SEGMENTS ||
+	    (long)len > sbspace(sb) ||
+	    bcmp(mtod(rec, caddr_t), sa, sa->sa_len) != 0)
+		return (false);
+
+	sbcompress(so, sb, n, sb->sb_mbtail);
+	up->u_gro_len += len;
+	if (len < up->u_gro_size)
+		up->u_gro_rec = NULL;
+	return (true);
+}
+
+/*
+ * The UDP_GRO control message, which tells the size of the datagrams
+ * merged into a record.  With UDP_GRO on, every record starts with one,
+ * also those holding a single datagram.
+ */
+static struct mbuf *
+udp_gro_control(int len)
+{
+	return (sbcreatecontrol((caddr_t)&len, sizeof(len), UDP_GRO,
+	    IPPROTO_UDP));
+}
+
 /*
  * Subroutine of udp_input(), which appends the provided mbuf chain to the
  * passed pcb/socket.  The caller must provide a bsd_sockaddr_in via udp_in that
@@ -207,11 +259,13 @@ udp_append(struct inpcb *inp, struct ip *ip, struct mbuf *n, int off,
 {
 	struct bsd_sockaddr *append_sa;
 	struct socket *so;
-	struct mbuf *opts = 0;
+	struct mbuf *opts = 0, *grom;
 #ifdef INET6
 	struct bsd_sockaddr_in6 udp_in6;
 #endif
 	struct udpcb *up;
+	bool gro;
+	int len;
 
 	INP_LOCK_ASSERT(inp);
 
@@ -275,29 +329,48 @@ udp_append(struct inpcb *inp, struct ip *ip, struct mbuf *n, int off,
 
 	so = inp->inp_socket;
 	SOCK_LOCK_ASSERT(so);
+	len = n->M_dat.MH.MH_pkthdr.len;
+	gro = false;
+	if (up->u_flags & UF_GRO) {
+		if (opts == NULL && udp_gro_merge(so, up, append_sa, n))
+			return;
+		gro = opts == NULL && len > 0;
+		grom = udp_gro_control(len);
+		if (grom != NULL) {
+			grom->m_hdr.mh_next = opts;
+			opts = grom;
+		} else
+			gro = false;
+	}
+	up->u_gro_rec = NULL;
 	if (sbappendaddr_locked(so, &so->so_rcv, append_sa, n, opts) == 0) {
 		m_freem(n);
 		if (opts)
 			m_freem(opts);
 		UDPSTAT_INC(udps_fullsock);
-	} else
+	} else {
+		if (gro) {
+			up->u_gro_rec = so->so_rcv.sb_lastrecord;
+			up->u_gro_size = up->u_gro_len = len;
+		}
 		sorwakeup_locked(so);
+	}
 }
 
-void
-udp_input(struct mbuf *m, int off)
+/*
+ * Validate the UDP header and checksum of a datagram passed up by IP, and
+ * fill in its source address.  Consumes the datagram and returns NULL if it
+ * is to be dropped.  Otherwise the UDP header follows the IP header, of
+ * *iphlen bytes, in the first mbuf.
+ */
+static struct mbuf *
+udp_input_check(struct mbuf *m, int *iphlen, struct bsd_sockaddr_in *udp_in,
+    struct ip *save_ip)
 {
-	int iphlen = off;
 	struct ip *ip;
 	struct udphdr *uh;
-	struct ifnet *ifp;
-	struct inpcb *inp;
 	int len;
-	struct ip save_ip;
-	struct bsd_sockaddr_in udp_in;
-	struct m_tag *fwd_tag;
 
-	ifp = m->M_dat.MH.MH_pkthdr.rcvif;
 	UDPSTAT_INC(udps_ipackets);
 
 	/*
@@ -305,39 +378,39 @@ udp_input(struct mbuf *m, int off)
 	 * user, and use on returned packets, but we don't yet have a way to
 	 * check the checksum with options still present.
 	 */
-	if (iphlen > sizeof (struct ip)) {
+	if (*iphlen > sizeof (struct ip)) {
 		ip_stripoptions(m, (struct mbuf *)0);
-		iphlen = sizeof(struct ip);
+		*iphlen = sizeof(struct ip);
 	}
 
 	/*
 	 * Get IP and UDP header together in first mbuf.
 	 */
 	ip = mtod(m, struct ip *);
-	if (m->m_hdr.mh_len < iphlen + sizeof(struct udphdr)) {
-		if ((m = m_pullup(m, iphlen + sizeof(struct udphdr))) == 0) {
+	if (m->m_hdr.mh_len < *iphlen + sizeof(struct udphdr)) {
+		if ((m = m_pullup(m, *iphlen + sizeof(struct udphdr))) == 0) {
 			UDPSTAT_INC(udps_hdrops);
-			return;
+			return (NULL);
 		}
 		ip = mtod(m, struct ip *);
 	}
-	uh = (struct udphdr *)((caddr_t)ip + iphlen);
+	uh = (struct udphdr *)((caddr_t)ip + *iphlen);
 
 	/*
 	 * Destination port of 0 is illegal, based on RFC768.
 	 */
 	if (uh->uh_dport == 0)
-		goto badunlocked;
+		goto bad;
 
 	/*
 	 * Construct bsd_sockaddr format source address.  Stuff source address
 	 * and datagram in user buffer.
 	 */
-	bzero(&udp_in, sizeof(udp_in));
-	udp_in.sin_len = sizeof(udp_in);
-	udp_in.sin_family = AF_INET;
-	udp_in.sin_port = uh->uh_sport;
-	udp_in.sin_addr = ip->ip_src;
+	bzero(udp_in, sizeof(*udp_in));
+	udp_in->sin_len = sizeof(*udp_in);
+	udp_in->sin_family = AF_INET;
+	udp_in->sin_port = uh->uh_sport;
+	udp_in->sin_addr = ip->ip_src;
 
 	/*
 	 * Make mbuf data length reflect UDP length.  If not enough data to
@@ -347,7 +420,7 @@ udp_input(struct mbuf *m, int off)
 	if (ip->ip_len != len) {
 		if (len > ip->ip_len || len < sizeof(struct udphdr)) {
 			UDPSTAT_INC(udps_badlen);
-			goto badunlocked;
+			goto bad;
 		}
 		m_adj(m, len - ip->ip_len);
 		/* ip->ip_len = len; */
@@ -357,10 +430,12 @@ udp_input(struct mbuf *m, int off)
 	 * Save a copy of the IP header in case we want restore it for
 	 * sending an ICMP error message in response.
 	 */
-	if (!V_udp_blackhole)
-		save_ip = *ip;
-	else
-		memset(&save_ip, 0, sizeof(save_ip));
+	if (save_ip != NULL) {
+		if (!V_udp_blackhole)
+			*save_ip = *ip;
+		else
+			memset(save_ip, 0, sizeof(*save_ip));
+	}
 
 	/*
 	 * Checksum extended UDP header and data.
@@ -387,12 +462,185 @@ udp_input(struct mbuf *m, int off)
 		}
 		if (uh_sum) {
 			UDPSTAT_INC(udps_badsum);
-			m_freem(m);
-			return;
+			goto bad;
 		}
 	} else
 		UDPSTAT_INC(udps_nosum);
 
+	return (m);
+
+bad:
+	m_freem(m);
+	return (NULL);
+}
+
+/*
+ * Fast path: once a socket alone on its port has received a datagram, the
+ * interface's classifier puts the following ones for it in a net channel,
+ * which the application drains with the socket locked.  Since that skips
+ * in_pcblookup(), the channel is unhooked as soon as another socket binds
+ * to the same port, and only hooked up again once it is alone.
+ */
+static ipv4_udp_conn_id
+udp_net_channel_id(struct inpcb *inp)
+{
+	return {
+		inp->inp_faddr,
+		inp->inp_laddr,
+		ntohs(inp->inp_fport),
+		ntohs(inp->inp_lport)
+	};
+}
+
+// INP_LOCK held
+static void
+udp_net_channel_packet(struct inpcb *inp, struct mbuf *m)
+{
+	struct bsd_sockaddr_in udp_in;
+	struct udphdr *uh;
+	struct ip *ip;
+	uint8_t protocol;
+	int iphlen;
+
+	log_packet_handling(m, NETISR_ETHER);
+	m_adj(m, ETHER_HDR_LEN);
+	m = ip_preprocess_packet(m, protocol, iphlen);
+	if (m == NULL)
+		return;
+	if (protocol != IPPROTO_UDP) {
+		m_freem(m);
+		return;
+	}
+	m = udp_input_check(m, &iphlen, &udp_in, NULL);
+	if (m == NULL)
+		return;
+	ip = mtod(m, struct ip *);
+	uh = (struct udphdr *)((caddr_t)ip + iphlen);
+
+	/*
+	 * The socket may have been connected or disconnected since the
+	 * datagram was classified.
+	 */
+	if (inp->inp_lport != uh->uh_dport ||
+	    (inp->inp_laddr.s_addr != INADDR_ANY &&
+	     inp->inp_laddr.s_addr != ip->ip_dst.s_addr) ||
+	    (inp->inp_faddr.s_addr != INADDR_ANY &&
+	     (inp->inp_faddr.s_addr != ip->ip_src.s_addr ||
+	      inp->inp_fport != uh->uh_sport)) ||
+	    (inp->inp_ip_minttl && inp->inp_ip_minttl > ip->ip_ttl)) {
+		m_freem(m);
+		return;
+	}
+	udp_append(inp, ip, m, iphlen, &udp_in);
+}
+
+static bool
+udp_port_shared(struct inpcb *inp)
+{
+	struct inpcbport *phd = inp->inp_phd;
+
+	return (phd != NULL && (LIST_FIRST(&phd->phd_pcblist) != inp ||
+	    LIST_NEXT(inp, inp_portlist) != NULL));
+}
+
+// INP_LOCK held
+static void
+udp_setup_net_channel(struct inpcb *inp, struct ifnet *intf)
+{
+	struct udpcb *up = intoudpcb(inp);
+	struct socket *so = inp->inp_socket;
+
+	INP_LOCK_ASSERT(inp);
+	if (up->u_nc_intf || up->u_tun_func || (inp->inp_vflag & INP_IPV6) ||
+	    inp->inp_phd == NULL)
+		return;
+	INP_HASH_RLOCK(&V_udbinfo);
+	if (!udp_port_shared(inp)) {
+		if (!up->u_nc) {
+			up->u_nc = aligned_new<net_channel>([=] (mbuf *m) {
+				udp_net_channel_packet(inp, m);
+			});
+			so->so_nc = up->u_nc;
+			if (so->fp) {
+				up->u_nc->add_file_pollers(so->fp);
+			}
+		}
+		if (intf->add_udp_net_channel(up->u_nc, udp_net_channel_id(inp)))
+			up->u_nc_intf = intf;
+	}
+	INP_HASH_RUNLOCK(&V_udbinfo);
+}
+
+// INP_HASH_WLOCK held, and INP_LOCK unless called for another socket
+static void
+udp_teardown_net_channel(struct inpcb *inp)
+{
+	struct udpcb *up = intoudpcb(inp);
+
+	INP_HASH_WLOCK_ASSERT(&V_udbinfo);
+	if (up == NULL || !up->u_nc_intf)
+		return;
+	up->u_nc_intf->del_udp_net_channel(udp_net_channel_id(inp));
+	up->u_nc_intf = nullptr;
+	// keep up->u_nc around since it might still contain packets
+}
+
+/*
+ * Called after inp has been bound to a port: unhook every socket on the
+ * port from the fast path if it is no longer theirs alone.
+ */
+static void
+udp_purge_net_channels(struct inpcb *inp)
+{
+	struct inpcb *t;
+
+	INP_HASH_WLOCK_ASSERT(&V_udbinfo);
+	if (!udp_port_shared(inp))
+		return;
+	LIST_FOREACH(t, &inp->inp_phd->phd_pcblist, inp_portlist) {
+		udp_teardown_net_channel(t);
+	}
+}
+
+// INP_LOCK held
+static void
+udp_free_net_channel(struct inpcb *inp)
+{
+	struct udpcb *up = intoudpcb(inp);
+	struct socket *so = inp->inp_socket;
+
+	if (!up->u_nc)
+		return;
+	INP_HASH_WLOCK(&V_udbinfo);
+	udp_teardown_net_channel(inp);
+	INP_HASH_WUNLOCK(&V_udbinfo);
+	if (so->fp) {
+		up->u_nc->del_file_pollers(so->fp);
+	}
+	so->so_nc = nullptr;
+	osv::rcu_dispose(up->u_nc);
+	up->u_nc = nullptr;
+}
+
+void
+udp_input(struct mbuf *m, int off)
+{
+	int iphlen = off;
+	struct ip *ip;
+	struct udphdr *uh;
+	struct ifnet *ifp;
+	struct inpcb *inp;
+	struct ip save_ip;
+	struct bsd_sockaddr_in udp_in;
+	struct m_tag *fwd_tag;
+
+	ifp = m->M_dat.MH.MH_pkthdr.rcvif;
+	m = udp_input_check(m, &iphlen, &udp_in, &save_ip);
+	if (m == NULL)
+		return;
+	ip = mtod(m, struct ip *);
+	uh = (struct udphdr *)((caddr_t)ip + iphlen);
+
 	if (IN_MULTICAST(ntohl(ip->ip_dst.s_addr)) ||
 	    in_broadcast(ip->ip_dst, ifp)) {
 		struct inpcb *last;
@@ -568,6 +816,8 @@ udp_input(struct mbuf *m, int off)
 		return;
 	}
 	udp_append(inp, ip, m, iphlen, &udp_in);
+	if (!(ifp->if_flags & IFF_LOOPBACK))
+		udp_setup_net_channel(inp, ifp);
 	INP_UNLOCK(inp);
 	return;
 
@@ -801,9 +1051,7 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 {
 	int error = 0, optval;
 	struct inpcb *inp;
-#ifdef IPSEC_NAT_T
 	struct udpcb *up;
-#endif
 
 	inp = sotoinpcb(so);
 	KASSERT(inp != NULL, ("%s: inp == NULL", __func__));
@@ -866,6 +1114,41 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 			}
 			INP_UNLOCK(inp);
 			break;
+		case UDP_SEGMENT:
+		case UDP_GRO:
+			INP_UNLOCK(inp);
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+					    sizeof optval);
+			if (error)
+				break;
+			if (sopt->sopt_name == UDP_SEGMENT &&
+			    (optval < 0 || optval > IP_MAXPACKET -
+			    (int)sizeof(struct udpiphdr))) {
+				error = EINVAL;
+				break;
+			}
+			inp = sotoinpcb(so);
+			KASSERT(inp != NULL, ("%s: inp == NULL", __func__));
+			INP_LOCK(inp);
+			up = intoudpcb(inp);
+			if (sopt->sopt_name == UDP_SEGMENT) {
+				up->u_gso_size = optval;
+				/*
+				 * The send buffer size is also the largest
+				 * datagram we accept, see udp_sendspace, so
+				 * make room for a full segmented send.
+				 */
+				if (optval && so->so_snd.sb_hiwat < IP_MAXPACKET)
+					(void)sbreserve_locked(&so->so_snd,
+					    IP_MAXPACKET, so, NULL);
+			} else if (optval)
+				up->u_flags |= UF_GRO;
+			else {
+				up->u_flags &= ~UF_GRO;
+				up->u_gro_rec = NULL;
+			}
+			INP_UNLOCK(inp);
+			break;
 		default:
 			INP_UNLOCK(inp);
 			error = ENOPROTOOPT;
@@ -874,6 +1157,16 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 		break;
 	case SOPT_GET:
 		switch (sopt->sopt_name) {
+		case UDP_SEGMENT:
+			optval = intoudpcb(inp)->u_gso_size;
+			INP_UNLOCK(inp);
+			error = sooptcopyout(sopt, &optval, sizeof optval);
+			break;
+		case UDP_GRO:
+			optval = (intoudpcb(inp)->u_flags & UF_GRO) != 0;
+			INP_UNLOCK(inp);
+			error = sooptcopyout(sopt, &optval, sizeof optval);
+			break;
 #ifdef IPSEC_NAT_T
 		case UDP_ENCAP:
 			up = intoudpcb(inp);
@@ -894,6 +1187,80 @@ udp_ctloutput(struct socket *so, struct sockopt *sopt)
 }
 
 #ifdef INET
+/*
+ * Add the UDP and IP headers to a datagram of len bytes in m and send it
+ * out.  The addresses and ports have been worked out by udp_output().
+ */
+static int
+udp_output_datagram(struct inpcb *inp, struct mbuf *m, int len,
+    struct in_addr laddr, u_short lport, struct in_addr faddr, u_short fport,
+    u_char tos, int ipflags)
+{
+	struct udpiphdr *ui;
+
+	INP_LOCK_ASSERT(inp);
+
+	/*
+	 * Calculate data length and get a mbuf for UDP, IP, and possible
+	 * link-layer headers.  Immediate slide the data pointer back forward
+	 * since we won't use that space at this layer.
+	 */
+	M_PREPEND(m, sizeof(struct udpiphdr) + max_linkhdr, M_DONTWAIT);
+	if (m == NULL)
+		return (ENOBUFS);
+	m->m_hdr.mh_data += max_linkhdr;
+	m->m_hdr.mh_len -= max_linkhdr;
+	m->M_dat.MH.MH_pkthdr.len -= max_linkhdr;
+
+	/*
+	 * Fill in mbuf with extended UDP header and addresses and length put
+	 * into network format.
+	 */
+	ui = mtod(m, struct udpiphdr *);
+	bzero(ui->ui_x1, sizeof(ui->ui_x1));	/* XXX still needed? */
+	ui->ui_pr = IPPROTO_UDP;
+	ui->ui_src = laddr;
+	ui->ui_dst = faddr;
+	ui->ui_sport = lport;
+	ui->ui_dport = fport;
+	ui->ui_ulen = htons((u_short)len + sizeof(struct udphdr));
+
+	/*
+	 * Set the Don't Fragment bit in the IP header.
+	 */
+	if (inp->inp_flags & INP_DONTFRAG) {
+		struct ip *ip;
+
+		ip = (struct ip *)&ui->ui_i;
+		ip->ip_off |= IP_DF;
+	}
+
+#ifdef MAC
+	mac_inpcb_create_mbuf(inp, m);
+#endif
+
+	/*
+	 * Set up checksum and output datagram.
+	 */
+	if (V_udp_cksum) {
+		if (inp->inp_flags & INP_ONESBCAST)
+			faddr.s_addr = INADDR_BROADCAST;
+		ui->ui_sum = in_pseudo(ui->ui_src.s_addr, faddr.s_addr,
+		    htons((u_short)len + sizeof(struct udphdr) + IPPROTO_UDP));
+		m->M_dat.MH.MH_pkthdr.csum_flags = CSUM_UDP |
+		    (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_SUM);
+		m->M_dat.MH.MH_pkthdr.csum_data = offsetof(struct udphdr, uh_sum);
+	} else
+		ui->ui_sum = 0;
+	((struct ip *)ui)->ip_len = sizeof (struct udpiphdr) + len;
+	((struct ip *)ui)->ip_ttl = inp->inp_ip_ttl;	/* XXX */
+	((struct ip *)ui)->ip_tos = tos;		/* XXX */
+	UDPSTAT_INC(udps_opackets);
+
+	return (ip_output(m, inp->inp_options, NULL, ipflags,
+	    inp->inp_moptions, inp));
+}
+
 #define	UH_WLOCKED	2
 #define	UH_RLOCKED	1
 #define	UH_UNLOCKED	0
@@ -901,15 +1268,16 @@ static int
 udp_output(struct inpcb *inp, struct mbuf *m, struct bsd_sockaddr *addr,
     struct mbuf *control, struct thread *td)
 {
-	struct udpiphdr *ui;
 	int len = m->M_dat.MH.MH_pkthdr.len;
 	struct in_addr faddr, laddr;
 	struct cmsghdr *cm;
 	struct bsd_sockaddr_in *sin, src;
+	struct mbuf *next;
 	int error = 0;
 	int ipflags;
 	u_short fport, lport;
 	int unlock_udbinfo;
+	u_int gso_size, seglen;
 	u_char tos;
 
 	/*
@@ -928,6 +1296,7 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct bsd_sockaddr *addr,
 	src.sin_family = 0;
 	INP_LOCK(inp);
 	tos = inp->inp_ip_tos;
+	gso_size = intoudpcb(inp)->u_gso_size;
 	if (control != NULL) {
 		/*
 		 * XXX: Currently, we assume all the optional information is
@@ -948,6 +1317,15 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct bsd_sockaddr *addr,
 				error = EINVAL;
 				break;
 			}
+			if (cm->cmsg_level == IPPROTO_UDP &&
+			    cm->cmsg_type == UDP_SEGMENT) {
+				if (cm->cmsg_len != CMSG_LEN(sizeof(uint16_t))) {
+					error = EINVAL;
+					break;
+				}
+				gso_size = *(uint16_t *)CMSG_DATA(cm);
+				continue;
+			}
 			if (cm->cmsg_level != IPPROTO_IP)
 				continue;
 
@@ -983,6 +1361,17 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct bsd_sockaddr *addr,
 		}
 		m_freem(control);
 	}
+	/*
+	 * UDP_SEGMENT: send the data as datagrams of gso_size bytes, the last
+	 * one possibly shorter, which share the work done below.
+	 */
+	if (gso_size >= (u_int)len)
+		gso_size = 0;
+	else if (gso_size && howmany(len, gso_size) > UDP_MAX_SEGMENTS)
+		error = EINVAL;
+	/* sosend summed the data as a whole, not per datagram */
+	if (gso_size)
+		m->M_dat.MH.MH_pkthdr.csum_flags &= ~CSUM_DATA_SUM;
 	if (error) {
 		INP_UNLOCK(inp);
 		m_freem(m);
@@ -1110,42 +1499,11 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct bsd_sockaddr *addr,
 		}
 	}
 
-	/*
-	 * Calculate data length and get a mbuf for UDP, IP, and possible
-	 * link-layer headers.  Immediate slide the data pointer back forward
-	 * since we won't use that space at this layer.
-	 */
-	M_PREPEND(m, sizeof(struct udpiphdr) + max_linkhdr, M_DONTWAIT);
-	if (m == NULL) {
-		error = ENOBUFS;
-		goto release;
-	}
-	m->m_hdr.mh_data += max_linkhdr;
-	m->m_hdr.mh_len -= max_linkhdr;
-	m->M_dat.MH.MH_pkthdr.len -= max_linkhdr;
-
-	/*
-	 * Fill in mbuf with extended UDP header and addresses and length put
-	 * into network format.
-	 */
-	ui = mtod(m, struct udpiphdr *);
-	bzero(ui->ui_x1, sizeof(ui->ui_x1));	/* XXX still needed? */
-	ui->ui_pr = IPPROTO_UDP;
-	ui->ui_src = laddr;
-	ui->ui_dst = faddr;
-	ui->ui_sport = lport;
-	ui->ui_dport = fport;
-	ui->ui_ulen = htons((u_short)len + sizeof(struct udphdr));
-
-	/*
-	 * Set the Don't Fragment bit in the IP header.
-	 */
-	if (inp->inp_flags & INP_DONTFRAG) {
-		struct ip *ip;
-
-		ip = (struct ip *)&ui->ui_i;
-		ip->ip_off |= IP_DF;
-	}
+	if (unlock_udbinfo == UH_WLOCKED)
+		INP_HASH_WUNLOCK(&V_udbinfo);
+	else if (unlock_udbinfo == UH_RLOCKED)
+		INP_HASH_RUNLOCK(&V_udbinfo);
+	unlock_udbinfo = UH_UNLOCKED;
 
 	ipflags = 0;
 	if (inp->inp_socket->so_options & SO_DONTROUTE)
@@ -1155,33 +1513,23 @@ udp_output(struct inpcb *inp, struct mbuf *m, struct bsd_sockaddr *addr,
 	if (inp->inp_flags & INP_ONESBCAST)
 		ipflags |= IP_SENDONES;
 
-#ifdef MAC
-	mac_inpcb_create_mbuf(inp, m);
-#endif
-
-	/*
-	 * Set up checksum and output datagram.
-	 */
-	if (V_udp_cksum) {
-		if (inp->inp_flags & INP_ONESBCAST)
-			faddr.s_addr = INADDR_BROADCAST;
-		ui->ui_sum = in_pseudo(ui->ui_src.s_addr, faddr.s_addr,
-		    htons((u_short)len + sizeof(struct udphdr) + IPPROTO_UDP));
-		m->M_dat.MH.MH_pkthdr.csum_flags = CSUM_UDP;
-		m->M_dat.MH.MH_pkthdr.csum_data = offsetof(struct udphdr, uh_sum);
-	} else
-		ui->ui_sum = 0;
-	((struct ip *)ui)->ip_len = sizeof (struct udpiphdr) + len;
-	((struct ip *)ui)->ip_ttl = inp->inp_ip_ttl;	/* XXX */
-	((struct ip *)ui)->ip_tos = tos;		/* XXX */
-	UDPSTAT_INC(udps_opackets);
-
-	if (unlock_udbinfo == UH_WLOCKED)
-		INP_HASH_WUNLOCK(&V_udbinfo);
-	else if (unlock_udbinfo == UH_RLOCKED)
-		INP_HASH_RUNLOCK(&V_udbinfo);
-	error = ip_output(m, inp->inp_options, NULL, ipflags,
-	    inp->inp_moptions, inp);
+	do {
+		next = NULL;
+		seglen = len;
+		if (gso_size && seglen > gso_size) {
+			next = m_split(m, gso_size, M_DONTWAIT);
+			if (next == NULL) {
+				error = ENOBUFS;
+				goto release;
+			}
+			seglen = gso_size;
+		}
+		error = udp_output_datagram(inp, m, seglen, laddr, lport,
+		    faddr, fport, tos, ipflags);
+		m = next;
+		len -= seglen;
+	} while (m != NULL && error == 0);
+	m_freem(m);
 	INP_UNLOCK(inp);
 	return (error);
 
@@ -1343,6 +1691,7 @@ udp_abort(struct socket *so)
 	INP_LOCK(inp);
 	if (inp->inp_faddr.s_addr != INADDR_ANY) {
 		INP_HASH_WLOCK(&V_udbinfo);
+		udp_teardown_net_channel(inp);
 		in_pcbdisconnect(inp);
 		inp->inp_laddr.s_addr = INADDR_ANY;
 		INP_HASH_WUNLOCK(&V_udbinfo);
@@ -1415,6 +1764,8 @@ udp_bind(struct socket *so, struct bsd_sockaddr *nam, struct thread *td)
 	INP_LOCK(inp);
 	INP_HASH_WLOCK(&V_udbinfo);
 	error = in_pcbbind(inp, nam, 0);
+	if (error == 0)
+		udp_purge_net_channels(inp);
 	INP_HASH_WUNLOCK(&V_udbinfo);
 	INP_UNLOCK(inp);
 	return (error);
@@ -1430,6 +1781,7 @@ udp_close(struct socket *so)
 	INP_LOCK(inp);
 	if (inp->inp_faddr.s_addr != INADDR_ANY) {
 		INP_HASH_WLOCK(&V_udbinfo);
+		udp_teardown_net_channel(inp);
 		in_pcbdisconnect(inp);
 		inp->inp_laddr.s_addr = INADDR_ANY;
 		INP_HASH_WUNLOCK(&V_udbinfo);
@@ -1454,7 +1806,10 @@ udp_connect(struct socket *so, struct bsd_sockaddr *nam, struct thread *td)
 	}
 	sin = (struct bsd_sockaddr_in *)nam;
 	INP_HASH_WLOCK(&V_udbinfo);
+	udp_teardown_net_channel(inp);
 	error = in_pcbconnect(inp, nam, 0);
+	if (error == 0)
+		udp_purge_net_channels(inp);
 	INP_HASH_WUNLOCK(&V_udbinfo);
 	if (error == 0)
 		soisconnected(so);
@@ -1476,6 +1831,7 @@ udp_detach(struct socket *so)
 	INP_LOCK(inp);
 	up = intoudpcb(inp);
 	KASSERT(up != NULL, ("%s: up == NULL", __func__));
+	udp_free_net_channel(inp);
 	inp->inp_ppcb = NULL;
 	in_pcbdetach(inp);
 	in_pcbfree(inp);
@@ -1496,6 +1852,7 @@ udp_disconnect(struct socket *so)
 		return (ENOTCONN);
 	}
 	INP_HASH_WLOCK(&V_udbinfo);
+	udp_teardown_net_channel(inp);
 	in_pcbdisconnect(inp);
 	inp->inp_laddr.s_addr = INADDR_ANY;
 	INP_HASH_WUNLOCK(&V_udbinfo);
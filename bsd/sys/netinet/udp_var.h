@@ -53,12 +53,20 @@ struct udpiphdr {
 
 typedef void(*udp_tun_func_t)(struct mbuf *, int off, struct inpcb *);
 
+struct net_channel;
+
 /*
  * UDP control block; one per udp.
  */
 struct udpcb {
 	udp_tun_func_t	u_tun_func;	/* UDP kernel tunneling callback. */
 	u_int		u_flags;	/* Generic UDP flags. */
+	net_channel	*u_nc;		/* datagrams classified to us */
+	struct ifnet	*u_nc_intf;	/* (h) interface classifying them */
+	u_int		u_gso_size;	/* UDP_SEGMENT: split sends this size */
+	struct mbuf	*u_gro_rec;	/* UDP_GRO: last record, still growing */
+	u_int		u_gro_size;	/* .. size of its datagrams */
+	u_int		u_gro_len;	/* .. and its length */
 };
 
 #define	intoudpcb(ip)	((struct udpcb *)(ip)->inp_ppcb)
@@ -69,6 +77,9 @@ struct udpcb {
 	/* .. per draft-ietf-ipsec-nat-t-ike-0[01],
 	 * and draft-ietf-ipsec-udp-encaps-(00/)01.txt */
 #define	UF_ESPINUDP		0x00000002	/* w/ non-ESP marker. */
+#define	UF_GRO			0x00000004	/* coalesce received datagrams */
+
+#define	UDP_MAX_SEGMENTS	64	/* most datagrams in one UDP_SEGMENT send */
 
 struct udpstat {
 				/* input statistics: */
@@ -128,6 +128,7 @@ struct pkthdr {
 		u_int16_t vt_vtag;	/* Ethernet 802.1p+q vlan tag */
 		u_int16_t vt_nrecs;	/* # of IGMPv3 records in this chain */
 	} PH_vt;
+	u_int16_t	 csum_sum;	/* sum of the data, see CSUM_DATA_SUM */
 	SLIST_HEAD(packet_tags, m_tag) tags; /* list of packet tags */
 };
 #define ether_vtag	PH_vt.vt_vtag
@@ -289,6 +290,7 @@ struct mbuf {
 /*	CSUM_TSO_IPV6		0x8000		will do IPv6/TSO */
 
 /*	CSUM_FRAGMENT_IPV6	0x10000		will do IPv6 fragementation */
+#define	CSUM_DATA_SUM		0x20000		/* csum_sum has the data's sum */
 
 #define	CSUM_DELAY_DATA_IPV6	(CSUM_TCP_IPV6 | CSUM_UDP_IPV6)
 #define	CSUM_DATA_VALID_IPV6	CSUM_DATA_VALID
@@ -874,6 +876,7 @@ void		 m_freem(struct mbuf *);
 struct mbuf	*m_getm2(struct mbuf *, int, int, short, int);
 struct mbuf	*m_getm2_zcopy(struct mbuf *, struct uio *, int, int, short,
 		    int, struct zmsghdr *);
+struct mbuf	*m_getm_zbuf(const void *, size_t, int, struct zbuf_handle *);
 struct mbuf	*m_getptr(struct mbuf *, int, int *);
 u_int		 m_length(struct mbuf *, struct mbuf **);
 int		 m_mbuftouio(struct uio *, struct mbuf *, int);
@@ -884,6 +887,7 @@ struct mbuf	*m_pullup(struct mbuf *, int);
 int		m_sanity(struct mbuf *, int);
 struct mbuf	*m_split(struct mbuf *, int, int);
 struct mbuf	*m_uiotombuf(struct uio *, int, int, int, int, int);
+struct mbuf	*m_uiotombuf_csum(struct uio *, int, int, int, int, int);
 struct mbuf	*m_uiotombuf_zcopy(struct uio *, int, int, int, int, int, struct zmsghdr *);
 struct mbuf	*m_unshare(struct mbuf *, int how);
 
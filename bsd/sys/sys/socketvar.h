@@ -43,6 +43,7 @@
 #include <bsd/sys/sys/sockopt.h>
 #endif
 #include <osv/net_channel.hh>
+#include <atomic>
 
 struct vnet;
 
@@ -125,6 +126,10 @@ struct socket {
 	// a net channel only supports one consumer, so let others wait on a waitqueue instead
 	bool so_nc_busy = false;
 	waitqueue so_nc_wq;
+	// SYNs for a listening socket. Processed without the socket lock, so
+	// its consumers are serialized by so_syn_nc_mtx instead
+	std::atomic<net_channel*> so_syn_nc = {};
+	mutex so_syn_nc_mtx;
 	/* FIXME: this is done for poll,
 	 * make sure there's only 1 ref to a fp */
 	struct file* fp;
@@ -333,6 +338,7 @@ int	sodisconnect(struct socket *so);
 struct	bsd_sockaddr *sodupbsd_sockaddr(const struct bsd_sockaddr *sa, int mflags);
 void	sofree(struct socket *so);
 void	sohasoutofband(struct socket *so);
+void	soflush_syn_net_channel(struct socket *so);
 int	solisten(struct socket *so, int backlog, struct thread *td);
 void	solisten_proto(struct socket *so, int backlog);
 int	solisten_proto_check(struct socket *so);
@@ -353,6 +359,13 @@ int	soreceive_stream(struct socket *so, struct bsd_sockaddr **paddr,
 int	soreceive_dgram(struct socket *so, struct bsd_sockaddr **paddr,
 	    struct uio *uio, struct mbuf **mp0, struct mbuf **controlp,
 	    int *flagsp);
+int	soreceive_dgram_batch(struct socket *so, struct mbuf **records,
+	    int *nrecords, int flags);
+int	soreceive_dgram_record(struct socket *so, struct mbuf *m,
+	    struct bsd_sockaddr **paddr, struct uio *uio,
+	    struct mbuf **controlp, int *flagsp);
+void	soreceive_dgram_requeue(struct socket *so, struct mbuf **records,
+	    int nrecords);
 int	soreceive_generic(struct socket *so, struct bsd_sockaddr **paddr,
 	    struct uio *uio, struct mbuf **mp0, struct mbuf **controlp,
 	    int *flagsp);
@@ -23,6 +23,10 @@ int kern_connect(int fd, struct bsd_sockaddr *sa);
 int kern_sendit(int s, struct msghdr *mp, int flags,
     struct mbuf *control, ssize_t *bytes);
 int kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes);
+int kern_sendmmsg(int s, struct mmsghdr *msgvec, struct mbuf **controls,
+    unsigned int vlen, int flags, unsigned int *count);
+int kern_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+    const struct timespec *timeout, unsigned int *count);
 int kern_setsockopt(int s, int level, int name, void *val, socklen_t valsize);
 int kern_getsockopt(int s, int level, int name, void *val, socklen_t *valsize);
 int kern_socketpair(int domain, int type, int protocol, int *rsv);
@@ -57,9 +61,13 @@ int linux_accept(int s, struct bsd_sockaddr* name, socklen_t* namelen, int *out_
 int linux_accept4(int s, struct bsd_sockaddr * name, socklen_t * namelen, int *out_fd, int flags);
 int linux_connect(int s, void *name, int namelen);
 int linux_sendmsg(int s, struct msghdr* msg, int flags, ssize_t* bytes);
+int linux_sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+	unsigned int *count);
 int linux_sendto(int s, void* buf, int len, int flags, void* to, int tolen, ssize_t *bytes);
 int linux_send(int s, caddr_t buf, size_t len, int flags, ssize_t* bytes);
 int linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes);
+int linux_recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+	const struct timespec *timeout, unsigned int *count);
 int linux_recv(int s, caddr_t buf, int len, int flags, ssize_t* bytes);
 int linux_recvfrom(int s, void* buf, size_t len, int flags,
 	struct bsd_sockaddr * from, socklen_t * fromlen, ssize_t* bytes);
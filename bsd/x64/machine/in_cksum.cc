@@ -39,6 +39,9 @@
 
 #include <sys/cdefs.h>			/* RCS ID & Copyright macro defns */
 
+#include "cpuid.hh"
+#include <string.h>
+
 #include <bsd/porting/netport.h>
 
 #include <bsd/sys/sys/param.h>
@@ -89,7 +92,7 @@ union q_util {
 };
 
 static u_int64_t
-in_cksumdata(const void *buf, int len)
+in_cksumdata_base(const void *buf, int len)
 {
 	const u_int32_t *lw = (const u_int32_t *) buf;
 	u_int64_t sum = 0;
@@ -169,6 +172,94 @@ in_cksumdata(const void *buf, int len)
 	return sum;
 }
 
+/*
+ * Sums the 32-bit words of the len bytes at src into a 64-bit sum, copying
+ * them to dst unless it is NULL.  len is a multiple of 64.  in_cksum_avx2()
+ * in in_cksum_avx2.cc does the same with AVX2, the in_cksum_bulk() ifunc
+ * picks one of the two at boot.
+ */
+static u_int64_t
+in_cksum_bulk_base(const void *src, void *dst, size_t len)
+{
+	const char *s = (const char *) src;
+	char *d = (char *) dst;
+	u_int64_t sum = 0, w;
+
+	for (; len; len -= 8, s += 8) {
+		memcpy(&w, s, 8);
+		if (d) {
+			memcpy(d, &w, 8);
+			d += 8;
+		}
+		sum += (w & 0xffffffff) + (w >> 32);
+	}
+	return (sum);
+}
+
+u_int64_t in_cksum_avx2(const void *src, void *dst, size_t len);
+
+/*
+ * The ymm registers are only usable once init_xcr0() enabled them, which
+ * it does for cpus with xsave and avx.
+ */
+static bool
+in_cksum_has_avx2(void)
+{
+	auto& f = processor::features();
+
+	return (f.avx2 && f.avx && f.xsave);
+}
+
+extern "C" {
+static u_int64_t (*resolve_in_cksum_bulk(void))(const void *, void *, size_t)
+{
+	return (in_cksum_has_avx2() ? in_cksum_avx2 : in_cksum_bulk_base);
+}
+}
+
+static u_int64_t in_cksum_bulk(const void *src, void *dst, size_t len)
+    __attribute__((ifunc("resolve_in_cksum_bulk")));
+
+/*
+ * Leaves data shorter than a few cache lines, and the bytes before the
+ * first and after the last 64 byte block, to in_cksumdata_base().  Its
+ * words are the aligned ones too, so the sums add up.
+ */
+static u_int64_t
+in_cksumdata_avx2(const void *buf, int len)
+{
+	const char *p = (const char *) buf;
+	u_int64_t sum = 0;
+	union q_util q_util;
+	int n;
+
+	if (len < 256)
+		return (in_cksumdata_base(buf, len));
+	if ((n = 3 & -(long) p) != 0) {
+		sum = in_cksumdata_base(p, n);
+		p += n;
+		len -= n;
+	}
+	n = len & ~63;
+	sum += in_cksum_avx2(p, NULL, n);
+	p += n;
+	len -= n;
+	if (len)
+		sum += in_cksumdata_base(p, len);
+	REDUCE32;
+	return (sum);
+}
+
+extern "C" {
+static u_int64_t (*resolve_in_cksumdata(void))(const void *, int)
+{
+	return (in_cksum_has_avx2() ? in_cksumdata_avx2 : in_cksumdata_base);
+}
+}
+
+static u_int64_t in_cksumdata(const void *buf, int len)
+    __attribute__((ifunc("resolve_in_cksumdata")));
+
 u_short
 in_addword(u_short a, u_short b)
 {
@@ -231,6 +322,48 @@ skip_start:
 	return (~sum & 0xffff);
 }
 
+/*
+ * Copies len bytes from src to dst, which is what sosend does with the
+ * data of a datagram anyway, summing them on the way instead of reading
+ * them again in in_delayed_cksum().  prev is the sum of the off bytes of
+ * data before these, to which theirs is added.  Returns the 16-bit sum,
+ * not complemented.
+ */
+u_short
+in_cksum_copy(const void *src, void *dst, int len, u_short prev, int off)
+{
+	const char *s = (const char *) src;
+	char *d = (char *) dst;
+	u_int64_t sum = 0, w;
+	union q_util q_util;
+	union l_util l_util;
+	int n;
+
+	/* Unlike in_cksumdata(), the words are relative to src */
+	if ((n = len & ~63) != 0) {
+		sum = in_cksum_bulk(s, d, n);
+		s += n;
+		d += n;
+		len -= n;
+	}
+	for (; len >= 8; len -= 8, s += 8, d += 8) {
+		memcpy(&w, s, 8);
+		memcpy(d, &w, 8);
+		sum += (w & 0xffffffff) + (w >> 32);
+	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, s, len);
+		memcpy(d, s, len);
+		sum += (w & 0xffffffff) + (w >> 32);
+	}
+	REDUCE16;
+	/* Bytes at odd offsets into the data are the high ones of its words */
+	if (off & 1)
+		sum = ((sum & 0xff) << 8) | (sum >> 8);
+	return (in_addword(prev, sum));
+}
+
 u_int in_cksum_hdr(const struct ip *ip)
 {
     u_int64_t sum = in_cksumdata(ip, sizeof(struct ip));
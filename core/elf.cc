@@ -50,6 +50,7 @@ TRACEPOINT(trace_elf_lookup_addr, "%p", const void *);
 
 extern void* elf_start;
 extern size_t elf_size;
+extern bool opt_patch_syscalls;
 extern char libvdso_start[];
 
 using namespace boost::range;
@@ -126,6 +127,8 @@ object::object(program& prog, std::string pathname)
     , _is_dynamically_linked_executable(false)
     , _init_called(false)
     , _eh_frame(0)
+    , _syscall_stubs(nullptr)
+    , _syscall_stubs_size(0)
     , _visibility_thread(nullptr)
     , _visibility_level(VisibilityLevel::Public)
     , _dlopen_ed(false)
@@ -578,6 +581,9 @@ void object::unload_segments()
             break;
         }
      }
+    if (_syscall_stubs) {
+        mmu::munmap(_syscall_stubs, _syscall_stubs_size);
+    }
 }
 
 unsigned object::get_segment_mmap_permissions(const Elf64_Phdr& phdr)
@@ -624,6 +630,25 @@ void object::make_text_writable(bool flag)
     }
 }
 
+// Turns the system call instructions of the object into calls of the
+// functions implementing them, where the architecture knows how to (see
+// arch_patch_syscalls()). Objects with text relocations are left alone, as
+// those might apply to the very instructions being patched.
+void object::patch_syscalls()
+{
+    if (has_non_writable_text_relocations()) {
+        return;
+    }
+    make_text_writable(true);
+    arch_patch_syscalls();
+    make_text_writable(false);
+}
+
+void* object::syscall_stubs_end() const
+{
+    return _syscall_stubs + _syscall_stubs_size;
+}
+
 template <typename T>
 T* object::dynamic_ptr(unsigned tag)
 {
@@ -1526,8 +1551,11 @@ program::load_object(std::string name, std::vector<std::string> extra_path,
         osv::rcu_dispose(old_modules);
         ef->load_segments();
         ef->process_headers();
+        if (opt_patch_syscalls) {
+            ef->patch_syscalls();
+        }
         if (ef->is_pic())
-            _next_alloc = ef->end();
+            _next_alloc = std::max(ef->end(), ef->syscall_stubs_end());
         add_debugger_obj(ef.get());
         loaded_objects.push_back(ef);
         // Do not try to load any dependant libraries for static executable, they don't apply here.
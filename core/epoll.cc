@@ -17,11 +17,11 @@
 #include <osv/file.h>
 #include <osv/poll.h>
 #include <fs/fs.hh>
-#include <boost/lockfree/queue.hpp>
-#include <boost/lockfree/policies.hpp>
+#include <boost/intrusive/list.hpp>
 
 #include <osv/debug.hh>
 #include <osv/export.h>
+#include <osv/rcu.hh>
 #include <unordered_map>
 #include <boost/range/algorithm/find.hpp>
 #include <algorithm>
@@ -37,7 +37,14 @@ TRACEPOINT(trace_epoll_ready, "fd=%d file=%p, event=0x%x", int, file*, int);
 // so the conversion is trivial, but we verify this here with static_asserts.
 // We also pass the EPOLLET bit from epoll to poll because sockets' poll needs
 // to avoid a certain optimization (see sopoll_generic_locked()).
-// The remaining epoll-specific bit, EPOLLONESHOT, is not passed to poll().
+// The remaining epoll-specific bits, EPOLLONESHOT and EPOLLEXCLUSIVE, are
+// not passed to poll().
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+#ifndef EPOLLWAKEUP
+#define EPOLLWAKEUP (1U << 29)
+#endif
 static_assert(POLLIN == EPOLLIN, "POLLIN!=EPOLLIN");
 static_assert(POLLOUT == EPOLLOUT, "POLLOUT!=EPOLLOUT");
 static_assert(POLLRDHUP == EPOLLRDHUP, "POLLRDHUP!=EPOLLRDHUP");
@@ -57,47 +64,114 @@ inline uint32_t events_poll_to_epoll(uint32_t e)
     return e;
 }
 
+// Linux only accepts these together with EPOLLEXCLUSIVE, and only with
+// EPOLL_CTL_ADD: an exclusive registration cannot be modified later on.
+constexpr uint32_t EXCLUSIVE_EVENTS =
+        EPOLLIN | EPOLLOUT | EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE;
+
+// The registration of one file in one epoll. Files being polled reach their
+// registrations directly through epoll_ptr::reg, so reporting activity does
+// not need to look anything up.
+//
+// Activity is reported lock-free (wakers may hold the polled file's locks,
+// or be inside an RCU read-side section where they cannot sleep at all), by
+// pushing the registration on the epoll's _pending stack. The PENDING bit
+// keeps a registration on the stack at most once, so the stack can never
+// overflow. The epoll moves pending registrations to its ready list, an
+// intrusive list threaded through the registrations themselves.
+//
+// A registration that is deleted may still be seen by wakers until an RCU
+// grace period has passed, and may still be on the _pending stack after
+// that, so it is freed by whoever is last of the RCU callback (which sets
+// RETIRED) and the epoll's flush (which clears PENDING).
+struct epoll_registration {
+    enum : unsigned {
+        PENDING = 1,
+        DELETED = 2,
+        RETIRED = 4,
+    };
+    epoll_registration(epoll_key key, const epoll_event& event)
+        : key(key), event(event), exclusive(event.events & EPOLLEXCLUSIVE) {}
+    epoll_key key;
+    // protected by the epoll's f_lock:
+    epoll_event event;
+    boost::intrusive::list_member_hook<> ready_link;
+    // fixed at registration:
+    const bool exclusive;
+    // lock-free:
+    std::atomic<unsigned> state = { 0 };
+    epoll_registration* pending_next = nullptr;
+};
+
 class epoll_file final : public special_file {
 
     // lock ordering (fp == some file being polled):
     //    f_lock > fp->f_lock
-    //    fp->f_lock > _activity_lock
-    // we never hold both f_lock and activity_lock.
+    // Wakers only use _pending and _owner, which need no lock.
+
+    typedef boost::intrusive::list<epoll_registration,
+            boost::intrusive::member_hook<epoll_registration,
+                    boost::intrusive::list_member_hook<>,
+                    &epoll_registration::ready_link>,
+            boost::intrusive::constant_time_size<false>> ready_list;
 
     // protected by f_lock:
-    std::unordered_map<epoll_key, epoll_event> map;
-    mutex _activity_lock;
-    // below, all protected by _activity_lock:
-    std::unordered_set<epoll_key> _activity;
+    std::unordered_map<epoll_key, epoll_registration*> map;
+    ready_list _ready;
     waitqueue _waiters;
-    boost::lockfree::queue<epoll_key, boost::lockfree::fixed_sized<true>> _activity_ring{512};
-    std::atomic<bool> _activity_ring_overflow = { false };
-    sched::thread_handle _activity_ring_owner;
+    // The waiter that lock-free wakers wake up; other waiters are woken
+    // one at a time through _waiters, so an event wakes a single thread.
+    sched::thread* _owner_thread = nullptr;
+    // lock-free:
+    sched::thread_handle _owner;
+    std::atomic<unsigned> _nwaiters = { 0 };
+    std::atomic<epoll_registration*> _pending = { nullptr };
 public:
     epoll_file()
         : special_file(0, DTYPE_UNSPEC)
     {
     }
+    ~epoll_file()
+    {
+        // All registrations were retired by close(), but some may still be
+        // pending, and their RCU callbacks left freeing them to us.
+        for (auto reg = _pending.exchange(nullptr); reg; ) {
+            auto next = reg->pending_next;
+            if (reg->state.fetch_and(~epoll_registration::PENDING)
+                    & epoll_registration::RETIRED) {
+                delete reg;
+            }
+            reg = next;
+        }
+    }
     virtual int close() override {
         WITH_LOCK(f_lock) {
+            _ready.clear();
             for (auto& e : map) {
-                e.first._file->epoll_del({ this, e.first });
+                e.first._file->epoll_del(ptr(e.second));
+                retire(e.second);
             }
+            map.clear();
         }
         return 0;
     }
     int add(epoll_key key, struct epoll_event *event)
     {
+        if ((event->events & EPOLLEXCLUSIVE) &&
+                (event->events & ~EXCLUSIVE_EVENTS)) {
+            return EINVAL;
+        }
         auto fp = key._file;
         WITH_LOCK(f_lock) {
             if (map.count(key)) {
                 return EEXIST;
             }
-            map.emplace(key, *event);
-            fp->epoll_add({ this, key});
-        }
-        if (fp->poll(events_epoll_to_poll(event->events))) {
-            wake(key);
+            auto reg = new epoll_registration(key, *event);
+            map.emplace(key, reg);
+            fp->epoll_add(ptr(reg));
+            if (fp->poll(events_epoll_to_poll(event->events))) {
+                make_ready(reg);
+            }
         }
         return 0;
     }
@@ -105,147 +179,172 @@ public:
     {
         auto fp = key._file;
         WITH_LOCK(f_lock) {
-            try {
-                map.at(key) = *event;
-            } catch (std::out_of_range &e) {
+            auto i = map.find(key);
+            if (i == map.end()) {
                 return ENOENT;
             }
-            fp->epoll_add({ this, key });
-        }
-        if (fp->poll(events_epoll_to_poll(event->events))) {
-            wake(key);
+            auto reg = i->second;
+            if (reg->exclusive || (event->events & EPOLLEXCLUSIVE)) {
+                return EINVAL;
+            }
+            reg->event = *event;
+            fp->epoll_add(ptr(reg));
+            if (fp->poll(events_epoll_to_poll(event->events))) {
+                make_ready(reg);
+            }
         }
         return 0;
     }
     int del(epoll_key key)
     {
         WITH_LOCK(f_lock) {
-            if (map.erase(key)) {
-                key._file->epoll_del({ this, key });
-                return 0;
-            } else {
+            auto i = map.find(key);
+            if (i == map.end()) {
                 return ENOENT;
             }
+            auto reg = i->second;
+            map.erase(i);
+            key._file->epoll_del(ptr(reg));
+            if (reg->ready_link.is_linked()) {
+                _ready.erase(_ready.iterator_to(*reg));
+            }
+            retire(reg);
         }
+        return 0;
     }
     int wait(struct epoll_event *events, int maxevents, int timeout_ms)
     {
         auto tmo = parse_poll_timeout(timeout_ms);
-        sched::timer tmr(*sched::thread::current());
+        auto current = sched::thread::current();
+        sched::timer tmr(*current);
         if (tmo) {
             tmr.set(*tmo);
         }
         int nr = 0;
-        WITH_LOCK(_activity_lock) {
-            while (!tmr.expired() && nr == 0) {
-                if (tmo) {
-                    _activity_ring_owner.reset(*sched::thread::current());
-                    sched::thread::wait_for(_activity_lock,
-                            _waiters,
-                            tmr,
-                            [&] { return !_activity.empty(); },
-                            [&] { return !_activity_ring.empty(); },
-                            [&] { return _activity_ring_overflow.load(std::memory_order_relaxed); }
-                    );
-                    _activity_ring_owner.clear();
-                }
-
-                flush_activity_ring();
-                // We need to drop _activity_lock and take f_lock in process_activity(),
-                // so move _activity to local storage for processing.
-                auto activity = std::move(_activity);
-                assert(_activity.empty());
-                DROP_LOCK(_activity_lock) {
-                    nr = process_activity(activity, events, maxevents);
-                }
-                // move back !EPOLLET back to main storage
-                if (_activity.empty()) {
-                    // nothing happened, move entire set back in
-                    _activity = std::move(activity);
-                } else {
-                    // move item by item (realistically a copy)
-                    std::move(activity.begin(), activity.end(),
-                            std::inserter(_activity, _activity.begin()));
-                }
-                if (!tmo) {
-                    break;
-                }
-            }
-        }
-        return nr;
-    }
-    int process_activity(std::unordered_set<epoll_key>& activity,
-                         epoll_event* events, int maxevents) {
-        int nr = 0;
         WITH_LOCK(f_lock) {
-            auto i = activity.begin();
-            while (i != activity.end() && nr < maxevents) {
-                epoll_key key = *i;
-                auto found = map.find(key);
-                auto cur = i++;
-                if (found == map.end()) {
-                    activity.erase(cur);
-                    continue; // raced
-                }
-                epoll_event& evt = found->second;
-                int active = 0;
-                if (evt.events) {
-                    active = key._file->poll(events_epoll_to_poll(evt.events));
-                }
-                active = events_poll_to_epoll(active);
-                if (!active || (evt.events & EPOLLET)) {
-                    activity.erase(cur);
-                } else {
-                    key._file->epoll_add({ this, key });
+            for (;;) {
+                flush_pending();
+                nr = process_ready(events, maxevents);
+                if (nr || !tmo || tmr.expired()) {
+                    break;
                 }
-                if (!active) {
-                    continue;
+                if (!_owner_thread) {
+                    _owner_thread = current;
+                    _owner.reset(*current);
                 }
-                if (evt.events & EPOLLONESHOT) {
-                    evt.events = 0;
-                    key._file->epoll_del({ this, key });
+                _nwaiters.fetch_add(1, std::memory_order_relaxed);
+                sched::thread::wait_for(f_lock, _waiters, tmr,
+                        [&] { return _pending.load(std::memory_order_relaxed) != nullptr; });
+                _nwaiters.fetch_sub(1, std::memory_order_relaxed);
+                if (_owner_thread == current) {
+                    _owner_thread = nullptr;
+                    _owner.clear();
                 }
-                trace_epoll_ready(key._fd, key._file, active);
-                events[nr].data = evt.data;
-                events[nr].events = active;
-                ++nr;
+            }
+            // Pass on to the next waiter what we leave behind: events we
+            // had no room for, or arrived while we were busy, and being the
+            // one that lock-free wakers wake up.
+            if (!_waiters.empty() && (!_owner_thread || !_ready.empty() ||
+                    _pending.load(std::memory_order_relaxed))) {
+                _waiters.wake_one(f_lock);
             }
         }
         return nr;
     }
-    void flush_activity_ring() {
-        epoll_key ep;
-        while (_activity_ring.pop(ep)) {
-            _activity.insert(ep);
-        }
-        if (_activity_ring_overflow.load(std::memory_order_relaxed)) {
-            _activity_ring_overflow.store(false, std::memory_order_relaxed);
-            for (auto&& x : map) {
-                _activity.insert(x.first);
-            }
+    bool wake(epoll_registration* reg) {
+        push_pending(reg);
+        _owner.wake();
+        return _nwaiters.load(std::memory_order_relaxed);
+    }
+    bool wake_in_rcu(epoll_registration* reg) {
+        push_pending(reg);
+        _owner.wake_from_kernel_or_with_irq_disabled();
+        return _nwaiters.load(std::memory_order_relaxed);
+    }
+private:
+    epoll_ptr ptr(epoll_registration* reg) {
+        return { this, reg->key, reg, reg->exclusive };
+    }
+    // Called with f_lock held, for activity found by epoll_ctl() itself
+    void make_ready(epoll_registration* reg) {
+        if (!reg->ready_link.is_linked()) {
+            _ready.push_back(*reg);
         }
-        // events on _activity_ring only wake up one waiter, so wake up all the rest  now.
-        // we need to do this even if no events were received, since if we exit, then
-        // _activity_ring_owner will remain unset.
-        _waiters.wake_all(_activity_lock);
+        _waiters.wake_one(f_lock);
     }
-    void wake(epoll_key key) {
-        if (_activity_ring.push(key)) {
-            _activity_ring_owner.wake();
+    void push_pending(epoll_registration* reg) {
+        if (reg->state.fetch_or(epoll_registration::PENDING)
+                & epoll_registration::PENDING) {
             return;
         }
-        WITH_LOCK(_activity_lock) {
-            auto ins = _activity.insert(key);
-            if (ins.second) {
-                _waiters.wake_all(_activity_lock);
+        auto head = _pending.load(std::memory_order_relaxed);
+        do {
+            reg->pending_next = head;
+        } while (!_pending.compare_exchange_weak(head, reg,
+                std::memory_order_release, std::memory_order_relaxed));
+    }
+    // Called with f_lock held
+    void flush_pending() {
+        auto reg = _pending.exchange(nullptr, std::memory_order_acquire);
+        while (reg) {
+            // Once PENDING is cleared reg may be pushed again, overwriting
+            // pending_next.
+            auto next = reg->pending_next;
+            auto old = reg->state.fetch_and(~epoll_registration::PENDING);
+            if (old & epoll_registration::RETIRED) {
+                delete reg;
+            } else if (!(old & epoll_registration::DELETED) &&
+                       !reg->ready_link.is_linked()) {
+                _ready.push_back(*reg);
             }
+            reg = next;
         }
     }
-    void wake_in_rcu(epoll_key key) {
-        if (!_activity_ring.push(key)) {
-            _activity_ring_overflow.store(true, std::memory_order_relaxed);
+    // Called with f_lock held, after reg was removed from the map and from
+    // its file.
+    void retire(epoll_registration* reg) {
+        reg->state.fetch_or(epoll_registration::DELETED);
+        osv::rcu_defer([reg] {
+            if (!(reg->state.fetch_or(epoll_registration::RETIRED)
+                    & epoll_registration::PENDING)) {
+                delete reg;
+            }
+        });
+    }
+    // Called with f_lock held. Registrations that turn out to be idle leave
+    // the ready list until they are woken again; level-triggered ones that
+    // are still active stay on it, at the back, so that with maxevents
+    // smaller than the list every registration gets its turn.
+    int process_ready(epoll_event* events, int maxevents) {
+        int nr = 0;
+        ready_list still_active;
+        while (!_ready.empty() && nr < maxevents) {
+            auto& reg = _ready.front();
+            _ready.pop_front();
+            epoll_event& evt = reg.event;
+            auto key = reg.key;
+            int active = 0;
+            if (evt.events) {
+                active = key._file->poll(events_epoll_to_poll(evt.events));
+            }
+            active = events_poll_to_epoll(active);
+            if (!active) {
+                continue;
+            }
+            if (evt.events & EPOLLONESHOT) {
+                evt.events = 0;
+                key._file->epoll_del(ptr(&reg));
+            } else if (!(evt.events & EPOLLET)) {
+                key._file->epoll_add(ptr(&reg));
+                still_active.push_back(reg);
+            }
+            trace_epoll_ready(key._fd, key._file, active);
+            events[nr].data = evt.data;
+            events[nr].events = active;
+            ++nr;
         }
-        _activity_ring_owner.wake_from_kernel_or_with_irq_disabled();
+        _ready.splice(_ready.end(), still_active);
+        return nr;
     }
 };
 
@@ -360,12 +459,12 @@ void epoll_file_closed(epoll_ptr ptr)
     ptr.epoll->del(ptr.key);
 }
 
-void epoll_wake(const epoll_ptr& ep)
+bool epoll_wake(const epoll_ptr& ep)
 {
-    ep.epoll->wake(ep.key);
+    return ep.epoll->wake(ep.reg);
 }
 
-void epoll_wake_in_rcu(const epoll_ptr& ep)
+bool epoll_wake_in_rcu(const epoll_ptr& ep)
 {
-    ep.epoll->wake_in_rcu(ep.key);
+    return ep.epoll->wake_in_rcu(ep.reg);
 }
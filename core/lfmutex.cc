@@ -10,10 +10,12 @@
 #include <osv/sched.hh>
 #include <osv/wait_record.hh>
 #include <osv/export.h>
+#include <osv/kernel_config_threads_mutex_spin.h>
 
 namespace lockfree {
 
 TRACEPOINT(trace_mutex_lock, "%p", mutex *);
+TRACEPOINT(trace_mutex_lock_spin, "%p, success=%d", mutex *, bool);
 TRACEPOINT(trace_mutex_lock_wait, "%p", mutex *);
 TRACEPOINT(trace_mutex_lock_wake, "%p", mutex *);
 TRACEPOINT(trace_mutex_try_lock, "%p, success=%d", mutex *, bool);
@@ -21,6 +23,41 @@ TRACEPOINT(trace_mutex_unlock, "%p", mutex *);
 TRACEPOINT(trace_mutex_send_lock, "%p, wr=%p", mutex *, wait_record *);
 TRACEPOINT(trace_mutex_receive_lock, "%p", mutex *);
 
+// Adaptive spinning: when the lock is held by a thread running on another
+// cpu, it is likely to be released well before we could sleep and be woken
+// up again, so wait for that a little before queuing ourselves. lock() has
+// already incremented count, so unlock() will either wake a queued thread
+// or leave the handoff to a concurrent lock() - which we are, and picking
+// it up, exactly like in try_lock(), gives us the lock.
+// The owner thread may exit at any time, so we do not look at it, but
+// rather for it among the threads running on the cpus.
+bool mutex::spin_lock()
+{
+    sched::cpu *owner_cpu = nullptr;
+    for (unsigned i = 0; i < CONF_threads_mutex_spin; i++) {
+        auto old_handoff = handoff.load();
+        if (old_handoff && handoff.compare_exchange_strong(old_handoff, 0U)) {
+            return true;
+        }
+        // A null owner means the lock is changing hands, so keep spinning
+        auto o = owner.load(std::memory_order_relaxed);
+        if (o && (!owner_cpu ||
+                  owner_cpu->running_thread.load(std::memory_order_relaxed) != o)) {
+            owner_cpu = sched::cpu::find_running(o);
+            if (!owner_cpu) {
+                return false;
+            }
+        }
+#ifdef __x86_64__
+        __asm __volatile("pause");
+#endif
+#ifdef __aarch64__
+        __asm __volatile("isb sy");
+#endif
+    }
+    return false;
+}
+
 void mutex::lock()
 {
     trace_mutex_lock(this);
@@ -46,6 +83,16 @@ void mutex::lock()
         return;
     }
 
+    if (CONF_threads_mutex_spin) {
+        bool got = spin_lock();
+        trace_mutex_lock_spin(this, got);
+        if (got) {
+            owner.store(current, std::memory_order_relaxed);
+            depth = 1;
+            return;
+        }
+    }
+
     // If we're here still here the lock is owned by a different thread.
     // Put this thread in a waiting queue, so it will eventually be woken
     // when another thread releases the lock.
@@ -7,26 +7,381 @@
 
 // This is the Linux-specific asynchronous I/O API / ABI from libaio.
 // Note that this API is different the Posix AIO API.
+//
+// Requests against block devices are turned into bios and handed straight to
+// the driver's strategy routine; they complete from the driver's completion
+// path. Requests against any other file are executed synchronously at
+// submission time, which is what Linux does for buffered I/O as well.
 
 #include <api/libaio.h>
 
-#include <osv/stubbing.hh>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
+#include <vector>
+
+#include <osv/bio.h>
+#include <osv/device.h>
+#include <osv/dentry.h>
+#include <osv/vnode.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <osv/clock.hh>
+#include <osv/prex.h>
+#include <osv/trace.hh>
 #include <osv/export.h>
+#include <osv/mmu.hh>
+#include <fs/fs.hh>
+
+TRACEPOINT(trace_aio_setup, "nr_events=%d ctx=%p", int, void*);
+TRACEPOINT(trace_aio_submit, "ctx=%p iocb=%p fd=%d op=%d", void*, void*, int, int);
+TRACEPOINT(trace_aio_complete, "ctx=%p iocb=%p res=%ld", void*, void*, long);
+TRACEPOINT(trace_aio_getevents, "ctx=%p min_nr=%ld nr=%ld ret=%d", void*, long, long, int);
+
+struct io_context {
+    explicit io_context(unsigned nr) : nr_events(nr), ring(nr) {}
+
+    // Number of requests submitted but not yet reaped by io_getevents()
+    unsigned busy() const { return inflight + count; }
+
+    void complete(struct iocb* cb, long res);
+
+    mutex lock;
+    condvar events_ready;
+    condvar idle;
+    const unsigned nr_events;
+    // Completed events, a ring of nr_events entries starting at head. It
+    // can not overflow since we never let more than nr_events requests in.
+    std::vector<io_event> ring;
+    unsigned head = 0;
+    unsigned count = 0;
+    unsigned inflight = 0;
+};
+
+void io_context::complete(struct iocb* cb, long res)
+{
+    trace_aio_complete(this, cb, res);
+
+    // Once the event is published, io_getevents() may hand cb back to the
+    // application, which is free to reuse or free it
+    bool notify = cb->u.c.flags & IOCB_FLAG_RESFD;
+    int resfd = cb->u.c.resfd;
+
+    WITH_LOCK(lock) {
+        auto& ev = ring[(head + count) % nr_events];
+        ev.data = cb->data;
+        ev.obj = cb;
+        ev.res = res;
+        ev.res2 = 0;
+        count++;
+        inflight--;
+        events_ready.wake_all();
+        if (!inflight) {
+            idle.wake_all();
+        }
+    }
+
+    if (notify) {
+        uint64_t one = 1;
+        ::write(resfd, &one, sizeof(one));
+    }
+}
+
+namespace {
+
+// A single iocb may be split into several bios (one per iovec)
+struct aio_request {
+    aio_request(io_context* c, struct iocb* i, unsigned nr_bios, long r)
+        : ctx(c), cb(i), pending(nr_bios), error(false), res(r) {}
+    io_context* ctx;
+    struct iocb* cb;
+    std::atomic<unsigned> pending;
+    std::atomic<bool> error;
+    long res;
+};
+
+void aio_bio_done(struct bio* bio)
+{
+    auto req = static_cast<aio_request*>(bio->bio_caller1);
+    if (bio->bio_flags & BIO_ERROR) {
+        req->error.store(true, std::memory_order_relaxed);
+    }
+    if (bio->bio_data) {
+        mmu::user_dma_end();
+    }
+    destroy_bio(bio);
+
+    if (req->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        req->ctx->complete(req->cb, req->error.load(std::memory_order_relaxed) ?
+                                    -EIO : req->res);
+        delete req;
+    }
+}
+
+// Return the block device behind the given file, if any, so we can bypass
+// the file system and the buffer cache.
+struct device* aio_bdev(const fileref& f)
+{
+    if (!f->f_dentry) {
+        return nullptr;
+    }
+    auto vp = f->f_dentry->d_vnode;
+    if (vp->v_type != VBLK || !vp->v_data) {
+        return nullptr;
+    }
+    auto dev = static_cast<struct device*>(vp->v_data);
+    if (!dev->driver || !dev->driver->devops->strategy) {
+        return nullptr;
+    }
+    return dev;
+}
+
+int aio_submit_bdev(io_context* ctx, struct iocb* cb, struct device* dev)
+{
+    u8 cmd;
+    struct iovec single;
+    const struct iovec* iov = &single;
+    int iovcnt = 1;
+
+    switch (cb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+    case IO_CMD_PWRITE:
+        cmd = cb->aio_lio_opcode == IO_CMD_PREAD ? BIO_READ : BIO_WRITE;
+        single.iov_base = cb->u.c.buf;
+        single.iov_len = cb->u.c.nbytes;
+        break;
+    case IO_CMD_PREADV:
+    case IO_CMD_PWRITEV:
+        cmd = cb->aio_lio_opcode == IO_CMD_PREADV ? BIO_READ : BIO_WRITE;
+        iov = static_cast<const struct iovec*>(cb->u.c.buf);
+        iovcnt = cb->u.c.nbytes;
+        if (iovcnt < 0 || iovcnt > IOV_MAX) {
+            return EINVAL;
+        }
+        break;
+    case IO_CMD_FSYNC:
+    case IO_CMD_FDSYNC: {
+        auto bio = alloc_bio();
+        if (!bio) {
+            return ENOMEM;
+        }
+        bio->bio_cmd = BIO_FLUSH;
+        bio->bio_dev = dev;
+        bio->bio_caller1 = new aio_request(ctx, cb, 1, 0);
+        bio->bio_done = aio_bio_done;
+        dev->driver->devops->strategy(bio);
+        return 0;
+    }
+    default:
+        return EINVAL;
+    }
+
+    // Like O_DIRECT, the bio path needs sector aligned requests
+    off_t offset = cb->u.c.offset;
+    size_t total = 0;
+    unsigned nr_bios = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len % BSIZE) {
+            return EINVAL;
+        }
+        total += iov[i].iov_len;
+        nr_bios += iov[i].iov_len != 0;
+    }
+    if (offset < 0 || offset % BSIZE || offset + (off_t)total > dev->size) {
+        return EINVAL;
+    }
+
+    if (!nr_bios) {
+        ctx->complete(cb, 0);
+        return 0;
+    }
+
+    // The request may complete before we are done submitting its bios, so
+    // account for all of them upfront
+    auto req = new aio_request(ctx, cb, nr_bios, total);
+    for (int i = 0; i < iovcnt; i++) {
+        if (!iov[i].iov_len) {
+            continue;
+        }
+        auto bio = alloc_bio();
+        assert(bio);
+        bio->bio_cmd = cmd;
+        bio->bio_dev = dev;
+        bio->bio_data = iov[i].iov_base;
+        bio->bio_offset = offset;
+        bio->bio_bcount = iov[i].iov_len;
+        bio->bio_caller1 = req;
+        bio->bio_done = aio_bio_done;
+        offset += iov[i].iov_len;
+
+        // The device accesses the caller's buffer directly
+        mmu::user_dma_begin();
+        dev->driver->devops->strategy(bio);
+    }
+
+    return 0;
+}
+
+int aio_submit_sync(io_context* ctx, struct iocb* cb)
+{
+    long res;
+    int fd = cb->aio_fildes;
+    auto iov = static_cast<const struct iovec*>(cb->u.c.buf);
+
+    switch (cb->aio_lio_opcode) {
+    case IO_CMD_PREAD:
+        res = pread(fd, cb->u.c.buf, cb->u.c.nbytes, cb->u.c.offset);
+        break;
+    case IO_CMD_PWRITE:
+        res = pwrite(fd, cb->u.c.buf, cb->u.c.nbytes, cb->u.c.offset);
+        break;
+    case IO_CMD_PREADV:
+        res = preadv(fd, iov, cb->u.c.nbytes, cb->u.c.offset);
+        break;
+    case IO_CMD_PWRITEV:
+        res = pwritev(fd, iov, cb->u.c.nbytes, cb->u.c.offset);
+        break;
+    case IO_CMD_FSYNC:
+        res = fsync(fd);
+        break;
+    case IO_CMD_FDSYNC:
+        res = fdatasync(fd);
+        break;
+    default:
+        return EINVAL;
+    }
+
+    ctx->complete(cb, res < 0 ? -errno : res);
+    return 0;
+}
+
+}
 
 OSV_LIBAIO_API
 int io_setup(int nr_events, io_context_t *ctxp_idp) {
-    // This is a stub that doesn't actually do anything. If the caller tries
-    // to follow the io_setup() call with any other libaio call, those will
-    // fail.
-    WARN_STUBBED();
-    if (nr_events < 0) {
+    if (nr_events <= 0 || !ctxp_idp) {
         return -EINVAL;
     }
+    auto ctx = new (std::nothrow) io_context(nr_events);
+    if (!ctx) {
+        return -ENOMEM;
+    }
+    *ctxp_idp = ctx;
+    trace_aio_setup(nr_events, ctx);
     return 0;
 }
 
-UNIMPL(OSV_LIBAIO_API int io_submit(io_context_t ctx, long nr, struct iocb *ios[]))
-UNIMPL(OSV_LIBAIO_API int io_getevents(io_context_t ctx_id, long min_nr, long nr,
-        struct io_event *events, struct timespec *timeout))
-UNIMPL(OSV_LIBAIO_API int io_destroy(io_context_t ctx))
-UNIMPL(OSV_LIBAIO_API int io_cancel(io_context_t ctx, struct iocb *iocb, struct io_event *evt))
+OSV_LIBAIO_API
+int io_submit(io_context_t ctx, long nr, struct iocb *ios[])
+{
+    if (!ctx || nr < 0) {
+        return -EINVAL;
+    }
+
+    long i;
+    for (i = 0; i < nr; i++) {
+        struct iocb* cb = ios[i];
+        trace_aio_submit(ctx, cb, cb->aio_fildes, cb->aio_lio_opcode);
+
+        fileref f = fileref_from_fd(cb->aio_fildes);
+        if (!f) {
+            return i ? i : -EBADF;
+        }
+
+        // Never let more requests in than the completion ring can hold
+        WITH_LOCK(ctx->lock) {
+            if (ctx->busy() >= ctx->nr_events) {
+                return i ? i : -EAGAIN;
+            }
+            ctx->inflight++;
+        }
+
+        int error;
+        if (auto dev = aio_bdev(f)) {
+            error = aio_submit_bdev(ctx, cb, dev);
+        } else {
+            error = aio_submit_sync(ctx, cb);
+        }
+
+        if (error) {
+            WITH_LOCK(ctx->lock) {
+                if (!--ctx->inflight) {
+                    ctx->idle.wake_all();
+                }
+            }
+            return i ? i : -error;
+        }
+    }
+
+    return i;
+}
+
+OSV_LIBAIO_API
+int io_getevents(io_context_t ctx, long min_nr, long nr,
+        struct io_event *events, struct timespec *timeout)
+{
+    if (!ctx || min_nr < 0 || nr < min_nr) {
+        return -EINVAL;
+    }
+
+    osv::clock::uptime::time_point deadline;
+    if (timeout) {
+        deadline = osv::clock::uptime::now() +
+                   std::chrono::seconds(timeout->tv_sec) +
+                   std::chrono::nanoseconds(timeout->tv_nsec);
+    }
+
+    int ret = 0;
+    WITH_LOCK(ctx->lock) {
+        while ((long)ctx->count < min_nr) {
+            if (timeout) {
+                if (ctx->events_ready.wait(&ctx->lock, deadline) &&
+                    (long)ctx->count < min_nr) {
+                    break;
+                }
+            } else {
+                ctx->events_ready.wait(&ctx->lock);
+            }
+        }
+
+        while (ret < nr && ctx->count) {
+            events[ret++] = ctx->ring[ctx->head];
+            ctx->head = (ctx->head + 1) % ctx->nr_events;
+            ctx->count--;
+        }
+    }
+
+    trace_aio_getevents(ctx, min_nr, nr, ret);
+    return ret;
+}
+
+OSV_LIBAIO_API
+int io_destroy(io_context_t ctx)
+{
+    if (!ctx) {
+        return -EINVAL;
+    }
+
+    // The bios already handed to the drivers can not be recalled, so wait
+    // for them before tearing the context down
+    WITH_LOCK(ctx->lock) {
+        while (ctx->inflight) {
+            ctx->idle.wait(&ctx->lock);
+        }
+    }
+
+    delete ctx;
+    return 0;
+}
+
+OSV_LIBAIO_API
+int io_cancel(io_context_t ctx, struct iocb *iocb, struct io_event *evt)
+{
+    if (!ctx || !iocb || !evt) {
+        return -EINVAL;
+    }
+    // Requests are either completed synchronously or already owned by the
+    // device, so there is never anything left to cancel
+    return -EAGAIN;
+}
@@ -66,6 +66,8 @@ TRACEPOINT(trace_memory_page_free, "page=%p", void*);
 TRACEPOINT(trace_memory_huge_failure, "page ranges=%d", unsigned long);
 TRACEPOINT(trace_memory_reclaim, "shrinker %s, target=%d, delta=%d", const char *, long, long);
 TRACEPOINT(trace_memory_wait, "allocation size=%d", size_t);
+TRACEPOINT(trace_memory_range_cache_refill, "size=%d, nr=%d", size_t, unsigned);
+TRACEPOINT(trace_memory_range_cache_drain, "bytes=%d", size_t);
 
 namespace dbg {
 
@@ -895,6 +897,273 @@ namespace stats {
     }
 }
 
+// Per-CPU cache of page ranges
+//
+// Every malloc_large() and alloc_huge_page() would otherwise take
+// free_page_ranges_lock twice (allocation and free), which serializes CPUs
+// that allocate or populate large buffers concurrently. Each CPU keeps a
+// few free ranges of a fixed set of size classes, four per power of two
+// from 2 pages up to a huge page, and moves them to and from
+// free_page_ranges in batches. Naturally aligned huge pages, as needed by
+// alloc_huge_page(), have their own bucket.
+//
+// Like the L1 page pool, the cache is only accessed with preemption
+// disabled and the ranges it holds count as allocated memory. It is
+// bypassed when memory is low, and the reclaimer drains it before asking
+// the shrinkers for memory.
+class range_cache {
+public:
+    static constexpr size_t min_pages = 2;
+    static constexpr size_t max_pages = mmu::huge_page_size / page_size;
+    static constexpr unsigned nr_classes =
+        7 + (ilog2_roundup_constexpr(max_pages) - 3) * 4;
+    static constexpr unsigned huge_bucket = nr_classes;
+    static constexpr unsigned max_batch = 8;
+
+    static page_range* alloc(size_t size);
+    static bool free(page_range* pr);
+    static void* alloc_huge();
+    static bool free_huge(void* v);
+    static void drain_all();
+    static void set_max_bytes(size_t max) { _max_bytes = max; }
+    static void get_stats(unsigned cpu_id, stats::range_cache_stats& stats);
+
+private:
+    static bool enabled() {
+        return smp_allocator && _max_bytes && stats::free() >= watermark_lo;
+    }
+    // Size classes are every page count up to 8 pages, then four evenly
+    // spaced steps per power of two: 10, 12, 14, 16, 20, 24, ...
+    static unsigned class_of(size_t pages) {
+        if (pages <= 8) {
+            return pages - min_pages;
+        }
+        auto order = ilog2(pages - 1);
+        auto step = (pages - 1) >> (order - 2);
+        return 7 + (order - 3) * 4 + (step - 4);
+    }
+    static size_t class_size(unsigned c) {
+        if (c == huge_bucket) {
+            return mmu::huge_page_size;
+        }
+        if (c < 7) {
+            return (c + min_pages) * page_size;
+        }
+        auto order = 3 + (c - 7) / 4;
+        auto step = 4 + (c - 7) % 4;
+        return ((step + 1) << (order - 2)) * page_size;
+    }
+    // Move a batch of ranges worth about 1/8 of the cache at a time
+    static unsigned batch_size(unsigned c) {
+        return std::max<size_t>(1, std::min<size_t>(max_batch,
+                                    _max_bytes / 8 / class_size(c)));
+    }
+    static page_range* pop(unsigned c);
+    static bool push(unsigned c, page_range* pr);
+    static page_range* refill(unsigned c);
+    static void release(page_range** ranges, unsigned n);
+
+    page_range* _ranges[nr_classes + 1][2 * max_batch];
+    unsigned _nr[nr_classes + 1];
+    size_t _bytes;
+    size_t _hits;
+    size_t _misses;
+
+    static size_t _max_bytes;
+};
+
+size_t range_cache::_max_bytes;
+PERCPU(range_cache, percpu_range_cache);
+
+page_range* range_cache::alloc(size_t size)
+{
+    auto pages = size / page_size;
+    if (pages < min_pages || pages > max_pages || !enabled()) {
+        return nullptr;
+    }
+    return pop(class_of(pages));
+}
+
+bool range_cache::free(page_range* pr)
+{
+    auto pages = pr->size / page_size;
+    if (pages < min_pages || pages > max_pages || !enabled()) {
+        return false;
+    }
+    auto c = class_of(pages);
+    if (class_size(c) != pr->size) {
+        return false;
+    }
+    return push(c, pr);
+}
+
+void* range_cache::alloc_huge()
+{
+    if (!enabled()) {
+        return nullptr;
+    }
+    return pop(huge_bucket);
+}
+
+bool range_cache::free_huge(void* v)
+{
+    if (!enabled()) {
+        return false;
+    }
+    return push(huge_bucket, new (v) page_range(mmu::huge_page_size));
+}
+
+page_range* range_cache::pop(unsigned c)
+{
+#if CONF_lazy_stack
+    arch::ensure_next_stack_page();
+#endif
+    WITH_LOCK(preempt_lock) {
+        auto& rc = *percpu_range_cache;
+        if (rc._nr[c]) {
+            rc._hits++;
+            rc._bytes -= class_size(c);
+            return rc._ranges[c][--rc._nr[c]];
+        }
+        rc._misses++;
+    }
+    return refill(c);
+}
+
+bool range_cache::push(unsigned c, page_range* pr)
+{
+    auto size = class_size(c);
+    page_range* victims[max_batch + 1];
+    unsigned n = 0;
+#if CONF_lazy_stack
+    arch::ensure_next_stack_page();
+#endif
+    WITH_LOCK(preempt_lock) {
+        auto& rc = *percpu_range_cache;
+        if (rc._nr[c] == 2 * max_batch || rc._bytes + size > _max_bytes) {
+            // Give back the coldest ranges of this class
+            n = std::min(batch_size(c), rc._nr[c]);
+            std::copy(rc._ranges[c], rc._ranges[c] + n, victims);
+            std::copy(rc._ranges[c] + n, rc._ranges[c] + rc._nr[c],
+                      rc._ranges[c]);
+            rc._nr[c] -= n;
+            rc._bytes -= n * size;
+        }
+        if (rc._bytes + size <= _max_bytes) {
+            rc._ranges[c][rc._nr[c]++] = pr;
+            rc._bytes += size;
+            pr = nullptr;
+        }
+    }
+    if (pr) {
+        victims[n++] = pr;
+    }
+    if (n) {
+        release(victims, n);
+    }
+    return true;
+}
+
+page_range* range_cache::refill(unsigned c)
+{
+    auto size = class_size(c);
+    auto batch = batch_size(c);
+    page_range* ranges[max_batch];
+    unsigned n = 0;
+    WITH_LOCK(free_page_ranges_lock) {
+        for (; n < batch; n++) {
+            if (c == huge_bucket) {
+                ranges[n] = free_page_ranges.alloc_aligned(size, 0, size, true);
+            } else {
+                ranges[n] = free_page_ranges.alloc(size);
+            }
+            if (!ranges[n]) {
+                break;
+            }
+        }
+        if (n) {
+            on_alloc(n * size);
+        }
+    }
+    trace_memory_range_cache_refill(size, n);
+    if (!n) {
+        return nullptr;
+    }
+
+    // Keep the first range for the caller and stash the rest in whichever
+    // CPU we are running on now, we might have migrated while waiting for
+    // the lock.
+#if CONF_lazy_stack
+    arch::ensure_next_stack_page();
+#endif
+    WITH_LOCK(preempt_lock) {
+        auto& rc = *percpu_range_cache;
+        while (n > 1 && rc._nr[c] < 2 * max_batch &&
+               rc._bytes + size <= _max_bytes) {
+            rc._ranges[c][rc._nr[c]++] = ranges[--n];
+            rc._bytes += size;
+        }
+    }
+    if (n > 1) {
+        release(ranges + 1, n - 1);
+    }
+    return ranges[0];
+}
+
+void range_cache::release(page_range** ranges, unsigned n)
+{
+    WITH_LOCK(free_page_ranges_lock) {
+        for (unsigned i = 0; i < n; i++) {
+            on_free(ranges[i]->size);
+            free_page_ranges.free(ranges[i]);
+        }
+    }
+}
+
+// Return the content of all the per-CPU caches to free_page_ranges, so it
+// can be coalesced and used to satisfy waiters. We have to run on each CPU
+// in turn to access its cache.
+void range_cache::drain_all()
+{
+    size_t drained = 0;
+    for (auto cpu : sched::cpus) {
+        sched::thread::pin(cpu);
+        for (unsigned c = 0; c <= huge_bucket; c++) {
+            page_range* ranges[2 * max_batch];
+            unsigned n = 0;
+            WITH_LOCK(preempt_lock) {
+                auto& rc = *percpu_range_cache;
+                n = rc._nr[c];
+                std::copy(rc._ranges[c], rc._ranges[c] + n, ranges);
+                rc._nr[c] = 0;
+                rc._bytes -= n * class_size(c);
+            }
+            if (n) {
+                release(ranges, n);
+                drained += n * class_size(c);
+            }
+        }
+    }
+    sched::thread::current()->unpin();
+    trace_memory_range_cache_drain(drained);
+}
+
+void range_cache::get_stats(unsigned cpu_id, stats::range_cache_stats& stats)
+{
+    auto& rc = *percpu_range_cache.for_cpu(sched::cpus[cpu_id]);
+    stats._max_bytes = _max_bytes;
+    stats._bytes = rc._bytes;
+    stats._hits = rc._hits;
+    stats._misses = rc._misses;
+}
+
+namespace stats {
+    void get_range_cache_stats(unsigned int cpu_id, range_cache_stats &stats)
+    {
+        range_cache::get_stats(cpu_id, stats);
+    }
+}
+
 static void* mapped_malloc_large(size_t size, size_t offset)
 {
     //TODO: For now pre-populate the memory, in future consider doing lazy population
@@ -931,6 +1200,16 @@ static void* malloc_large(size_t size, size_t alignment, bool block = true, bool
         return obj;
     }
 
+    if (alignment <= page_size) {
+        if (auto ret_header = range_cache::alloc(size)) {
+            void* obj = ret_header;
+            obj += offset;
+            trace_memory_malloc_large(obj, requested_size, ret_header->size,
+                                      alignment);
+            return obj;
+        }
+    }
+
     while (true) {
         WITH_LOCK(free_page_ranges_lock) {
             reclaimer_thread.wait_for_minimum_memory();
@@ -1135,6 +1414,10 @@ void reclaimer::_do_reclaim()
         }
 #endif
 
+        // Memory sitting in the per-CPU range caches is the cheapest to get
+        // back, and can coalesce with its neighbours once returned
+        range_cache::drain_all();
+
         _shrinker_loop(target, [this] { return _oom_blocked.has_waiters(); });
 
         WITH_LOCK(free_page_ranges_lock) {
@@ -1181,7 +1464,10 @@ static void free_page_range(void *addr, size_t size)
 static void free_large(void* obj)
 {
     obj = align_down(obj - 1, page_size);
-    free_page_range(static_cast<page_range*>(obj));
+    auto pr = static_cast<page_range*>(obj);
+    if (!range_cache::free(pr)) {
+        free_page_range(pr);
+    }
 }
 
 static size_t large_object_offset(void *&obj)
@@ -1387,6 +1673,10 @@ static sched::cpu::notifier _notifier([] () {
     *percpu_l1 = new l1(sched::cpu::current());
     if (++l1_initialized_cnt == sched::cpus.size()) {
         l1_pool_stats.resize(sched::cpus.size());
+        // Let the per-CPU range caches hold up to 1/64 of the memory in
+        // total, but no more than 8MB each
+        range_cache::set_max_bytes(std::min<size_t>(8 << 20,
+            stats::total() / 64 / sched::cpus.size()));
     }
     // N per-cpu threads for L1 page pool, 1 thread for L2 page pool
     // Switch to smp_allocator only when all the N + 1 threads are ready
@@ -1795,6 +2085,11 @@ void free_page(void* v)
  */
 void* alloc_huge_page(size_t N)
 {
+    if (N == mmu::huge_page_size) {
+        if (auto v = range_cache::alloc_huge()) {
+            return v;
+        }
+    }
     WITH_LOCK(free_page_ranges_lock) {
         auto pr = free_page_ranges.alloc_aligned(N, 0, N, true);
         if (pr) {
@@ -1816,6 +2111,9 @@ void* alloc_huge_page(size_t N)
 
 void free_huge_page(void* v, size_t N)
 {
+    if (N == mmu::huge_page_size && range_cache::free_huge(v)) {
+        return;
+    }
     free_page_range(v, N);
 }
 
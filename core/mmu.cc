@@ -125,6 +125,18 @@ rwlock_t vma_list_mutex;
 // (linear map, etc.) which are not part of vma_list.
 mutex page_table_high_mutex;
 
+// Held for read while a device transfers data directly to or from
+// application memory, see user_dma_begin(). The huge page collapse thread
+// must not move such pages.
+rwlock_t user_dma_lock;
+
+// Transparent huge page statistics, reported in /proc/vmstat
+static std::atomic<ulong> thp_collapse_alloc;
+static std::atomic<ulong> thp_collapse_alloc_failed;
+static std::atomic<ulong> thp_collapse_inplace;
+static std::atomic<ulong> thp_collapse_full_scans;
+static std::atomic<ulong> thp_split_pmd;
+
 // 1's for the bits provided by the pte for this level
 // 0's for the bits provided by the virtual address for this level
 phys pte_level_mask(unsigned level)
@@ -273,6 +285,7 @@ void split_large_page(hw_ptep<1> ptep)
     pt_element<1> pte_orig = ptep.read();
     pte_orig.set_large(false);
     allocate_intermediate_level(ptep, pte_orig);
+    thp_split_pmd.fetch_add(1, std::memory_order_relaxed);
 }
 
 struct page_allocator {
@@ -640,6 +653,85 @@ public:
     unsigned nr_page_sizes(void) { return 1; }
 };
 
+/*
+ * Replace a page table full of small pages by a single huge page, provided
+ * that all of them are present with the same permissions. If the small pages
+ * happen to be an aligned, physically contiguous run, as is the case for a
+ * huge page that was split earlier, the run is mapped as is. Otherwise their
+ * content is copied into the huge page given by the caller and the small
+ * pages are freed. operate_range() returns the kind of collapse done, or
+ * with dry_run set, the kind that would be done.
+ *
+ * The caller must hold vma_list_mutex for write: once the page table is
+ * unhooked, any access to the range faults and waits for the lock, so the
+ * small pages can not change while we copy them.
+ */
+class collapse_huge_page : public page_table_operation<allocate_intermediate_opt::no, skip_empty_opt::yes, descend_opt::no> {
+public:
+    enum class result : ulong { none, copy, inplace };
+    collapse_huge_page(void* huge, bool dry_run) : _huge(huge), _dry_run(dry_run) {}
+    template<int N>
+    bool page(hw_ptep<N> ptep, uintptr_t offset) {
+        return true;
+    }
+    bool page(hw_ptep<1> ptep, uintptr_t offset) {
+        auto pte = ptep.read();
+        if (pte.large()) {
+            return true;
+        }
+        auto pt = hw_ptep<0>::force(phys_cast<pt_element<0>>(pte.next_pt_addr()));
+        auto first = pt.at(0).read();
+        bool contiguous = !(first.addr() & (huge_page_size - 1));
+        for (unsigned i = 0; i < pte_per_page; i++) {
+            auto small = pt.at(i).read();
+            // A PROT_NONE page is valid but has the reserved bit set
+            if (!small.valid() || small.rsvd_bit(0) || pte_is_cow(small) ||
+                small.writable() != first.writable() ||
+                small.executable() != first.executable()) {
+                return true;
+            }
+            contiguous &= small.addr() == first.addr() + i * page_size;
+        }
+        if (_dry_run) {
+            _result = contiguous ? result::inplace : result::copy;
+            return true;
+        }
+        if (!contiguous && !_huge) {
+            return true;
+        }
+
+        unsigned perm = perm_read |
+            (first.writable() ? perm_write : 0) |
+            (first.executable() ? perm_exec : 0);
+        ptep.write(make_empty_pte<1>());
+        mmu::flush_tlb_all();
+        void* huge = contiguous ? phys_to_virt(first.addr()) : _huge;
+        if (!contiguous) {
+            for (unsigned i = 0; i < pte_per_page; i++) {
+                memcpy(huge + i * page_size,
+                       phys_to_virt(pt.at(i).read().addr()), page_size);
+            }
+        }
+        ptep.write(make_leaf_pte(ptep, virt_to_phys(huge), perm));
+        if (!contiguous) {
+            for (unsigned i = 0; i < pte_per_page; i++) {
+                memory::free_page(phys_to_virt(pt.at(i).read().addr()));
+            }
+            _huge = nullptr;
+        }
+        osv::rcu_defer([](void *page) { memory::free_page(page); }, phys_to_virt(pte.next_pt_addr()));
+        _result = contiguous ? result::inplace : result::copy;
+        return true;
+    }
+    bool tlb_flush_needed() { return false; }
+    void finalize() {}
+    ulong account_results() { return static_cast<ulong>(_result); }
+private:
+    void* _huge;
+    bool _dry_run;
+    result _result = result::none;
+};
+
 struct tlb_gather {
     static constexpr size_t max_pages = 20;
     struct tlb_page {
@@ -1353,7 +1445,11 @@ void* map_file(const void* addr, size_t size, unsigned flags, unsigned perm,
     WITH_LOCK(vma_list_mutex.for_write()) {
         v = (void*) allocate(vma, start, size, search);
         if (flags & mmap_populate) {
-            populate_vma(vma, v, std::min(size, align_up(::size(f), page_size)));
+            try {
+                populate_vma(vma, v, std::min(size, align_up(::size(f), page_size)));
+            } catch (error&) {
+                // Like on Linux, left to the page faults to report
+            }
         }
     }
     return v;
@@ -1856,8 +1952,13 @@ void file_vma::fault(uintptr_t addr, exception_frame *ef)
         size = page_size;
     }
 
-    populate_vma<account_opt::no>(this, (void*)addr, size,
-            mmu::is_page_fault_write(ef->get_error()));
+    try {
+        populate_vma<account_opt::no>(this, (void*)addr, size,
+                mmu::is_page_fault_write(ef->get_error()));
+    } catch (error&) {
+        // The file system could not provide the page
+        vm_sigbus(addr, ef);
+    }
 }
 
 file_vma::~file_vma()
@@ -2103,6 +2204,229 @@ error mincore(const void *addr, size_t length, unsigned char *vec)
     return no_error();
 }
 
+void user_dma_begin()
+{
+    user_dma_lock.rlock();
+}
+
+void user_dma_end()
+{
+    user_dma_lock.runlock();
+}
+
+TRACEPOINT(trace_mmu_thp_collapse, "addr=%p, inplace=%d", void*, bool);
+TRACEPOINT(trace_mmu_thp_scan, "windows=%u, candidates=%u, collapsed=%u", unsigned, unsigned, unsigned);
+
+// vma::fault() maps a huge page only when the whole aligned window lies
+// within a vma that allows it. Windows that were split later (mprotect(),
+// partial munmap() or madvise()) or that straddle vmas, like those of a JVM
+// heap committed piece by piece, would otherwise stay mapped by small pages
+// forever. This thread periodically scans anonymous memory for aligned
+// windows whose small pages are all present, and replaces them by a huge
+// page.
+class thp_collapser {
+public:
+    void start() {
+        _thread = sched::thread::make([this] { run(); },
+            sched::thread::attr().name("thp-collapse"));
+        _thread->start();
+    }
+    unsigned pass();
+private:
+    struct candidate {
+        uintptr_t addr;
+        bool inplace;
+    };
+    static constexpr unsigned scan_interval_s = 10;
+    static constexpr unsigned max_windows_per_pass = 4096;
+    static constexpr unsigned max_collapses_per_pass = 64;
+
+    // While a window is collapsed its pages are briefly not mapped, and a
+    // copying collapse moves them. Only memory the application mapped with
+    // mmap() is touched: kernel code may access the rest, like malloc()'s
+    // large allocations or thread stacks, with preemption disabled or hand it
+    // to a device. Populated mappings were asked to stay resident, so they
+    // are left alone too.
+    static bool collapsible(vma& v) {
+        return (v.page_ops() == page_allocator_initp ||
+                v.page_ops() == page_allocator_noinitp) &&
+               (v.perm() & perm_read) && v.has_flags(mmap_user) &&
+               !v.has_flags(mmap_small | mmap_shared | mmap_stack |
+                            mmap_populate | mmap_jvm_balloon);
+    }
+    void run();
+    unsigned scan(std::vector<candidate>& candidates);
+    bool collapse(const candidate& c);
+
+    mutex _mutex;
+    uintptr_t _cursor = 0;
+    std::vector<candidate> _candidates;
+    std::unique_ptr<sched::thread> _thread;
+};
+
+constexpr unsigned thp_collapser::scan_interval_s;
+constexpr unsigned thp_collapser::max_windows_per_pass;
+constexpr unsigned thp_collapser::max_collapses_per_pass;
+
+void thp_collapser::run()
+{
+    while (true) {
+        sched::thread::sleep(std::chrono::seconds(scan_interval_s));
+        pass();
+    }
+}
+
+unsigned thp_collapser::pass()
+{
+    SCOPE_LOCK(_mutex);
+    _candidates.clear();
+    auto windows = scan(_candidates);
+    unsigned collapsed = 0;
+    for (auto& c : _candidates) {
+        collapsed += collapse(c);
+    }
+    trace_mmu_thp_scan(windows, _candidates.size(), collapsed);
+    return collapsed;
+}
+
+// Look for collapsible windows from where the previous pass stopped, in runs
+// of adjacent vmas with the same permissions. Only the page tables are read
+// here, so faults can proceed concurrently.
+unsigned thp_collapser::scan(std::vector<candidate>& candidates)
+{
+    unsigned windows = 0;
+    WITH_LOCK(vma_list_mutex.for_read()) {
+        auto i = vma_list.lower_bound(_cursor, addr_compare());
+        if (i != vma_list.begin() && std::prev(i)->end() > _cursor) {
+            --i;
+        }
+        while (i != vma_list.end() && windows < max_windows_per_pass &&
+               candidates.size() < max_collapses_per_pass) {
+            if (!collapsible(*i)) {
+                ++i;
+                continue;
+            }
+            auto run_start = std::max(i->start(), _cursor);
+            auto run_end = i->end();
+            auto next = std::next(i);
+            while (next != vma_list.end() && next->start() == run_end &&
+                   collapsible(*next) && next->perm() == i->perm()) {
+                run_end = next->end();
+                ++next;
+            }
+            auto addr = align_up(run_start, huge_page_size);
+            for (; addr + huge_page_size <= run_end; addr += huge_page_size) {
+                if (windows == max_windows_per_pass ||
+                    candidates.size() == max_collapses_per_pass) {
+                    break;
+                }
+                windows++;
+                auto r = static_cast<collapse_huge_page::result>(
+                    operate_range(collapse_huge_page(nullptr, true),
+                                  reinterpret_cast<void*>(addr), huge_page_size));
+                if (r != collapse_huge_page::result::none) {
+                    candidates.push_back({addr, r == collapse_huge_page::result::inplace});
+                }
+            }
+            if (addr + huge_page_size <= run_end) {
+                // Out of budget in the middle of the run, resume there
+                _cursor = addr;
+                return windows;
+            }
+            _cursor = run_end;
+            i = next;
+        }
+        if (i == vma_list.end()) {
+            _cursor = 0;
+            thp_collapse_full_scans.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return windows;
+}
+
+bool thp_collapser::collapse(const candidate& c)
+{
+    // Allocate before taking vma_list_mutex, we can not afford waiting for
+    // memory while page faults are blocked
+    void* huge = nullptr;
+    if (!c.inplace) {
+        huge = memory::alloc_huge_page(huge_page_size);
+        if (!huge) {
+            thp_collapse_alloc_failed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    auto r = collapse_huge_page::result::none;
+    PREVENT_STACK_PAGE_FAULT
+    WITH_LOCK(vma_list_mutex.for_write()) {
+        // The vmas may have changed since the scan
+        auto range = find_intersecting_vmas(addr_range(c.addr, c.addr + huge_page_size));
+        auto covered = c.addr;
+        for (auto i = range.first; i != range.second; ++i) {
+            if (i->start() > covered || !collapsible(*i) ||
+                i->perm() != range.first->perm()) {
+                break;
+            }
+            covered = i->end();
+        }
+        // Moving pages a device is transferring data to or from would lose
+        // that data, so leave them alone for now if there is any such
+        // transfer in flight.
+        if (covered >= c.addr + huge_page_size &&
+            (c.inplace || user_dma_lock.try_wlock())) {
+            r = static_cast<collapse_huge_page::result>(
+                operate_range(collapse_huge_page(huge, false),
+                              reinterpret_cast<void*>(c.addr), huge_page_size));
+            if (!c.inplace) {
+                user_dma_lock.wunlock();
+            }
+        }
+    }
+
+    if (r == collapse_huge_page::result::copy) {
+        thp_collapse_alloc.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        if (huge) {
+            memory::free_huge_page(huge, huge_page_size);
+        }
+        if (r == collapse_huge_page::result::inplace) {
+            thp_collapse_inplace.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (r != collapse_huge_page::result::none) {
+        trace_mmu_thp_collapse(reinterpret_cast<void*>(c.addr),
+                               r == collapse_huge_page::result::inplace);
+    }
+    return r != collapse_huge_page::result::none;
+}
+
+static thp_collapser s_thp_collapser;
+
+void start_thp_collapse()
+{
+    s_thp_collapser.start();
+}
+
+unsigned thp_collapse_pass()
+{
+    return s_thp_collapser.pass();
+}
+
+std::string procfs_vmstat()
+{
+    return osv::sprintf("thp_collapse_alloc %lu\n"
+                        "thp_collapse_alloc_failed %lu\n"
+                        "thp_collapse_inplace %lu\n"
+                        "thp_collapse_full_scans %lu\n"
+                        "thp_split_pmd %lu\n",
+                        thp_collapse_alloc.load(std::memory_order_relaxed),
+                        thp_collapse_alloc_failed.load(std::memory_order_relaxed),
+                        thp_collapse_inplace.load(std::memory_order_relaxed),
+                        thp_collapse_full_scans.load(std::memory_order_relaxed),
+                        thp_split_pmd.load(std::memory_order_relaxed));
+}
+
 std::string procfs_maps()
 {
     std::string output;
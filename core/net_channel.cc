@@ -12,6 +12,7 @@
 #include <bsd/sys/netinet/ip.h>
 #include <bsd/sys/netinet/ip.h>
 #include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/udp.h>
 #include <bsd/sys/net/ethernet.h>
 #include <bsd/sys/net/netisr.h>
 
@@ -22,6 +23,14 @@
 #include <osv/kernel_config_lazy_stack_invariant.h>
 #include <osv/kernel_config_core_epoll.h>
 
+net_channel::~net_channel()
+{
+    mbuf* m;
+    while (_queue.pop(m)) {
+        m_freem(m);
+    }
+}
+
 void net_channel::process_queue()
 {
     mbuf* m;
@@ -47,8 +56,14 @@ void net_channel::wake_pollers()
 #if CONF_core_epoll
         // can't call epoll_wake from rcu, so copy the data
         if (!_epollers.empty()) {
+            // see file::wake_epoll() about EPOLLEXCLUSIVE
+            bool woke_exclusive = false;
             _epollers.reader_for_each([&] (const epoll_ptr& ep) {
-                epoll_wake_in_rcu(ep);
+                if (!ep.exclusive) {
+                    epoll_wake_in_rcu(ep);
+                } else if (!woke_exclusive) {
+                    woke_exclusive = epoll_wake_in_rcu(ep);
+                }
             });
         }
 #endif
@@ -106,24 +121,89 @@ void net_channel::del_epoll(const epoll_ptr& ep)
 #endif
 }
 
+void net_channel::add_file_pollers(file* fp)
+{
+    WITH_LOCK(fp->f_lock) {
+        for (auto&& pl : fp->f_poll_list) {
+            add_poller(*pl._req);
+        }
+        if (fp->f_epolls) {
+            for (auto&& ep : *fp->f_epolls) {
+                add_epoll(ep);
+            }
+        }
+    }
+}
+
+void net_channel::del_file_pollers(file* fp)
+{
+    for (auto&& pl : fp->f_poll_list) {
+        del_poller(*pl._req);
+    }
+}
+
 classifier::classifier()
 {
 }
 
+// must be called with _mtx held
+bool classifier::add(ipv4_tcp_channels& channels, ipv4_tcp_conn_id id, net_channel* channel)
+{
+    if (channels.owner_find(id, std::hash<ipv4_tcp_conn_id>(), key_item_compare())) {
+        return false;
+    }
+    channels.emplace(id, channel);
+    return true;
+}
+
+// must be called with _mtx held
+void classifier::remove(ipv4_tcp_channels& channels, ipv4_tcp_conn_id id)
+{
+    auto i = channels.owner_find(id,
+            std::hash<ipv4_tcp_conn_id>(), key_item_compare());
+    assert(i);
+    channels.erase(i);
+}
+
 void classifier::add(ipv4_tcp_conn_id id, net_channel* channel)
 {
     WITH_LOCK(_mtx) {
-        _ipv4_tcp_channels.emplace(id, channel);
+        add(_ipv4_tcp_channels, id, channel);
     }
 }
 
 void classifier::remove(ipv4_tcp_conn_id id)
 {
     WITH_LOCK(_mtx) {
-        auto i = _ipv4_tcp_channels.owner_find(id,
-                std::hash<ipv4_tcp_conn_id>(), key_item_compare());
-        assert(i);
-        _ipv4_tcp_channels.erase(i);
+        remove(_ipv4_tcp_channels, id);
+    }
+}
+
+bool classifier::add_udp(ipv4_udp_conn_id id, net_channel* channel)
+{
+    WITH_LOCK(_mtx) {
+        return add(_ipv4_udp_channels, id, channel);
+    }
+}
+
+void classifier::remove_udp(ipv4_udp_conn_id id)
+{
+    WITH_LOCK(_mtx) {
+        remove(_ipv4_udp_channels, id);
+    }
+}
+
+bool classifier::add_listener(ipv4_tcp_conn_id id, net_channel* channel)
+{
+    WITH_LOCK(_mtx) {
+        return add(_ipv4_tcp_listeners, id, channel);
+    }
+}
+
+void classifier::remove_listener(ipv4_tcp_conn_id id)
+{
+    WITH_LOCK(_mtx) {
+        remove(_ipv4_tcp_listeners, id);
     }
 }
 
@@ -133,7 +213,7 @@ bool classifier::post_packet(mbuf* m)
     assert(!sched::thread::current()->is_app());
 #endif
     WITH_LOCK(osv::rcu_read_lock) {
-        if (auto nc = classify_ipv4_tcp(m)) {
+        if (auto nc = classify_ipv4(m)) {
             log_packet_in(m, NETISR_ETHER);
             if (!nc->push(m)) {
                 return false;
@@ -147,10 +227,32 @@ bool classifier::post_packet(mbuf* m)
 }
 
 // must be called with rcu lock held
-net_channel* classifier::classify_ipv4_tcp(mbuf* m)
+net_channel* classifier::find(ipv4_tcp_channels& channels, ipv4_tcp_conn_id id)
+{
+    auto i = channels.reader_find(id,
+            std::hash<ipv4_tcp_conn_id>(), key_item_compare());
+    if (!i) {
+        return nullptr;
+    }
+    return i->chan;
+}
+
+// must be called with rcu lock held
+net_channel* classifier::find_bound(ipv4_tcp_channels& channels, in_addr addr, in_port_t port)
+{
+    in_addr any{INADDR_ANY};
+    if (auto nc = find(channels, {any, addr, 0, port})) {
+        return nc;
+    }
+    return find(channels, {any, any, 0, port});
+}
+
+// must be called with rcu lock held
+net_channel* classifier::classify_ipv4(mbuf* m)
 {
     caddr_t h = m->m_hdr.mh_data;
-    if (unsigned(m->m_hdr.mh_len) < ETHER_HDR_LEN + sizeof(ip)) {
+    unsigned len = m->m_hdr.mh_len;
+    if (len < ETHER_HDR_LEN + sizeof(ip)) {
         return nullptr;
     }
     auto ether_hdr = reinterpret_cast<ether_header*>(h);
@@ -163,7 +265,7 @@ net_channel* classifier::classify_ipv4_tcp(mbuf* m)
     if (ip_size < sizeof(ip)) {
         return nullptr;
     }
-    if (ip_hdr->ip_p != IPPROTO_TCP) {
+    if (ip_hdr->ip_p != IPPROTO_TCP && ip_hdr->ip_p != IPPROTO_UDP) {
         return nullptr;
     }
     if (ntohs(ip_hdr->ip_off) & ~IP_DF) {
@@ -171,18 +273,45 @@ net_channel* classifier::classify_ipv4_tcp(mbuf* m)
     }
     auto src_addr = ip_hdr->ip_src;
     auto dst_addr = ip_hdr->ip_dst;
+    // Broadcasts and multicasts may have to go to several sockets, which
+    // only the stack knows about
+    bool unicast = !(ether_hdr->ether_dhost[0] & 1)
+        && !IN_MULTICAST(ntohl(dst_addr.s_addr))
+        && dst_addr.s_addr != INADDR_BROADCAST;
     h += ip_size;
-    auto tcp_hdr = reinterpret_cast<tcphdr*>(h);
-    if (tcp_hdr->th_flags & (TH_SYN | TH_FIN | TH_RST)) {
-	    return nullptr;
+    if (ip_hdr->ip_p == IPPROTO_UDP) {
+        if (_ipv4_udp_channels.empty() || !unicast
+            || len < ETHER_HDR_LEN + ip_size + sizeof(udphdr)) {
+            return nullptr;
+        }
+        auto udp_hdr = reinterpret_cast<udphdr*>(h);
+        auto src_port = ntohs(udp_hdr->uh_sport);
+        auto dst_port = ntohs(udp_hdr->uh_dport);
+        if (auto nc = find(_ipv4_udp_channels,
+                {src_addr, dst_addr, src_port, dst_port})) {
+            return nc;
+        }
+        return find_bound(_ipv4_udp_channels, dst_addr, dst_port);
     }
+    auto tcp_hdr = reinterpret_cast<tcphdr*>(h);
+    auto flags = tcp_hdr->th_flags;
     auto src_port = ntohs(tcp_hdr->th_sport);
     auto dst_port = ntohs(tcp_hdr->th_dport);
-    auto id = ipv4_tcp_conn_id{src_addr, dst_addr, src_port, dst_port};
-    auto i = _ipv4_tcp_channels.reader_find(id,
-            std::hash<ipv4_tcp_conn_id>(), key_item_compare());
-    if (!i) {
-        return nullptr;
+    if ((flags & (TH_SYN | TH_ACK | TH_FIN | TH_RST)) == TH_SYN) {
+        // A connection request: let the application thread listening for
+        // it run the handshake, as long as one is polling and will notice
+        if (_ipv4_tcp_listeners.empty() || !unicast
+            || len < ETHER_HDR_LEN + ip_size + sizeof(tcphdr)) {
+            return nullptr;
+        }
+        auto nc = find_bound(_ipv4_tcp_listeners, dst_addr, dst_port);
+        if (!nc || !nc->has_pollers()) {
+            return nullptr;
+        }
+        return nc;
     }
-    return i->chan;
+    if (flags & (TH_SYN | TH_FIN | TH_RST)) {
+	    return nullptr;
+    }
+    return find(_ipv4_tcp_channels, {src_addr, dst_addr, src_port, dst_port});
 }
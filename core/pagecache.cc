@@ -98,6 +98,7 @@ protected:
     void* _page;
     typedef boost::variant<std::nullptr_t, mmu::hw_ptep<0>, std::unique_ptr<std::unordered_set<mmu::hw_ptep<0>>>> ptep_list;
     ptep_list _ptes; // set of pointers to ptes that map the page
+    bool _writable = false; // page belongs to the file, shared mappings may write to it
 
     template<typename T>
     class ptes_visitor : public boost::static_visitor<T> {
@@ -204,6 +205,12 @@ public:
     const hashkey& key() {
         return _key;
     }
+    void set_writable() {
+        _writable = true;
+    }
+    bool writable() {
+        return _writable;
+    }
 };
 
 class cached_page_write : public cached_page {
@@ -458,16 +465,37 @@ void map_arc_buf(hashkey *key, arc_buf_t* ab, void *page)
     (*arc_share_buf_fun)(ab);
 }
 
-void map_read_cached_page(hashkey *key, void *page)
+void map_read_cached_page(hashkey *key, void *page, bool writable)
 {
     SCOPE_LOCK(read_lock);
     cached_page* pc = new cached_page(*key, page);
-    read_cache.emplace(*key, pc);
+    if (writable) {
+        pc->set_writable();
+    }
+    if (!read_cache.emplace(*key, pc).second) {
+        // another thread faulting on the same page was faster
+        delete pc;
+    }
+}
+
+void unmap_read_cached_page(hashkey *key)
+{
+    SCOPE_LOCK(read_lock);
+    cached_page* cp = find_in_cache(read_cache, *key);
+    if (cp && drop_read_cached_page(read_cache, cp, false)) {
+        mmu::flush_tlb_all();
+    }
 }
 
+// Throws the error of the file system, which file_vma::fault() turns into a
+// SIGBUS for the faulting thread
 static int create_read_cached_page(vfs_file* fp, hashkey& key)
 {
-    return fp->read_page_from_cache(&key, key.offset);
+    int ret = fp->read_page_from_cache(&key, key.offset);
+    if (ret > 0) {
+        throw make_error(ret);
+    }
+    return ret;
 }
 
 static std::unique_ptr<cached_page_write> create_write_cached_page(vfs_file* fp, hashkey& key)
@@ -515,6 +543,38 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
     cached_page_write* wcp = find_in_cache(write_cache, key);
 
     if (write) {
+        if (!wcp && shared && !IS_ZFS(st.st_dev)) {
+            // file systems which map pages of the file itself (ramfs) let
+            // shared mappings write to them in place, so look for such a page
+            // first, creating it if needed, before copying into write cache
+            for (bool created = false;; created = true) {
+                bool cached = false;
+                WITH_LOCK(read_lock) {
+                    cached_page* cp = find_in_cache(read_cache, key);
+                    if (cp && cp->writable()) {
+                        add_read_mapping(cp, ptep);
+                        return mmu::write_pte(cp->addr(), ptep, pte);
+                    }
+                    cached = cp;
+                }
+                if (cached || created) {
+                    break;
+                }
+                int ret;
+                DROP_LOCK(write_lock) {
+                    ret = create_read_cached_page(fp, key);
+                }
+                if (find_in_cache(write_cache, key)) {
+                    // write cache page appeared while we were not holding
+                    // the write lock, re-fault and try again
+                    return false;
+                }
+                if (ret == -1) {
+                    // a hole past the end of the file
+                    break;
+                }
+            }
+        }
         if (!wcp) {
             auto newcp = create_write_cached_page(fp, key);
             if (shared) {
@@ -526,7 +586,7 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 if (IS_ZFS(st.st_dev)) {
                     drop_arc_read_cached_page(key);
                 } else {
-                    // ROFS (at least for now)
+                    // ROFS and ramfs
                     drop_read_cached_page(key);
                 }
             } else {
@@ -534,7 +594,7 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 if (IS_ZFS(st.st_dev)) {
                     remove_arc_read_mapping(key, ptep);
                 } else {
-                    // ROFS (at least for now)
+                    // ROFS and ramfs
                     remove_read_mapping(key, ptep);
                 }
                 // cow (copy-on-write) of private page from read cache
@@ -560,12 +620,13 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                 }
             }
             else {
-                // ROFS (at least for now)
+                // ROFS and ramfs, the latter need no cow for shared mappings
                 WITH_LOCK(read_lock) {
                     cached_page* cp = find_in_cache(read_cache, key);
                     if (cp) {
                         add_read_mapping(cp, ptep);
-                        return mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, true));
+                        bool cow = !(shared && cp->writable());
+                        return mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, cow));
                     }
                 }
             }
@@ -629,7 +690,7 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep)
             }
         }
     } else {
-        // ROFS (at least for now)
+        // ROFS and ramfs
         WITH_LOCK(read_lock) {
             cached_page* rcp = find_in_cache(read_cache, key);
             if (rcp && mmu::virt_to_phys(rcp->addr()) == old.addr()) {
@@ -283,6 +283,11 @@ void cpu::reschedule_from_interrupt(bool called_from_yield,
 
     p->_total_cpu_time += interval;
     p->_runtime.ran_for(interval);
+    p->_last_ran = now;
+
+    if (steal_requests) {
+        handle_steal_requests(now);
+    }
 
     if (p_status == thread::status::running) {
         // The current thread is still runnable. Check if it still has the
@@ -373,6 +378,7 @@ void cpu::reschedule_from_interrupt(bool called_from_yield,
     trace_sched_load(runqueue.size());
 
     n->_detached_state->st.store(thread::status::running);
+    running_thread.store(n, std::memory_order_relaxed);
     n->_runtime.hysteresis_run_start();
 
     assert(n!=p);
@@ -474,7 +480,9 @@ void cpu::do_idle()
         WITH_LOCK(idle_poll_lock) {
             // spin for a bit before halting
             for (unsigned ctr = 0; ctr < 10000; ++ctr) {
-                // FIXME: can we pull threads from loaded cpus?
+                if (ctr % 1000 == 0) {
+                    request_steal();
+                }
                 handle_incoming_wakeups();
                 if (!runqueue.empty()) {
                     return;
@@ -541,6 +549,8 @@ void cpu::handle_incoming_wakeups()
                 } else if (t.tcpu() != this) {
                     // Thread was woken on the wrong cpu. Can be a side-effect
                     // of sched::thread::pin(thread*, cpu*). Do nothing.
+                } else if (wake_affine(t, cpus[i])) {
+                    send_waking(t, cpus[i]);
                 } else {
                     t._detached_state->st.store(thread::status::queued);
                     // Make sure the CPU-local runtime measure is suitably
@@ -580,6 +590,16 @@ void cpu::init_on_cpu()
     clock_event->setup_on_cpu();
 }
 
+cpu* cpu::find_running(const thread* t)
+{
+    for (auto c : cpus) {
+        if (c->running_thread.load(std::memory_order_relaxed) == t) {
+            return c;
+        }
+    }
+    return nullptr;
+}
+
 unsigned cpu::load()
 {
     return runqueue.size();
@@ -816,34 +836,145 @@ void cpu::load_balance()
         assert(!thread::current()->is_app());
 #endif
         WITH_LOCK(irq_lock) {
-            auto i = std::find_if(runqueue.rbegin(), runqueue.rend(),
-                    [](thread& t) { return t._migration_lock_counter == 0; });
-            if (i == runqueue.rend()) {
-                continue;
+            auto mig = pick_migratable(osv::clock::uptime::now());
+            if (mig) {
+                migrate_queued(*mig, min);
             }
-            auto& mig = *i;
-            trace_sched_migrate(&mig, min->id);
-            runqueue.erase(std::prev(i.base()));  // i.base() returns off-by-one
-            // we won't race with wake(), since we're not thread::waiting
-            assert(mig._detached_state->st.load() == thread::status::queued);
-            mig._detached_state->st.store(thread::status::waking);
-            mig.suspend_timers();
-            mig._detached_state->_cpu = min;
-            // Convert the CPU-local runtime measure to a globally meaningful
-            // measure
-            mig._runtime.export_runtime();
-            mig.remote_thread_local_var(::percpu_base) = min->percpu_base;
-            mig.remote_thread_local_var(current_cpu) = min;
-            mig.stat_migrations.incr();
-            min->incoming_wakeups[id].push_back(mig);
-            min->incoming_wakeups_mask.set(id);
-            // FIXME: avoid if the cpu is alive and if the priority does not
-            // FIXME: warrant an interruption
-            min->send_wakeup_ipi();
         }
     }
 }
 
+// A cpu is idle when it runs its idle thread with nothing else to run.
+// Called on other cpus too, so the answer may be stale by the time it is
+// used; that only makes the placement decisions below less than perfect.
+bool cpu::is_idle()
+{
+    return running_thread.load(std::memory_order_relaxed) == idle_thread &&
+           load() == 0 && !incoming_wakeups_mask;
+}
+
+// Choose a thread in our runqueue to move to another cpu, or nullptr if
+// none may move. Like the periodic balancing always did, look at the back
+// of the runqueue, at the threads which would wait the longest to run here,
+// and prefer one which is cache-cold (see migration_cost).
+// Must be called with interrupts disabled.
+thread* cpu::pick_migratable(osv::clock::uptime::time_point now)
+{
+    thread* hot = nullptr;
+    unsigned n = 0;
+    for (auto i = runqueue.rbegin(); i != runqueue.rend() && n < 16; ++i, ++n) {
+        if (i->_migration_lock_counter) {
+            continue;
+        }
+        if (now - i->_last_ran >= migration_cost) {
+            return &*i;
+        }
+        if (!hot) {
+            hot = &*i;
+        }
+    }
+    return hot;
+}
+
+// Move a thread waiting in our runqueue to target.
+// Must be called with interrupts disabled.
+void cpu::migrate_queued(thread& mig, cpu* target)
+{
+    runqueue.erase(runqueue.iterator_to(mig));
+    // we won't race with wake(), since we're not thread::waiting
+    assert(mig._detached_state->st.load() == thread::status::queued);
+    mig._detached_state->st.store(thread::status::waking);
+    send_waking(mig, target);
+}
+
+// Hand a thread in the waking state, which was last on this cpu, over to
+// target, which will queue it as if it was woken there.
+// Must be called with interrupts disabled.
+void cpu::send_waking(thread& t, cpu* target)
+{
+    trace_sched_migrate(&t, target->id);
+    t.suspend_timers();
+    t._detached_state->_cpu = target;
+    // Convert the CPU-local runtime measure to a globally meaningful
+    // measure
+    t._runtime.export_runtime();
+    t.remote_thread_local_var(::percpu_base) = target->percpu_base;
+    t.remote_thread_local_var(current_cpu) = target;
+    t.stat_migrations.incr();
+    target->incoming_wakeups[id].push_back(t);
+    target->incoming_wakeups_mask.set(id);
+    // FIXME: avoid if the cpu is alive and if the priority does not
+    // FIXME: warrant an interruption
+    target->send_wakeup_ipi();
+}
+
+// Wakeup placement: a thread is woken on the cpu it last ran on, whose
+// caches may still hold its working set, as long as that cpu is free to
+// run it. If it is busy while the cpu of the waker went idle, waiting here
+// would only add latency, so the thread goes to the waker's cpu - which is
+// also where the data the waker produced for it is.
+bool cpu::wake_affine(thread& t, cpu* waker)
+{
+    if (waker == this || t._migration_lock_counter) {
+        return false;
+    }
+    auto p = thread::current();
+    bool busy = !runqueue.empty() || (p != idle_thread &&
+        p->_detached_state->st.load(std::memory_order_relaxed) == thread::status::running);
+    return busy && waker->is_idle();
+}
+
+// Idle-time work stealing: ask the cpu with the most queued threads to send
+// us one. Runqueues are private to their cpus, so rather than taking the
+// thread ourselves we post a request, which that cpu handles on its next
+// reschedule - right away, as we interrupt it.
+void cpu::request_steal()
+{
+    cpu* busiest = nullptr;
+    // A busy cpu's idle thread waits in its runqueue too
+    unsigned max_load = 1;
+    for (auto c : cpus) {
+        auto l = c->load();
+        if (c != this && l > max_load) {
+            busiest = c;
+            max_load = l;
+        }
+    }
+    if (busiest && !busiest->steal_requests.test_and_set(id)) {
+        trace_sched_ipi(busiest->id);
+        wakeup_ipi.send(busiest);
+    }
+}
+
+// Called from reschedule_from_interrupt() when other cpus asked for work.
+void cpu::handle_steal_requests(osv::clock::uptime::time_point now)
+{
+    cpu_set requests{steal_requests.fetch_clear()};
+    for (auto c : requests) {
+        auto target = cpus[c];
+        // The requester may have found something to do meanwhile
+        if (!target->is_idle()) {
+            continue;
+        }
+        // Leave a thread to run here, unless the current one keeps running
+        auto p = thread::current();
+        auto waiting = runqueue.size();
+        if (waiting && p != idle_thread) {
+            waiting--;
+        }
+        bool p_runs = p != idle_thread &&
+            p->_detached_state->st.load(std::memory_order_relaxed) == thread::status::running;
+        if (waiting < (p_runs ? 1 : 2)) {
+            return;
+        }
+        auto mig = pick_migratable(now);
+        if (!mig) {
+            return;
+        }
+        migrate_queued(*mig, target);
+    }
+}
+
 cpu::notifier::notifier(std::function<void ()> cpu_up)
     : _cpu_up(cpu_up)
 {
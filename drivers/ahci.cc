@@ -299,7 +299,9 @@ int port::make_request(struct bio* bio)
             disk_flush(bio);
             break;
         default:
-            return ENOTBLK;
+            bio->bio_error = EOPNOTSUPP;
+            biodone(bio, false);
+            return EOPNOTSUPP;
         }
         return 0;
     }
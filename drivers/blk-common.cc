@@ -15,9 +15,50 @@
 #include "drivers/blk-common.hh"
 
 #include <sys/mount.h>
+#include <osv/prex.h>
+
+#include <algorithm>
+#include <memory>
 
 TRACEPOINT(trace_blk_ioctl, "dev=%s type=%#x nr=%d size=%d, dir=%d", char*, int, int, int, int);
 
+static int
+blk_range_cmd(struct device* dev, u8 cmd, void* data, off_t offset, size_t len)
+{
+    auto* bio = alloc_bio();
+    if (!bio) {
+        return ENOMEM;
+    }
+    bio->bio_cmd = cmd;
+    bio->bio_dev = dev;
+    bio->bio_data = data;
+    bio->bio_offset = offset;
+    bio->bio_bcount = len;
+
+    dev->driver->devops->strategy(bio);
+    int error = bio_wait(bio);
+    destroy_bio(bio);
+    return error;
+}
+
+// Used by BLKZEROOUT when the device can not zero ranges by itself
+static int
+blk_write_zeroes_fallback(struct device* dev, off_t offset, size_t len)
+{
+    constexpr size_t chunk = 64 * 1024;
+    std::unique_ptr<char[]> zeroes(new char[chunk]());
+    while (len) {
+        size_t n = std::min(len, chunk);
+        int error = blk_range_cmd(dev, BIO_WRITE, zeroes.get(), offset, n);
+        if (error) {
+            return error;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
 int
 blk_ioctl(struct device* dev, u_long io_cmd, void* buf)
 {
@@ -42,6 +83,49 @@ blk_ioctl(struct device* dev, u_long io_cmd, void* buf)
                 dev->driver->devops->strategy(bio);
             }
             break;
+        case BLKPOLLGET:
+            if (!buf) {
+                return EINVAL;
+            }
+            *(unsigned int*) buf = dev->poll_us;
+            break;
+        case BLKPOLLSET:
+            if (!buf || *(unsigned int*) buf > BLKPOLL_MAX_US) {
+                return EINVAL;
+            }
+            device_set_poll(dev, *(unsigned int*) buf);
+            break;
+        case BLKDISCARD:
+        case BLKZEROOUT:
+            {
+                // Like Linux, the argument is a {start, length} pair in bytes
+                if (!buf) {
+                    return EINVAL;
+                }
+                auto* range = static_cast<uint64_t*>(buf);
+                uint64_t offset = range[0], len = range[1];
+                if ((offset | len) & (BSIZE - 1) ||
+                    offset > (uint64_t)dev->size || len > (uint64_t)dev->size - offset) {
+                    return EINVAL;
+                }
+                if (!len) {
+                    break;
+                }
+                if (io_cmd == BLKDISCARD) {
+                    if (!dev->max_discard_size) {
+                        return EOPNOTSUPP;
+                    }
+                    return blk_range_cmd(dev, BIO_DISCARD, nullptr, offset, len);
+                }
+                if (!dev->max_write_zeroes_size) {
+                    return blk_write_zeroes_fallback(dev, offset, len);
+                }
+                int error = blk_range_cmd(dev, BIO_WRITE_ZEROES, nullptr, offset, len);
+                if (error == EOPNOTSUPP) {
+                    error = blk_write_zeroes_fallback(dev, offset, len);
+                }
+                return error;
+            }
         default:
             printf("ioctl not defined; type:%#x nr:%d size:%d, dir:%d\n",_IOC_TYP(io_cmd),_IOC_NR(io_cmd),_IOC_SIZE(io_cmd),_IOC_DIR(io_cmd));
             return EINVAL;
@@ -10,7 +10,38 @@
 #define BLK_COMMON_HH
 
 #include <osv/device.h>
+#include <osv/clock.hh>
+#include <chrono>
 
 int blk_ioctl(struct device* dev, u_long io_cmd, void* buf);
 
+// Hybrid completion polling, used by the drivers after submitting a request
+// to a device with a non-zero poll_us (see BLKPOLLSET). The submitting
+// thread keeps calling reap(), which processes whatever is on the
+// completion queue and returns true once the submitted request was among
+// the completions, for at most poll_us microseconds. When reap() can not
+// get to the queue because the completion thread is already processing it,
+// it sets busy and we back off, leaving the request to the interrupt path.
+template <typename Reap>
+bool blk_poll(unsigned poll_us, Reap reap)
+{
+    auto deadline = osv::clock::uptime::now() + std::chrono::microseconds(poll_us);
+    do {
+        bool busy = false;
+        if (reap(busy)) {
+            return true;
+        }
+        if (busy) {
+            return false;
+        }
+#ifdef __x86_64__
+        __asm __volatile("pause");
+#endif
+#ifdef __aarch64__
+        __asm __volatile("isb sy");
+#endif
+    } while (osv::clock::uptime::now() < deadline);
+    return false;
+}
+
 #endif
@@ -134,7 +134,9 @@ int ide_drive::make_request(struct bio* bio)
             }
             break;
         default:
-            return ENOTBLK;
+            bio->bio_error = EOPNOTSUPP;
+            biodone(bio, false);
+            return EOPNOTSUPP;
         }
 
         size_t len = 0;
@@ -18,6 +18,7 @@
 #include <osv/align.hh>
 
 #include "nvme-queue.hh"
+#include "drivers/blk-common.hh"
 
 TRACEPOINT(trace_nvme_cq_wait, "nvme%d qid=%d, cq_head=%d", int, int, int);
 TRACEPOINT(trace_nvme_cq_woken, "nvme%d qid=%d, have_elements=%d", int, int, bool);
@@ -33,11 +34,15 @@ TRACEPOINT(trace_nvme_req_done_success, "nvme%d qid=%d, cid=%d, bio=%p", int, in
 
 TRACEPOINT(trace_nvme_admin_cmd_submit, "nvme%d qid=%d, cid=%d, opc=%d", int, int, int, u8);
 TRACEPOINT(trace_nvme_read_write_cmd_submit, "nvme%d qid=%d cid=%d, bio=%p, slba=%d, nlb=%d, write=%d", int, int, u16, void*, u64, u32, bool);
+TRACEPOINT(trace_nvme_range_cmd_submit, "nvme%d qid=%d cid=%d, bio=%p, slba=%d, nlb=%d, zeroes=%d", int, int, u16, void*, u64, u64, bool);
 
 TRACEPOINT(trace_nvme_sq_tail_advance, "nvme%d qid=%d, sq_tail=%d, sq_head=%d, depth=%d, full=%d", int, int, int, int, int, bool);
 TRACEPOINT(trace_nvme_sq_full_wait, "nvme%d qid=%d, sq_tail=%d, sq_head=%d", int, int, int, int);
 TRACEPOINT(trace_nvme_sq_full_wake, "nvme%d qid=%d, sq_tail=%d, sq_head=%d", int, int, int, int);
 
+TRACEPOINT(trace_nvme_poll, "nvme%d qid=%d, bio=%p, poll_us=%u", int, int, void*, unsigned);
+TRACEPOINT(trace_nvme_poll_ret, "nvme%d qid=%d, bio=%p, completed=%d", int, int, void*, bool);
+
 TRACEPOINT(trace_nvme_cid_conflict, "nvme%d qid=%d, cid=%d", int, int, int);
 
 TRACEPOINT(trace_nvme_prp_alloc, "nvme%d qid=%d, prp=%p", int, int, void*);
@@ -262,7 +267,7 @@ void io_queue_pair::init_pending_bios(u32 level)
 int io_queue_pair::make_request(struct bio* bio, u32 nsid = 1)
 {
     u64 slba = bio->bio_offset;
-    u32 nlb = bio->bio_bcount; //do the blockshift in nvme_driver
+    u64 nlb = bio->bio_bcount; //do the blockshift in nvme_driver
 
     SCOPE_LOCK(_lock);
     if (_sq_full) {
@@ -311,62 +316,104 @@ int io_queue_pair::make_request(struct bio* bio, u32 nsid = 1)
         submit_flush_cmd(cid, nsid);
         break;
 
+    case BIO_DISCARD:
+        trace_nvme_range_cmd_submit(_driver_id, _id, cid, bio, slba, nlb, false);
+        submit_discard_cmd(cid, nsid, slba, nlb, bio);
+        break;
+
+    case BIO_WRITE_ZEROES:
+        trace_nvme_range_cmd_submit(_driver_id, _id, cid, bio, slba, nlb, true);
+        bio->bio_private = nullptr;
+        submit_write_zeroes_cmd(cid, nsid, slba, nlb);
+        break;
+
     default:
         NVME_ERROR("Operation not implemented\n");
-        return ENOTBLK;
+        _pending_bios[cid_to_row(cid)][cid_to_col(cid)] = nullptr;
+        bio->bio_error = EOPNOTSUPP;
+        biodone(bio, false);
+        return EOPNOTSUPP;
     }
     return 0;
 }
 
 void io_queue_pair::req_done()
 {
-    nvme_cq_entry_t* cqep = nullptr;
     while (true)
     {
         wait_for_completion_queue_entries();
-        while ((cqep = get_completion_queue_entry())) {
-            // Read full CQ entry onto stack so we can advance CQ head ASAP
-            // and release the CQ slot
-            nvme_cq_entry_t cqe = *cqep;
-            advance_cq_head();
-            mmio_setl(_cq._doorbell, _cq._head);
-            //
-            // Wake up the requesting thread in case the submission queue was full before
-            auto old_sq_head = _sq._head.exchange(cqe.sqhd); //update sq_head
-            if (old_sq_head != cqe.sqhd && _sq_full) {
-                _sq_full = false;
-                if (_sq_full_waiter) {
-                     trace_nvme_sq_full_wake(_driver_id, _id, _sq._tail, _sq._head);
-                    _sq_full_waiter.wake_from_kernel_or_with_irq_disabled();
-                }
-            }
-            //
-            // Read cid and release it
-            u16 cid = cqe.cid;
-            auto pending_bio = _pending_bios[cid_to_row(cid)][cid_to_col(cid)].exchange(nullptr);
-            assert(pending_bio);
-            //
-            // Save for future re-use or free PRP list saved under bio_private if any
-            if (pending_bio->bio_private) {
-                if (!_free_prp_lists.push((u64*)pending_bio->bio_private)) {
-                   free_page(pending_bio->bio_private); //_free_prp_lists is full so free the page
-                   trace_nvme_prp_free(_driver_id, _id, pending_bio->bio_private);
-                }
+        WITH_LOCK(_completion_lock) {
+            process_completions(nullptr);
+        }
+    }
+}
+
+bool io_queue_pair::process_completions(struct bio* mine)
+{
+    nvme_cq_entry_t* cqep = nullptr;
+    bool found = false;
+    while ((cqep = get_completion_queue_entry())) {
+        // Read full CQ entry onto stack so we can advance CQ head ASAP
+        // and release the CQ slot
+        nvme_cq_entry_t cqe = *cqep;
+        advance_cq_head();
+        mmio_setl(_cq._doorbell, _cq._head);
+        //
+        // Wake up the requesting thread in case the submission queue was full before
+        auto old_sq_head = _sq._head.exchange(cqe.sqhd); //update sq_head
+        if (old_sq_head != cqe.sqhd && _sq_full) {
+            _sq_full = false;
+            if (_sq_full_waiter) {
+                 trace_nvme_sq_full_wake(_driver_id, _id, _sq._tail, _sq._head);
+                _sq_full_waiter.wake_from_kernel_or_with_irq_disabled();
             }
-            // Call biodone
-            if (cqe.sct != 0 || cqe.sc != 0) {
-                trace_nvme_req_done_error(_driver_id, _id, cid, cqe.sct, cqe.sc, pending_bio);
-                biodone(pending_bio, false);
-                NVME_ERROR("I/O queue: cid=%d, sct=%#x, sc=%#x, bio=%#x, slba=%llu, nlb=%llu\n",
-                    cqe.cid, cqe.sct, cqe.sc, pending_bio,
-                    pending_bio ? pending_bio->bio_offset : 0,
-                    pending_bio ? pending_bio->bio_bcount : 0);
-            } else {
-                trace_nvme_req_done_success(_driver_id, _id, cid, pending_bio);
-                biodone(pending_bio, true);
+        }
+        //
+        // Read cid and release it
+        u16 cid = cqe.cid;
+        auto pending_bio = _pending_bios[cid_to_row(cid)][cid_to_col(cid)].exchange(nullptr);
+        assert(pending_bio);
+        // Only compare, the bio may be gone once biodone() returns
+        found |= pending_bio == mine;
+        //
+        // Save for future re-use or free PRP list saved under bio_private if any
+        if (pending_bio->bio_private) {
+            if (!_free_prp_lists.push((u64*)pending_bio->bio_private)) {
+               free_page(pending_bio->bio_private); //_free_prp_lists is full so free the page
+               trace_nvme_prp_free(_driver_id, _id, pending_bio->bio_private);
             }
         }
+        // Call biodone
+        if (cqe.sct != 0 || cqe.sc != 0) {
+            trace_nvme_req_done_error(_driver_id, _id, cid, cqe.sct, cqe.sc, pending_bio);
+            biodone(pending_bio, false);
+            NVME_ERROR("I/O queue: cid=%d, sct=%#x, sc=%#x, bio=%#x, slba=%llu, nlb=%llu\n",
+                cqe.cid, cqe.sct, cqe.sc, pending_bio,
+                pending_bio ? pending_bio->bio_offset : 0,
+                pending_bio ? pending_bio->bio_bcount : 0);
+        } else {
+            trace_nvme_req_done_success(_driver_id, _id, cid, pending_bio);
+            biodone(pending_bio, true);
+        }
     }
+    return found;
+}
+
+bool io_queue_pair::poll(struct bio* bio, unsigned poll_us)
+{
+    trace_nvme_poll(_driver_id, _id, bio, poll_us);
+    bool done = blk_poll(poll_us, [&] (bool& busy) {
+        // The completion thread, or a bio_done callback further up our own
+        // stack, may already be processing the completion queue
+        if (_completion_lock.owned() || !_completion_lock.try_lock()) {
+            busy = true;
+            return false;
+        }
+        SCOPE_ADOPT_LOCK(_completion_lock);
+        return process_completions(bio);
+    });
+    trace_nvme_poll_ret(_driver_id, _id, bio, done);
+    return done;
 }
 
 u16 io_queue_pair::submit_read_write_cmd(u16 cid, u32 nsid, int opc, u64 slba, u32 nlb, struct bio* bio)
@@ -398,6 +445,64 @@ u16 io_queue_pair::submit_flush_cmd(u16 cid, u32 nsid)
     return submit_cmd(&cmd);
 }
 
+u16 io_queue_pair::submit_discard_cmd(u16 cid, u32 nsid, u64 slba, u64 nlb, struct bio* bio)
+{
+    nvme_sq_entry_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+
+    // The ranges go into a page taken from the PRP list pool, which is
+    // where it returns to when the command completes (see bio_private)
+    u64* page = nullptr;
+    _free_prp_lists.pop(page);
+    if (!page) {
+        page = (u64*) alloc_page();
+        trace_nvme_prp_alloc(_driver_id, _id, page);
+    }
+    assert(page != nullptr);
+    bio->bio_private = page;
+
+    // Batch the range into as many 32-bit sized ranges as it takes,
+    // the driver keeps it within NVME_DSM_MAX_RANGES of them
+    auto* ranges = reinterpret_cast<nvme_dsm_range_t*>(page);
+    u32 nr = 0;
+    while (nlb) {
+        assert(nr < NVME_DSM_MAX_RANGES);
+        u32 n = std::min<u64>(nlb, UINT32_MAX);
+        ranges[nr].cattr = 0;
+        ranges[nr].nlb = n;
+        ranges[nr].slba = slba;
+        slba += n;
+        nlb -= n;
+        nr++;
+    }
+
+    cmd.vs.common.opc = NVME_CMD_DS_MGMT;
+    cmd.vs.common.nsid = nsid;
+    cmd.vs.common.cid = cid;
+    cmd.vs.common.prp1 = mmu::virt_to_phys(page);
+    cmd.vs.cdw10_15[0] = nr - 1;
+    cmd.vs.cdw10_15[1] = NVME_DSM_ATTR_DEALLOCATE;
+
+    return submit_cmd(&cmd);
+}
+
+u16 io_queue_pair::submit_write_zeroes_cmd(u16 cid, u32 nsid, u64 slba, u32 nlb)
+{
+    nvme_sq_entry_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+
+    // Same layout as read and write, minus the data. Let the controller
+    // deallocate the blocks if it can do so and still return zeroes.
+    cmd.vs.common.opc = NVME_CMD_WRITE_ZEROES;
+    cmd.vs.common.nsid = nsid;
+    cmd.vs.common.cid = cid;
+    cmd.vs.cdw10_15[0] = (u32) slba;
+    cmd.vs.cdw10_15[1] = (u32) (slba >> 32);
+    cmd.vs.cdw10_15[2] = (nlb - 1) | NVME_WRITE_ZEROES_DEAC;
+
+    return submit_cmd(&cmd);
+}
+
 admin_queue_pair::admin_queue_pair(
     int driver_id,
     int id,
@@ -143,14 +143,24 @@ public:
 
     int make_request(struct bio* bio, u32 nsid);
     void req_done();
+
+    // Spin on the completion queue for up to poll_us microseconds, until
+    // the given just submitted bio completes. Returns whether it did.
+    bool poll(struct bio* bio, unsigned poll_us);
 private:
     void init_pending_bios(u32 level);
 
+    // Process the entries on the completion queue, called with
+    // _completion_lock held. Returns whether mine was among them.
+    bool process_completions(struct bio* mine);
+
     inline u16 cid_to_row(u16 cid) { return cid / _qsize; }
     inline u16 cid_to_col(u16 cid) { return cid % _qsize; }
 
     u16 submit_read_write_cmd(u16 cid, u32 nsid, int opc, u64 slba, u32 nlb, struct bio* bio);
     u16 submit_flush_cmd(u16 cid, u32 nsid);
+    u16 submit_discard_cmd(u16 cid, u32 nsid, u64 slba, u64 nlb, struct bio* bio);
+    u16 submit_write_zeroes_cmd(u16 cid, u32 nsid, u64 slba, u32 nlb);
 
     sched::thread_handle _sq_full_waiter;
 
@@ -161,6 +171,10 @@ private:
     // Given cid, we can easily identify a pending bio by calculating
     // the row - cid / _qsize and column - cid % _qsize
     std::atomic<struct bio*>* _pending_bios[max_pending_levels] = {};
+
+    // Serializes processing of the completion queue between the completion
+    // thread and submitters polling for their request (see BLKPOLLSET)
+    mutex _completion_lock;
 };
 
 // Pair of SQ and CQ queues used for setting up/configuring controller
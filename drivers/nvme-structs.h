@@ -64,9 +64,25 @@ enum {
     NVME_CMD_READ           = 0x2,      ///< read
     NVME_CMD_WRITE_UNCOR    = 0x4,      ///< write uncorrectable
     NVME_CMD_COMPARE        = 0x5,      ///< compare
+    NVME_CMD_WRITE_ZEROES   = 0x8,      ///< write zeroes
     NVME_CMD_DS_MGMT        = 0x9,      ///< dataset management
 };
 
+/// Optional NVM command support (identify controller oncs)
+enum {
+    NVME_ONCS_DS_MGMT       = 1 << 2,   ///< dataset management
+    NVME_ONCS_WRITE_ZEROES  = 1 << 3,   ///< write zeroes
+};
+
+/// Dataset management: deallocate attribute (cdw 11)
+#define NVME_DSM_ATTR_DEALLOCATE    (1 << 2)
+/// Dataset management: maximum number of ranges of one command
+#define NVME_DSM_MAX_RANGES         256
+/// Write zeroes: deallocate (cdw 12)
+#define NVME_WRITE_ZEROES_DEAC      (1 << 25)
+/// Write zeroes: maximum number of logical blocks (16-bit 0-based field)
+#define NVME_WRITE_ZEROES_MAX_NLB   0x10000
+
 /// NVMe admin command op code
 enum {
     NVME_ACMD_DELETE_SQ     = 0x0,      ///< delete io submission queue
@@ -293,6 +309,15 @@ typedef struct _nvme_command_rw {
 
 static_assert(sizeof(nvme_command_rw_t)==64);
 
+/// NVMe command:  Dataset Management range (the command data)
+typedef struct _nvme_dsm_range {
+    u32                     cattr;      ///< context attributes
+    u32                     nlb;        ///< number of logical blocks
+    u64                     slba;       ///< starting LBA
+} nvme_dsm_range_t;
+
+static_assert(sizeof(nvme_dsm_range_t)==16);
+
 /// Admin and NVM Vendor Specific Command
 typedef struct _nvme_command_vs {
     nvme_command_common_t   common;     ///< common cdw 0
@@ -10,6 +10,7 @@
 
 #include "drivers/nvme.hh"
 #include "drivers/pci-device.hh"
+#include "drivers/blk-common.hh"
 #include <osv/interrupt.hh>
 
 #include <cassert>
@@ -80,7 +81,7 @@ static struct devops nvme_devops {
     no_close,
     nvme_read,
     nvme_write,
-    no_ioctl,
+    blk_ioctl,
     no_devctl,
     multiplex_strategy,
 };
@@ -170,6 +171,12 @@ driver::driver(pci::device &pci_dev)
     //IO size greater than 4096 << 9 would mean we need
     //more than 1 page for the prplist which is not implemented
     dev->max_io_size = mmu::page_size << ((9 < _identify_controller->mdts)? 9 : _identify_controller->mdts);
+    if (_identify_controller->oncs & NVME_ONCS_DS_MGMT) {
+        dev->max_discard_size = ((size_t) NVME_DSM_MAX_RANGES * UINT32_MAX) << ns->blockshift;
+    }
+    if (_identify_controller->oncs & NVME_ONCS_WRITE_ZEROES) {
+        dev->max_write_zeroes_size = ((size_t) NVME_WRITE_ZEROES_MAX_NLB) << ns->blockshift;
+    }
 
     read_partition_table(dev);
 
@@ -432,8 +439,14 @@ int driver::identify_namespace(u32 nsid)
 
 int driver::make_request(bio* bio, u32 nsid)
 {
+    // Read it upfront, the bio may complete and be freed as soon as it is
+    // on the submission queue
+    unsigned poll_us = bio->bio_dev->poll_us;
+
     if (bio->bio_bcount % _ns_data[nsid]->blocksize || bio->bio_offset % _ns_data[nsid]->blocksize) {
         NVME_ERROR("bio request not block-aligned length=%d, offset=%d blocksize=%d\n",bio->bio_bcount, bio->bio_offset, _ns_data[nsid]->blocksize);
+        bio->bio_error = EINVAL;
+        biodone(bio, false);
         return EINVAL;
     }
     bio->bio_offset = bio->bio_offset >> _ns_data[nsid]->blockshift;
@@ -446,8 +459,20 @@ int driver::make_request(bio* bio, u32 nsid)
         return 0;
     }
 
+    if ((bio->bio_cmd == BIO_DISCARD && !(_identify_controller->oncs & NVME_ONCS_DS_MGMT)) ||
+        (bio->bio_cmd == BIO_WRITE_ZEROES && !(_identify_controller->oncs & NVME_ONCS_WRITE_ZEROES))) {
+        bio->bio_error = EOPNOTSUPP;
+        biodone(bio, false);
+        return EOPNOTSUPP;
+    }
+
     unsigned int qidx = sched::current_cpu->id % _io_queues.size();
-    return _io_queues[qidx]->make_request(bio, nsid);
+    auto& queue = _io_queues[qidx];
+    int ret = queue->make_request(bio, nsid);
+    if (!ret && poll_us) {
+        queue->poll(bio, poll_us);
+    }
+    return ret;
 }
 
 void driver::register_admin_interrupt()
@@ -310,7 +310,9 @@ int scsi_common::handle_bio(u16 target, u16 lun, struct bio *bio)
             exec_cmd(bio);
             break;
         default:
-            return ENOTBLK;
+            bio->bio_error = EOPNOTSUPP;
+            biodone(bio, false);
+            return EOPNOTSUPP;
         }
         return 0;
 }
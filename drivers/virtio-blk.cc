@@ -24,6 +24,7 @@
 #include <osv/debug.h>
 
 #include <osv/sched.hh>
+#include <osv/printf.hh>
 #include "osv/trace.hh"
 #include "osv/aligned_new.hh"
 
@@ -38,13 +39,19 @@ TRACEPOINT(trace_virtio_blk_read_config_blk_size, "blk_size=%u", u32);
 TRACEPOINT(trace_virtio_blk_read_config_topology, "physical_block_exp=%u, alignment_offset=%u, min_io_size=%u, opt_io_size=%u", u32, u32, u32, u32);
 TRACEPOINT(trace_virtio_blk_read_config_wce, "wce=%u", u32);
 TRACEPOINT(trace_virtio_blk_read_config_ro, "readonly=true");
+TRACEPOINT(trace_virtio_blk_read_config_num_queues, "num_queues=%u", u32);
+TRACEPOINT(trace_virtio_blk_read_config_discard, "max_discard_sectors=%u, max_discard_seg=%u, discard_sector_alignment=%u", u32, u32, u32);
+TRACEPOINT(trace_virtio_blk_read_config_write_zeroes, "max_write_zeroes_sectors=%u, max_write_zeroes_seg=%u, may_unmap=%u", u32, u32, u32);
 TRACEPOINT(trace_virtio_blk_make_request_seg_max, "request of size %d needs more segment than the max %d", size_t, u32);
 TRACEPOINT(trace_virtio_blk_make_request_readonly, "write on readonly device");
-TRACEPOINT(trace_virtio_blk_wake, "");
+TRACEPOINT(trace_virtio_blk_make_request_unsupp, "unsupported command %#x", u8);
+TRACEPOINT(trace_virtio_blk_wake, "queue=%u", unsigned);
 TRACEPOINT(trace_virtio_blk_strategy, "write=%u, offset=%lu, bcount=%lu", bool, off_t, size_t);
 TRACEPOINT(trace_virtio_blk_strategy_ret, "%d", int);
 TRACEPOINT(trace_virtio_blk_req_ok, "bio=%p, sector=%lu, len=%lu, type=%x", struct bio*, u64, size_t, u32);
 TRACEPOINT(trace_virtio_blk_req_unsupp, "bio=%p, sector=%lu, len=%lu, type=%x", struct bio*, u64, size_t, u32);
+TRACEPOINT(trace_virtio_blk_poll, "bio=%p, poll_us=%u", struct bio*, unsigned);
+TRACEPOINT(trace_virtio_blk_poll_ret, "bio=%p, completed=%d", struct bio*, bool);
 TRACEPOINT(trace_virtio_blk_req_err, "bio=%p, sector=%lu, len=%lu, type=%x", struct bio*, u64, size_t, u32);
 
 using namespace memory;
@@ -54,6 +61,11 @@ namespace virtio {
 
 int blk::_instance = 0;
 
+static const int sector_size = 512;
+
+// All virtio-blk drivers, for queue_stats()
+static mutex blk_drivers_lock;
+static std::vector<blk*> blk_drivers;
 
 struct blk_priv {
     devop_strategy_t strategy;
@@ -105,10 +117,11 @@ struct driver blk_driver = {
 bool blk::ack_irq()
 {
     auto isr = _dev.read_and_ack_isr();
-    auto queue = get_virt_queue(0);
 
     if (isr) {
-        queue->disable_interrupts();
+        for (auto&& q : _queues) {
+            q->vqueue->disable_interrupts();
+        }
         return true;
     } else {
         return false;
@@ -130,40 +143,68 @@ blk::blk(virtio_device& virtio_dev)
     // Step 7 - generic init of virtqueues
     probe_virt_queues();
 
-    //register the single irq callback for the block
-    sched::thread* t = sched::thread::make([this] { this->req_done(); },
-            sched::thread::attr().name("virtio-blk"));
-    t->start();
-    auto queue = get_virt_queue(0);
+    unsigned nr_queues = negotiate_queues();
+    for (unsigned i = 0; i < nr_queues; i++) {
+        auto attr = sched::thread::attr().name("virtio-blk");
+        if (nr_queues > 1) {
+            //
+            // Bind each completion thread to the CPU whose submissions go
+            // to its queue, so a request completes where it was issued.
+            //
+            attr = sched::thread::attr().
+                   name("virtio-blk" + std::to_string(i)).
+                   pin(sched::cpus[i]);
+        }
+        _queues.emplace_back(new blk_queue(get_virt_queue(i),
+                                           [this, i] { this->req_done(i); },
+                                           attr));
+    }
+    for (auto&& q : _queues) {
+        q->completion_task->start();
+    }
+
+    // Without per-queue vectors a single interrupt has to wake all queues
+    auto wake_queues = [this] {
+        for (auto&& q : _queues) {
+            q->completion_task->wake_with_irq_disabled();
+        }
+    };
 
     interrupt_factory int_factory;
 #if CONF_drivers_pci
-    int_factory.register_msi_bindings = [queue, t](interrupt_manager &msi) {
-        msi.easy_register( {{ 0, [=] { queue->disable_interrupts(); }, t }});
+    int_factory.register_msi_bindings = [this](interrupt_manager &msi) {
+        // MSI-X entries are mapped 1:1 to the virtqueue indexes
+        std::vector<msix_binding> bindings;
+        for (unsigned i = 0; i < _queues.size(); i++) {
+            vring* vq = _queues[i]->vqueue;
+            bindings.push_back({ i, [vq] { vq->disable_interrupts(); },
+                                 _queues[i]->completion_task.get() });
+        }
+        msi.easy_register(bindings);
     };
 
-    int_factory.create_pci_interrupt = [this,t](pci::device &pci_dev) {
+    int_factory.create_pci_interrupt = [this,wake_queues](pci::device &pci_dev) {
         return new pci_interrupt(
             pci_dev,
             [=] { return this->ack_irq(); },
-            [=] { t->wake_with_irq_disabled(); });
+            [=] { wake_queues(); });
     };
 #endif
 
 #if CONF_drivers_mmio
 #ifdef __aarch64__
-    int_factory.create_spi_edge_interrupt = [this,t]() {
+    int_factory.create_spi_edge_interrupt = [this,wake_queues]() {
         return new spi_interrupt(
             gic::irq_type::IRQ_TYPE_EDGE,
             _dev.get_irq(),
             [=] { return this->ack_irq(); },
-            [=] { t->wake_with_irq_disabled(); });
+            [=] { wake_queues(); });
     };
 #else
-    int_factory.create_gsi_edge_interrupt = [this,t]() {
+    int_factory.create_gsi_edge_interrupt = [this,wake_queues]() {
         return new gsi_edge_interrupt(
             _dev.get_irq(),
-            [=] { if (this->ack_irq()) t->wake_with_irq_disabled(); });
+            [=] { if (this->ack_irq()) wake_queues(); });
     };
 #endif
 #endif
@@ -171,7 +212,9 @@ blk::blk(virtio_device& virtio_dev)
     _dev.register_interrupt(int_factory);
 
     // Enable indirect descriptor
-    queue->set_use_indirect(true);
+    for (auto&& q : _queues) {
+        q->vqueue->set_use_indirect(true);
+    }
 
     // Step 8
     add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
@@ -187,9 +230,25 @@ blk::blk(virtio_device& virtio_dev)
     prv->drv = this;
     dev->size = prv->drv->size();
     dev->max_io_size = _config.seg_max ? (_config.seg_max - 1) * mmu::page_size : UINT_MAX;
+    dev->max_discard_size = max_range_size(VIRTIO_BLK_F_DISCARD,
+        _config.max_discard_sectors, _config.max_discard_seg);
+    if (dev->max_discard_size && _config.discard_sector_alignment > 1) {
+        // Keep the pieces multiplex_strategy() splits discards into aligned
+        dev->discard_alignment = (size_t)_config.discard_sector_alignment * sector_size;
+        if (dev->max_discard_size >= dev->discard_alignment) {
+            dev->max_discard_size -= dev->max_discard_size % dev->discard_alignment;
+        }
+    }
+    dev->max_write_zeroes_size = max_range_size(VIRTIO_BLK_F_WRITE_ZEROES,
+        _config.max_write_zeroes_sectors, _config.max_write_zeroes_seg);
     read_partition_table(dev);
 
-    debugf("virtio-blk: Add blk device instances %d as %s, devsize=%lld\n", _id, dev_name.c_str(), dev->size);
+    WITH_LOCK(blk_drivers_lock) {
+        blk_drivers.push_back(this);
+    }
+
+    debugf("virtio-blk: Add blk device instances %d as %s, devsize=%lld, queues=%d\n",
+        _id, dev_name.c_str(), dev->size, (int)_queues.size());
 }
 
 blk::~blk()
@@ -198,6 +257,9 @@ blk::~blk()
     // including the thread objects and their stack
 }
 
+// Default discard/write zeroes segment size when the device sets no limit
+static const u32 max_range_sectors = 1u << 31;
+
 #define READ_CONFIGURATION_FIELD(config,field_name,field) \
     virtio_conf_read(offsetof(config,field_name), &field, sizeof(field));
 
@@ -235,47 +297,106 @@ void blk::read_config()
         set_readonly();
         trace_virtio_blk_read_config_ro();
     }
+    if (get_guest_feature_bit(VIRTIO_BLK_F_MQ)) {
+        READ_CONFIGURATION_FIELD(blk_config,num_queues,_config.num_queues)
+        trace_virtio_blk_read_config_num_queues(_config.num_queues);
+    } else {
+        _config.num_queues = 1;
+    }
+    // A device may leave the limits at 0, meaning a single segment or no
+    // limit beyond what fits in the 32-bit sector count of one segment
+    if (get_guest_feature_bit(VIRTIO_BLK_F_DISCARD)) {
+        READ_CONFIGURATION_FIELD(blk_config,max_discard_sectors,_config.max_discard_sectors)
+        READ_CONFIGURATION_FIELD(blk_config,max_discard_seg,_config.max_discard_seg)
+        READ_CONFIGURATION_FIELD(blk_config,discard_sector_alignment,_config.discard_sector_alignment)
+        if (!_config.max_discard_sectors) {
+            _config.max_discard_sectors = max_range_sectors;
+        }
+        _config.max_discard_seg = std::max(_config.max_discard_seg, 1u);
+        trace_virtio_blk_read_config_discard(_config.max_discard_sectors,
+            _config.max_discard_seg, _config.discard_sector_alignment);
+    }
+    if (get_guest_feature_bit(VIRTIO_BLK_F_WRITE_ZEROES)) {
+        READ_CONFIGURATION_FIELD(blk_config,max_write_zeroes_sectors,_config.max_write_zeroes_sectors)
+        READ_CONFIGURATION_FIELD(blk_config,max_write_zeroes_seg,_config.max_write_zeroes_seg)
+        READ_CONFIGURATION_FIELD(blk_config,write_zeroes_may_unmap,_config.write_zeroes_may_unmap)
+        if (!_config.max_write_zeroes_sectors) {
+            _config.max_write_zeroes_sectors = max_range_sectors;
+        }
+        _config.max_write_zeroes_seg = std::max(_config.max_write_zeroes_seg, 1u);
+        trace_virtio_blk_read_config_write_zeroes(_config.max_write_zeroes_sectors,
+            _config.max_write_zeroes_seg, (u32)_config.write_zeroes_may_unmap);
+    }
 }
 
-void blk::req_done()
+unsigned blk::negotiate_queues()
 {
-    auto* queue = get_virt_queue(0);
-    blk_req* req;
+    // Submissions are routed by CPU, so more queues than CPUs would idle
+    unsigned nr = std::min<unsigned>(_config.num_queues, sched::cpus.size());
+    nr = std::max(nr, 1u);
+
+    // We may not be able to activate as many virtqueues as the device offers
+    while (nr > 1 && !get_virt_queue(nr - 1)) {
+        nr--;
+    }
+
+    return nr;
+}
+
+void blk::req_done(unsigned qidx)
+{
+    auto& q = *_queues[qidx];
 
     while (1) {
 
-        virtio_driver::wait_for_queue(queue, &vring::used_ring_not_empty);
-        trace_virtio_blk_wake();
-
-        u32 len;
-        while((req = static_cast<blk_req*>(queue->get_buf_elem(&len))) != nullptr) {
-            if (req->bio) {
-                switch (req->res.status) {
-                case VIRTIO_BLK_S_OK:
-                    trace_virtio_blk_req_ok(req->bio, req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
-                    biodone(req->bio, true);
-                    break;
-                case VIRTIO_BLK_S_UNSUPP:
-                    trace_virtio_blk_req_unsupp(req->bio, req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
-                    biodone(req->bio, false);
-                    break;
-                default:
-                    trace_virtio_blk_req_err(req->bio, req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
-                    biodone(req->bio, false);
-                    break;
-               }
-            }
+        virtio_driver::wait_for_queue(q.vqueue, &vring::used_ring_not_empty);
+        trace_virtio_blk_wake(qidx);
+        q.stats.wakeups++;
 
-            delete req;
-            queue->get_buf_finalize();
+        WITH_LOCK(q.completion_lock) {
+            process_completions(q, nullptr);
         }
-
-        // wake up the requesting thread in case the ring was full before
-        queue->wakeup_waiter();
     }
 }
 
-static const int sector_size = 512;
+bool blk::process_completions(blk_queue& q, struct bio* mine)
+{
+    auto* queue = q.vqueue;
+    bool found = false;
+    blk_req* req;
+
+    u32 len;
+    while((req = static_cast<blk_req*>(queue->get_buf_elem(&len))) != nullptr) {
+        if (req->bio) {
+            // Only compare, the bio may be gone once biodone() returns
+            found |= req->bio == mine;
+            switch (req->res.status) {
+            case VIRTIO_BLK_S_OK:
+                trace_virtio_blk_req_ok(req->bio, req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
+                q.stats.completions++;
+                biodone(req->bio, true);
+                break;
+            case VIRTIO_BLK_S_UNSUPP:
+                trace_virtio_blk_req_unsupp(req->bio, req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
+                q.stats.errors++;
+                biodone(req->bio, false);
+                break;
+            default:
+                trace_virtio_blk_req_err(req->bio, req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
+                q.stats.errors++;
+                biodone(req->bio, false);
+                break;
+           }
+        }
+
+        delete req;
+        queue->get_buf_finalize();
+    }
+
+    // wake up the requesting thread in case the ring was full before
+    queue->wakeup_waiter();
+    return found;
+}
 
 int64_t blk::size()
 {
@@ -284,19 +405,26 @@ int64_t blk::size()
 
 int blk::make_request(struct bio* bio)
 {
-    // The lock is here for parallel requests protection
-    WITH_LOCK(_lock) {
+    if (!bio) return EIO;
+
+    // Read it upfront, the bio may complete and be freed as soon as it is
+    // on the ring
+    unsigned poll_us = bio->bio_dev->poll_us;
 
-        if (!bio) return EIO;
+    // Use the queue of the submitting CPU, so that the request completes on
+    // it as well. The thread may migrate before taking the lock, which only
+    // costs locality, the lock is there for parallel requests protection.
+    auto& q = *_queues[sched::cpu::current()->id % _queues.size()];
+    WITH_LOCK(q.lock) {
 
-        if (get_guest_feature_bit(VIRTIO_BLK_F_SEG_MAX)) {
+        if (bio->bio_data && get_guest_feature_bit(VIRTIO_BLK_F_SEG_MAX)) {
             if (bio->bio_bcount/mmu::page_size + 1 > _config.seg_max) {
                 trace_virtio_blk_make_request_seg_max(bio->bio_bcount, _config.seg_max);
                 return EIO;
             }
         }
 
-        auto* queue = get_virt_queue(0);
+        auto* queue = q.vqueue;
         blk_request_type type;
 
         switch (bio->bio_cmd) {
@@ -314,8 +442,27 @@ int blk::make_request(struct bio* bio)
         case BIO_FLUSH:
             type = VIRTIO_BLK_T_FLUSH;
             break;
+        case BIO_DISCARD:
+        case BIO_WRITE_ZEROES:
+            if (is_readonly()) {
+                trace_virtio_blk_make_request_readonly();
+                biodone(bio, false);
+                return EROFS;
+            }
+            if (!get_guest_feature_bit(bio->bio_cmd == BIO_DISCARD ?
+                    VIRTIO_BLK_F_DISCARD : VIRTIO_BLK_F_WRITE_ZEROES)) {
+                trace_virtio_blk_make_request_unsupp(bio->bio_cmd);
+                bio->bio_error = EOPNOTSUPP;
+                biodone(bio, false);
+                return EOPNOTSUPP;
+            }
+            type = bio->bio_cmd == BIO_DISCARD ?
+                VIRTIO_BLK_T_DISCARD : VIRTIO_BLK_T_WRITE_ZEROES;
+            break;
         default:
-            return ENOTBLK;
+            bio->bio_error = EOPNOTSUPP;
+            biodone(bio, false);
+            return EOPNOTSUPP;
         }
 
         auto* req = new blk_req(bio);
@@ -327,7 +474,11 @@ int blk::make_request(struct bio* bio)
         queue->init_sg();
         queue->add_out_sg(hdr, sizeof(struct blk_outhdr));
 
-        if (bio->bio_data && bio->bio_bcount > 0) {
+        if (type == VIRTIO_BLK_T_DISCARD) {
+            add_range_sg(queue, req, _config.max_discard_sectors);
+        } else if (type == VIRTIO_BLK_T_WRITE_ZEROES) {
+            add_range_sg(queue, req, _config.max_write_zeroes_sectors);
+        } else if (bio->bio_data && bio->bio_bcount > 0) {
             if (type == VIRTIO_BLK_T_OUT)
                 queue->add_out_sg(bio->bio_data, bio->bio_bcount);
             else
@@ -338,11 +489,62 @@ int blk::make_request(struct bio* bio)
         queue->add_in_sg(&req->res, sizeof (struct blk_res));
 
         queue->add_buf_wait(req);
+        q.stats.requests++;
 
         queue->kick();
+    }
 
+    if (poll_us) {
+        trace_virtio_blk_poll(bio, poll_us);
+        bool done = blk_poll(poll_us, [&] (bool& busy) {
+            // The completion thread, or a bio_done callback further up
+            // our own stack, may already be processing the used ring
+            if (q.completion_lock.owned() || !q.completion_lock.try_lock()) {
+                busy = true;
+                return false;
+            }
+            SCOPE_ADOPT_LOCK(q.completion_lock);
+            return process_completions(q, bio);
+        });
+        trace_virtio_blk_poll_ret(bio, done);
+        if (done) {
+            q.stats.polled++;
+        }
+    }
+
+    return 0;
+}
+
+void blk::add_range_sg(vring* queue, blk_req* req, u32 max_sectors)
+{
+    u64 sector = req->hdr.sector;
+    u64 left = req->bio->bio_bcount / sector_size;
+    unsigned nr = (left + max_sectors - 1) / max_sectors;
+    bool zeroes = req->hdr.type == VIRTIO_BLK_T_WRITE_ZEROES;
+
+    // multiplex_strategy() keeps bios within max_discard_size and
+    // max_write_zeroes_size
+    assert(nr <= (zeroes ? _config.max_write_zeroes_seg : _config.max_discard_seg));
+
+    req->ranges.reset(new blk_discard_write_zeroes[nr]);
+    for (unsigned i = 0; i < nr; i++) {
+        auto& range = req->ranges[i];
+        range.sector = sector;
+        range.num_sectors = std::min<u64>(left, max_sectors);
+        range.flags = zeroes && _config.write_zeroes_may_unmap ?
+            VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP : 0;
+        sector += range.num_sectors;
+        left -= range.num_sectors;
+    }
+    queue->add_out_sg(req->ranges.get(), nr * sizeof(blk_discard_write_zeroes));
+}
+
+size_t blk::max_range_size(int feature, u32 max_sectors, u32 max_seg)
+{
+    if (!get_guest_feature_bit(feature)) {
         return 0;
     }
+    return (size_t)max_sectors * max_seg * sector_size;
 }
 
 u64 blk::get_driver_features()
@@ -354,7 +556,25 @@ u64 blk::get_driver_features()
                  | ( 1 << VIRTIO_BLK_F_RO)
                  | ( 1 << VIRTIO_BLK_F_BLK_SIZE)
                  | ( 1 << VIRTIO_BLK_F_CONFIG_WCE)
-                 | ( 1 << VIRTIO_BLK_F_WCE));
+                 | ( 1 << VIRTIO_BLK_F_WCE)
+                 | ( 1 << VIRTIO_BLK_F_MQ)
+                 | ( 1 << VIRTIO_BLK_F_DISCARD)
+                 | ( 1 << VIRTIO_BLK_F_WRITE_ZEROES));
+}
+
+std::string blk::queue_stats()
+{
+    std::string output;
+    WITH_LOCK(blk_drivers_lock) {
+        for (auto drv : blk_drivers) {
+            for (unsigned i = 0; i < drv->_queues.size(); i++) {
+                auto& stats = drv->_queues[i]->stats;
+                output += osv::sprintf("vblk%d/%u requests %lu completions %lu errors %lu wakeups %lu polled %lu\n",
+                    drv->_id, i, stats.requests, stats.completions, stats.errors, stats.wakeups, stats.polled);
+            }
+        }
+    }
+    return output;
 }
 
 hw_driver* blk::probe(hw_device* dev)
@@ -10,6 +10,8 @@
 #include "drivers/virtio.hh"
 #include "drivers/virtio-device.hh"
 #include <osv/bio.h>
+#include <memory>
+#include <vector>
 
 namespace virtio {
 
@@ -28,6 +30,9 @@ public:
         VIRTIO_BLK_F_WCE        = 9,  /* Writeback mode enabled after reset */
         VIRTIO_BLK_F_TOPOLOGY   = 10, /* Topology information is available */
         VIRTIO_BLK_F_CONFIG_WCE = 11, /* Writeback mode available in config */
+        VIRTIO_BLK_F_MQ         = 12, /* Support more than one vq */
+        VIRTIO_BLK_F_DISCARD    = 13, /* DISCARD is supported */
+        VIRTIO_BLK_F_WRITE_ZEROES = 14, /* WRITE ZEROES is supported */
     };
 
     enum {
@@ -54,6 +59,10 @@ public:
         VIRTIO_BLK_T_FLUSH = 4,
         /* Get device ID command */
         VIRTIO_BLK_T_GET_ID = 8,
+        /* Discard command */
+        VIRTIO_BLK_T_DISCARD = 11,
+        /* Write zeroes command */
+        VIRTIO_BLK_T_WRITE_ZEROES = 13,
         /* Barrier before this op. */
         VIRTIO_BLK_T_BARRIER = 0x80000000,
     };
@@ -96,6 +105,27 @@ public:
 
             /* writeback mode (if VIRTIO_BLK_F_CONFIG_WCE) */
             u8 wce;
+            u8 unused;
+
+            /* number of vqs, only available when VIRTIO_BLK_F_MQ is set */
+            u16 num_queues;
+
+            /* the next 3 entries are guarded by VIRTIO_BLK_F_DISCARD */
+            /* maximum discard sectors for one segment */
+            u32 max_discard_sectors;
+            /* maximum number of discard segments in a discard command */
+            u32 max_discard_seg;
+            /* discard commands must be aligned to this number of sectors */
+            u32 discard_sector_alignment;
+
+            /* the next 3 entries are guarded by VIRTIO_BLK_F_WRITE_ZEROES */
+            /* maximum write zeroes sectors for one segment */
+            u32 max_write_zeroes_sectors;
+            /* maximum number of segments in a write zeroes command */
+            u32 max_write_zeroes_seg;
+            /* device can set the unmap flag in a write zeroes segment */
+            u8 write_zeroes_may_unmap;
+            u8 unused1[3];
     } __attribute__((packed));
 
     /* This is the first element of the read scatter-gather list. */
@@ -119,6 +149,18 @@ public:
         u8 status;
     };
 
+    /* A range of a discard or write zeroes command */
+    struct blk_discard_write_zeroes {
+        u64 sector;
+        u32 num_sectors;
+        u32 flags;
+    };
+
+    enum {
+        /* Deallocate the range when zeroing it (VIRTIO_BLK_T_WRITE_ZEROES) */
+        VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP = 1,
+    };
+
     explicit blk(virtio_device& dev);
     virtual ~blk();
 
@@ -129,7 +171,6 @@ public:
 
     int make_request(struct bio*);
 
-    void req_done();
     int64_t size();
 
     void set_readonly() {_ro = true;}
@@ -138,6 +179,10 @@ public:
     bool ack_irq();
 
     static hw_driver* probe(hw_device* dev);
+
+    // Per-queue request counters of all virtio-blk devices, one line per
+    // queue, for /sys/osv/virtio-blk/queues
+    static std::string queue_stats();
 private:
 
     struct blk_req {
@@ -147,17 +192,56 @@ private:
         blk_outhdr hdr;
         blk_res res;
         struct bio* bio;
+        // Ranges of a discard or write zeroes request
+        std::unique_ptr<blk_discard_write_zeroes[]> ranges;
+    };
+
+    // Split the range of a discard or write zeroes bio into segments the
+    // device accepts, all sent with the one request
+    void add_range_sg(vring* queue, blk_req* req, u32 max_sectors);
+    // Bytes a single discard or write zeroes request can cover, 0 if the
+    // command is not supported
+    size_t max_range_size(int feature, u32 max_sectors, u32 max_seg);
+
+    // A request virtqueue along with its completion thread. With
+    // VIRTIO_BLK_F_MQ there is one per CPU, and both submission and
+    // completion of a request happen on the CPU of the submitter.
+    struct blk_queue {
+        blk_queue(vring* vq, std::function<void ()> poll_func,
+                  sched::thread::attr attr)
+            : vqueue(vq), completion_task(sched::thread::make(poll_func, attr)) {}
+
+        vring* vqueue;
+        std::unique_ptr<sched::thread> completion_task;
+        // This mutex protects parallel make_request invocations on the queue
+        mutex lock;
+        // Serializes processing of the used ring between the completion
+        // thread and submitters polling for their request (see BLKPOLLSET)
+        mutex completion_lock;
+
+        struct {
+            u64 requests;     /* requests added to the ring */
+            u64 completions;  /* requests completed successfully */
+            u64 errors;       /* requests completed with an error */
+            u64 wakeups;      /* completion thread wakeups */
+            u64 polled;       /* requests completed by their submitter polling */
+        } stats = {};
     };
 
+    unsigned negotiate_queues();
+    void req_done(unsigned qidx);
+    // Complete the requests on the used ring, called with
+    // q.completion_lock held. Returns whether mine was among them.
+    bool process_completions(blk_queue& q, struct bio* mine);
+
     std::string _driver_name;
     blk_config _config;
+    std::vector<std::unique_ptr<blk_queue>> _queues;
 
     //maintains the virtio instance number for multiple drives
     static int _instance;
     int _id;
     bool _ro;
-    // This mutex protects parallel make_request invocations
-    mutex _lock;
 };
 
 }
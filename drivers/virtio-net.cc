@@ -46,6 +46,8 @@ TRACEPOINT(trace_virtio_net_fill_rx_ring_added, "if=%d, added=%d", int, int);
 TRACEPOINT(trace_virtio_net_tx_packet, "if=%d, len=%d", int, int);
 TRACEPOINT(trace_virtio_net_tx_failed_add_buf, "if=%d", int);
 TRACEPOINT(trace_virtio_net_tx_no_space_calling_gc, "if=%d", int);
+TRACEPOINT(trace_virtio_net_ctrl_cmd, "if=%d, class=%d, cmd=%d, ack=%d",
+           int, u8, u8, u8);
 
 TRACEPOINT(trace_virtio_net_tx_packet_size, "vring %p vec_sz %d", void*, int);
 TRACEPOINT(trace_virtio_net_tx_xmit_one_failed_to_post, "vring %p vec_sz %d",
@@ -60,6 +62,7 @@ using namespace memory;
 
 extern bool opt_maxnic;
 extern int maxnic;
+extern int opt_nic_queues;
 
 namespace virtio {
 
@@ -133,13 +136,31 @@ static int if_transmit(struct ifnet* ifp, struct mbuf* m_head)
     return vnet->xmit(m_head);
 }
 
-inline int net::xmit(struct mbuf* buff)
+inline net::txq& net::select_txq(mbuf* m)
 {
+    if (_active_pairs == 1) {
+        return *_txq[0];
+    }
+
     //
-    // We currently have only a single TX queue. Select a proper TXq here when
-    // we implement a multi-queue.
+    // Keep the frames of the same flow on the same queue when the stack has
+    // given us a hash, otherwise use the queue of the current CPU. The choice
+    // is only a hint: the per-CPU xmitter of each queue deals with migration
+    // and ordering itself.
     //
-    return _txq.xmit(buff);
+    unsigned idx;
+    if (M_HASHTYPE_GET(m) != M_HASHTYPE_NONE) {
+        idx = m->M_dat.MH.MH_pkthdr.flowid % _active_pairs;
+    } else {
+        idx = sched::cpu::current()->id % _active_pairs;
+    }
+
+    return *_txq[idx];
+}
+
+inline int net::xmit(struct mbuf* buff)
+{
+    return select_txq(buff).xmit(buff);
 }
 
 inline int net::txq::xmit(mbuf* buff)
@@ -184,35 +205,52 @@ static void if_getinfo(struct ifnet* ifp, struct if_data* out_data)
     vnet->fill_stats(out_data);
 }
 
+static void add_wakeup_stats(wakeup_stats& to, const wakeup_stats& from)
+{
+    to.packets_8   += from.packets_8;
+    to.packets_16  += from.packets_16;
+    to.packets_32  += from.packets_32;
+    to.packets_64  += from.packets_64;
+    to.packets_128 += from.packets_128;
+    to.packets_256 += from.packets_256;
+}
+
 void net::fill_stats(struct if_data* out_data) const
 {
-    // We currently support only a single Tx/Rx queue so no iteration so far
-    fill_qstats(_rxq, out_data);
-    fill_qstats(_txq, out_data);
+    assert(!out_data->ifi_oerrors && !out_data->ifi_obytes && !out_data->ifi_opackets);
+
+    // Accumulate the statistics of all queue pairs
+    for (auto&& rxq : _rxq) {
+        fill_qstats(*rxq, out_data);
+    }
+    for (auto&& txq : _txq) {
+        fill_qstats(*txq, out_data);
+    }
 }
 
 void net::fill_qstats(const struct rxq& rxq, struct if_data* out_data) const
 {
-    out_data->ifi_ipackets   += rxq.stats.rx_packets;
-    out_data->ifi_ibytes     += rxq.stats.rx_bytes;
-    out_data->ifi_iqdrops    += rxq.stats.rx_drops;
-    out_data->ifi_ierrors    += rxq.stats.rx_csum_err;
-    out_data->ifi_ibh_wakeups = rxq.stats.rx_bh_wakeups;
-    out_data->ifi_iwakeup_stats = rxq.stats.rx_wakeup_stats;
+    out_data->ifi_ipackets    += rxq.stats.rx_packets;
+    out_data->ifi_ibytes      += rxq.stats.rx_bytes;
+    out_data->ifi_iqdrops     += rxq.stats.rx_drops;
+    out_data->ifi_ierrors     += rxq.stats.rx_csum_err;
+    out_data->ifi_ibh_wakeups += rxq.stats.rx_bh_wakeups;
+    out_data->ifi_ilro_queued  += rxq.lro.lro_queued;
+    out_data->ifi_ilro_flushed += rxq.lro.lro_flushed;
+    add_wakeup_stats(out_data->ifi_iwakeup_stats, rxq.stats.rx_wakeup_stats);
 }
 
 void net::fill_qstats(const struct txq& txq, struct if_data* out_data) const
 {
-    assert(!out_data->ifi_oerrors && !out_data->ifi_obytes && !out_data->ifi_opackets);
-    out_data->ifi_opackets       += txq.stats.tx_packets;
-    out_data->ifi_obytes         += txq.stats.tx_bytes;
-    out_data->ifi_oerrors        += txq.stats.tx_err + txq.stats.tx_drops;
-    out_data->ifi_oworker_kicks   = txq.stats.tx_worker_kicks;
-    out_data->ifi_oworker_wakeups = txq.stats.tx_worker_wakeups;
-    out_data->ifi_oworker_packets = txq.stats.tx_worker_packets;
-    out_data->ifi_okicks          = txq.stats.tx_kicks;
-    out_data->ifi_oqueue_is_full  = txq.stats.tx_hw_queue_is_full;
-    out_data->ifi_owakeup_stats   = txq.stats.tx_wakeup_stats;
+    out_data->ifi_opackets        += txq.stats.tx_packets;
+    out_data->ifi_obytes          += txq.stats.tx_bytes;
+    out_data->ifi_oerrors         += txq.stats.tx_err + txq.stats.tx_drops;
+    out_data->ifi_oworker_kicks   += txq.stats.tx_worker_kicks;
+    out_data->ifi_oworker_wakeups += txq.stats.tx_worker_wakeups;
+    out_data->ifi_oworker_packets += txq.stats.tx_worker_packets;
+    out_data->ifi_okicks          += txq.stats.tx_kicks;
+    out_data->ifi_oqueue_is_full  += txq.stats.tx_hw_queue_is_full;
+    add_wakeup_stats(out_data->ifi_owakeup_stats, txq.stats.tx_wakeup_stats);
 }
 
 bool net::ack_irq()
@@ -220,7 +258,9 @@ bool net::ack_irq()
     auto isr = _dev.read_and_ack_isr();
 
     if (isr) {
-        _rxq.vqueue->disable_interrupts();
+        for (auto&& rxq : _rxq) {
+            rxq->vqueue->disable_interrupts();
+        }
         return true;
     } else {
         return false;
@@ -239,17 +279,31 @@ void net::init()
 
 net::net(virtio_device& dev)
     : virtio_driver(dev),
-    _pre_init(this),
-    _rxq(get_virt_queue(0), [this] { this->receiver(); }),
-    _txq(this, get_virt_queue(1))
+    _pre_init(this)
 {
     _driver_name = "virtio-net";
     virtio_i("VIRTIO NET INSTANCE");
     _id = _instance++;
 
-    sched::thread* poll_task = _rxq.poll_task.get();
-
-    poll_task->set_priority(sched::thread::priority_infinity);
+    unsigned pairs = negotiate_queue_pairs();
+    for (unsigned i = 0; i < pairs; i++) {
+        auto attr = sched::thread::attr().name("virtio-net-rx");
+        if (pairs > 1) {
+            //
+            // Bind each Rx poll thread to its own CPU. The MSI-X vector of
+            // the queue follows its thread (see set_affinity_and_wake()) so
+            // both the interrupt and the processing stay on that CPU.
+            //
+            attr = sched::thread::attr().
+                   name("virtio-net-rx" + std::to_string(i)).
+                   pin(sched::cpus[i % sched::cpus.size()]);
+        }
+        _rxq.emplace_back(new rxq(get_virt_queue(2 * i),
+                                  [this, i] { this->receiver(*_rxq[i]); },
+                                  attr));
+        _rxq.back()->poll_task->set_priority(sched::thread::priority_infinity);
+        _txq.emplace_back(aligned_new<txq>(this, get_virt_queue(2 * i + 1)));
+    }
 
     // Please look at the section 5.1.6.1 of virtio specification for explanation
     if (_dev.is_modern()) {
@@ -277,7 +331,7 @@ net::net(virtio_device& dev)
     _ifn->if_qflush = if_qflush;
     _ifn->if_init = if_init;
     _ifn->if_getinfo = if_getinfo;
-    IFQ_SET_MAXLEN(&_ifn->if_snd, _txq.vqueue->size());
+    IFQ_SET_MAXLEN(&_ifn->if_snd, _txq[0]->vqueue->size());
 
     _ifn->if_capabilities = 0;
 
@@ -295,55 +349,182 @@ net::net(virtio_device& dev)
             _ifn->if_capabilities |= IFCAP_LRO;
     }
 
+    // Without guest TSO the host hands us every segment of a TCP stream
+    // separately, so coalesce them in software before the stack sees them
+    if (!_guest_tso4) {
+        _sw_lro = true;
+        _ifn->if_capabilities |= IFCAP_LRO;
+        for (auto&& rxq : _rxq) {
+            tcp_lro_init(&rxq->lro);
+            rxq->lro.ifp = _ifn;
+            rxq->lro.lro_net_channels = true;
+        }
+    }
+
     _ifn->if_capenable = _ifn->if_capabilities | IFCAP_HWSTATS;
 
-    //Start the polling thread before attaching it to the Rx interrupt
-    poll_task->start();
-    _txq.start();
+    //Start the polling threads before attaching them to the Rx interrupts
+    for (auto&& rxq : _rxq) {
+        rxq->poll_task->start();
+    }
+    for (auto&& txq : _txq) {
+        txq->start();
+    }
 
     ether_ifattach(_ifn, _config.mac);
 
+    // Without per-queue vectors a single interrupt has to kick all Rx queues
+    auto wake_rx_tasks = [this] {
+        for (auto&& rxq : _rxq) {
+            rxq->poll_task->wake_with_irq_disabled();
+        }
+    };
+
     interrupt_factory int_factory;
 #if CONF_drivers_pci
-    int_factory.register_msi_bindings = [this,poll_task](interrupt_manager &msi) {
-       msi.easy_register({
-           { 0, [&] { this->_rxq.vqueue->disable_interrupts(); }, poll_task },
-           { 1, [&] { this->_txq.vqueue->disable_interrupts(); }, nullptr }
-       });
+    int_factory.register_msi_bindings = [this](interrupt_manager &msi) {
+       // MSI-X entries are mapped 1:1 to the virtqueue indexes
+       std::vector<msix_binding> bindings;
+       for (unsigned i = 0; i < _rxq.size(); i++) {
+           vring* rx_vq = _rxq[i]->vqueue;
+           vring* tx_vq = _txq[i]->vqueue;
+           bindings.push_back({ 2 * i, [rx_vq] { rx_vq->disable_interrupts(); },
+                                _rxq[i]->poll_task.get() });
+           bindings.push_back({ 2 * i + 1, [tx_vq] { tx_vq->disable_interrupts(); },
+                                nullptr });
+       }
+       msi.easy_register(bindings);
     };
 
-    int_factory.create_pci_interrupt = [this,poll_task](pci::device &pci_dev) {
+    int_factory.create_pci_interrupt = [this,wake_rx_tasks](pci::device &pci_dev) {
         return new pci_interrupt(
             pci_dev,
             [=] { return this->ack_irq(); },
-            [=] { poll_task->wake_with_irq_disabled(); });
+            [=] { wake_rx_tasks(); });
     };
 #endif
 
 #if CONF_drivers_mmio
 #ifdef __aarch64__
-    int_factory.create_spi_edge_interrupt = [this,poll_task]() {
+    int_factory.create_spi_edge_interrupt = [this,wake_rx_tasks]() {
         return new spi_interrupt(
             gic::irq_type::IRQ_TYPE_EDGE,
             _dev.get_irq(),
             [=] { return this->ack_irq(); },
-            [=] { poll_task->wake_with_irq_disabled(); });
+            [=] { wake_rx_tasks(); });
     };
 #else
-    int_factory.create_gsi_edge_interrupt = [this,poll_task]() {
+    int_factory.create_gsi_edge_interrupt = [this,wake_rx_tasks]() {
         return new gsi_edge_interrupt(
             _dev.get_irq(),
-            [=] { if (this->ack_irq()) poll_task->wake_with_irq_disabled(); });
+            [=] { if (this->ack_irq()) wake_rx_tasks(); });
     };
 #endif
 #endif
 
     _dev.register_interrupt(int_factory);
 
-    fill_rx_ring();
+    for (auto&& rxq : _rxq) {
+        fill_rx_ring(*rxq);
+    }
 
     // Step 8
     add_dev_status(VIRTIO_CONFIG_S_DRIVER_OK);
+
+    //
+    // The device uses only the first queue pair until told otherwise, which
+    // can only be done once it is live. If it refuses, the remaining queues
+    // simply stay idle.
+    //
+    if (_rxq.size() > 1) {
+        if (set_queue_pairs(_rxq.size())) {
+            _active_pairs = _rxq.size();
+        } else {
+            net_w("Failed to enable %d queue pairs, using a single one",
+                  (int)_rxq.size());
+        }
+    }
+}
+
+unsigned net::negotiate_queue_pairs()
+{
+    if (!_mq) {
+        return 1;
+    }
+
+    unsigned pairs = std::min<unsigned>(_config.max_virtqueue_pairs,
+                                        sched::cpus.size());
+    if (opt_nic_queues > 0) {
+        pairs = std::min<unsigned>(pairs, opt_nic_queues);
+    }
+
+    // The control virtqueue follows the maximum number of pairs the device
+    // has, whether or not we use them all
+    unsigned ctrl_idx = 2 * _config.max_virtqueue_pairs;
+    _ctrlq = get_virt_queue(ctrl_idx);
+    if (!_ctrlq) {
+        net_w("Control virtqueue %d is missing, using a single queue pair",
+              ctrl_idx);
+        return 1;
+    }
+
+    // We may not be able to activate as many virtqueues as the device offers
+    while (pairs > 1 && !get_virt_queue(2 * pairs - 1)) {
+        pairs--;
+    }
+
+    net_i("Using %d Rx/Tx queue pairs out of %d", pairs,
+          _config.max_virtqueue_pairs);
+
+    return std::max(pairs, 1U);
+}
+
+bool net::ctrl_send_command(u8 class_t, u8 cmd, void* data, u32 len)
+{
+    if (!_ctrlq) {
+        return false;
+    }
+
+    //
+    // The buffers have to be visible to the device so keep them off the
+    // (possibly lazily populated) thread stack.
+    //
+    std::unique_ptr<net_ctrl_hdr> hdr(new net_ctrl_hdr{class_t, cmd});
+    std::unique_ptr<net_ctrl_ack> ack(new net_ctrl_ack(VIRTIO_NET_ERR));
+
+    _ctrlq->init_sg();
+    _ctrlq->add_out_sg(hdr.get(), sizeof(*hdr));
+    _ctrlq->add_out_sg(data, len);
+    _ctrlq->add_in_sg(ack.get(), sizeof(*ack));
+    _ctrlq->add_buf_wait(hdr.get());
+    _ctrlq->kick();
+
+    //
+    // There is no interrupt bound to the control queue and the commands are
+    // rare and handled synchronously by the device - simply poll for the
+    // completion.
+    //
+    while (!_ctrlq->used_ring_not_empty()) {
+        sched::thread::yield();
+    }
+
+    u32 used_len;
+    _ctrlq->get_buf_elem(&used_len);
+    _ctrlq->get_buf_finalize();
+    _ctrlq->get_buf_gc();
+
+    trace_virtio_net_ctrl_cmd(_ifn->if_index, class_t, cmd, *ack);
+
+    return *ack == VIRTIO_NET_OK;
+}
+
+bool net::set_queue_pairs(u16 pairs)
+{
+    std::unique_ptr<net_ctrl_mq> mq(new net_ctrl_mq{pairs});
+
+    return ctrl_send_command(VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+                             mq.get(), sizeof(*mq));
 }
 
 net::~net()
@@ -375,6 +556,16 @@ void net::read_config()
                 (u32)_config.mac[5]);
 
     _mergeable_bufs = get_guest_feature_bit(VIRTIO_NET_F_MRG_RXBUF);
+    _ctrl_vq = get_guest_feature_bit(VIRTIO_NET_F_CTRL_VQ);
+    // The number of queue pairs may only be changed over the control queue
+    _mq = _ctrl_vq && get_guest_feature_bit(VIRTIO_NET_F_MQ);
+    if (_mq) {
+        virtio_conf_read(offsetof(net_config, max_virtqueue_pairs),
+                         &_config.max_virtqueue_pairs,
+                         sizeof(_config.max_virtqueue_pairs));
+    } else {
+        _config.max_virtqueue_pairs = 1;
+    }
     _status = get_guest_feature_bit(VIRTIO_NET_F_STATUS);
     _tso_ecn = get_guest_feature_bit(VIRTIO_NET_F_GUEST_ECN);
     _host_tso_ecn = get_guest_feature_bit(VIRTIO_NET_F_HOST_ECN);
@@ -388,6 +579,7 @@ void net::read_config()
     net_i("Features: %s=%d,%s=%d", "Host TSO ECN", _host_tso_ecn, "CSUM", _csum);
     net_i("Features: %s=%d,%s=%d", "Guest_csum", _guest_csum, "guest tso4", _guest_tso4);
     net_i("Features: %s=%d,%s=%d", "host tso4", _host_tso4, "MRG_RX_BUF", _mergeable_bufs);
+    net_i("Features: %s=%d,%s=%d", "ctrl vq", _ctrl_vq, "max vq pairs", _config.max_virtqueue_pairs);
 
     // If VIRTIO_NET_F_MRG_RXBUF is not negotiated and VIRTIO_NET_F_GUEST_TSO4
     // or VIRTIO_NET_F_GUEST_UFO are, the VirtIO spec mandates the guest to use
@@ -459,9 +651,9 @@ bool net::bad_rx_csum(struct mbuf* m, struct net_hdr* hdr)
     return false;
 }
 
-void net::receiver()
+void net::receiver(struct rxq& rxq)
 {
-    vring* vq = _rxq.vqueue;
+    vring* vq = rxq.vqueue;
     std::vector<iovec> packet;
     u64 rx_drops = 0, rx_packets = 0, csum_ok = 0;
     u64 csum_err = 0, rx_bytes = 0;
@@ -473,8 +665,8 @@ void net::receiver()
         virtio_driver::wait_for_queue(vq, &vring::used_ring_not_empty);
         trace_virtio_net_rx_wake();
 
-        _rxq.stats.rx_bh_wakeups++;
-        _rxq.update_wakeup_stats(rx_packets);
+        rxq.stats.rx_bh_wakeups++;
+        rxq.update_wakeup_stats(rx_packets);
 
         u32 len;
         int nbufs;
@@ -484,13 +676,14 @@ void net::receiver()
         // use local header that we copy out of the mbuf since we're
         // truncating it.
         net_hdr_mrg_rxbuf* mhdr;
+        bool lro = _sw_lro && (_ifn->if_capenable & IFCAP_LRO);
 
         while (void* buffer = vq->get_buf_elem(&len)) {
 
             vq->get_buf_finalize();
 
             if (vq->effective_avail_ring_count() >= refill_thresh)
-                fill_rx_ring();
+                fill_rx_ring(rxq);
 
             // Bad packet/buffer - discard and continue to the next one
             if (len < _hdr_size + ETHER_HDR_LEN) {
@@ -539,9 +732,11 @@ void net::receiver()
             rx_packets++;
             rx_bytes += m_head->M_dat.MH.MH_pkthdr.len;
 
-            bool fast_path = _ifn->if_classifier.post_packet(m_head);
-            if (!fast_path) {
-                (*_ifn->if_input)(_ifn, m_head);
+            if (!lro || tcp_lro_queue(&rxq.lro, m_head) != 0) {
+                bool fast_path = _ifn->if_classifier.post_packet(m_head);
+                if (!fast_path) {
+                    (*_ifn->if_input)(_ifn, m_head);
+                }
             }
 
             trace_virtio_net_rx_packet(_ifn->if_index, rx_bytes);
@@ -552,12 +747,17 @@ void net::receiver()
                 break;
         }
 
+        // Pass up what was coalesced in this batch
+        if (lro) {
+            tcp_lro_flush_all(&rxq.lro);
+        }
+
         // Update the stats
-        _rxq.stats.rx_drops      += rx_drops;
-        _rxq.stats.rx_packets    += rx_packets;
-        _rxq.stats.rx_csum       += csum_ok;
-        _rxq.stats.rx_csum_err   += csum_err;
-        _rxq.stats.rx_bytes      += rx_bytes;
+        rxq.stats.rx_drops      += rx_drops;
+        rxq.stats.rx_packets    += rx_packets;
+        rxq.stats.rx_csum       += csum_ok;
+        rxq.stats.rx_csum_err   += csum_err;
+        rxq.stats.rx_bytes      += rx_bytes;
     }
 }
 
@@ -619,11 +819,11 @@ void net::do_free_large_buffer(void* buffer)
     memory::free_phys_contiguous_aligned(buffer);
 }
 
-void net::fill_rx_ring()
+void net::fill_rx_ring(struct rxq& rxq)
 {
     trace_virtio_net_fill_rx_ring(_ifn->if_index);
     int added = 0;
-    vring* vq = _rxq.vqueue;
+    vring* vq = rxq.vqueue;
 
     int size_in_pages = _use_large_buffers ? LARGE_BUFFER_SIZE_IN_PAGES : 1;
     while (vq->avail_ring_not_empty()) {
@@ -918,6 +1118,8 @@ u64 net::get_driver_features()
                  | (1 << VIRTIO_NET_F_HOST_TSO4)  \
                  | (1 << VIRTIO_NET_F_GUEST_ECN)
                  | (1 << VIRTIO_NET_F_GUEST_UFO)
+                 | (1 << VIRTIO_NET_F_CTRL_VQ)
+                 | (1 << VIRTIO_NET_F_MQ)
             );
 }
 
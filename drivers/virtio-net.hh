@@ -12,9 +12,13 @@
 #include <bsd/sys/net/if_var.h>
 #include <bsd/sys/net/if.h>
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/netinet/in.h>
+#include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/tcp_lro.h>
 
 #include <osv/percpu_xmit.hh>
 #include <osv/contiguous_alloc.hh>
+#include <osv/aligned_new.hh>
 
 #include "drivers/virtio.hh"
 #include "drivers/pci-device.hh"
@@ -220,8 +224,6 @@ public:
 
     void wait_for_queue(vring* queue);
     bool bad_rx_csum(struct mbuf* m, struct net_hdr* hdr);
-    void receiver();
-    void fill_rx_ring();
     mbuf* packet_to_mbuf(const std::vector<iovec>& iovec);
     static void free_buffer_and_refcnt(void* buffer, void* refcnt);
     static void free_large_buffer_and_refcnt(void* buffer, void* refcnt);
@@ -266,6 +268,8 @@ private:
     std::string _driver_name;
     net_config _config;
     bool _mergeable_bufs;
+    bool _ctrl_vq = false;
+    bool _mq = false;
     bool _tso_ecn = false;
     bool _status = false;
     bool _host_tso_ecn = false;
@@ -275,6 +279,7 @@ private:
     bool _host_tso4 = false;
     bool _guest_ufo = false;
     bool _use_large_buffers = false;
+    bool _sw_lro = false;
 
     u32 _hdr_size;
 
@@ -314,12 +319,14 @@ private:
 
     /* Single Rx queue object */
     struct rxq {
-        rxq(vring* vq, std::function<void ()> poll_func)
-            : vqueue(vq), poll_task(sched::thread::make(poll_func, sched::thread::attr().
-                                    name("virtio-net-rx"))) {};
+        rxq(vring* vq, std::function<void ()> poll_func,
+            sched::thread::attr attr)
+            : vqueue(vq), poll_task(sched::thread::make(poll_func, attr)) {};
         vring* vqueue;
         std::unique_ptr<sched::thread> poll_task;
         struct rxq_stats stats = { 0 };
+        // Software LRO state, also counts the coalesced packets
+        struct lro_ctrl lro = {};
 
         void update_wakeup_stats(const u64 wakeup_packets) {
             if_update_wakeup_stats(stats.rx_wakeup_stats, wakeup_packets);
@@ -487,6 +494,45 @@ private:
      */
     void fill_qstats(const struct txq& txq, struct if_data* out_data) const;
 
+    void receiver(struct rxq& rxq);
+    void fill_rx_ring(struct rxq& rxq);
+
+    /**
+     * Select the Tx queue for the given frame: use the flow hash when the
+     * stack has provided one and the current CPU otherwise.
+     * @param m frame to transmit
+     *
+     * @return Tx queue handle
+     */
+    struct txq& select_txq(mbuf* m);
+
+    /**
+     * Compute the number of queue pairs to use. With VIRTIO_NET_F_MQ this is
+     * the number of vCPUs (or the --nic-queues value if smaller), capped by
+     * what the device offers.
+     */
+    unsigned negotiate_queue_pairs();
+
+    /**
+     * Send a single command over the control virtqueue and wait for the
+     * device to acknowledge it.
+     * @param class_t command class (VIRTIO_NET_CTRL_*)
+     * @param cmd command within the class
+     * @param data command specific payload
+     * @param len length of the payload
+     *
+     * @return TRUE if the device has acknowledged the command
+     */
+    bool ctrl_send_command(u8 class_t, u8 cmd, void* data, u32 len);
+
+    /**
+     * Enable the given number of Rx/Tx queue pairs on the device.
+     * @param pairs number of queue pairs
+     *
+     * @return TRUE on success
+     */
+    bool set_queue_pairs(u16 pairs);
+
     void free_buffer(void *buffer)
     {
         if (_use_large_buffers) {
@@ -496,9 +542,16 @@ private:
         }
     }
 
-    /* We currently support only a single Rx+Tx queue */
-    struct rxq _rxq;
-    struct txq _txq;
+    /*
+     * Rx/Tx queue pairs: a single pair unless VIRTIO_NET_F_MQ has been
+     * negotiated, in which case there is a pair per vCPU. The Rx queue of the
+     * i-th pair is the virtqueue 2*i and its Tx queue is the virtqueue 2*i+1.
+     */
+    std::vector<std::unique_ptr<struct rxq>> _rxq;
+    std::vector<std::unique_ptr<struct txq, aligned_new_deleter<struct txq>>> _txq;
+    vring* _ctrlq = nullptr;
+    // Number of queue pairs the device has agreed to use
+    unsigned _active_pairs = 1;
 
     //maintains the virtio instance number for multiple drives
     static int _instance;
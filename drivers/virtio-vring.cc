@@ -35,6 +35,10 @@ TRACEPOINT(trace_vring_get_buf_elem, "vring=%p _used_ring_host_head %d "
 TRACEPOINT(trace_vring_get_buf_gc, "vring=%p _used_ring_guest_head %d "
                                    "_used_ring_host_head %d", void*, int, int);
 TRACEPOINT(trace_vring_get_buf_ret, "vring=%p _avail_count %d", void*, int);
+TRACEPOINT(trace_vring_packed_add_buf, "vring=%p queue=%d, id=%d, idx=%d, wrap=%d",
+                                       void*, u16, u16, u16, bool);
+TRACEPOINT(trace_vring_packed_get_buf_elem, "vring=%p _packed_used_idx %d wrap %d",
+                                            void*, u16, bool);
 
 namespace virtio {
 
@@ -42,8 +46,19 @@ namespace virtio {
     {
         _driver = driver;
         _q_index = q_index;
+        _packed = driver->get_packed_ring_cap();
+        _packed_desc = nullptr;
+        _driver_event = nullptr;
+        _device_event = nullptr;
+        _packed_state = nullptr;
+        _packed_used_ids = nullptr;
         // Alloc enough pages for the vring...
         size_t alignment = driver->get_vring_alignment();
+        if (_packed) {
+            _num = num;
+            packed_init(alignment);
+            return;
+        }
         size_t sz = VIRTIO_ALIGN(vring::get_size(num, alignment), alignment);
         _vring_ptr = memory::alloc_phys_contiguous_aligned(sz, 4096);
         memset(_vring_ptr, 0, sz);
@@ -76,10 +91,64 @@ namespace virtio {
         _use_indirect = false;
     }
 
+    void vring::packed_init(size_t alignment)
+    {
+        //
+        // The descriptor ring is followed by the driver and the device event
+        // suppression areas (16 and 4 bytes aligned respectively, see 2.8.10
+        // of the virtio spec).
+        //
+        size_t desc_sz = _num * sizeof(vring_packed_desc);
+        size_t sz = VIRTIO_ALIGN(desc_sz + 2 * sizeof(vring_packed_event),
+                                 alignment);
+        _vring_ptr = memory::alloc_phys_contiguous_aligned(sz, 4096);
+        memset(_vring_ptr, 0, sz);
+
+        _packed_desc = static_cast<vring_packed_desc*>(_vring_ptr);
+        _driver_event = reinterpret_cast<vring_packed_event*>(_vring_ptr + desc_sz);
+        _device_event = _driver_event + 1;
+
+        // Both wrap counters start at 1
+        _packed_avail_idx = 0;
+        _avail_wrap_counter = true;
+        _packed_used_idx = 0;
+        _used_wrap_counter = true;
+
+        _packed_state = new packed_buf_state[_num];
+        for (unsigned i = 0; i < _num; i++) {
+            _packed_state[i] = { 0, static_cast<u16>(i + 1), nullptr };
+        }
+        _packed_free_id = 0;
+        _packed_used_ids = new u16[_num];
+        _packed_used_put = 0;
+        _packed_used_get = 0;
+
+        // The split ring pointers are never used in the packed mode
+        _desc = nullptr;
+        _avail = nullptr;
+        _used = nullptr;
+        _avail_event = nullptr;
+        _used_event = nullptr;
+
+        _cookie = new void*[_num];
+
+        _avail_head = 0;
+        _used_ring_guest_head = 0;
+        _used_ring_host_head = 0;
+        _avail_added_since_kick = 0;
+        _avail_count = _num;
+
+        _sg_vec.reserve(max_sgs);
+
+        _use_indirect = false;
+    }
+
     vring::~vring()
     {
         memory::free_phys_contiguous_aligned(_vring_ptr);
         delete [] _cookie;
+        delete [] _packed_state;
+        delete [] _packed_used_ids;
     }
 
     u64 vring::get_paddr()
@@ -89,16 +158,25 @@ namespace virtio {
 
     u64 vring::get_desc_addr()
     {
+        if (_packed) {
+            return mmu::virt_to_phys(_packed_desc);
+        }
         return mmu::virt_to_phys(_desc);
     }
 
     u64 vring::get_avail_addr()
     {
+        if (_packed) {
+            return mmu::virt_to_phys(_driver_event);
+        }
         return mmu::virt_to_phys(_avail);
     }
 
     u64 vring::get_used_addr()
     {
+        if (_packed) {
+            return mmu::virt_to_phys(_device_event);
+        }
         return mmu::virt_to_phys(_used);
     }
 
@@ -112,6 +190,10 @@ namespace virtio {
     void vring::disable_interrupts()
     {
         trace_virtio_disable_interrupts(this);
+        if (_packed) {
+            packed_disable_interrupts();
+            return;
+        }
         _avail->disable_interrupt();
     }
 
@@ -130,6 +212,10 @@ namespace virtio {
     void vring::enable_interrupts()
     {
         trace_virtio_enable_interrupts(this);
+        if (_packed) {
+            packed_enable_interrupts();
+            return;
+        }
         _avail->enable_interrupt();
         set_used_event(_used_ring_host_head, std::memory_order_relaxed);
         std::atomic_thread_fence(std::memory_order_seq_cst);
@@ -138,6 +224,10 @@ namespace virtio {
     bool
     vring::add_buf(void* cookie) {
 
+            if (_packed) {
+                return packed_add_buf(cookie);
+            }
+
             get_buf_gc();
 
             trace_virtio_add_buf(this, _q_index, _avail_count);
@@ -206,6 +296,11 @@ namespace virtio {
     {
             vring_used_elem elem;
 
+            if (_packed) {
+                packed_get_buf_gc();
+                return;
+            }
+
             trace_vring_get_buf_gc(this, _used_ring_guest_head,
                                    _used_ring_host_head);
 
@@ -243,6 +338,10 @@ namespace virtio {
             vring_used_elem elem;
             void* cookie = nullptr;
 
+            if (_packed) {
+                return packed_get_buf_elem(len);
+            }
+
             // need to trim the free running counter w/ the array size
             int used_ptr = _used_ring_host_head & (_num - 1);
             u16 used_idx = _used->_idx.load(std::memory_order_acquire);
@@ -279,11 +378,17 @@ namespace virtio {
 
     bool vring::used_ring_not_empty() const
     {
+        if (_packed) {
+            return packed_used_ring_not_empty();
+        }
         return _used_ring_host_head != _used->_idx.load(std::memory_order_relaxed);
     }
 
     bool vring::used_ring_is_half_empty() const
     {
+        if (_packed) {
+            return packed_used_ring_is_half_empty();
+        }
         return _used->_idx.load(std::memory_order_relaxed) - _used_ring_host_head > (u16)(_num / 2);
     }
 
@@ -296,6 +401,10 @@ namespace virtio {
     vring::kick() {
         bool kicked = true;
 
+        if (_packed) {
+            return packed_kick();
+        }
+
         if (_driver->get_event_idx_cap()) {
 
             std::atomic_thread_fence(std::memory_order_seq_cst);
@@ -334,6 +443,266 @@ namespace virtio {
         return false;
     }
 
+    bool vring::packed_desc_is_used(u16 idx, bool wrap_counter) const
+    {
+        u16 flags = _packed_desc[idx]._flags.load(std::memory_order_relaxed);
+        bool avail = flags & vring_packed_desc::VRING_PACKED_DESC_F_AVAIL;
+        bool used = flags & vring_packed_desc::VRING_PACKED_DESC_F_USED;
+
+        return avail == used && used == wrap_counter;
+    }
+
+    bool vring::packed_add_buf(void* cookie)
+    {
+        get_buf_gc();
+
+        trace_virtio_add_buf(this, _q_index, _avail_count);
+
+        int desc_needed = _sg_vec.size();
+        bool indirect = false;
+        if (use_indirect(desc_needed)) {
+            desc_needed = 1;
+            indirect = true;
+        }
+
+        if (_avail_count < desc_needed) {
+            //make sure the interrupts get there
+            kick();
+
+            return false;
+        }
+
+        // Every buffer on the ring holds a distinct id, so there is always
+        // a free one as long as there is a free descriptor
+        u16 id = _packed_free_id;
+        auto& state = _packed_state[id];
+
+        u16 head = _packed_avail_idx;
+        u16 idx = head;
+        u16 head_flags = 0;
+        auto avail_used_flags = [this] {
+            return _avail_wrap_counter ?
+                   vring_packed_desc::VRING_PACKED_DESC_F_AVAIL :
+                   vring_packed_desc::VRING_PACKED_DESC_F_USED;
+        };
+
+        if (indirect) {
+            auto table = static_cast<vring_packed_desc*>(
+                alloc_phys_contiguous_aligned(_sg_vec.size() * sizeof(vring_packed_desc), 16));
+            if (!table) {
+                return false;
+            }
+            // The device walks an indirect table sequentially, no chaining
+            for (unsigned i = 0; i < _sg_vec.size(); i++) {
+                table[i]._paddr = _sg_vec[i]._paddr;
+                table[i]._len = _sg_vec[i]._len;
+                table[i]._id = 0;
+                table[i]._flags.store(_sg_vec[i]._flags, std::memory_order_relaxed);
+            }
+            _packed_desc[idx]._paddr = mmu::virt_to_phys(table);
+            _packed_desc[idx]._len = _sg_vec.size() * sizeof(vring_packed_desc);
+            _packed_desc[idx]._id = id;
+            head_flags = vring_desc::VRING_DESC_F_INDIRECT | avail_used_flags();
+            state.indirect = table;
+            if (++idx >= _num) {
+                idx = 0;
+                _avail_wrap_counter = !_avail_wrap_counter;
+            }
+        } else {
+            for (unsigned i = 0; i < _sg_vec.size(); i++) {
+                u16 flags = _sg_vec[i]._flags | avail_used_flags();
+                if (i + 1 < _sg_vec.size()) {
+                    flags |= vring_desc::VRING_DESC_F_NEXT;
+                }
+                _packed_desc[idx]._paddr = _sg_vec[i]._paddr;
+                _packed_desc[idx]._len = _sg_vec[i]._len;
+                _packed_desc[idx]._id = id;
+                if (idx == head) {
+                    head_flags = flags;
+                } else {
+                    _packed_desc[idx]._flags.store(flags, std::memory_order_relaxed);
+                }
+                if (++idx >= _num) {
+                    idx = 0;
+                    _avail_wrap_counter = !_avail_wrap_counter;
+                }
+            }
+            state.indirect = nullptr;
+        }
+
+        trace_vring_packed_add_buf(this, _q_index, id, head, _avail_wrap_counter);
+
+        _packed_free_id = state.next;
+        state.num = desc_needed;
+        _cookie[id] = cookie;
+
+        _packed_avail_idx = idx;
+        // The kick logic works in ring slots rather than buffers
+        _avail_added_since_kick += desc_needed;
+        _avail_count -= desc_needed;
+
+        // Expose the head last so the device sees the whole chain at once
+        _packed_desc[head]._flags.store(head_flags, std::memory_order_release);
+
+        return true;
+    }
+
+    void* vring::packed_get_buf_elem(u32* len)
+    {
+        trace_vring_packed_get_buf_elem(this, _packed_used_idx, _used_wrap_counter);
+
+        if (!packed_desc_is_used(_packed_used_idx, _used_wrap_counter)) {
+            return nullptr;
+        }
+        // Read the rest of the descriptor only after its flags
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        auto& desc = _packed_desc[_packed_used_idx];
+        *len = desc._len;
+
+        return _cookie[desc._id];
+    }
+
+    void vring::packed_advance_used()
+    {
+        u16 id = _packed_desc[_packed_used_idx]._id;
+
+        // The device skips the rest of the chain when it writes a used
+        // descriptor
+        _packed_used_idx += _packed_state[id].num;
+        if (_packed_used_idx >= _num) {
+            _packed_used_idx -= _num;
+            _used_wrap_counter = !_used_wrap_counter;
+        }
+
+        _cookie[id] = nullptr;
+        _packed_used_ids[_packed_used_put] = id;
+        if (++_packed_used_put == _num) {
+            _packed_used_put = 0;
+        }
+    }
+
+    void vring::packed_update_used_event()
+    {
+        if (_driver->get_event_idx_cap() &&
+            _driver_event->_flags.load(std::memory_order_relaxed) !=
+            vring_packed_event::RING_EVENT_FLAGS_DISABLE) {
+            trace_vring_update_used_event(this, _used_ring_host_head);
+            _driver_event->_off_wrap.store(_packed_used_idx |
+                (_used_wrap_counter << vring_packed_event::RING_EVENT_WRAP_COUNTER_SHIFT),
+                std::memory_order_release);
+        }
+    }
+
+    void vring::packed_get_buf_gc()
+    {
+        trace_vring_get_buf_gc(this, _used_ring_guest_head,
+                               _used_ring_host_head);
+
+        while (_used_ring_guest_head != _used_ring_host_head) {
+            u16 id = _packed_used_ids[_packed_used_get];
+            if (++_packed_used_get == _num) {
+                _packed_used_get = 0;
+            }
+            auto& state = _packed_state[id];
+
+            if (state.indirect) {
+                free_phys_contiguous_aligned(state.indirect);
+                state.indirect = nullptr;
+            }
+
+            _avail_count += state.num;
+            state.next = _packed_free_id;
+            _packed_free_id = id;
+            _used_ring_guest_head++;
+        }
+
+        trace_vring_get_buf_ret(this, _avail_count);
+    }
+
+    bool vring::packed_used_ring_not_empty() const
+    {
+        return packed_desc_is_used(_packed_used_idx, _used_wrap_counter);
+    }
+
+    bool vring::packed_used_ring_is_half_empty() const
+    {
+        //
+        // There is no used index to compare against, so check whether the
+        // device has already written half a ring ahead of us. This is exact
+        // for single descriptor buffers and a good enough estimate otherwise.
+        //
+        u16 idx = _packed_used_idx + _num / 2;
+        bool wrap_counter = _used_wrap_counter;
+        if (idx >= _num) {
+            idx -= _num;
+            wrap_counter = !wrap_counter;
+        }
+
+        return packed_desc_is_used(idx, wrap_counter);
+    }
+
+    bool vring::packed_kick()
+    {
+        bool kicked;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        u16 flags = _device_event->_flags.load(std::memory_order_relaxed);
+        if (flags == vring_packed_event::RING_EVENT_FLAGS_DESC) {
+            u16 off_wrap = _device_event->_off_wrap.load(std::memory_order_relaxed);
+            u16 event_idx = off_wrap & ~(1 << vring_packed_event::RING_EVENT_WRAP_COUNTER_SHIFT);
+            bool wrap_counter = off_wrap >> vring_packed_event::RING_EVENT_WRAP_COUNTER_SHIFT;
+            if (wrap_counter != _avail_wrap_counter) {
+                event_idx -= _num;
+            }
+
+            u16 new_idx = _packed_avail_idx;
+            u16 old_idx = new_idx - _avail_added_since_kick;
+            // Ring positions wrap at _num, so once a whole ring was added
+            // since the last kick the event index may look already passed
+            kicked = _avail_added_since_kick >= _num ||
+                     (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old_idx);
+
+            trace_virtio_kicked_event_idx(this, kicked, _q_index,
+                    new_idx, event_idx, _avail_added_since_kick);
+        } else if (flags == vring_packed_event::RING_EVENT_FLAGS_DISABLE) {
+            return false;
+        } else {
+            kicked = true;
+        }
+
+        // See the comment in kick() about kicking every half u16 range
+        if (kicked || (_avail_added_since_kick >= (u16)(~0) / 2)) {
+            _driver->kick(_q_index);
+            _avail_added_since_kick = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    void vring::packed_disable_interrupts()
+    {
+        _driver_event->_flags.store(vring_packed_event::RING_EVENT_FLAGS_DISABLE,
+                                    std::memory_order_relaxed);
+    }
+
+    void vring::packed_enable_interrupts()
+    {
+        if (_driver->get_event_idx_cap()) {
+            _driver_event->_off_wrap.store(_packed_used_idx |
+                (_used_wrap_counter << vring_packed_event::RING_EVENT_WRAP_COUNTER_SHIFT),
+                std::memory_order_relaxed);
+            _driver_event->_flags.store(vring_packed_event::RING_EVENT_FLAGS_DESC,
+                                        std::memory_order_relaxed);
+        } else {
+            _driver_event->_flags.store(vring_packed_event::RING_EVENT_FLAGS_ENABLE,
+                                        std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
     void
     vring::add_buf_wait(void* cookie)
     {
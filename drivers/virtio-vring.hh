@@ -119,6 +119,50 @@ class virtio_driver;
         //std::atomic<u16> avail_event;
     };
 
+    // Packed ring descriptor, used both for available and used buffers
+    class vring_packed_desc {
+    public:
+        enum flags {
+            // Set by the driver to the value of its wrap counter when making
+            // the descriptor available, by the device to the value of its
+            // wrap counter when marking it used
+            VRING_PACKED_DESC_F_AVAIL=1 << 7,
+            // Set by the driver to the inverse of its wrap counter, by the
+            // device to the value of its wrap counter
+            VRING_PACKED_DESC_F_USED=1 << 15
+        };
+
+        u64 _paddr;
+        u32 _len;
+        // Buffer id, written back by the device in the used descriptor
+        u16 _id;
+        // Using std::atomic since it hands the descriptor over to the other
+        // side
+        std::atomic<u16> _flags;
+    };
+
+    // Driver and device event suppression areas of a packed ring
+    class vring_packed_event {
+    public:
+        enum flags {
+            // Notify on every used/available buffer
+            RING_EVENT_FLAGS_ENABLE=0,
+            // Do not notify at all
+            RING_EVENT_FLAGS_DISABLE=1,
+            // Notify when reaching the descriptor given by _off_wrap. Only
+            // valid with VIRTIO_RING_F_EVENT_IDX
+            RING_EVENT_FLAGS_DESC=2
+        };
+
+        enum {
+            RING_EVENT_WRAP_COUNTER_SHIFT=15
+        };
+
+        // Descriptor ring offset (bits 0-14) and wrap counter (bit 15)
+        std::atomic<u16> _off_wrap;
+        std::atomic<u16> _flags;
+    };
+
     class vring {
     public:
 
@@ -149,6 +193,9 @@ class virtio_driver;
          */
         __attribute__((always_inline)) inline // Necessary because of issue #1029
         void get_buf_finalize(bool update_host = true) {
+            if (_packed) {
+                packed_advance_used();
+            }
             _used_ring_host_head++;
 
             trace_vring_get_buf_finalize(this, _used_ring_host_head);
@@ -160,6 +207,10 @@ class virtio_driver;
 
         __attribute__((always_inline)) inline // Necessary because of issue #1029
         void update_used_event() {
+            if (_packed) {
+                packed_update_used_event();
+                return;
+            }
             // only let the host know about our used idx in case irq are enabled
             if (_avail->interrupt_on()) {
                 trace_vring_update_used_event(this, _used_ring_host_head);
@@ -188,6 +239,9 @@ class virtio_driver;
         bool kick();
         // Total number of descriptors in ring
         int size() {return _num;}
+        // TRUE if this is a packed (VIRTIO_F_RING_PACKED) rather than a split
+        // ring
+        bool is_packed() const {return _packed;}
 
         u16 index() {return _q_index; }
 
@@ -247,6 +301,20 @@ class virtio_driver;
 
     private:
 
+        // Packed ring variants of the ring operations above
+        void packed_init(size_t alignment);
+        bool packed_add_buf(void* cookie);
+        void* packed_get_buf_elem(u32* len);
+        void packed_get_buf_gc();
+        void packed_advance_used();
+        void packed_update_used_event();
+        bool packed_used_ring_not_empty() const;
+        bool packed_used_ring_is_half_empty() const;
+        bool packed_kick();
+        void packed_disable_interrupts();
+        void packed_enable_interrupts();
+        bool packed_desc_is_used(u16 idx, bool wrap_counter) const;
+
         // Up pointer
         virtio_driver* _driver;
         u16 _q_index;
@@ -283,6 +351,39 @@ class virtio_driver;
         std::atomic<u16>* _used_event;
         // A flag set by driver to turn on/off indirect descriptor
         bool _use_indirect;
+
+        // Packed ring state, only valid when _packed is set. The used
+        // descriptors are consumed in ring order just like the split used
+        // ring, so the _used_ring_host_head/_used_ring_guest_head counters
+        // keep their meaning and _packed_used_ids remembers the buffer ids
+        // between get_buf_finalize() and get_buf_gc().
+        bool _packed;
+        vring_packed_desc* _packed_desc;
+        // Driver area: our interrupt suppression
+        vring_packed_event* _driver_event;
+        // Device area: the device notification suppression
+        vring_packed_event* _device_event;
+        // Next descriptor to make available and its wrap counter
+        u16 _packed_avail_idx;
+        bool _avail_wrap_counter;
+        // Next descriptor expected to be used and its wrap counter
+        u16 _packed_used_idx;
+        bool _used_wrap_counter;
+        // Per buffer id: number of ring descriptors it takes, the indirect
+        // table (if any) and the free id list link
+        struct packed_buf_state {
+            u16 num;
+            u16 next;
+            vring_packed_desc* indirect;
+        };
+        packed_buf_state* _packed_state;
+        u16 _packed_free_id;
+        u16* _packed_used_ids;
+        // Unlike a split ring, a packed one may have any size, so the free
+        // running counters above can not index _packed_used_ids. These are
+        // the slots get_buf_finalize() writes and get_buf_gc() reads next.
+        u16 _packed_used_put;
+        u16 _packed_used_get;
     };
 
 
@@ -164,6 +164,8 @@ void vmxnet3::fill_stats(struct if_data* out_data) const
     out_data->ifi_ibytes   += _rxq[0].stats.rx_bytes;
     out_data->ifi_iqdrops  += _rxq[0].stats.rx_drops;
     out_data->ifi_ierrors  += _rxq[0].stats.rx_csum_err;
+    out_data->ifi_ilro_queued  += _rxq[0].lro.lro_queued;
+    out_data->ifi_ilro_flushed += _rxq[0].lro.lro_flushed;
     out_data->ifi_opackets += _txq[0].stats.tx_packets;
     out_data->ifi_obytes   += _txq[0].stats.tx_bytes;
     out_data->ifi_oerrors  += _txq[0].stats.tx_err + _txq[0].stats.tx_drops;
@@ -206,6 +208,9 @@ void vmxnet3_rxqueue::init(struct ifnet* ifn, pci::bar *bar0)
 {
     _ifn = ifn;
     _bar0 = bar0;
+    tcp_lro_init(&lro);
+    lro.ifp = ifn;
+    lro.lro_net_channels = true;
     for (unsigned i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
         layout->cmd_ring[i] = _cmd_rings[i].get_desc_pa();
         layout->cmd_ring_len[i] = _cmd_rings[i].get_desc_num();
@@ -789,6 +794,9 @@ void vmxnet3_rxqueue::receive_work()
         do {
             receive();
         } while(available());
+
+        // Pass up what was coalesced in this batch
+        tcp_lro_flush_all(&lro);
     }
 }
 
@@ -924,6 +932,9 @@ void vmxnet3_rxqueue::input(vmxnet3_rx_compdesc *rxcd, struct mbuf *m)
         checksum(rxcd, m);
     stats.rx_packets++;
     stats.rx_bytes += m->M_dat.MH.MH_pkthdr.len;
+    if ((_ifn->if_capenable & IFCAP_LRO) && tcp_lro_queue(&lro, m) == 0) {
+        return;
+    }
     bool fast_path = _ifn->if_classifier.post_packet(m);
     if (!fast_path) {
         (*_ifn->if_input)(_ifn, m);
@@ -13,6 +13,9 @@
 #include <bsd/sys/net/if_var.h>
 #include <bsd/sys/net/if.h>
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/netinet/in.h>
+#include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/tcp_lro.h>
 
 #include "drivers/driver.hh"
 #include "drivers/vmxnet3-queues.hh"
@@ -235,6 +238,9 @@ public:
         u64 rx_bh_wakeups; /* number of timer Rx BH has been woken up */
         wakeup_stats rx_wakeup_stats;
     } stats = { 0 };
+    // Software LRO state, also counts the coalesced packets. The device
+    // is asked to do LRO, but hosts do not always honour that.
+    struct lro_ctrl lro = {};
     std::unique_ptr<sched::thread> task;
 
 private:
@@ -140,6 +140,10 @@ void read_partition_table(struct device *dev)
 		new_dev->offset = (off_t)entry->rela_sector << 9;
 		new_dev->size = (off_t)entry->total_sectors << 9;
 		new_dev->max_io_size = dev->max_io_size;
+		new_dev->poll_us = dev->poll_us;
+		new_dev->max_discard_size = dev->max_discard_size;
+		new_dev->discard_alignment = dev->discard_alignment;
+		new_dev->max_write_zeroes_size = dev->max_write_zeroes_size;
 		new_dev->private_data = dev->private_data;
 		device_set_softc(new_dev, device_get_softc(dev));
 
@@ -150,6 +154,25 @@ void read_partition_table(struct device *dev)
 	brelse(bp);
 }
 
+/*
+ * Set the completion polling budget of the disk @dev is on (see
+ * BLKPOLLSET). The disk and its partitions share their queues and private
+ * data, so they all get the same budget, whichever of them it is set on.
+ */
+void device_set_poll(struct device *dev, unsigned poll_us)
+{
+	struct device *tmp;
+
+	sched_lock();
+	for (tmp = device_list; tmp != NULL; tmp = tmp->next) {
+		if (tmp == dev || (tmp->driver == dev->driver && dev->private_data &&
+		    tmp->private_data == dev->private_data)) {
+			tmp->poll_us = poll_us;
+		}
+	}
+	sched_unlock();
+}
+
 void device_register(struct device *dev, const char *name, int flags)
 {
 	size_t len;
@@ -185,6 +208,10 @@ void device_register(struct device *dev, const char *name, int flags)
 	dev->private_data = priv;
 	dev->next = device_list;
 	dev->max_io_size = UINT_MAX;
+	dev->poll_us = 0;
+	dev->max_discard_size = 0;
+	dev->discard_alignment = 0;
+	dev->max_write_zeroes_size = 0;
 	device_list = dev;
 
 	sched_unlock();
@@ -13,6 +13,7 @@
 #include <osv/sched.hh>
 #include <osv/mmu.hh>
 #include <osv/pid.h>
+#include <osv/syscalls.hh>
 
 #include "fs/pseudofs/pseudofs.hh"
 
@@ -178,6 +179,8 @@ procfs_mount(mount* mp, const char *dev, int flags, const void* data)
 
     root->add("cpuinfo", inode_count++, [] { return processor::features_str(); });
     root->add("meminfo", inode_count++, [] { return pseudofs::meminfo("MemTotal:\t%ld kB\nMemFree: \t%ld kB\n"); });
+    root->add("vmstat", inode_count++, mmu::procfs_vmstat);
+    root->add("syscalls", inode_count++, procfs_syscalls);
 
     vp->v_data = static_cast<void*>(root);
 
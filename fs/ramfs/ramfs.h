@@ -31,7 +31,7 @@
 #define _RAMFS_H
 
 #include <osv/prex.h>
-#include <map>
+#include <vector>
 
 /* #define DEBUG_RAMFS 1 */
 
@@ -43,35 +43,43 @@
 
 #define ASSERT(e)    assert(e)
 
-struct ramfs_file_segment {
-    size_t size;
-    char *data;
-};
-
 /*
  * File/directory node for RAMFS
  */
 struct ramfs_node {
     struct ramfs_node *rn_next;   /* next node in the same directory */
+    struct ramfs_node *rn_prev;   /* previous node in the same directory */
     struct ramfs_node *rn_child;  /* first child node */
+    struct ramfs_node *rn_last_child; /* last child node */
     int rn_type;    /* file or directory */
     char *rn_name;    /* name (null-terminated) */
     size_t rn_namelen;    /* length of name not including terminator */
     size_t rn_size;    /* file size */
     uint64_t inode_no;
 
-    /* Holds data for both symlinks and regular files.
-     * Each ramfs_file_segment holds single chunk of file and is keyed
-     * in the map by its offset in that file; the first entry will have a key 0
-     * and hold the very first chunk of the file. This way as file grows
-     * we do not need to free old and allocate new memory buffer, instead
-     * we only allocate new file segment for new chunk of the file and add
-     * it to the map */
-    std::map<off_t,struct ramfs_file_segment> *rn_file_segments_by_offset;
-    /* Sum of sizes of all segments - typically bigger than actual file size
-     * We could have iterated over all entries in the map to calculate it
-     * but it is faster to cache it as a field */
-    size_t rn_total_segments_size;
+    /* Directories index their children by name in a hash table of
+     * rn_nbuckets chains linked by rn_hash_next, which grows with
+     * the number of children so that lookups stay O(1) */
+    struct ramfs_node **rn_buckets;
+    size_t rn_nbuckets;
+    size_t rn_nchildren;
+    struct ramfs_node *rn_hash_next; /* next node in the same bucket */
+    uint32_t rn_hash;    /* hash of the name */
+    /* Directory offset of the node, assigned in increasing order as nodes
+     * are added to the directory so that readdir() can resume after
+     * the last returned node even if nodes were removed meanwhile */
+    off_t rn_dir_offset;
+    off_t rn_next_dir_offset;    /* offset for the next child */
+    struct ramfs_node *rn_readdir_hint;    /* last child returned by readdir() */
+
+    /* Holds data of regular files, one page per entry indexed by the page
+     * number in the file. Null entries are holes which read as zeros.
+     * The pages are mapped directly by mmap(). */
+    std::vector<void *> *rn_pages;
+    /* Holds data of symlinks and of files from bootfs, in which case
+     * it points straight into the kernel image and rn_owns_buf is false.
+     * Such files move their data into pages when written to or mapped. */
+    char *rn_buf;
 
     struct timespec rn_ctime;
     struct timespec rn_atime;
@@ -79,6 +87,7 @@ struct ramfs_node {
 
     int rn_mode;
     bool rn_owns_buf;
+    bool rn_mapped;    /* pages may be mapped by the page cache */
     int rn_ref_count;
     bool rn_removed;
 };
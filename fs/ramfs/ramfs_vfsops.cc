@@ -28,15 +28,19 @@
  */
 
 #include <errno.h>
+#include <atomic>
 
 #include <osv/vnode.h>
 #include <osv/mount.h>
 #include <osv/dentry.h>
+#include <fs/vfs/vfs_id.h>
 
 #include "ramfs.h"
 
 extern struct vnops ramfs_vnops;
 
+static std::atomic<long> ramfs_mounts(0);
+
 static int ramfs_mount(struct mount *mp, const char *dev, int flags, const void *data);
 
 static int ramfs_unmount(struct mount *mp, int flags);
@@ -72,6 +76,10 @@ ramfs_mount(struct mount *mp, const char *dev, int flags, const void *data)
     if (np == NULL)
         return ENOMEM;
     mp->m_root->d_vnode->v_data = np;
+
+    /* The page cache tells files apart by file system id and inode number */
+    mp->m_fsid.__val[0] = ++ramfs_mounts;
+    mp->m_fsid.__val[1] = RAMFS_ID >> 32;
     return 0;
 }
 
@@ -45,12 +45,19 @@
 #include <osv/file.h>
 #include <osv/mount.h>
 #include <osv/vnode_attr.h>
+#include <osv/mempool.hh>
+#include <osv/pagecache.hh>
 
 #include "ramfs.h"
 
 static mutex_t ramfs_lock = MUTEX_INITIALIZER;
 static uint64_t inode_count = 1; /* inode 0 is reserved to root */
 
+/* Holes in files read from here */
+static const char ramfs_zero_page[PAGE_SIZE] = {};
+
+#define RAMFS_MIN_BUCKETS 8
+
 static void
 set_times_to_now(struct timespec *time1, struct timespec *time2 = nullptr, struct timespec *time3 = nullptr)
 {
@@ -67,6 +74,127 @@ set_times_to_now(struct timespec *time1, struct timespec *time2 = nullptr, struc
     }
 }
 
+/*
+ * FNV-1a hash of a directory entry name
+ */
+static uint32_t
+ramfs_hash(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void
+ramfs_index_resize(struct ramfs_node *dnp, size_t nbuckets)
+{
+    auto buckets = (ramfs_node **) calloc(nbuckets, sizeof(ramfs_node *));
+    if (buckets == NULL) {
+        /* Keep using the old table, only with longer chains */
+        return;
+    }
+    for (size_t i = 0; i < dnp->rn_nbuckets; i++) {
+        struct ramfs_node *np = dnp->rn_buckets[i];
+        while (np != NULL) {
+            struct ramfs_node *next = np->rn_hash_next;
+            auto bucket = &buckets[np->rn_hash & (nbuckets - 1)];
+            np->rn_hash_next = *bucket;
+            *bucket = np;
+            np = next;
+        }
+    }
+    free(dnp->rn_buckets);
+    dnp->rn_buckets = buckets;
+    dnp->rn_nbuckets = nbuckets;
+}
+
+static void
+ramfs_index_insert(struct ramfs_node *dnp, struct ramfs_node *np)
+{
+    if (dnp->rn_nchildren >= dnp->rn_nbuckets) {
+        ramfs_index_resize(dnp, dnp->rn_nbuckets * 2);
+    }
+    np->rn_hash = ramfs_hash(np->rn_name, np->rn_namelen);
+    auto bucket = &dnp->rn_buckets[np->rn_hash & (dnp->rn_nbuckets - 1)];
+    np->rn_hash_next = *bucket;
+    *bucket = np;
+    dnp->rn_nchildren++;
+}
+
+static void
+ramfs_index_remove(struct ramfs_node *dnp, struct ramfs_node *np)
+{
+    auto prev = &dnp->rn_buckets[np->rn_hash & (dnp->rn_nbuckets - 1)];
+    while (*prev != np) {
+        prev = &(*prev)->rn_hash_next;
+    }
+    *prev = np->rn_hash_next;
+    np->rn_hash_next = NULL;
+    dnp->rn_nchildren--;
+}
+
+static struct ramfs_node *
+ramfs_index_find(struct ramfs_node *dnp, const char *name, size_t len)
+{
+    uint32_t hash = ramfs_hash(name, len);
+    struct ramfs_node *np = dnp->rn_buckets[hash & (dnp->rn_nbuckets - 1)];
+    for (; np != NULL; np = np->rn_hash_next) {
+        if (np->rn_hash == hash && np->rn_namelen == len &&
+            memcmp(name, np->rn_name, len) == 0) {
+            return np;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Link a node to the end of the directory list and to the index.
+ * Called with ramfs_lock held.
+ */
+static void
+ramfs_link_node(struct ramfs_node *dnp, struct ramfs_node *np)
+{
+    ramfs_index_insert(dnp, np);
+
+    np->rn_next = NULL;
+    np->rn_prev = dnp->rn_last_child;
+    if (dnp->rn_last_child == NULL) {
+        dnp->rn_child = np;
+    } else {
+        dnp->rn_last_child->rn_next = np;
+    }
+    dnp->rn_last_child = np;
+    np->rn_dir_offset = dnp->rn_next_dir_offset++;
+}
+
+/*
+ * Unlink a node from the directory list and from the index.
+ * Called with ramfs_lock held.
+ */
+static void
+ramfs_unlink_node(struct ramfs_node *dnp, struct ramfs_node *np)
+{
+    ramfs_index_remove(dnp, np);
+
+    if (np->rn_prev == NULL) {
+        dnp->rn_child = np->rn_next;
+    } else {
+        np->rn_prev->rn_next = np->rn_next;
+    }
+    if (np->rn_next == NULL) {
+        dnp->rn_last_child = np->rn_prev;
+    } else {
+        np->rn_next->rn_prev = np->rn_prev;
+    }
+    if (dnp->rn_readdir_hint == np) {
+        dnp->rn_readdir_hint = np->rn_prev;
+    }
+    np->rn_next = np->rn_prev = NULL;
+}
+
 struct ramfs_node *
 ramfs_allocate_node(const char *name, int type)
 {
@@ -86,6 +214,16 @@ ramfs_allocate_node(const char *name, int type)
     strlcpy(np->rn_name, name, np->rn_namelen + 1);
     np->rn_type = type;
 
+    if (type == VDIR) {
+        np->rn_buckets = (ramfs_node **) calloc(RAMFS_MIN_BUCKETS, sizeof(ramfs_node *));
+        if (np->rn_buckets == NULL) {
+            free(np->rn_name);
+            free(np);
+            return NULL;
+        }
+        np->rn_nbuckets = RAMFS_MIN_BUCKETS;
+    }
+
     if (type == VDIR)
         np->rn_mode = S_IFDIR|0777;
     else if (type == VLNK)
@@ -98,12 +236,43 @@ ramfs_allocate_node(const char *name, int type)
     np->rn_ref_count = 0;
     np->rn_removed = false;
 
-    np->rn_file_segments_by_offset = new std::map<off_t,struct ramfs_file_segment>();
-    np->rn_total_segments_size = 0;
+    if (type == VREG) {
+        np->rn_pages = new std::vector<void *>();
+    }
 
     return np;
 }
 
+static dev_t
+ramfs_fsid(struct mount *mp)
+{
+    return ((uint32_t) mp->m_fsid.__val[0]) |
+           ((dev_t) ((uint32_t) mp->m_fsid.__val[1]) << 32);
+}
+
+/*
+ * Free the pages of a file from the given page on. Pages which may have
+ * been mapped are taken out of the page cache, and so out of all mappings
+ * of the file, first.
+ */
+static void
+ramfs_free_pages(struct vnode *vp, struct ramfs_node *np, size_t first)
+{
+    auto& pages = *np->rn_pages;
+    for (size_t i = first; i < pages.size(); i++) {
+        if (pages[i] == NULL) {
+            continue;
+        }
+        if (vp != NULL && np->rn_mapped) {
+            pagecache::hashkey key {ramfs_fsid(vp->v_mount), vp->v_ino,
+                                    (off_t) (i * PAGE_SIZE)};
+            pagecache::unmap_read_cached_page(&key);
+        }
+        memory::free_page(pages[i]);
+        pages[i] = NULL;
+    }
+}
+
 void
 ramfs_free_node(struct ramfs_node *np)
 {
@@ -111,17 +280,15 @@ ramfs_free_node(struct ramfs_node *np)
 	    return;
     }
 
-    if (np->rn_file_segments_by_offset != NULL) {
-        if (np->rn_owns_buf) {
-            for (auto it = np->rn_file_segments_by_offset->begin(); it != np->rn_file_segments_by_offset->end(); ++it) {
-                free(it->second.data);
-                it->second.data = NULL;
-            }
-        }
-
-        delete np->rn_file_segments_by_offset;
+    if (np->rn_pages != NULL) {
+        /* Nobody has the file open, so nobody can have it mapped */
+        ramfs_free_pages(NULL, np, 0);
+        delete np->rn_pages;
     }
-
+    if (np->rn_owns_buf) {
+        free(np->rn_buf);
+    }
+    free(np->rn_buckets);
 
     free(np->rn_name);
     free(np);
@@ -130,7 +297,7 @@ ramfs_free_node(struct ramfs_node *np)
 static struct ramfs_node *
 ramfs_add_node(struct ramfs_node *dnp, char *name, int type)
 {
-    struct ramfs_node *np, *prev;
+    struct ramfs_node *np;
 
     np = ramfs_allocate_node(name, type);
     if (np == NULL)
@@ -139,15 +306,7 @@ ramfs_add_node(struct ramfs_node *dnp, char *name, int type)
     mutex_lock(&ramfs_lock);
     np->inode_no = inode_count++;
 
-    /* Link to the directory list */
-    if (dnp->rn_child == NULL) {
-        dnp->rn_child = np;
-    } else {
-        prev = dnp->rn_child;
-        while (prev->rn_next != NULL)
-            prev = prev->rn_next;
-        prev->rn_next = np;
-    }
+    ramfs_link_node(dnp, np);
 
     set_times_to_now(&(dnp->rn_mtime), &(dnp->rn_ctime));
 
@@ -158,26 +317,12 @@ ramfs_add_node(struct ramfs_node *dnp, char *name, int type)
 static int
 ramfs_remove_node(struct ramfs_node *dnp, struct ramfs_node *np)
 {
-    struct ramfs_node *prev;
-
     if (dnp->rn_child == NULL)
         return EBUSY;
 
     mutex_lock(&ramfs_lock);
 
-    /* Unlink from the directory list */
-    if (dnp->rn_child == np) {
-        dnp->rn_child = np->rn_next;
-    } else {
-        for (prev = dnp->rn_child; prev->rn_next != np;
-             prev = prev->rn_next) {
-            if (prev->rn_next == NULL) {
-                mutex_unlock(&ramfs_lock);
-                return ENOENT;
-            }
-        }
-        prev->rn_next = np->rn_next;
-    }
+    ramfs_unlink_node(dnp, np);
 
     np->rn_removed = true;
     if (np->rn_ref_count <= 0) {
@@ -190,30 +335,44 @@ ramfs_remove_node(struct ramfs_node *dnp, struct ramfs_node *np)
     return 0;
 }
 
+/*
+ * Move a node to the end of the (same or another) directory under a new name.
+ */
 static int
-ramfs_rename_node(struct ramfs_node *np, char *name)
+ramfs_rename_node(struct ramfs_node *dnp1, struct ramfs_node *np,
+                  struct ramfs_node *dnp2, char *name)
 {
     size_t len;
-    char *tmp;
+    char *tmp = NULL;
 
     len = strlen(name);
     if (len > NAME_MAX) {
         return ENAMETOOLONG;
     }
-    if (len <= np->rn_namelen) {
-        /* Reuse current name buffer */
-        strlcpy(np->rn_name, name, np->rn_namelen + 1);
-    } else {
+    if (len > np->rn_namelen) {
         /* Expand name buffer */
         tmp = (char *) malloc(len + 1);
         if (tmp == NULL)
             return ENOMEM;
-        strlcpy(tmp, name, len + 1);
+    }
+
+    mutex_lock(&ramfs_lock);
+
+    ramfs_unlink_node(dnp1, np);
+    if (tmp != NULL) {
         free(np->rn_name);
         np->rn_name = tmp;
     }
+    /* Reuse current name buffer otherwise */
+    strlcpy(np->rn_name, name, len + 1);
     np->rn_namelen = len;
+    ramfs_link_node(dnp2, np);
+
     set_times_to_now(&(np->rn_ctime));
+    set_times_to_now(&(dnp1->rn_mtime), &(dnp1->rn_ctime));
+    set_times_to_now(&(dnp2->rn_mtime), &(dnp2->rn_ctime));
+
+    mutex_unlock(&ramfs_lock);
     return 0;
 }
 
@@ -222,8 +381,6 @@ ramfs_lookup(struct vnode *dvp, char *name, struct vnode **vpp)
 {
     struct ramfs_node *np, *dnp;
     struct vnode *vp;
-    size_t len;
-    int found;
 
     *vpp = NULL;
 
@@ -232,17 +389,9 @@ ramfs_lookup(struct vnode *dvp, char *name, struct vnode **vpp)
 
     mutex_lock(&ramfs_lock);
 
-    len = strlen(name);
     dnp = (ramfs_node *) dvp->v_data;
-    found = 0;
-    for (np = dnp->rn_child; np != NULL; np = np->rn_next) {
-        if (np->rn_namelen == len &&
-            memcmp(name, np->rn_name, len) == 0) {
-            found = 1;
-            break;
-        }
-    }
-    if (found == 0) {
+    np = ramfs_index_find(dnp, name, strlen(name));
+    if (np == NULL) {
         mutex_unlock(&ramfs_lock);
         return ENOENT;
     }
@@ -301,13 +450,7 @@ ramfs_symlink(struct vnode *dvp, char *name, char *link)
     // Save the link target without the final null, as readlink() wants it.
     size_t len = strlen(link);
     np->rn_size = len;
-
-    ramfs_file_segment new_segment = {
-        .size = len,
-        .data = strndup(link, len)
-    };
-    (*np->rn_file_segments_by_offset)[0] = new_segment;
-    np->rn_total_segments_size = len;
+    np->rn_buf = strndup(link, len);
 
     return 0;
 }
@@ -335,7 +478,7 @@ ramfs_readlink(struct vnode *vp, struct uio *uio)
         len = uio->uio_resid;
 
     set_times_to_now( &(np->rn_atime));
-    return uiomove((*np->rn_file_segments_by_offset)[0].data + uio->uio_offset, len, uio);
+    return uiomove(np->rn_buf + uio->uio_offset, len, uio);
 }
 
 /* Remove a directory */
@@ -353,65 +496,90 @@ ramfs_remove(struct vnode *dvp, struct vnode *vp, char *name)
     return ramfs_remove_node((ramfs_node *) dvp->v_data, (ramfs_node *) vp->v_data);
 }
 
-#define ENLARGE_FACTOR 1.1f
+/*
+ * Move the data of a file from bootfs, which lives in the kernel image,
+ * into pages of its own so it can be modified or mapped.
+ */
 static int
-ramfs_enlarge_data_buffer(struct ramfs_node *np, size_t desired_length)
+ramfs_own_data(struct ramfs_node *np)
 {
-    // New total size has to be at least greater by the ENLARGE_FACTOR
-    auto new_total_segment_size = round_page(std::max<size_t>(np->rn_total_segments_size * ENLARGE_FACTOR, desired_length));
-    assert(new_total_segment_size >= desired_length);
-
-    auto new_segment_size = np->rn_owns_buf ? new_total_segment_size - np->rn_total_segments_size : new_total_segment_size;
-    ramfs_file_segment new_segment = {
-        .size = new_segment_size,
-        .data = (char*) malloc(new_segment_size)
-    };
-    if (!new_segment.data)
-        return EIO;
-
-    auto new_segment_file_offset = np->rn_total_segments_size;
-    if (!np->rn_owns_buf) {
-        // This is a file from bootfs and we cannot simply enlarge same way
-	// as regular one because because original segment is not be page-aligned.
-	// Therefore we need to created new segment and copy content of the old one
-        memcpy(new_segment.data, (*np->rn_file_segments_by_offset)[0].data, np->rn_size);
-        new_segment_file_offset = 0;
+    if (np->rn_owns_buf) {
+        return 0;
     }
 
-    // Insert new segment with the file offset it starts at which happends
-    // to be old total segments size
-    (*np->rn_file_segments_by_offset)[new_segment_file_offset] = new_segment;
-    np->rn_total_segments_size = new_total_segment_size;
+    auto& pages = *np->rn_pages;
+    pages.resize((np->rn_size + PAGE_SIZE - 1) / PAGE_SIZE, NULL);
+    for (size_t i = 0; i < pages.size(); i++) {
+        void *page = memory::alloc_page();
+        if (page == NULL) {
+            ramfs_free_pages(NULL, np, 0);
+            pages.clear();
+            return ENOMEM;
+        }
+        size_t len = std::min<size_t>(PAGE_SIZE, np->rn_size - i * PAGE_SIZE);
+        memcpy(page, np->rn_buf + i * PAGE_SIZE, len);
+        memset((char *) page + len, 0, PAGE_SIZE - len);
+        pages[i] = page;
+    }
+    np->rn_buf = NULL;
     np->rn_owns_buf = true;
 
     return 0;
 }
 
+/*
+ * Return the page of a file at the given index, allocating it in place
+ * of a hole if asked to.
+ */
+static void *
+ramfs_get_page(struct ramfs_node *np, size_t index, bool allocate)
+{
+    auto& pages = *np->rn_pages;
+    if (index < pages.size() && pages[index] != NULL) {
+        return pages[index];
+    }
+    if (!allocate) {
+        return NULL;
+    }
+    void *page = memory::alloc_page();
+    if (page == NULL) {
+        return NULL;
+    }
+    memset(page, 0, PAGE_SIZE);
+    if (index >= pages.size()) {
+        pages.resize(index + 1, NULL);
+    }
+    pages[index] = page;
+    return page;
+}
+
 /* Truncate file */
 static int
 ramfs_truncate(struct vnode *vp, off_t length)
 {
     struct ramfs_node *np;
+    int error;
 
     DPRINTF(("truncate %s length=%d\n", vp->v_path, length));
     np = (ramfs_node *) vp->v_data;
 
-    //TODO: Shall we free segments id new length < np->total_segments_size
-    if (length == 0) {
-        if (np->rn_owns_buf) {
-            for (auto it = (*np->rn_file_segments_by_offset).begin(); it != (*np->rn_file_segments_by_offset).end(); ++it) {
-                free(it->second.data);
-            }
-        }
+    error = ramfs_own_data(np);
+    if (error) {
+        return error;
+    }
 
-        (*np->rn_file_segments_by_offset).clear();
-        np->rn_total_segments_size = 0;
-    } else if (size_t(length) > np->rn_total_segments_size) {
-        auto ret = ramfs_enlarge_data_buffer(np, length);
-        if (ret) {
-            return ret;
+    size_t npages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (size_t(length) < np->rn_size) {
+        ramfs_free_pages(vp, np, npages);
+        /* The tail of the last page must read as zeros if the file grows */
+        size_t tail = length % PAGE_SIZE;
+        void *page = tail ? ramfs_get_page(np, npages - 1, false) : NULL;
+        if (page != NULL) {
+            memset((char *) page + tail, 0, PAGE_SIZE - tail);
         }
     }
+    /* Growing the file only adds holes */
+    np->rn_pages->resize(npages, NULL);
 
     np->rn_size = length;
     vp->v_size = length;
@@ -443,35 +611,28 @@ ramfs_create(struct vnode *dvp, char *name, mode_t mode)
 }
 
 static int
-ramfs_read_or_write_file_data(std::map<off_t,struct ramfs_file_segment> &file_segments_by_offset, struct uio *uio, size_t bytes_to_read_or_write)
-{
-    // Find the segment where we need to start reading from or writing to based on uio_offset
-    auto segment_to_read_or_write = file_segments_by_offset.lower_bound(uio->uio_offset);
-    if( segment_to_read_or_write == file_segments_by_offset.end()) {
-        segment_to_read_or_write = --file_segments_by_offset.end();
-    }
-    else if (segment_to_read_or_write->first > uio->uio_offset) {
-        segment_to_read_or_write--;
-    }
-    assert(uio->uio_offset >= segment_to_read_or_write->first &&
-           uio->uio_offset < (off_t)(segment_to_read_or_write->first + segment_to_read_or_write->second.size));
-
-    // Simply iterate starting with initial identified segment above to read or write
-    // until we have read all bytes or have iterated all segments
-    uint64_t file_offset = uio->uio_offset;
-    for (; segment_to_read_or_write != file_segments_by_offset.end() && bytes_to_read_or_write > 0; segment_to_read_or_write++) {
-        // First calculate where we need to start in this segment ...
-        auto offset_in_segment = file_offset - segment_to_read_or_write->first;
-        // .. then calculate how many bytes to read or write in this segment
-        auto maximum_bytes_to_read_or_write_in_segment = segment_to_read_or_write->second.size - offset_in_segment;
-        auto bytes_to_read_or_write_in_segment = std::min<uint64_t>(bytes_to_read_or_write,maximum_bytes_to_read_or_write_in_segment);
-        assert(offset_in_segment >= 0 && offset_in_segment < segment_to_read_or_write->second.size);
-        auto ret = uiomove(segment_to_read_or_write->second.data + offset_in_segment, bytes_to_read_or_write_in_segment, uio);
+ramfs_read_or_write_file_data(struct ramfs_node *np, struct uio *uio, size_t bytes_to_read_or_write)
+{
+    // Files from bootfs are read straight from the kernel image
+    if (!np->rn_owns_buf) {
+        assert(uio->uio_rw == UIO_READ);
+        return uiomove(np->rn_buf + uio->uio_offset, bytes_to_read_or_write, uio);
+    }
+
+    while (bytes_to_read_or_write > 0) {
+        size_t index = uio->uio_offset / PAGE_SIZE;
+        size_t offset_in_page = uio->uio_offset % PAGE_SIZE;
+        size_t len = std::min<size_t>(bytes_to_read_or_write, PAGE_SIZE - offset_in_page);
+        // Reading a hole does not fill it, writing to one does
+        char *page = (char *) ramfs_get_page(np, index, uio->uio_rw == UIO_WRITE);
+        if (page == NULL && uio->uio_rw == UIO_WRITE) {
+            return ENOMEM;
+        }
+        auto ret = uiomove(page ? page + offset_in_page : (char *) ramfs_zero_page, len, uio);
         if (ret) {
             return ret;
         }
-        bytes_to_read_or_write -= bytes_to_read_or_write_in_segment;
-        file_offset += bytes_to_read_or_write_in_segment;
+        bytes_to_read_or_write -= len;
     }
 
     return 0;
@@ -506,7 +667,7 @@ ramfs_read(struct vnode *vp, struct file *fp, struct uio *uio, int ioflag)
 
     set_times_to_now(&(np->rn_atime));
 
-    return ramfs_read_or_write_file_data(*(np->rn_file_segments_by_offset),uio,len);
+    return ramfs_read_or_write_file_data(np, uio, len);
 }
 
 int
@@ -520,17 +681,11 @@ ramfs_set_file_data(struct vnode *vp, const void *data, size_t size)
     if (vp->v_type != VREG) {
         return EINVAL;
     }
-    if (!(*np->rn_file_segments_by_offset).empty()) {
+    if (np->rn_buf != NULL || !np->rn_pages->empty()) {
         return EINVAL;
     }
 
-    ramfs_file_segment new_segment = {
-        .size = size,
-        .data = (char *) data
-    };
-    (*np->rn_file_segments_by_offset)[0] = new_segment;
-    np->rn_total_segments_size = size;
-
+    np->rn_buf = (char *) data;
     np->rn_size = size;
     np->rn_owns_buf = false;
 
@@ -560,33 +715,31 @@ ramfs_write(struct vnode *vp, struct uio *uio, int ioflag)
         return 0;
     }
 
+    auto error = ramfs_own_data(np);
+    if (error) {
+        return error;
+    }
+
     if (ioflag & IO_APPEND)
         uio->uio_offset = np->rn_size;
 
     if (size_t(uio->uio_offset + uio->uio_resid) > (size_t) vp->v_size) {
         /* Expand the file size before writing to it */
         off_t end_pos = uio->uio_offset + uio->uio_resid;
-        if (end_pos > (off_t) np->rn_total_segments_size) {
-            auto ret = ramfs_enlarge_data_buffer(np, end_pos);
-            if (ret) {
-                return ret;
-            }
-        }
+        np->rn_pages->resize((end_pos + PAGE_SIZE - 1) / PAGE_SIZE, NULL);
         np->rn_size = end_pos;
         vp->v_size = end_pos;
     }
 
     set_times_to_now(&(np->rn_mtime), &(np->rn_ctime));
 
-    assert(uio->uio_offset + uio->uio_resid <= (off_t)(np->rn_total_segments_size));
-    return ramfs_read_or_write_file_data(*(np->rn_file_segments_by_offset),uio,uio->uio_resid);
+    return ramfs_read_or_write_file_data(np, uio, uio->uio_resid);
 }
 
 static int
 ramfs_rename(struct vnode *dvp1, struct vnode *vp1, char *name1,
              struct vnode *dvp2, struct vnode *vp2, char *name2)
 {
-    struct ramfs_node *np, *old_np;
     int error;
 
     if (vp2) {
@@ -595,31 +748,9 @@ ramfs_rename(struct vnode *dvp1, struct vnode *vp1, char *name1,
         if (error)
             return error;
     }
-    /* Same directory ? */
-    if (dvp1 == dvp2) {
-        /* Change the name of existing file */
-        error = ramfs_rename_node((ramfs_node *) vp1->v_data, name2);
-        if (error)
-            return error;
-    } else {
-        /* Create new file or directory */
-        old_np = (ramfs_node *) vp1->v_data;
-        np = ramfs_add_node((ramfs_node *) dvp2->v_data, name2, old_np->rn_type);
-        if (np == NULL)
-            return ENOMEM;
-
-        np->rn_size = old_np->rn_size;
-        np->rn_file_segments_by_offset = old_np->rn_file_segments_by_offset;
-        np->rn_total_segments_size = old_np->rn_total_segments_size;
-        np->rn_owns_buf = old_np->rn_owns_buf;
-
-        old_np->rn_file_segments_by_offset = NULL;
-        old_np->rn_owns_buf = false;
-
-        /* Remove source file */
-        ramfs_remove_node((ramfs_node *) dvp1->v_data, (ramfs_node *) vp1->v_data);
-    }
-    return 0;
+    /* Move the node itself, so it keeps its data, children and inode number */
+    return ramfs_rename_node((ramfs_node *) dvp1->v_data, (ramfs_node *) vp1->v_data,
+                             (ramfs_node *) dvp2->v_data, name2);
 }
 
 /*
@@ -629,7 +760,6 @@ static int
 ramfs_readdir(struct vnode *vp, struct file *fp, struct dirent *dir)
 {
     struct ramfs_node *np, *dnp;
-    int i;
 
     mutex_lock(&ramfs_lock);
 
@@ -642,20 +772,28 @@ ramfs_readdir(struct vnode *vp, struct file *fp, struct dirent *dir)
         dir->d_type = DT_DIR;
         strlcpy((char *) &dir->d_name, "..", sizeof(dir->d_name));
     } else {
+        /*
+         * Return the first node at or after the directory offset, which
+         * still works if nodes were added or removed since the last call.
+         * Resume from where the last call left off if we can, so that
+         * reading a whole directory is linear in its size.
+         */
+        off_t offset = fp->f_offset - 2;
         dnp = (ramfs_node *) vp->v_data;
-        np = dnp->rn_child;
+        np = dnp->rn_readdir_hint;
+        if (np == NULL || np->rn_dir_offset > offset) {
+            np = dnp->rn_child;
+        }
+        while (np != NULL && np->rn_dir_offset < offset) {
+            np = np->rn_next;
+        }
         if (np == NULL) {
             mutex_unlock(&ramfs_lock);
             return ENOENT;
         }
+        dnp->rn_readdir_hint = np;
+        fp->f_offset = np->rn_dir_offset + 2;
 
-        for (i = 0; i != (fp->f_offset - 2); i++) {
-            np = np->rn_next;
-            if (np == NULL) {
-                mutex_unlock(&ramfs_lock);
-                return ENOENT;
-            }
-        }
         if (np->rn_type == VDIR)
             dir->d_type = DT_DIR;
         else if (np->rn_type == VLNK)
@@ -686,6 +824,7 @@ ramfs_getattr(struct vnode *vnode, struct vattr *attr)
 {
     attr->va_nodeid = vnode->v_ino;
     attr->va_size = vnode->v_size;
+    attr->va_fsid = ramfs_fsid(vnode->v_mount);
 
     struct ramfs_node *np = (ramfs_node *) vnode->v_data;
     attr->va_type = (vtype) np->rn_type;
@@ -722,6 +861,43 @@ ramfs_setattr(struct vnode *vnode, struct vattr *attr) {
     return 0;
 }
 
+/*
+ * Map a page of a file into the page cache, so that mmap() maps the page
+ * of the file itself. Shared mappings write straight to it.
+ */
+static int
+ramfs_map_cached_page(struct vnode *vp, struct file *fp, struct uio *uio)
+{
+    struct ramfs_node *np = (ramfs_node *) vp->v_data;
+
+    if (vp->v_type == VDIR)
+        return EISDIR;
+    if (vp->v_type != VREG)
+        return EINVAL;
+    if (uio->uio_offset < 0)
+        return EINVAL;
+    /* Leave the page past the end of the file to the caller as a hole */
+    if (uio->uio_offset >= (off_t) vp->v_size)
+        return 0;
+    if (uio->uio_resid != PAGE_SIZE || uio->uio_offset % PAGE_SIZE)
+        return EINVAL;
+
+    auto error = ramfs_own_data(np);
+    if (error) {
+        return error;
+    }
+    void *page = ramfs_get_page(np, uio->uio_offset / PAGE_SIZE, true);
+    if (page == NULL) {
+        return ENOMEM;
+    }
+
+    np->rn_mapped = true;
+    pagecache::map_read_cached_page((pagecache::hashkey *) uio->uio_iov->iov_base, page, true);
+    uio->uio_resid = 0;
+
+    return 0;
+}
+
 int ramfs_open(struct file *fp)
 {
     struct vnode *vp = file_dentry(fp)->d_vnode;
@@ -769,7 +945,7 @@ struct vnops ramfs_vnops = {
         ramfs_inactive,         /* inactive */
         ramfs_truncate,         /* truncate */
         ramfs_link,             /* link */
-        (vnop_cache_t) nullptr, /* arc */
+        ramfs_map_cached_page,  /* arc */
         ramfs_fallocate,        /* fallocate */
         ramfs_readlink,         /* read link */
         ramfs_symlink,          /* symbolic link */
@@ -45,9 +45,18 @@
 // than 32K are loaded in full on first read. This simple read-around strategy
 // can achieve 80-90% cache hit ratio in many conducted measurements. Also it can
 // deliver 2-3 increase of read speed over non-cache mode at some cost of
-// too much unneeded data read (15-20%). Lastly the loaded data stays
-// in memory forever as there is no LRU logic implemented that could limit
-// memory used.
+// too much unneeded data read (15-20%). On top of that, once a file is read
+// sequentially, the cache reads ahead a window of segments that grows up to
+// 1MB, submitting all of their reads to the device at once.
+//
+// The cache is bounded: segments are kept on a global CLOCK list and evicted
+// when the cache grows beyond a quarter of physical memory, or earlier when
+// the memory reclaimer asks for memory back. Segments mapped by mmap() are
+// referenced by the page cache and stay in memory.
+//
+// Images can optionally be compressed with LZ4 in 32K clusters which match
+// the cache segments, so each cluster gets decompressed straight into its
+// segment. Such images are always read through the cache.
 //
 // The structure of the data on disk is explained in scripts/gen-rofs-img.py
 
@@ -61,8 +70,15 @@
 #include <osv/buf.h>
 
 #define ROFS_VERSION            1
+#define ROFS_VERSION_COMPRESSED 2
 #define ROFS_MAGIC              0xDEADBEAD
 
+#define ROFS_COMPRESSION_NONE   0
+#define ROFS_COMPRESSION_LZ4    1
+// Compressed file data is split into clusters of this size, each compressed
+// on its own so that it can be decompressed straight into a cache segment
+#define ROFS_CLUSTER_SIZE_IN_BLOCKS 64  // 32K
+
 #define ROFS_INODE_SIZE ((uint64_t)sizeof(struct rofs_inode))
 
 #define ROFS_SUPERBLOCK_SIZE sizeof(struct rofs_super_block)
@@ -101,12 +117,26 @@ struct rofs_super_block {
     uint64_t directory_entries_count;
     uint64_t symlinks_count;
     uint64_t inodes_count;
+    // The fields below are only set in compressed images (ROFS_VERSION_COMPRESSED)
+    uint64_t compression;
+    uint64_t cluster_size_in_blocks;
+    uint64_t cluster_table_first_block;
+    uint64_t clusters_count;
+};
+
+//
+// Location of a cluster of compressed file data. A cluster that would not
+// shrink is stored as is, in which case compressed_size equals its
+// uncompressed size.
+struct rofs_cluster {
+    uint64_t block;
+    uint64_t compressed_size;
 };
 
 struct rofs_inode {
     mode_t mode;
     uint64_t inode_no;
-    uint64_t data_offset;
+    uint64_t data_offset; // For files in compressed images index of the first cluster
     union {
         uint64_t file_size;
         uint64_t dir_children_count;
@@ -123,16 +153,24 @@ struct rofs_info {
     struct rofs_dir_entry *dir_entries;
     char **symlinks;
     struct rofs_inode *inodes;
+    struct rofs_cluster *clusters;  // Only in compressed images, otherwise null
 };
 
 namespace rofs {
     int
-    cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio);
+    cache_read(struct rofs_inode *inode, struct device *device, struct rofs_info *rofs, struct uio *uio);
     int
-    cache_get_page_address(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio, void **addr);
+    cache_get_page_address(struct rofs_inode *inode, struct device *device, struct rofs_info *rofs, struct uio *uio, void **addr);
+    void
+    cache_release(struct rofs_super_block *sb);
 }
 
+struct bio;
 int rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void* buf);
+int rofs_start_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void* buf,
+                           struct bio **bio);
+int rofs_finish_read_blocks(struct bio *bio);
+long rofs_lz4_decompress(const void *source, size_t source_size, void *dest, size_t dest_size);
 void rofs_set_vnode(struct vnode* vnode, struct rofs_inode *inode);
 
 #endif
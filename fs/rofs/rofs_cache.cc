@@ -13,31 +13,55 @@
 #include <include/osv/contiguous_alloc.hh>
 #include <osv/debug.h>
 #include <osv/sched.hh>
+#include <osv/mempool.hh>
+#include <osv/rwlock.h>
+#include <boost/intrusive/list.hpp>
 #include <sys/mman.h>
 
 /*
  * From cache perspective let us divide each file into sequence of contiguous 32K segments.
  * The files smaller or equal than 32K get loaded in one read, others get loaded
- * segment by segment.
+ * segment by segment. Sequentially read files are additionally read ahead
+ * by up to CACHE_MAX_READAHEAD_SEGMENTS segments.
+ *
+ * All segments, except for the ones mapped by mmap(), are kept on a global
+ * CLOCK list and evicted once the cache grows beyond its limit or when
+ * the memory reclaimer asks for memory back.
+ *
+ * In compressed images the segments match the compressed clusters, so
+ * each segment is loaded by reading and decompressing a single cluster.
  **/
 //
 //TODO These 2 values can be made configurable
 #define CACHE_SEGMENT_SIZE_IN_BLOCKS 64  // 32K
 #define CACHE_SEGMENT_INDEX(offset) (offset >> 15)
+#define CACHE_MAX_READAHEAD_SEGMENTS 32  // 1M
+
+static_assert(CACHE_SEGMENT_SIZE_IN_BLOCKS == ROFS_CLUSTER_SIZE_IN_BLOCKS,
+              "cache segments must match compressed clusters");
 
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
 extern std::atomic<long> rofs_block_allocated;
+extern std::atomic<long> rofs_block_evicted;
 extern std::atomic<long> rofs_cache_reads;
 extern std::atomic<long> rofs_cache_misses;
+extern std::atomic<long> rofs_cache_readaheads;
 #endif
 
 namespace rofs {
 //
 // This structure holds cache information and data of specific file
 struct file_cache {
-    std::unordered_map<uint64_t, struct file_cache_segment *> segments_by_index;
+    std::unordered_map<uint64_t, class file_cache_segment *> segments_by_index;
     struct rofs_inode *inode;
     struct rofs_super_block *sb;
+    struct rofs_cluster *clusters; // Clusters of the file in compressed image, otherwise null
+    uint64_t clusters_count;       // Number of entries in the cluster table from clusters on
+    // Protects segments_by_index and loading of the segments
+    mutex lock;
+    // Used to detect sequential reads, see plan_readahead()
+    uint64_t next_offset = 0;
+    unsigned readahead_segments = 0;
 };
 
 //
@@ -74,13 +98,23 @@ private:
     uint64_t starting_block;  // This is relative to the 512-block of the inode itself
     uint64_t block_count;     // Length of data in 512 blocks
     bool data_ready;          // Has data been fully read from disk?
+    void *compressed;         // Compressed data being read from disk
+    uint64_t compressed_size; // and its size
 
 public:
-    file_cache_segment(struct file_cache *_cache, uint64_t _starting_block, uint64_t _block_count) {
+    boost::intrusive::list_member_hook<> lru_link; // Link in the global CLOCK list
+    std::atomic<bool> referenced;  // Read since the CLOCK hand last passed?
+    std::atomic<unsigned> pins;    // Readers copying data out without the file lock
+    bool mapped;                   // Mapped by mmap(), never evicted
+
+    file_cache_segment(struct file_cache *_cache, uint64_t _starting_block, uint64_t _block_count)
+        : referenced(false), pins(0), mapped(false) {
         this->cache = _cache;
         this->starting_block = _starting_block;
         this->block_count = _block_count;
         this->data_ready = false;   // Data has to be loaded from disk
+        this->compressed = nullptr;
+        this->compressed_size = 0;
         auto size = _cache->sb->block_size * _block_count;
         // Only allocate contiguous page-aligned memory if size greater or equal a page
         // to make sure page-cache mapping works properly
@@ -103,6 +137,14 @@ public:
         }
     }
 
+    struct file_cache *owner() {
+        return this->cache;
+    }
+
+    uint64_t index() {
+        return this->starting_block / CACHE_SEGMENT_SIZE_IN_BLOCKS;
+    }
+
     uint64_t length() {
         return this->block_count * this->cache->sb->block_size;
     }
@@ -121,22 +163,85 @@ public:
         print("[rofs] [%d] -> file_cache_segment::read() i-node: %d, starting block %d, reading [%d] bytes at segment offset [%d]\n",
               sched::thread::current()->id(), cache->inode->inode_no, starting_block, bytes_to_read,
               offset_in_segment);
+        referenced.store(true, std::memory_order_relaxed);
         return uiomove(data + offset_in_segment, bytes_to_read, uio);
     }
 
+    uint64_t bytes_on_disk() {
+        return cache->inode->file_size - starting_block * cache->sb->block_size;
+    }
+
     //
-    // Read all segment data from disk and copy to memory
-    int read_from_disk(struct device *device) {
+    // Start reading all segment data from disk into memory
+    int start_read_from_disk(struct device *device, struct bio **bio) {
+        if (cache->clusters) {
+            return start_read_cluster_from_disk(device, bio);
+        }
         auto block = cache->inode->data_offset + starting_block;
-        auto bytes_remaining = cache->inode->file_size - starting_block * cache->sb->block_size;
+        auto bytes_remaining = bytes_on_disk();
         auto blocks_remaining = bytes_remaining / cache->sb->block_size;
         if (bytes_remaining % cache->sb->block_size > 0) {
             blocks_remaining++;
         }
         auto block_count_to_read = std::min(block_count, blocks_remaining);
-        print("[rofs] [%d] -> file_cache_segment::read_from_disk() i-node: %d, starting block %d, reading [%d] blocks at disk offset [%d]\n",
+        print("[rofs] [%d] -> file_cache_segment::start_read_from_disk() i-node: %d, starting block %d, reading [%d] blocks at disk offset [%d]\n",
               sched::thread::current()->id(), cache->inode->inode_no, starting_block, block_count_to_read, block);
-        auto error = rofs_read_blocks(device, block, block_count_to_read, data);
+        return rofs_start_read_blocks(device, block, block_count_to_read, data, bio);
+    }
+
+    //
+    // Start reading the cluster holding segment data in compressed image. Clusters
+    // that did not compress are read straight into the segment memory.
+    int start_read_cluster_from_disk(struct device *device, struct bio **bio) {
+        // A corrupt inode or cluster table must not make us read past the
+        // table or past the segment memory
+        if (index() >= cache->clusters_count) {
+            printf("!!!!! Cluster %lu of i-node %lu beyond the cluster table\n",
+                   index(), cache->inode->inode_no);
+            return EIO;
+        }
+        auto &cluster = cache->clusters[index()];
+        if (cluster.compressed_size > length()) {
+            printf("!!!!! Cluster %lu of i-node %lu larger than a segment\n",
+                   index(), cache->inode->inode_no);
+            return EIO;
+        }
+        compressed_size = cluster.compressed_size;
+        auto block_count_to_read = (cluster.compressed_size + cache->sb->block_size - 1) / cache->sb->block_size;
+        print("[rofs] [%d] -> file_cache_segment::start_read_cluster_from_disk() i-node: %d, starting block %d, reading [%d] blocks at disk offset [%d]\n",
+              sched::thread::current()->id(), cache->inode->inode_no, starting_block, block_count_to_read, cluster.block);
+        if (cluster.compressed_size >= std::min(bytes_on_disk(), length())) {
+            return rofs_start_read_blocks(device, cluster.block, block_count_to_read, data, bio);
+        }
+
+        compressed = malloc(block_count_to_read * cache->sb->block_size);
+        if (!compressed) {
+            return ENOMEM;
+        }
+        auto error = rofs_start_read_blocks(device, cluster.block, block_count_to_read, compressed, bio);
+        if (error) {
+            free(compressed);
+            compressed = nullptr;
+        }
+        return error;
+    }
+
+    //
+    // Wait for the read started by start_read_from_disk()
+    int finish_read_from_disk(struct bio *bio) {
+        auto error = rofs_finish_read_blocks(bio);
+        auto bytes_remaining = bytes_on_disk();
+        if (compressed) {
+            if (!error) {
+                auto size = rofs_lz4_decompress(compressed, compressed_size, data, length());
+                if (size != (long)std::min(bytes_remaining, length())) {
+                    printf("!!!!! Error decompressing cluster\n");
+                    error = EIO;
+                }
+            }
+            free(compressed);
+            compressed = nullptr;
+        }
         this->data_ready = (error == 0);
         if (error) {
             printf("!!!!! Error reading from disk\n");
@@ -150,21 +255,121 @@ public:
 };
 
 static std::unordered_map<rofs_cache_key, struct file_cache *, rofs_cache_key_hasher> global_file_cache;
-static mutex file_cache_lock;
+static rwlock file_cache_lock;
+
+//
+// All segments not mapped by mmap() in the order the CLOCK hand visits them.
+// Lock ordering: a file cache lock may be held while taking lru_lock, the other
+// way around it may only be try_lock()ed.
+typedef boost::intrusive::list<file_cache_segment,
+    boost::intrusive::member_hook<file_cache_segment,
+                                  boost::intrusive::list_member_hook<>,
+                                  &file_cache_segment::lru_link>> segment_list;
+static segment_list lru;
+static mutex lru_lock;
+static std::atomic<size_t> cached_bytes(0);
+static size_t max_cached_bytes;
 
-static struct file_cache *get_or_create_file_cache(struct rofs_inode *inode, struct rofs_super_block *sb) {
+//
+// Evicts unpinned segments not read since the CLOCK hand last passed them
+// until at least target bytes are freed or every segment has been given
+// its second chance. Returns the number of bytes freed.
+static size_t evict(size_t target)
+{
+    segment_list victims;
+    size_t freed = 0;
+    WITH_LOCK(lru_lock) {
+        for (auto budget = 2 * lru.size(); freed < target && budget && !lru.empty(); budget--) {
+            auto &segment = lru.front();
+            lru.pop_front();
+            auto cache = segment.owner();
+            // Whoever holds the file lock may be using the segment, including
+            // this very thread when reclaiming from a read
+            if (segment.referenced.exchange(false, std::memory_order_relaxed) ||
+                cache->lock.owned() || !cache->lock.try_lock()) {
+                lru.push_back(segment);
+                continue;
+            }
+            if (segment.pins.load(std::memory_order_acquire)) {
+                cache->lock.unlock();
+                lru.push_back(segment);
+                continue;
+            }
+            cache->segments_by_index.erase(segment.index());
+            cache->lock.unlock();
+            freed += segment.length();
+            victims.push_back(segment);
+        }
+    }
+    cached_bytes.fetch_sub(freed, std::memory_order_relaxed);
+
+    while (!victims.empty()) {
+        auto &segment = victims.front();
+        victims.pop_front();
+#if defined(ROFS_DIAGNOSTICS_ENABLED)
+        rofs_block_evicted += segment.length() / segment.owner()->sb->block_size;
+#endif
+        delete &segment;
+    }
+    return freed;
+}
+
+//
+// Keeps the cache within max_cached_bytes. Frees a bit more than needed so that
+// a stream of reads does not have to evict every time.
+static void evict_over_limit()
+{
+    auto cached = cached_bytes.load(std::memory_order_relaxed);
+    if (cached > max_cached_bytes) {
+        evict(cached - max_cached_bytes + max_cached_bytes / 16);
+    }
+}
+
+class cache_shrinker : public memory::shrinker {
+public:
+    cache_shrinker() : shrinker("ROFS") {}
+    size_t request_memory(size_t n, bool hard) override {
+        return evict(n);
+    }
+};
+
+static void init_cache_limits()
+{
+    static cache_shrinker shrinker;
+    max_cached_bytes = memory::phys_mem_size / 4;
+}
+
+static struct file_cache *get_or_create_file_cache(struct rofs_inode *inode, struct rofs_info *rofs) {
     struct rofs_cache_key key = {
         .inode_no = inode->inode_no,
-        .sb = sb
+        .sb = rofs->sb
     };
 
-    // This is the only global mutex
-    WITH_LOCK(file_cache_lock) {
+    WITH_LOCK(file_cache_lock.for_read()) {
+        auto cache_entry = global_file_cache.find(key);
+        if (cache_entry != global_file_cache.end()) {
+            return cache_entry->second;
+        }
+    }
+
+    WITH_LOCK(file_cache_lock.for_write()) {
         auto cache_entry = global_file_cache.find(key);
         if (cache_entry == global_file_cache.end()) {
+            if (global_file_cache.empty()) {
+                init_cache_limits();
+            }
             struct file_cache *new_cache = new file_cache();
             new_cache->inode = inode;
-            new_cache->sb = sb;
+            new_cache->sb = rofs->sb;
+            if (rofs->clusters) {
+                auto count = rofs->sb->clusters_count;
+                auto first = std::min(inode->data_offset, count);
+                new_cache->clusters = rofs->clusters + first;
+                new_cache->clusters_count = count - first;
+            } else {
+                new_cache->clusters = nullptr;
+                new_cache->clusters_count = 0;
+            }
             global_file_cache.emplace(key, new_cache);
             return new_cache;
         } else {
@@ -173,14 +378,29 @@ static struct file_cache *get_or_create_file_cache(struct rofs_inode *inode, str
     }
 }
 
+//
+// Creates new segment and makes it visible to the file and the CLOCK hand;
+// called with the file cache lock held
+static file_cache_segment *add_segment(struct file_cache *cache, uint64_t index, uint64_t block_count)
+{
+    auto segment = new file_cache_segment(cache, index * CACHE_SEGMENT_SIZE_IN_BLOCKS, block_count);
+    cache->segments_by_index.emplace(index, segment);
+    WITH_LOCK(lru_lock) {
+        lru.push_back(*segment);
+    }
+    cached_bytes.fetch_add(segment->length(), std::memory_order_relaxed);
+    return segment;
+}
+
 enum CacheTransactionType {
     READ_FROM_MEMORY = 1,
     READ_FROM_DISK
 };
 
 // This represents an operation/transaction to read data from segment memory or/and from disk
+// Transactions with no bytes to read only load the segment into memory (readahead).
 struct cache_segment_transaction {
-    struct file_cache_segment *segment;
+    class file_cache_segment *segment;
     CacheTransactionType transaction_type;
     uint64_t segment_offset;
     uint64_t bytes_to_read;
@@ -197,13 +417,54 @@ struct cache_segment_transaction {
     }
 };
 
+//
+// Detects sequential reads of a file and maintains a readahead window of segments
+// following the requested ones: it starts at one segment and doubles with every
+// sequential read up to CACHE_MAX_READAHEAD_SEGMENTS, while any other read closes it.
+// The missing segments of the window are planned to be loaded whenever the request
+// itself missed or the reader got past the middle of the previous window, so that
+// most sequential reads are served from memory and disk reads come in batches.
+static void
+plan_readahead(struct file_cache *cache, uint64_t offset, uint64_t end_offset, bool missed,
+               std::vector<struct cache_segment_transaction> &transactions)
+{
+    if (offset == cache->next_offset) {
+        cache->readahead_segments = std::min<unsigned>(std::max<unsigned>(2 * cache->readahead_segments, 1),
+                                                       CACHE_MAX_READAHEAD_SEGMENTS);
+    } else {
+        cache->readahead_segments = 0;
+    }
+    cache->next_offset = end_offset;
+
+    uint64_t first_index = CACHE_SEGMENT_INDEX(end_offset - 1) + 1;
+    uint64_t end_index = std::min<uint64_t>(first_index + cache->readahead_segments,
+                                            CACHE_SEGMENT_INDEX(cache->inode->file_size - 1) + 1);
+    if (first_index >= end_index) {
+        return;
+    }
+    auto marker_index = std::min<uint64_t>(first_index + cache->readahead_segments / 2, end_index - 1);
+    if (!missed && cache->segments_by_index.count(marker_index)) {
+        return;
+    }
+
+    for (auto index = first_index; index < end_index; index++) {
+        if (cache->segments_by_index.count(index)) {
+            continue;
+        }
+        print("[rofs] [%d] -> rofs_cache_get_segment_operations i-node: %d, cache segment %d READAHEAD\n",
+              sched::thread::current()->id(), cache->inode->inode_no, index);
+        auto new_cache_segment = add_segment(cache, index, CACHE_SEGMENT_SIZE_IN_BLOCKS);
+        transactions.push_back(cache_segment_transaction(new_cache_segment, 0, 0));
+    }
+}
+
 //
 // This function analyzes uio against existing segments in file_cache
 // and builds a vector of transactions/operation that is used by cache_read to tell it
 // to either read data from memory in cache segment or read data from disk into
-// new segment
+// new segment. Called with the file cache lock held.
 static std::vector<struct cache_segment_transaction>
-plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
+plan_cache_transactions(struct file_cache *cache, struct uio *uio, bool readahead) {
 
     std::vector<struct cache_segment_transaction> transactions;
     //
@@ -214,8 +475,7 @@ plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
         if (cache->inode->file_size % cache->sb->block_size > 0) {
             block_count++;
         }
-        auto new_cache_segment = new file_cache_segment(cache, 0, block_count);
-        cache->segments_by_index.emplace(0, new_cache_segment);
+        auto new_cache_segment = add_segment(cache, 0, block_count);
         uint64_t read_amt = std::min<uint64_t>(cache->inode->file_size - uio->uio_offset, uio->uio_resid);
         transactions.push_back(cache_segment_transaction(new_cache_segment, uio->uio_offset, read_amt));
         print("[rofs] [%d] -> rofs_cache_get_segment_operations i-node: %d, read FULL file of %d bytes\n",
@@ -226,6 +486,7 @@ plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
     // File is larger than cache segment or previous attempt to read from disk failed
     uint64_t file_offset = uio->uio_offset;
     uint64_t bytes_to_read = std::min<uint64_t>(cache->inode->file_size - uio->uio_offset, uio->uio_resid);
+    bool missed = false;
     while (bytes_to_read > 0) {
         //
         // Next try to see if any cache segment is hit
@@ -238,6 +499,7 @@ plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
             auto transaction = cache_segment_transaction(cache_segment->second, file_offset, bytes_to_read);
             file_offset += transaction.bytes_to_read;
             bytes_to_read -= transaction.bytes_to_read;
+            missed |= transaction.transaction_type == CacheTransactionType::READ_FROM_DISK;
             transactions.push_back(transaction);
         }
         //
@@ -245,77 +507,120 @@ plan_cache_transactions(struct file_cache *cache, struct uio *uio) {
         else {
             print("[rofs] [%d] -> rofs_cache_get_segment_operations i-node: %d, cache segment %d MISS at file offset %d\n",
                   sched::thread::current()->id(), cache->inode->inode_no, cache_segment_index, file_offset);
-            uint64_t segment_starting_block = cache_segment_index * CACHE_SEGMENT_SIZE_IN_BLOCKS;
             //
             // Allocate new cache segment
-            auto new_cache_segment = new file_cache_segment(cache, segment_starting_block,
-                                                            CACHE_SEGMENT_SIZE_IN_BLOCKS);
-            cache->segments_by_index.emplace(cache_segment_index, new_cache_segment);
+            auto new_cache_segment = add_segment(cache, cache_segment_index, CACHE_SEGMENT_SIZE_IN_BLOCKS);
 
             auto transaction = cache_segment_transaction(new_cache_segment, file_offset, bytes_to_read);
             file_offset += transaction.bytes_to_read;;
             bytes_to_read -= transaction.bytes_to_read;
+            missed = true;
             transactions.push_back(transaction);
         }
     }
 
+    if (readahead && file_offset > uio->uio_offset) {
+        plan_readahead(cache, uio->uio_offset, file_offset, missed, transactions);
+    }
+
     return transactions;
 }
 
+//
+// Loads all segments planned to be read from disk. The reads are all submitted
+// before waiting for any of them, so that readahead does not cost a round trip
+// per segment. Returns the error of the first failed load of requested data,
+// failed readahead is ignored. Called with the file cache lock held.
+static int
+read_segments_from_disk(struct device *device, std::vector<struct cache_segment_transaction> &transactions)
+{
+    std::vector<std::pair<struct cache_segment_transaction *, struct bio *>> reads;
+    int error = 0;
+
+    for (auto &transaction : transactions) {
+        if (transaction.transaction_type != CacheTransactionType::READ_FROM_DISK) {
+            continue;
+        }
+#if defined(ROFS_DIAGNOSTICS_ENABLED)
+        if (transaction.bytes_to_read) {
+            rofs_cache_misses += 1;
+        } else {
+            rofs_cache_readaheads += 1;
+        }
+#endif
+        struct bio *bio;
+        auto read_error = transaction.segment->start_read_from_disk(device, &bio);
+        if (read_error) {
+            if (transaction.bytes_to_read && !error) {
+                error = read_error;
+            }
+            continue;
+        }
+        reads.emplace_back(&transaction, bio);
+    }
+
+    for (auto &read : reads) {
+        auto read_error = read.first->segment->finish_read_from_disk(read.second);
+        if (read_error && read.first->bytes_to_read && !error) {
+            error = read_error;
+        }
+    }
+    return error;
+}
+
 //
 // This function calls plan_cache_transactions first to identify what part of uio can be
-// read from memory and what needs to be read from disk
-// NOTE: This function is NOT thread-safe and does not need to be because it is called only
-// by rofs_read_with_cache() which in turn is called by vfs_file::read() in a critical section
-// specific to given file. So effectively cache_read() is assumed to be called by one thread
-// at a time and no thread synchronization is needed.
+// read from memory and what needs to be read from disk.
+// The file cache lock is only held while planning and reading from disk; the segments
+// are pinned while data is copied out of them, as the copy may fault on a page
+// mapped from this or another file and end up back in the cache.
 int
-cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio) {
+cache_read(struct rofs_inode *inode, struct device *device, struct rofs_info *rofs, struct uio *uio) {
     //
     // Find existing one or create new file cache
-    struct file_cache *cache = get_or_create_file_cache(inode, sb);
+    struct file_cache *cache = get_or_create_file_cache(inode, rofs);
 
     //
     // Prepare list of cache transactions (copy from memory
     // or read from disk into cache memory and then copy into memory)
-    auto segment_transactions = plan_cache_transactions(cache, uio);
-    print("[rofs] [%d] rofs_cache_read called for i-node [%d] at %d with %d ops\n",
-          sched::thread::current()->id(), inode->inode_no, uio->uio_offset, segment_transactions.size());
-
+    std::vector<struct cache_segment_transaction> segment_transactions;
     int error = 0;
+    WITH_LOCK(cache->lock) {
+        segment_transactions = plan_cache_transactions(cache, uio, true);
+        print("[rofs] [%d] rofs_cache_read called for i-node [%d] at %d with %d ops\n",
+              sched::thread::current()->id(), inode->inode_no, uio->uio_offset, segment_transactions.size());
+        error = read_segments_from_disk(device, segment_transactions);
+        for (auto &transaction : segment_transactions) {
+            transaction.segment->pins.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
 
-    // Iterate over the list of cache operation and either copy from memory
-    // or read from disk into cache memory and then copy into memory
-    auto it = segment_transactions.begin();
-    for (; it != segment_transactions.end(); ++it) {
-        auto transaction = *it;
-#if defined(ROFS_DIAGNOSTICS_ENABLED)
-        rofs_cache_reads += 1;
-#endif
-        if (transaction.transaction_type == CacheTransactionType::READ_FROM_MEMORY) {
-            //
-            // Copy data from segment to target buffer
-            error = transaction.segment->read(uio, transaction.segment_offset, transaction.bytes_to_read);
+    // Iterate over the list of cache operation and copy data from the segments
+    // now in memory
+    for (auto &transaction : segment_transactions) {
+        if (!transaction.bytes_to_read) {
+            continue;
         }
-        // Read from disk into segment missing in cache or empty segment that was in cache but had not data because
-        // of failure to read
-        else {
-            error = transaction.segment->read_from_disk(device);
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
-            rofs_cache_misses += 1;
+        rofs_cache_reads += 1;
 #endif
-            //
-            // Copy data from segment to target buffer
-            if (!error) {
-                error = transaction.segment->read(uio, transaction.segment_offset, transaction.bytes_to_read);
-            }
+        if (!transaction.segment->is_data_ready()) {
+            error = error ? error : EIO;
+            break;
         }
-
+        //
+        // Copy data from segment to target buffer
+        error = transaction.segment->read(uio, transaction.segment_offset, transaction.bytes_to_read);
         if (error) {
             break;
         }
     }
 
+    for (auto &transaction : segment_transactions) {
+        transaction.segment->pins.fetch_sub(1, std::memory_order_release);
+    }
+    evict_over_limit();
+
     print("[rofs] [%d] rofs_cache_read completed for i-node [%d]\n", sched::thread::current()->id(),
           inode->inode_no);
     return error;
@@ -323,41 +628,88 @@ cache_read(struct rofs_inode *inode, struct device *device, struct rofs_super_bl
 
 // Ensure a page (4096 bytes) of a file specified by offset is in memory in cache. Otherwise
 // load it from disk and eventually return address of the page in memory.
+// The page cache keeps referencing the page once mapped, so the segment is taken off
+// the CLOCK list for good.
 int
-cache_get_page_address(struct rofs_inode *inode, struct device *device, struct rofs_super_block *sb, struct uio *uio, void **addr)
+cache_get_page_address(struct rofs_inode *inode, struct device *device, struct rofs_info *rofs, struct uio *uio, void **addr)
 {
     // Find existing one or create new file cache
-    struct file_cache *cache = get_or_create_file_cache(inode, sb);
-
-    //
-    // Prepare a cache transaction (copy from memory
-    // or read from disk into cache memory and then copy into memory)
-    auto segment_transactions = plan_cache_transactions(cache, uio);
-    print("[rofs] [%d] rofs_get_page_address called for i-node [%d] at %d with %d ops\n",
-          sched::thread::current()->id(), inode->inode_no, offset, segment_transactions.size());
+    struct file_cache *cache = get_or_create_file_cache(inode, rofs);
 
     int error = 0;
-
-    assert(segment_transactions.size() == 1);
-    auto transaction = segment_transactions[0];
+    WITH_LOCK(cache->lock) {
+        //
+        // Prepare a cache transaction (copy from memory
+        // or read from disk into cache memory and then copy into memory)
+        auto segment_transactions = plan_cache_transactions(cache, uio, false);
+        print("[rofs] [%d] rofs_get_page_address called for i-node [%d] at %d with %d ops\n",
+              sched::thread::current()->id(), inode->inode_no, uio->uio_offset, segment_transactions.size());
+
+        assert(segment_transactions.size() == 1);
+        auto transaction = segment_transactions[0];
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
-    rofs_cache_reads += 1;
+        rofs_cache_reads += 1;
 #endif
-    if (transaction.transaction_type == CacheTransactionType::READ_FROM_DISK) {
         // Read from disk into segment missing in cache or empty segment that was in cache but had not data because
         // of failure to read
-        error = transaction.segment->read_from_disk(device);
-#if defined(ROFS_DIAGNOSTICS_ENABLED)
-        rofs_cache_misses += 1;
-#endif
-   }
+        error = read_segments_from_disk(device, segment_transactions);
+
+        if (!error) {
+            auto segment = transaction.segment;
+            if (!segment->mapped) {
+                segment->mapped = true;
+                WITH_LOCK(lru_lock) {
+                    lru.erase(lru.iterator_to(*segment));
+                }
+                cached_bytes.fetch_sub(segment->length(), std::memory_order_relaxed);
+            }
+            *addr = segment->memory_address(transaction.segment_offset);
+        } else {
+            *addr = nullptr;
+        }
+    }
+    evict_over_limit();
 
-   if( !error)
-       *addr = transaction.segment->memory_address(transaction.segment_offset);
-   else
-       *addr = nullptr;
+    return error;
+}
 
-   return error;
+//
+// Drops all cached data of the files of the given mount, called on unmount
+void
+cache_release(struct rofs_super_block *sb)
+{
+    std::vector<struct file_cache *> caches;
+    WITH_LOCK(file_cache_lock.for_write()) {
+        for (auto it = global_file_cache.begin(); it != global_file_cache.end();) {
+            if (it->first.sb == sb) {
+                caches.push_back(it->second);
+                it = global_file_cache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (auto cache : caches) {
+        WITH_LOCK(cache->lock) {
+            size_t released = 0;
+            WITH_LOCK(lru_lock) {
+                for (auto &entry : cache->segments_by_index) {
+                    auto segment = entry.second;
+                    if (segment->lru_link.is_linked()) {
+                        lru.erase(lru.iterator_to(*segment));
+                        released += segment->length();
+                    }
+                }
+            }
+            cached_bytes.fetch_sub(released, std::memory_order_relaxed);
+            for (auto &entry : cache->segments_by_index) {
+                delete entry.second;
+            }
+            cache->segments_by_index.clear();
+        }
+        delete cache;
+    }
 }
 
 }
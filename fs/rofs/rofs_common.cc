@@ -57,29 +57,119 @@ void rofs_set_vnode(struct vnode *vnode, struct rofs_inode *inode)
     vnode->v_size = size;
 }
 
+//
+// Submits a read of blocks_count blocks into buf without waiting for it, so
+// that several reads can be in flight at once. The read must be completed
+// with rofs_finish_read_blocks().
 int
-rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void *buf)
+rofs_start_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void *buf,
+                       struct bio **bio)
 {
-    ROFS_STOPWATCH_START
-    struct bio *bio = alloc_bio();
-    if (!bio)
+    *bio = alloc_bio();
+    if (!*bio)
         return ENOMEM;
 
-    bio->bio_cmd = BIO_READ;
-    bio->bio_dev = device;
-    bio->bio_data = buf;
-    bio->bio_offset = starting_block << 9;
-    bio->bio_bcount = blocks_count * BSIZE;
-
-    bio->bio_dev->driver->devops->strategy(bio);
-    int error = bio_wait(bio);
+    (*bio)->bio_cmd = BIO_READ;
+    (*bio)->bio_dev = device;
+    (*bio)->bio_data = buf;
+    (*bio)->bio_offset = starting_block << 9;
+    (*bio)->bio_bcount = blocks_count * BSIZE;
 
-    destroy_bio(bio);
+    (*bio)->bio_dev->driver->devops->strategy(*bio);
+    return 0;
+}
 
+int
+rofs_finish_read_blocks(struct bio *bio)
+{
+    ROFS_STOPWATCH_START
+    int error = bio_wait(bio);
 #if defined(ROFS_DIAGNOSTICS_ENABLED)
-    rofs_block_read_count += blocks_count;
+    rofs_block_read_count += bio->bio_bcount / BSIZE;
 #endif
+    destroy_bio(bio);
     ROFS_STOPWATCH_END(rofs_block_read_ms)
 
     return error;
 }
+
+int
+rofs_read_blocks(struct device *device, uint64_t starting_block, uint64_t blocks_count, void *buf)
+{
+    struct bio *bio;
+    int error = rofs_start_read_blocks(device, starting_block, blocks_count, buf, &bio);
+    if (error)
+        return error;
+
+    return rofs_finish_read_blocks(bio);
+}
+
+static bool
+lz4_read_length(const uint8_t *&ip, const uint8_t *iend, size_t &length)
+{
+    uint8_t b;
+    do {
+        if (ip >= iend)
+            return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+//
+// Decompresses a single LZ4 block (raw block format, no frame) as written
+// by scripts/gen-rofs-img.py. Returns the number of bytes decompressed or
+// -1 if the block is corrupt or would not fit into dest.
+long
+rofs_lz4_decompress(const void *source, size_t source_size, void *dest, size_t dest_size)
+{
+    auto ip = static_cast<const uint8_t *>(source);
+    auto iend = ip + source_size;
+    auto op = static_cast<uint8_t *>(dest);
+    auto ostart = op;
+    auto oend = op + dest_size;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        //
+        // Literals
+        size_t length = token >> 4;
+        if (length == 15 && !lz4_read_length(ip, iend, length))
+            return -1;
+        if ((size_t)(iend - ip) < length || (size_t)(oend - op) < length)
+            return -1;
+        memcpy(op, ip, length);
+        ip += length;
+        op += length;
+        //
+        // The last sequence has no match
+        if (ip == iend)
+            break;
+        //
+        // Match
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - ostart))
+            return -1;
+        length = token & 15;
+        if (length == 15 && !lz4_read_length(ip, iend, length))
+            return -1;
+        length += 4;
+        if ((size_t)(oend - op) < length)
+            return -1;
+        auto match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            // Overlapping match repeats the last offset bytes
+            while (length--)
+                *op++ = *match++;
+        }
+    }
+
+    return op - ostart;
+}
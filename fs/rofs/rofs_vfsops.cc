@@ -40,8 +40,10 @@ static int rofs_unmount(struct mount *mp, int flags);
 std::atomic<long> rofs_block_read_ms(0);
 std::atomic<long> rofs_block_read_count(0);
 std::atomic<long> rofs_block_allocated(0);
+std::atomic<long> rofs_block_evicted(0);
 std::atomic<long> rofs_cache_reads(0);
 std::atomic<long> rofs_cache_misses(0);
+std::atomic<long> rofs_cache_readaheads(0);
 #endif
 
 std::atomic<long> rofs_mounts(0);
@@ -89,7 +91,7 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
         return -1; // TODO: Proper error code
     }
 
-    if (sb->version != ROFS_VERSION) {
+    if (sb->version != ROFS_VERSION && sb->version != ROFS_VERSION_COMPRESSED) {
         kprintf("[rofs] Found rofs volume but incompatible version!\n");
         kprintf("[rofs] Expecting %llu but found %llu\n", ROFS_VERSION, sb->version);
         device_close(device);
@@ -104,6 +106,14 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
     print("[rofs] Got directory entries count:     %d\n", sb->directory_entries_count);
     print("[rofs] Got symlinks count:              %d\n", sb->symlinks_count);
     print("[rofs] Got inode count:                 %d\n", sb->inodes_count);
+
+    if (sb->version == ROFS_VERSION_COMPRESSED &&
+        (sb->compression != ROFS_COMPRESSION_LZ4 || sb->cluster_size_in_blocks != ROFS_CLUSTER_SIZE_IN_BLOCKS)) {
+        kprintf("[rofs] Found compressed rofs volume but unsupported compression %llu or cluster size %llu!\n",
+                sb->compression, sb->cluster_size_in_blocks);
+        device_close(device);
+        return -1;
+    }
     //
     // Since we have found ROFS, we can copy the superblock now
     sb = new rofs_super_block;
@@ -120,6 +130,7 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
 
     rofs = new struct rofs_info;
     rofs->sb = sb;
+    rofs->clusters = nullptr;
     rofs->dir_entries = (struct rofs_dir_entry *) malloc(sizeof(struct rofs_dir_entry) * sb->directory_entries_count);
 
     void *data_ptr = buf.get();
@@ -161,6 +172,22 @@ rofs_mount(struct mount *mp, const char *dev, int flags, const void *data)
     for (unsigned int idx = 0; idx < sb->inodes_count; idx++) {
         print("[rofs] inode: %d, size: %d\n", rofs->inodes[idx].inode_no, rofs->inodes[idx].file_size);
     }
+    //
+    // Read table of clusters of compressed file data
+    if (sb->version == ROFS_VERSION_COMPRESSED) {
+        auto table_size = sb->clusters_count * sizeof(struct rofs_cluster);
+        auto table_blocks = (table_size + BSIZE - 1) / BSIZE;
+        buf.reset(alloc_phys_contiguous_aligned(BSIZE * std::max<uint64_t>(table_blocks, 1), PAGE_SIZE));
+        error = rofs_read_blocks(device, sb->cluster_table_first_block, table_blocks, buf.get());
+        if (error) {
+            kprintf("[rofs] Error reading rofs cluster table blocks\n");
+            device_close(device);
+            return error;
+        }
+        rofs->clusters = (struct rofs_cluster *) malloc(std::max<uint64_t>(table_size, 1));
+        memcpy(rofs->clusters, buf.get(), table_size);
+        print("[rofs] Got clusters count:              %d\n", sb->clusters_count);
+    }
 
     // Save a reference to our superblock
     mp->m_data = rofs;
@@ -190,6 +217,9 @@ static int rofs_statfs(struct mount *mp, struct statfs *statp)
 
     // Total blocks
     statp->f_blocks = sb->structure_info_blocks_count + sb->structure_info_first_block;
+    if (sb->version == ROFS_VERSION_COMPRESSED) {
+        statp->f_blocks += (sb->clusters_count * sizeof(struct rofs_cluster) + BSIZE - 1) / BSIZE;
+    }
     // Read only. 0 blocks free
     statp->f_bfree = 0;
     statp->f_bavail = 0;
@@ -213,6 +243,8 @@ rofs_unmount(struct mount *mp, int flags)
     struct device *dev = mp->m_dev;
 
     int error = device_close(dev);
+    rofs::cache_release(sb);
+    free(rofs->clusters);
     delete sb;
     delete rofs;
 
@@ -220,6 +252,8 @@ rofs_unmount(struct mount *mp, int flags)
     debugff("ROFS: spent %.2f ms reading from disk\n", ((double) rofs_block_read_ms.load()) / 1000);
     debugff("ROFS: read %d 512-byte blocks from disk\n", rofs_block_read_count.load());
     debugff("ROFS: allocated %d 512-byte blocks of cache memory\n", rofs_block_allocated.load());
+    debugff("ROFS: evicted %d 512-byte blocks of cache memory\n", rofs_block_evicted.load());
+    debugff("ROFS: read ahead %d cache segments\n", rofs_cache_readaheads.load());
     long total_cache_reads = rofs_cache_reads.load();
     double hit_ratio = total_cache_reads > 0 ? (rofs_cache_reads.load() - rofs_cache_misses.load()) / ((double)total_cache_reads) : 0;
     debugff("ROFS: hit ratio is %.2f%%\n", hit_ratio * 100);
@@ -114,6 +114,12 @@ static int rofs_read_without_cache(struct vnode *vnode, struct file *fp, struct
 
     VERIFY_READ_INPUT_ARGUMENTS()
 
+    // Compressed data can only be decompressed in whole clusters which
+    // is what the cache does
+    if (rofs->clusters) {
+        return rofs::cache_read(inode, device, rofs, uio);
+    }
+
     int rv = 0;
     int error = -1;
     uint64_t block = inode->data_offset;
@@ -154,13 +160,12 @@ static int rofs_read_without_cache(struct vnode *vnode, struct file *fp, struct
 // by subsequent or contiguous reads. For details look at rofs_cache.cc.
 static int rofs_read_with_cache(struct vnode *vnode, struct file* fp, struct uio *uio, int ioflag) {
     struct rofs_info *rofs = (struct rofs_info *) vnode->v_mount->m_data;
-    struct rofs_super_block *sb = rofs->sb;
     struct rofs_inode *inode = (struct rofs_inode *) vnode->v_data;
     struct device *device = vnode->v_mount->m_dev;
 
     VERIFY_READ_INPUT_ARGUMENTS()
 
-    return rofs::cache_read(inode,device,sb,uio);
+    return rofs::cache_read(inode,device,rofs,uio);
 }
 //
 // This functions reads directory information (dentries) based on information in memory
@@ -279,7 +284,6 @@ static int rofs_getattr(struct vnode *vnode, struct vattr *attr)
 
 int rofs_map_cached_page(struct vnode *vnode, struct file* fp, struct uio *uio) {
     struct rofs_info *rofs = (struct rofs_info *) vnode->v_mount->m_data;
-    struct rofs_super_block *sb = rofs->sb;
     struct rofs_inode *inode = (struct rofs_inode *) vnode->v_data;
     struct device *device = vnode->v_mount->m_dev;
 
@@ -300,7 +304,7 @@ int rofs_map_cached_page(struct vnode *vnode, struct file* fp, struct uio *uio)
         return EINVAL;
 
     void *page_address;
-    int ret = rofs::cache_get_page_address(inode, device, sb, uio, &page_address);
+    int ret = rofs::cache_get_page_address(inode, device, rofs, uio, &page_address);
 
     if (!ret) {
         pagecache::map_read_cached_page((pagecache::hashkey*)uio->uio_iov->iov_base, page_address);
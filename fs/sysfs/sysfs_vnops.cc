@@ -9,8 +9,12 @@
 #include <osv/mount.h>
 #include <mntent.h>
 #include <osv/mempool.hh>
+#include <osv/drivers_config.h>
 
 #include "fs/pseudofs/pseudofs.hh"
+#if CONF_drivers_virtio_blk
+#include "drivers/virtio-blk.hh"
+#endif
 
 namespace sysfs {
 
@@ -68,6 +72,13 @@ static string sysfs_memory_pools()
             cpu->id, stats._max, stats._watermark_lo, stats._watermark_hi, stats._nr);
     }
 
+    for (auto cpu : sched::cpus) {
+        stats::range_cache_stats stats;
+        stats::get_range_cache_stats(cpu->id, stats);
+        output += osv::sprintf("cpu %d range cache (in bytes) %ld %ld hits %ld misses %ld\n",
+            cpu->id, stats._max_bytes, stats._bytes, stats._hits, stats._misses);
+    }
+
     return output;
 }
 
@@ -103,6 +114,11 @@ sysfs_mount(mount* mp, const char *dev, int flags, const void* data)
 
     auto osv_extension = make_shared<pseudo_dir_node>(inode_count++);
     osv_extension->add("memory", memory);
+#if CONF_drivers_virtio_blk
+    auto virtio_blk = make_shared<pseudo_dir_node>(inode_count++);
+    virtio_blk->add("queues", inode_count++, virtio::blk::queue_stats);
+    osv_extension->add("virtio-blk", virtio_blk);
+#endif
 
     auto* root = new pseudo_dir_node(vp->v_ino);
     root->add("devices", devices);
@@ -14,6 +14,8 @@
 #include <osv/debug.h>
 #include <osv/mutex.h>
 #include <osv/rcu.hh>
+#include <osv/sched.hh>
+#include <osv/types.h>
 #include <osv/export.h>
 #include <boost/range/algorithm/find.hpp>
 
@@ -25,12 +27,271 @@
 
 using namespace osv;
 
+/*
+ * Only serializes growing the table; descriptors are allocated, replaced
+ * and closed with atomic operations.
+ */
+mutex_t gfdt_lock = MUTEX_INITIALIZER;
+
+namespace {
+
 /*
  * Global file descriptors table - in OSv we have a single process so file
  * descriptors are maintained globally.
+ *
+ * The table is made of chunks of fds_per_chunk slots. Chunks are allocated
+ * as descriptors are handed out and are never freed, so the table can grow
+ * up to FDMAX_HARD without ever moving a slot and fget() only needs an RCU
+ * read lock.
+ *
+ * Free descriptors are tracked by a three level bitmap: one bit per
+ * descriptor, one bit per full bitmap word in each chunk, and one bit per
+ * full chunk. Descriptors are claimed and released with atomic operations
+ * only, so allocating the lowest free descriptor takes a few word scans
+ * instead of a walk over all open files. The two upper levels are hints:
+ * they are set after rechecking that the level below is full, and cleared
+ * after a descriptor is released, so they may say there is room where
+ * there is none, but never hide a free descriptor.
  */
-rcu_ptr<file> gfdt[FDMAX] = {};
-mutex_t gfdt_lock = MUTEX_INITIALIZER;
+class fd_table {
+public:
+    static constexpr unsigned fds_per_chunk = 1024;
+    static constexpr unsigned max_chunks = FDMAX_HARD / fds_per_chunk;
+
+    // Must be called under rcu_read_lock
+    file* get(unsigned fd);
+    // Installs fp in the lowest free descriptor not below min_fd and
+    // returns it, or returns -1 if there is none below limit
+    int alloc(file* fp, unsigned min_fd, unsigned limit);
+    // Removes and returns the file installed in fd
+    file* close(unsigned fd);
+    // Installs fp in fd and returns the file it replaces in old
+    int set(unsigned fd, file* fp, file** old);
+private:
+    static constexpr unsigned bits = 64;
+    static constexpr unsigned words_per_chunk = fds_per_chunk / bits;
+    static constexpr u64 all_words = (u64(1) << words_per_chunk) - 1;
+
+    struct chunk {
+        std::atomic<file*> files[fds_per_chunk];
+        // One bit per descriptor in use (or being set up or torn down)
+        std::atomic<u64> used[words_per_chunk];
+        // One bit per full word of used[]
+        std::atomic<u64> full;
+    };
+
+    chunk* get_chunk(unsigned c) {
+        return _chunks[c].load(std::memory_order_acquire);
+    }
+    chunk* grow(unsigned c);
+    unsigned first_free_chunk(unsigned c, unsigned nr_chunks);
+    int claim(unsigned c, chunk* ch, unsigned from);
+    void mark_full(unsigned c, chunk* ch, unsigned w);
+    void release(unsigned fd);
+
+    std::atomic<chunk*> _chunks[max_chunks];
+    // One bit per chunk whose used[] words are all full
+    std::atomic<u64> _full[max_chunks / bits];
+};
+
+static_assert(FDMAX_HARD % (fd_table::fds_per_chunk * 64) == 0,
+              "FDMAX_HARD must be a multiple of 64 chunks");
+static_assert(FDMAX <= FDMAX_HARD, "FDMAX can not exceed FDMAX_HARD");
+
+file* fd_table::get(unsigned fd)
+{
+    auto ch = get_chunk(fd / fds_per_chunk);
+    if (!ch) {
+        return nullptr;
+    }
+    return ch->files[fd % fds_per_chunk].load(std::memory_order_acquire);
+}
+
+fd_table::chunk* fd_table::grow(unsigned c)
+{
+    chunk* ch;
+    WITH_LOCK(gfdt_lock) {
+        ch = _chunks[c].load(std::memory_order_relaxed);
+        if (!ch) {
+            ch = new (std::nothrow) chunk();
+            _chunks[c].store(ch, std::memory_order_release);
+        }
+    }
+    return ch;
+}
+
+// Returns the first chunk from c on which is not known to be full
+unsigned fd_table::first_free_chunk(unsigned c, unsigned nr_chunks)
+{
+    while (c < nr_chunks) {
+        auto avail = ~_full[c / bits].load() & (~u64(0) << (c % bits));
+        if (avail) {
+            return std::min(c / bits * bits + __builtin_ctzll(avail),
+                            nr_chunks);
+        }
+        c = (c / bits + 1) * bits;
+    }
+    return nr_chunks;
+}
+
+void fd_table::mark_full(unsigned c, chunk* ch, unsigned w)
+{
+    auto wbit = u64(1) << w;
+    auto full = ch->full.fetch_or(wbit) | wbit;
+    // A descriptor in the word may have been released before we set the
+    // hint, and its release() may have missed it.
+    if (ch->used[w].load() != ~u64(0)) {
+        ch->full.fetch_and(~wbit);
+        return;
+    }
+    if (full != all_words) {
+        return;
+    }
+    auto cbit = u64(1) << (c % bits);
+    _full[c / bits].fetch_or(cbit);
+    if (ch->full.load() != all_words) {
+        _full[c / bits].fetch_and(~cbit);
+    }
+}
+
+// Claims the lowest free slot at or above index from in the chunk, and
+// returns its index or -1 if there is none
+int fd_table::claim(unsigned c, chunk* ch, unsigned from)
+{
+    auto words = ~ch->full.load() & all_words & (~u64(0) << (from / bits));
+    while (words) {
+        unsigned w = __builtin_ctzll(words);
+        words &= words - 1;
+        auto mask = w == from / bits ? ~u64(0) << (from % bits) : ~u64(0);
+        auto& word = ch->used[w];
+        auto v = word.load(std::memory_order_relaxed);
+        u64 avail;
+        while ((avail = ~v & mask)) {
+            auto bit = avail & -avail;
+            if (word.compare_exchange_weak(v, v | bit,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                if ((v | bit) == ~u64(0)) {
+                    mark_full(c, ch, w);
+                }
+                return w * bits + __builtin_ctzll(bit);
+            }
+        }
+    }
+    return -1;
+}
+
+void fd_table::release(unsigned fd)
+{
+    auto c = fd / fds_per_chunk;
+    auto ch = get_chunk(c);
+    auto w = fd % fds_per_chunk / bits;
+    auto wbit = u64(1) << w;
+    auto cbit = u64(1) << (c % bits);
+    ch->used[w].fetch_and(~(u64(1) << (fd % bits)));
+    // Clear the hints only after the descriptor itself, see mark_full()
+    if (ch->full.load() & wbit) {
+        ch->full.fetch_and(~wbit);
+    }
+    if (_full[c / bits].load() & cbit) {
+        _full[c / bits].fetch_and(~cbit);
+    }
+}
+
+int fd_table::alloc(file* fp, unsigned min_fd, unsigned limit)
+{
+    auto nr_chunks = (limit + fds_per_chunk - 1) / fds_per_chunk;
+    auto c = min_fd / fds_per_chunk;
+    auto from = min_fd % fds_per_chunk;
+
+    while (c < nr_chunks) {
+        if (!from) {
+            c = first_free_chunk(c, nr_chunks);
+            if (c == nr_chunks) {
+                break;
+            }
+        }
+        auto ch = get_chunk(c);
+        if (!ch && !(ch = grow(c))) {
+            break;
+        }
+        auto i = claim(c, ch, from);
+        if (i >= 0) {
+            unsigned fd = c * fds_per_chunk + i;
+            if (fd >= limit) {
+                release(fd);
+                break;
+            }
+            ch->files[i].store(fp, std::memory_order_release);
+            return fd;
+        }
+        c++;
+        from = 0;
+    }
+    return -1;
+}
+
+file* fd_table::close(unsigned fd)
+{
+    auto ch = get_chunk(fd / fds_per_chunk);
+    if (!ch) {
+        return nullptr;
+    }
+    // A slot is emptied before its descriptor is released, so whoever
+    // claims the descriptor next finds it empty
+    auto fp = ch->files[fd % fds_per_chunk].exchange(nullptr);
+    if (fp) {
+        release(fd);
+    }
+    return fp;
+}
+
+int fd_table::set(unsigned fd, file* fp, file** old)
+{
+    auto c = fd / fds_per_chunk;
+    auto ch = get_chunk(c);
+    if (!ch && !(ch = grow(c))) {
+        return ENOMEM;
+    }
+    auto i = fd % fds_per_chunk;
+    auto w = i / bits;
+    auto bit = u64(1) << (i % bits);
+    auto& slot = ch->files[i];
+    auto& word = ch->used[w];
+
+    for (;;) {
+        auto orig = slot.load(std::memory_order_acquire);
+        if (orig) {
+            // Replace the open file, unless it is being closed right now
+            if (slot.compare_exchange_strong(orig, fp)) {
+                *old = orig;
+                return 0;
+            }
+            continue;
+        }
+        auto v = word.load(std::memory_order_relaxed);
+        if (!(v & bit)) {
+            if (word.compare_exchange_strong(v, v | bit,
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                if ((v | bit) == ~u64(0)) {
+                    mark_full(c, ch, w);
+                }
+                slot.store(fp, std::memory_order_release);
+                *old = nullptr;
+                return 0;
+            }
+            continue;
+        }
+        // The descriptor was just claimed by fdalloc() or is being closed;
+        // either way this is over in a moment.
+        sched::thread::yield();
+    }
+}
+
+fd_table gfdt;
+
+std::atomic<unsigned> gfdt_limit = { FDMAX };
+
+}
 
 /*
  * Allocate a file descriptor and assign fd to it atomically.
@@ -41,35 +302,39 @@ int _fdalloc(struct file *fp, int *newfd, int min_fd)
 {
     int fd;
 
+    if (min_fd < 0)
+        return EINVAL;
+
     fhold(fp);
 
-    for (fd = min_fd; fd < FDMAX; fd++) {
-        if (gfdt[fd])
-            continue;
+    fd = gfdt.alloc(fp, min_fd, fd_limit());
+    if (fd < 0) {
+        fdrop(fp);
+        return EMFILE;
+    }
 
-        WITH_LOCK(gfdt_lock) {
-            /* Now that we hold the lock,
-             * make sure the entry is still available */
-            if (gfdt[fd].read_by_owner()) {
-                continue;
-            }
+    *newfd = fd;
+    return 0;
+}
 
-            /* Install */
-            gfdt[fd].assign(fp);
-            *newfd = fd;
-        }
+int fd_limit(void)
+{
+    return gfdt_limit.load(std::memory_order_relaxed);
+}
 
-        return 0;
-    }
+int fd_set_limit(unsigned limit)
+{
+    if (limit > FDMAX_HARD)
+        return EPERM;
 
-    fdrop(fp);
-    return EMFILE;
+    gfdt_limit.store(limit, std::memory_order_relaxed);
+    return 0;
 }
 
 extern "C" OSV_LIBC_API
 int getdtablesize(void)
 {
-    return FDMAX;
+    return fd_limit();
 }
 
 /*
@@ -86,14 +351,12 @@ int fdclose(int fd)
 {
     struct file* fp;
 
-    WITH_LOCK(gfdt_lock) {
-
-        fp = gfdt[fd].read_by_owner();
-        if (fp == nullptr) {
-            return EBADF;
-        }
+    if (fd < 0 || fd >= FDMAX_HARD)
+        return EBADF;
 
-        gfdt[fd].assign(nullptr);
+    fp = gfdt.close(fd);
+    if (fp == nullptr) {
+        return EBADF;
     }
 
     fdrop(fp);
@@ -108,16 +371,17 @@ int fdclose(int fd)
 int fdset(int fd, struct file *fp)
 {
     struct file *orig;
+    int error;
 
-    if (fd < 0 || fd >= FDMAX)
+    if (fd < 0 || fd >= fd_limit())
         return EBADF;
 
     fhold(fp);
 
-    WITH_LOCK(gfdt_lock) {
-        orig = gfdt[fd].read_by_owner();
-        /* Install new file structure in place */
-        gfdt[fd].assign(fp);
+    error = gfdt.set(fd, fp, &orig);
+    if (error) {
+        fdrop(fp);
+        return error;
     }
 
     if (orig)
@@ -146,7 +410,7 @@ int fget(int fd, struct file **out_fp)
 {
     struct file *fp;
 
-    if (fd < 0 || fd >= FDMAX)
+    if (fd < 0 || fd >= FDMAX_HARD)
         return EBADF;
 
 #if CONF_lazy_stack_invariant
@@ -156,7 +420,7 @@ int fget(int fd, struct file **out_fp)
     arch::ensure_next_stack_page();
 #endif
     WITH_LOCK(rcu_read_lock) {
-        fp = gfdt[fd].read();
+        fp = gfdt.get(fd);
         if (fp == nullptr) {
             return EBADF;
         }
@@ -185,8 +449,15 @@ void file::wake_epoll(int events)
         if (!f_epolls) {
             return;
         }
+        // Of the epolls that registered with EPOLLEXCLUSIVE, stop waking
+        // up at the first one that had threads waiting
+        bool woke_exclusive = false;
         for (auto&& ep : *f_epolls) {
-            epoll_wake(ep);
+            if (!ep.exclusive) {
+                epoll_wake(ep);
+            } else if (!woke_exclusive) {
+                woke_exclusive = epoll_wake(ep);
+            }
         }
     }
 #endif
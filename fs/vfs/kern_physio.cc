@@ -43,7 +43,7 @@ bio_wait(struct bio *bio)
 		bio->bio_wait.wait(bio->bio_mutex);
 	}
 	if (bio->bio_flags & BIO_ERROR) {
-		return EIO;
+		return bio->bio_error ? bio->bio_error : EIO;
 	}
 	return 0;
 }
@@ -76,6 +76,7 @@ static void multiplex_bio_done(struct bio *b)
 {
 	struct bio *bio = static_cast<struct bio*>(b->bio_caller1);
 	bool error = b->bio_flags & BIO_ERROR;
+	int bio_error = b->bio_error;
 	destroy_bio(b);
 
 
@@ -85,6 +86,8 @@ static void multiplex_bio_done(struct bio *b)
 	if (error) {
 		WITH_LOCK(bio->bio_mutex) {
 			bio->bio_flags |= BIO_ERROR;
+			if (bio_error)
+				bio->bio_error = bio_error;
 		}
 	}
 
@@ -107,7 +110,21 @@ void multiplex_strategy(struct bio *bio)
 
 	assert(strategy != nullptr);
 
-	if (len <= dev->max_io_size) {
+	// Range commands carry no data, they are only limited by what the
+	// device takes in one request. Devices which can not do them at all
+	// leave the limit at 0.
+	uint64_t max_size = dev->max_io_size;
+	if (bio->bio_cmd == BIO_DISCARD || bio->bio_cmd == BIO_WRITE_ZEROES) {
+		max_size = bio->bio_cmd == BIO_DISCARD ?
+			dev->max_discard_size : dev->max_write_zeroes_size;
+		if (!max_size) {
+			bio->bio_error = EOPNOTSUPP;
+			biodone(bio, false);
+			return;
+		}
+	}
+
+	if (len <= max_size) {
 		strategy(bio);
 		return;
 	}
@@ -116,10 +133,10 @@ void multiplex_strategy(struct bio *bio)
 	// trivially determine what is the number going to be. Otherwise, we can have a
 	// situation in which we bump the refcount to 1, get scheduled out, the bio is
 	// finished, and when it drops its refcount to 0, we consider the main bio finished.
-	refcount_init(&bio->bio_refcnt, (len / dev->max_io_size) + !!(len % dev->max_io_size));
+	refcount_init(&bio->bio_refcnt, (len / max_size) + !!(len % max_size));
 
 	while (len > 0) {
-		uint64_t req_size = MIN(len, dev->max_io_size);
+		uint64_t req_size = MIN(len, max_size);
 		struct bio *b = alloc_bio();
 
 		b->bio_bcount = req_size;
@@ -133,7 +150,8 @@ void multiplex_strategy(struct bio *bio)
 		b->bio_done = multiplex_bio_done;
 
 		strategy(b);
-		buf += req_size;
+		if (buf)
+			buf += req_size;
 		offset += req_size;
 		len -= req_size;
 	}
@@ -40,6 +40,7 @@
 #include <sys/statx.h>
 #include <sys/time.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 
 #include <limits.h>
 #include <unistd.h>
@@ -71,6 +72,7 @@
 #include "libc/internal/libc.h"
 
 #include <algorithm>
+#include <memory>
 #include <unordered_map>
 
 #include <sys/file.h>
@@ -87,6 +89,9 @@
 
 #include "drivers/zfs.hh"
 #include "bsd/porting/shrinker.h"
+#include <osv/zcopy.hh>
+#include <osv/async.hh>
+#include <poll.h>
 
 using namespace std;
 
@@ -2297,8 +2302,101 @@ int lchown(const char *path, uid_t owner, gid_t group)
 }
 
 
-OSV_LIBC_API
-ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
+// sendfile() to a stream socket lends the pages of the input file to the
+// network stack as external mbuf storage instead of copying them. The range
+// is mapped once, but only faulted in one window at a time, so the pages it
+// pins stay bounded: a window is given back once the last mbuf pointing into
+// it is freed, and the mapping goes away after the last window.
+static constexpr size_t sendfile_window = 1 << 20;
+
+static int sendfile_zcopy(int out_fd, int in_fd, off_t offset, size_t count,
+                          bool nonblock, size_t *sent)
+{
+    *sent = 0;
+    off_t map_offset = align_down(offset, (off_t)mmu::page_size);
+    size_t map_len = offset - map_offset + count;
+    char *map = static_cast<char *>(mmap(nullptr, map_len, PROT_READ,
+                                         MAP_SHARED, in_fd, map_offset));
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+    // Windows must not share huge pages, they are given back separately
+    madvise(map, map_len, MADV_NOHUGEPAGE);
+    // The last mbuf may be freed with network locks held, where munmap()
+    // and madvise() must not sleep
+    auto mapping = new zbuf_handle([map, map_len] {
+        async::run_later([map, map_len] {
+            munmap(map, map_len);
+        });
+    });
+
+    int error = 0;
+    while (*sent < count) {
+        char *data = map + (offset - map_offset) + *sent;
+        char *window = align_down(data, mmu::page_size);
+        size_t len = std::min(count - *sent, sendfile_window - (data - window));
+        size_t window_len = align_up(data + len, mmu::page_size) - window;
+
+        // The pages have to be present for the stack to find their
+        // physical addresses
+        for (size_t i = 0; i < window_len; i += mmu::page_size) {
+            *static_cast<volatile char *>(window + i);
+        }
+        mapping->hold();
+        auto zb = new zbuf_handle([mapping, window, window_len] {
+            async::run_later([mapping, window, window_len] {
+                madvise(window, window_len, MADV_DONTNEED);
+                mapping->release();
+            });
+        });
+
+        size_t bytes;
+        error = zcopy_sendbuf(out_fd, data, len, zb, nonblock, &bytes);
+        zb->release();
+        *sent += bytes;
+        if (error || bytes < len) {
+            break;
+        }
+    }
+    mapping->release();
+    return error;
+}
+
+static ssize_t sendfile_copy(int out_fd, int in_fd, off_t offset,
+                             off_t *off_out, size_t count, bool nonblock)
+{
+    size_t bytes_to_mmap = count + (offset % mmu::page_size);
+    off_t offset_for_mmap =  align_down(offset, (off_t)mmu::page_size);
+
+    char *src = static_cast<char *>(mmap(nullptr, bytes_to_mmap, PROT_READ, MAP_SHARED, in_fd, offset_for_mmap));
+
+    if (src == MAP_FAILED) {
+        return -1;
+    }
+
+    ssize_t ret;
+    if (off_out) {
+        ret = pwrite(out_fd, src + (offset % PAGE_SIZE), count, *off_out);
+    } else if (nonblock) {
+        ret = send(out_fd, src + (offset % PAGE_SIZE), count, MSG_DONTWAIT);
+    } else {
+        ret = write(out_fd, src + (offset % PAGE_SIZE), count);
+    }
+    int error = errno;
+
+    assert(munmap(src, bytes_to_mmap) == 0);
+
+    if (ret < 0) {
+        return libc_error(error);
+    }
+    return ret;
+}
+
+// Copy count bytes from in_fd to out_fd, either at off_out or at the current
+// position of out_fd when off_out is null. With nonblock, out_fd is a socket
+// which is not waited on even if it is in blocking mode.
+static ssize_t do_sendfile(int out_fd, int in_fd, off_t *_offset,
+                           off_t *off_out, size_t count, bool nonblock = false)
 {
     struct file *in_fp;
     struct file *out_fp;
@@ -2326,6 +2424,8 @@ ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
 	} else if (!(out_fp->f_flags & FWRITE)) {
             return libc_error(EBADF);
 	}
+    } else if (off_out) {
+        return libc_error(ESPIPE);
     }
 
     off_t offset ;
@@ -2352,30 +2452,44 @@ ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
         }
     }
 
-    size_t bytes_to_mmap = count + (offset % mmu::page_size);
-    off_t offset_for_mmap =  align_down(offset, (off_t)mmu::page_size);
-
-    char *src = static_cast<char *>(mmap(nullptr, bytes_to_mmap, PROT_READ, MAP_SHARED, in_fd, offset_for_mmap));
-
-    if (src == MAP_FAILED) {
-        return -1;
+    ssize_t ret = 0;
+    int error = EOPNOTSUPP;
+    if (out_fp->f_type == DTYPE_SOCKET) {
+        size_t sent;
+        error = sendfile_zcopy(out_fd, in_fd, offset, count, nonblock, &sent);
+        if (error == EOPNOTSUPP && sent == 0) {
+            // Not a stream socket, fall back to copying
+        } else if (error && sent == 0) {
+            return libc_error(error);
+        } else {
+            ret = sent;
+        }
+    }
+    if (error == EOPNOTSUPP) {
+        ret = sendfile_copy(out_fd, in_fd, offset, off_out, count, nonblock);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
-    auto ret = write(out_fd, src + (offset % PAGE_SIZE), count);
-
-    if (ret < 0) {
-        return libc_error(errno);
-    } else if(_offset == nullptr) {
+    if (_offset == nullptr) {
         lseek(in_fd, ret, SEEK_CUR);
     } else {
         *_offset += ret;
     }
-
-    assert(munmap(src, count) == 0);
+    if (off_out) {
+        *off_out += ret;
+    }
 
     return ret;
 }
 
+OSV_LIBC_API
+ssize_t sendfile(int out_fd, int in_fd, off_t *_offset, size_t count)
+{
+    return do_sendfile(out_fd, in_fd, _offset, nullptr, count);
+}
+
 #undef sendfile64
 LFS64(sendfile);
 
@@ -2389,15 +2503,136 @@ ssize_t copy_file_range(int fd_in, off_t *off_in,
         errno = EINVAL;
         return -1;
     }
-    //We do not support writing to a file at specified offset because
-    //we delegate to sendfile() which assumes current position of the output
-    //file
-    if (off_out) {
-        WARN("copy_file_range() does not support non-zero off_out\n");
-        errno = EINVAL;
-        return -1;
+    return do_sendfile(fd_out, fd_in, off_in, off_out, len);
+}
+
+// Move data between two descriptors without a round trip through user
+// space. Pipes are byte queues rather than lists of pages here, so unlike on
+// Linux the data is copied once through a kernel buffer; only a file spliced
+// into a socket is sent without copying, by way of sendfile().
+static constexpr size_t splice_chunk = 64 * 1024;
+
+static int splice_io(struct file *fp, bool write, char *buf, size_t len,
+                     off_t *off, bool nonblock, size_t *bytes)
+{
+    struct iovec iov = { buf, len };
+    struct uio uio;
+    uio.uio_iov = &iov;
+    uio.uio_iovcnt = 1;
+    uio.uio_offset = off ? *off : -1;
+    uio.uio_resid = len;
+    uio.uio_rw = write ? UIO_WRITE : UIO_READ;
+    int flags = (off ? FOF_OFFSET : 0) | (nonblock ? FOF_NONBLOCK : 0);
+    int error = write ? fp->write(&uio, flags) : fp->read(&uio, flags);
+    *bytes = len - uio.uio_resid;
+    if (off) {
+        *off += *bytes;
+    }
+    return error;
+}
+
+// Write as much of buf as fits without blocking. If nothing does and we may
+// block, wait until there is room for some of it, like a pipe would.
+static int splice_write(int fd, struct file *fp, char *buf, size_t len,
+                        off_t *off, bool may_block, size_t *bytes)
+{
+    for (;;) {
+        int error = splice_io(fp, true, buf, len, off, true, bytes);
+        if (*bytes) {
+            return 0;
+        }
+        if (error && error != EWOULDBLOCK) {
+            return error;
+        }
+        if (!may_block) {
+            return EWOULDBLOCK;
+        }
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        poll(&pfd, 1, -1);
+    }
+}
+
+extern "C" OSV_LIBC_API
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+               size_t len, unsigned int flags)
+{
+    fileref in_f{fileref_from_fd(fd_in)};
+    fileref out_f{fileref_from_fd(fd_out)};
+
+    if (!in_f || !out_f) {
+        return libc_error(EBADF);
+    }
+    if (!(in_f->f_flags & FREAD) || !(out_f->f_flags & FWRITE)) {
+        return libc_error(EBADF);
+    }
+    // Only files have a position to splice from or to
+    if ((off_in && in_f->f_type != DTYPE_VNODE) ||
+        (off_out && out_f->f_type != DTYPE_VNODE)) {
+        return libc_error(ESPIPE);
+    }
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0)) {
+        return libc_error(EINVAL);
+    }
+    if (!len) {
+        return 0;
+    }
+
+    bool nonblock = flags & SPLICE_F_NONBLOCK;
+    if (in_f->f_type == DTYPE_VNODE && out_f->f_type == DTYPE_SOCKET) {
+        return do_sendfile(fd_out, fd_in, off_in, nullptr, len, nonblock);
+    }
+
+    bool seekable = in_f->f_type == DTYPE_VNODE;
+    std::unique_ptr<char[]> buf(new char[std::min(len, splice_chunk)]);
+    size_t total = 0;
+    int error = 0;
+    while (total < len) {
+        size_t got, put;
+        // Only wait for input or for room in the output while nothing has
+        // been moved yet
+        bool may_block = !nonblock && !total;
+        error = splice_io(in_f.get(), false, buf.get(),
+                          std::min(len - total, splice_chunk), off_in,
+                          !may_block, &got);
+        if (error || !got) {
+            break;
+        }
+        error = splice_write(fd_out, out_f.get(), buf.get(), got, off_out,
+                             may_block, &put);
+        if (put < got) {
+            size_t left = got - put;
+            if (seekable) {
+                // Give back what did not fit
+                if (off_in) {
+                    *off_in -= left;
+                } else {
+                    lseek(fd_in, -(off_t)left, SEEK_CUR);
+                }
+            } else {
+                // Data taken out of a pipe or a socket can not be pushed
+                // back, so it has to go out even if that means waiting
+                while (left) {
+                    size_t more;
+                    error = splice_write(fd_out, out_f.get(), buf.get() + put,
+                                         left, off_out, true, &more);
+                    if (error) {
+                        break;
+                    }
+                    put += more;
+                    left -= more;
+                }
+            }
+        }
+        total += put;
+        if (error || put < got) {
+            break;
+        }
+    }
+
+    if (error && !total) {
+        return libc_error(error);
     }
-    return sendfile(fd_out, fd_in, off_in, len);
+    return total;
 }
 
 NO_SYS(OSV_LIBC_API int fchmodat(int dirfd, const char *pathname, mode_t mode, int flags));
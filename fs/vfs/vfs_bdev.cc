@@ -16,6 +16,7 @@
 #include <osv/prex.h>
 #include <osv/buf.h>
 #include <osv/bio.h>
+#include <osv/mmu.hh>
 
 int
 bdev_read(struct device *dev, struct uio *uio, int ioflags)
@@ -125,9 +126,12 @@ physio(struct device *dev, struct uio *uio, int ioflags)
 		bio->bio_offset = uio->uio_offset;
 		bio->bio_bcount = uio->uio_resid;
 
+		/* The device accesses the caller's buffer directly */
+		mmu::user_dma_begin();
 		dev->driver->devops->strategy(bio);
 
 		ret = bio_wait(bio);
+		mmu::user_dma_end();
 		destroy_bio(bio);
 		if (ret)
 			return ret;
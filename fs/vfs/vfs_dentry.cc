@@ -40,31 +40,99 @@
 
 #include <osv/dentry.h>
 #include <osv/vnode.h>
+#include <osv/sched.hh>
+#include <osv/rcu.hh>
+#include <osv/rcu-hashtable.hh>
+#include <osv/kernel_config_lazy_stack.h>
+#include <osv/kernel_config_lazy_stack_invariant.h>
 #include "vfs.h"
 
-#define DENTRY_BUCKETS 32
-
-static LIST_HEAD(dentry_hash_head, dentry) dentry_hash_table[DENTRY_BUCKETS];
-static LIST_HEAD(fake, dentry) fake;
-static mutex dentry_hash_lock;
+#define DENTRY_BUCKETS 32	/* initial size of the dentry hash table */
 
 /*
  * Get the hash value from the mount point and path name.
- * XXX: replace with a better hash for 64-bit pointers.
  */
-static u_int
+static size_t
 dentry_hash(struct mount *mp, const char *path)
 {
-    u_int val = 0;
+    size_t val = 0;
 
     if (path) {
         while (*path) {
             val = ((val << 5) + val) + *path++;
         }
     }
-    return (val ^ (unsigned long) mp) & (DENTRY_BUCKETS - 1);
+    // The low bits of a mount pointer are always zero
+    return val ^ ((uintptr_t)mp >> 4);
+}
+
+struct dentry_key {
+    struct mount *mp;
+    const char *path;
+};
+
+struct dentry_hasher {
+    size_t operator()(const dentry_key& k) const {
+        return dentry_hash(k.mp, k.path);
+    }
+    size_t operator()(struct dentry *dp) const {
+        return dentry_hash(dp->d_mount, dp->d_path);
+    }
+};
+
+struct dentry_key_equal {
+    bool operator()(const dentry_key& k, struct dentry *dp) const {
+        return dp->d_mount == k.mp && !strncmp(dp->d_path, k.path, PATH_MAX);
+    }
+};
+
+/*
+ * All hashed dentries, looked up by mount point and path name.
+ *
+ * Lookups are done under rcu_read_lock only; insertions and removals (and
+ * so resizing) are serialized by dentry_hash_lock. Since a lookup may
+ * race with the final drele(), a dentry and its path are only freed after
+ * an RCU grace period, and a reference is only taken on a dentry whose
+ * count has not dropped to zero yet. Such a dentry may still be in the
+ * table next to a new one for the same path, so lookups skip it and go
+ * on searching.
+ */
+static osv::rcu_hashtable<struct dentry *, dentry_hasher>
+    dentry_table(DENTRY_BUCKETS);
+static mutex dentry_hash_lock;
+
+static bool dhold_if_positive(struct dentry *dp)
+{
+    auto c = __atomic_load_n(&dp->d_refcnt, __ATOMIC_RELAXED);
+    // A zero d_refcnt means that the dentry is being freed; don't
+    // increment
+    while (c > 0 && !__atomic_compare_exchange_n(&dp->d_refcnt, &c, c + 1,
+            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // nothing to do
+    }
+    return c > 0;
 }
 
+// Matches only dentries it could take a reference on, for dentry_lookup()
+struct dentry_key_hold {
+    bool operator()(const dentry_key& k, struct dentry *dp) const {
+        return dentry_key_equal()(k, dp) && dhold_if_positive(dp);
+    }
+};
+
+/*
+ * Remove a dentry from the hash table, if it is still there.
+ *
+ * Locking: dentry_hash_lock must be held.
+ */
+static void
+dentry_unhash(struct dentry *dp)
+{
+    auto i = dentry_table.owner_find(dp);
+    if (i) {
+        dentry_table.erase(i);
+    }
+}
 
 struct dentry *
 dentry_alloc(struct dentry *parent_dp, struct vnode *vp, const char *path)
@@ -95,9 +163,9 @@ dentry_alloc(struct dentry *parent_dp, struct vnode *vp, const char *path)
 
     vn_add_name(vp, dp);
 
-    mutex_lock(&dentry_hash_lock);
-    LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(mp, path)], dp, d_link);
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_table.insert(dp);
+    }
     return dp;
 };
 
@@ -106,16 +174,27 @@ dentry_lookup(struct mount *mp, char *path)
 {
     struct dentry *dp;
 
-    mutex_lock(&dentry_hash_lock);
-    LIST_FOREACH(dp, &dentry_hash_table[dentry_hash(mp, path)], d_link) {
-        if (dp->d_mount == mp && !strncmp(dp->d_path, path, PATH_MAX)) {
-            dp->d_refcnt++;
-            mutex_unlock(&dentry_hash_lock);
+#if CONF_lazy_stack_invariant
+    assert(sched::preemptable() && arch::irq_enabled());
+#endif
+#if CONF_lazy_stack
+    arch::ensure_next_stack_page();
+#endif
+    WITH_LOCK(osv::rcu_read_lock) {
+        auto i = dentry_table.reader_find(dentry_key{mp, path},
+                dentry_hasher(), dentry_key_hold());
+        if (!i) {
+            return nullptr;                /* not found */
+        }
+        dp = *i;
+        // Now that we hold a reference, make sure a concurrent
+        // dentry_move() did not rename dp after we matched it.
+        if (dentry_key_equal()(dentry_key{mp, path}, dp)) {
             return dp;
         }
     }
-    mutex_unlock(&dentry_hash_lock);
-    return nullptr;                /* not found */
+    drele(dp);
+    return nullptr;
 }
 
 static void dentry_children_remove(struct dentry *dp)
@@ -125,8 +204,7 @@ static void dentry_children_remove(struct dentry *dp)
     WITH_LOCK(dp->d_lock) {
         LIST_FOREACH(entry, &dp->d_children, d_children_link) {
             ASSERT(entry);
-            ASSERT(entry->d_refcnt > 0);
-            LIST_REMOVE(entry, d_link);
+            dentry_unhash(entry);
         }
     }
 }
@@ -156,30 +234,28 @@ dentry_move(struct dentry *dp, struct dentry *parent_dp, char *path)
         // Remove all dp's child dentries from the hashtable.
         dentry_children_remove(dp);
         // Remove dp with outdated hash info from the hashtable.
-        LIST_REMOVE(dp, d_link);
+        dentry_unhash(dp);
         // Update dp.
         dp->d_path = strdup(path);
         dp->d_parent = parent_dp;
         // Insert dp updated hash info into the hashtable.
-        LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(dp->d_mount, path)],
-            dp, d_link);
+        dentry_table.insert(dp);
     }
 
     if (old_pdp) {
         drele(old_pdp);
     }
 
-    free(old_path);
+    // Concurrent lookups may still be comparing against the old path
+    osv::rcu_defer(free, old_path);
 }
 
 void
 dentry_remove(struct dentry *dp)
 {
-    mutex_lock(&dentry_hash_lock);
-    LIST_REMOVE(dp, d_link);
-    /* put it on a fake list for drele() to work*/
-    LIST_INSERT_HEAD(&fake, dp, d_link);
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_unhash(dp);
+    }
 }
 
 void
@@ -188,9 +264,7 @@ dref(struct dentry *dp)
     ASSERT(dp);
     ASSERT(dp->d_refcnt > 0);
 
-    mutex_lock(&dentry_hash_lock);
-    dp->d_refcnt++;
-    mutex_unlock(&dentry_hash_lock);
+    __sync_fetch_and_add(&dp->d_refcnt, 1);
 }
 
 void
@@ -199,15 +273,14 @@ drele(struct dentry *dp)
     ASSERT(dp);
     ASSERT(dp->d_refcnt > 0);
 
-    mutex_lock(&dentry_hash_lock);
-    if (--dp->d_refcnt) {
-        mutex_unlock(&dentry_hash_lock);
+    if (__sync_sub_and_fetch(&dp->d_refcnt, 1)) {
         return;
     }
-    LIST_REMOVE(dp, d_link);
-    vn_del_name(dp->d_vnode, dp);
 
-    mutex_unlock(&dentry_hash_lock);
+    WITH_LOCK(dentry_hash_lock) {
+        dentry_unhash(dp);
+    }
+    vn_del_name(dp->d_vnode, dp);
 
     if (dp->d_parent) {
         WITH_LOCK(dp->d_parent->d_lock) {
@@ -219,16 +292,15 @@ drele(struct dentry *dp)
 
     vrele(dp->d_vnode);
 
-    free(dp->d_path);
-    free(dp);
+    // Lookups which found dp before it was unhashed may still be looking
+    // at it.
+    osv::rcu_defer([] (struct dentry *d) {
+        free(d->d_path);
+        free(d);
+    }, dp);
 }
 
 void
 dentry_init(void)
 {
-    int i;
-
-    for (i = 0; i < DENTRY_BUCKETS; i++) {
-        LIST_INIT(&dentry_hash_table[i]);
-    }
 }
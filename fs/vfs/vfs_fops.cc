@@ -157,6 +157,9 @@ void vfs_file::sync(off_t start, off_t end)
 // eviction that will hold the mmu-side lock that protects the mappings
 // Always follow that order. We however can't just get rid of the mmu-side lock,
 // because not all invalidations will be synchronous.
+//
+// Returns 0 if the page was mapped, -1 for a hole past the end of the file,
+// or the error of the file system.
 int vfs_file::read_page_from_cache(void* key, off_t offset)
 {
     struct vnode *vp = f_dentry->d_vnode;
@@ -172,8 +175,11 @@ int vfs_file::read_page_from_cache(void* key, off_t offset)
     data.uio_rw = UIO_READ;
 
     vn_lock(vp);
-    assert(VOP_CACHE(vp, this, &data) == 0);
+    int error = VOP_CACHE(vp, this, &data);
     vn_unlock(vp);
+    if (error) {
+        return error;
+    }
 
     return (data.uio_resid != 0) ? -1 : 0;
 }
@@ -42,6 +42,11 @@
 #include <osv/prex.h>
 #include <osv/vnode.h>
 #include <osv/export.h>
+#include <osv/sched.hh>
+#include <osv/rcu.hh>
+#include <osv/rcu-hashtable.hh>
+#include <osv/kernel_config_lazy_stack.h>
+#include <osv/kernel_config_lazy_stack_invariant.h>
 #include "vfs.h"
 
 OSV_LIBSOLARIS_API
@@ -68,56 +73,134 @@ int vttoif_tab[10] = {
  * vrele      -1        *
  */
 
-#define VNODE_BUCKETS 32		/* size of vnode hash table */
+#define VNODE_BUCKETS 32		/* initial size of vnode hash table */
+
+/*
+ * Get the hash value from the mount point and inode number.
+ */
+static size_t
+vn_hash(struct mount *mp, uint64_t ino)
+{
+	/* The low bits of a mount pointer are always zero */
+	return ino ^ ((uintptr_t)mp >> 4);
+}
+
+struct vnode_key {
+	struct mount *mp;
+	uint64_t ino;
+};
+
+struct vnode_hasher {
+	size_t operator()(const vnode_key& k) const {
+		return vn_hash(k.mp, k.ino);
+	}
+	size_t operator()(struct vnode *vp) const {
+		return vn_hash(vp->v_mount, vp->v_ino);
+	}
+};
+
+struct vnode_key_equal {
+	bool operator()(const vnode_key& k, struct vnode *vp) const {
+		return vp->v_mount == k.mp && vp->v_ino == k.ino;
+	}
+};
 
 /*
  * vnode table.
  * All active (opened) vnodes are stored on this hash table.
- * They can be accessed by its path name.
+ * They can be accessed by their mount point and inode number.
+ *
+ * Lookups only need rcu_read_lock; a vnode is freed an RCU grace
+ * period after it left the table, and lookups never take a reference
+ * on a vnode whose count already dropped to zero. Such a vnode may
+ * still be in the table while vget() adds a new one for the same inode,
+ * so lookups skip it and go on searching.
  */
-static LIST_HEAD(vnode_hash_head, vnode) vnode_table[VNODE_BUCKETS];
+static osv::rcu_hashtable<struct vnode *, vnode_hasher>
+	vnode_table(VNODE_BUCKETS);
 
 /*
- * Global lock to access all vnodes and vnode table.
- * If a vnode is already locked, there is no need to
- * lock this global lock to access internal data.
+ * Global lock serializing changes to the vnode table.
  */
 static mutex_t vnode_lock = MUTEX_INITIALIZER;
 #define VNODE_LOCK()	mutex_lock(&vnode_lock)
 #define VNODE_UNLOCK()	mutex_unlock(&vnode_lock)
-#define VNODE_OWNED()	mutex_owned(&vnode_lock)
+
+static bool
+vhold_if_positive(struct vnode *vp)
+{
+	auto c = __atomic_load_n(&vp->v_refcnt, __ATOMIC_RELAXED);
+	/* zero v_refcnt means the vnode is being freed; don't increment */
+	while (c > 0 && !__atomic_compare_exchange_n(&vp->v_refcnt, &c, c + 1,
+	    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		/* nothing to do */
+	}
+	return c > 0;
+}
 
 /*
- * Get the hash value from the mount point and path name.
- * XXX(hch): replace with a better hash for 64-bit pointers.
+ * Matches only vnodes it could take a reference on, for vn_find().
  */
-static u_int
-vn_hash(struct mount *mp, uint64_t ino)
+struct vnode_key_hold {
+	bool operator()(const vnode_key& k, struct vnode *vp) const {
+		return vnode_key_equal()(k, vp) && vhold_if_positive(vp);
+	}
+};
+
+/*
+ * Remove a vnode whose last reference was dropped from the vnode table.
+ */
+static void
+vn_unhash(struct vnode *vp)
 {
-	return (ino ^ (unsigned long)mp) & (VNODE_BUCKETS - 1);
+	VNODE_LOCK();
+	auto i = vnode_table.owner_find(vp);
+	if (i)
+		vnode_table.erase(i);
+	VNODE_UNLOCK();
 }
 
 /*
- * Returns locked vnode for specified mount point and path.
- * vn_lock() will increment the reference count of vnode.
+ * Returns the vnode for specified mount point and inode number with its
+ * reference count incremented, but not locked.
+ */
+static struct vnode *
+vn_find(struct mount *mp, uint64_t ino)
+{
+	struct vnode *vp = nullptr;
+
+#if CONF_lazy_stack_invariant
+	assert(sched::preemptable() && arch::irq_enabled());
+#endif
+#if CONF_lazy_stack
+	arch::ensure_next_stack_page();
+#endif
+	WITH_LOCK(osv::rcu_read_lock) {
+		auto i = vnode_table.reader_find(vnode_key{mp, ino},
+		    vnode_hasher(), vnode_key_hold());
+		if (i)
+			vp = *i;
+	}
+	return vp;
+}
+
+/*
+ * Returns locked vnode for specified mount point and inode number.
+ * vn_lookup() will increment the reference count of vnode.
  *
- * Locking: VNODE_LOCK must be held.
+ * Locking: none needed, the lookup itself is lock free.
  */
 struct vnode *
 vn_lookup(struct mount *mp, uint64_t ino)
 {
 	struct vnode *vp;
 
-	assert(VNODE_OWNED());
-	LIST_FOREACH(vp, &vnode_table[vn_hash(mp, ino)], v_link) {
-		if (vp->v_mount == mp && vp->v_ino == ino) {
-			vp->v_refcnt++;
-			mutex_lock(&vp->v_lock);
-			vp->v_nrlocks++;
-			return vp;
-		}
-	}
-	return nullptr;		/* not found */
+	vp = vn_find(mp, ino);
+	if (!vp)
+		return nullptr;		/* not found */
+
+	vn_lock(vp);
+	return vp;
 }
 
 #ifdef DEBUG_VFS
@@ -178,11 +261,22 @@ vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 
 	DPRINTF(VFSDB_VNODE, ("vget %LLu\n", ino));
 
+	vp = vn_lookup(mp, ino);
+	if (vp) {
+		*vpp = vp;
+		return 1;
+	}
+
 	VNODE_LOCK();
 
-	vp = vn_lookup(mp, ino);
+	/*
+	 * Somebody may have added it while we were not holding the lock.
+	 * Don't wait for the vnode lock with VNODE_LOCK held, though.
+	 */
+	vp = vn_find(mp, ino);
 	if (vp) {
 		VNODE_UNLOCK();
+		vn_lock(vp);
 		*vpp = vp;
 		return 1;
 	}
@@ -212,7 +306,7 @@ vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 	mutex_lock(&vp->v_lock);
 	vp->v_nrlocks++;
 
-	LIST_INSERT_HEAD(&vnode_table[vn_hash(mp, ino)], vp, v_link);
+	vnode_table.insert(vp);
 	VNODE_UNLOCK();
 
 	*vpp = vp;
@@ -231,15 +325,11 @@ vput(struct vnode *vp)
 	ASSERT(vp->v_refcnt > 0);
 	DPRINTF(VFSDB_VNODE, ("vput: ref=%d %s\n", vp->v_refcnt, vn_path(vp)));
 
-	VNODE_LOCK();
-	vp->v_refcnt--;
-	if (vp->v_refcnt > 0) {
-	    VNODE_UNLOCK();
+	if (__sync_sub_and_fetch(&vp->v_refcnt, 1) > 0) {
 		vn_unlock(vp);
 		return;
 	}
-	LIST_REMOVE(vp, v_link);
-	VNODE_UNLOCK();
+	vn_unhash(vp);
 
 	/*
 	 * Deallocate fs specific vnode data
@@ -250,7 +340,7 @@ vput(struct vnode *vp)
 	vp->v_nrlocks--;
 	ASSERT(vp->v_nrlocks == 0);
 	mutex_unlock(&vp->v_lock);
-	delete vp;
+	osv::rcu_dispose(vp);
 }
 
 /*
@@ -262,10 +352,8 @@ vref(struct vnode *vp)
 	ASSERT(vp);
 	ASSERT(vp->v_refcnt > 0);	/* Need vget */
 
-	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vref: ref=%d\n", vp->v_refcnt));
-	vp->v_refcnt++;
-	VNODE_UNLOCK();
+	__sync_fetch_and_add(&vp->v_refcnt, 1);
 }
 
 /*
@@ -280,15 +368,10 @@ vrele(struct vnode *vp)
 	ASSERT(vp);
 	ASSERT(vp->v_refcnt > 0);
 
-	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vrele: ref=%d\n", vp->v_refcnt));
-	vp->v_refcnt--;
-	if (vp->v_refcnt > 0) {
-		VNODE_UNLOCK();
+	if (__sync_sub_and_fetch(&vp->v_refcnt, 1) > 0)
 		return;
-	}
-	LIST_REMOVE(vp, v_link);
-	VNODE_UNLOCK();
+	vn_unhash(vp);
 
 	/*
 	 * Deallocate fs specific vnode data
@@ -296,7 +379,7 @@ vrele(struct vnode *vp)
 	if (vp->v_op && vp->v_op->vop_inactive)
 		VOP_INACTIVE(vp);
 	vfs_unbusy(vp->v_mount);
-	delete vp;
+	osv::rcu_dispose(vp);
 }
 
 /*
@@ -448,8 +531,6 @@ vn_access(struct vnode *vp, int flags)
 void
 vnode_dump(void)
 {
-	int i;
-	struct vnode *vp;
 	struct mount *mp;
 	char type[][6] = { "VNON ", "VREG ", "VDIR ", "VBLK ", "VCHR ",
 			   "VLNK ", "VSOCK", "VFIFO" };
@@ -459,16 +540,14 @@ vnode_dump(void)
 	kprintf(" vnode    mount    type  refcnt blkno    path\n");
 	kprintf(" -------- -------- ----- ------ -------- ------------------------------\n");
 
-	for (i = 0; i < VNODE_BUCKETS; i++) {
-	        LIST_FOREACH(vp, &vnode_table[i], v_link) {
-			mp = vp->v_mount;
+	vnode_table.owner_for_each([&] (struct vnode *vp) {
+		mp = vp->v_mount;
 
-			kprintf(" %08x %08x %s %6d %8d %s%s\n", (u_long)vp,
-				(u_long)mp, type[vp->v_type], vp->v_refcnt,
-				(strlen(mp->m_path) == 1) ? "\0" : mp->m_path,
-				vn_path(vp));
-		}
-	}
+		kprintf(" %08x %08x %s %6d %8d %s%s\n", (u_long)vp,
+			(u_long)mp, type[vp->v_type], vp->v_refcnt,
+			(strlen(mp->m_path) == 1) ? "\0" : mp->m_path,
+			vn_path(vp));
+	});
 	kprintf("\n");
 	VNODE_UNLOCK();
 }
@@ -505,10 +584,6 @@ vop_erofs(void)
 void
 vnode_init(void)
 {
-	int i;
-
-	for (i = 0; i < VNODE_BUCKETS; i++)
-		LIST_INIT(&vnode_table[i]);
 }
 
 void vn_add_name(struct vnode *vp, struct dentry *dp)
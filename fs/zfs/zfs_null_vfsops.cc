@@ -8,6 +8,8 @@
 #include <osv/mount.h>
 #include <osv/export.h>
 
+#include <stdint.h>
+
 #define zfs_mount   ((vfsop_mount_t)vfs_nullop)
 #define zfs_umount  ((vfsop_umount_t)vfs_nullop)
 #define zfs_sync    ((vfsop_sync_t)vfs_nullop)
@@ -38,6 +40,15 @@ struct vfsops zfs_vfsops = {
 
 extern "C" {
 OSV_LIBSOLARIS_API bool zfs_driver_initialized = false;
+// Set with --zfs-trim, see vdev_disk_trim() in libsolaris.so
+OSV_LIBSOLARIS_API bool zfs_trim_enabled = false;
+OSV_LIBSOLARIS_API uint64_t zfs_trimmed_bytes = 0;
+
+void zfs_enable_trim(void)
+{
+    zfs_trim_enabled = true;
+}
+
 int zfs_init(void)
 {
     return 0;
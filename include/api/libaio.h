@@ -15,8 +15,57 @@
 extern "C" {
 #endif
 
+struct timespec;
+
 typedef struct io_context *io_context_t;
 
+/* The layout of the structures below follows the libaio ABI (which is the
+ * same as the Linux kernel one) on 64-bit little-endian machines. */
+typedef enum io_iocb_cmd {
+    IO_CMD_PREAD = 0,
+    IO_CMD_PWRITE = 1,
+    IO_CMD_FSYNC = 2,
+    IO_CMD_FDSYNC = 3,
+    IO_CMD_POLL = 5,
+    IO_CMD_NOOP = 6,
+    IO_CMD_PREADV = 7,
+    IO_CMD_PWRITEV = 8,
+} io_iocb_cmd_t;
+
+/* Flags for iocb.u.c.flags */
+#define IOCB_FLAG_RESFD         (1 << 0)
+
+struct io_iocb_common {
+    /* buffer, or an iovec array for IO_CMD_PREADV/IO_CMD_PWRITEV */
+    void *buf;
+    /* byte count, or the iovec count for the vectored commands */
+    unsigned long nbytes;
+    long long offset;
+    long long __pad3;
+    unsigned flags;
+    /* eventfd to signal on completion if IOCB_FLAG_RESFD is set */
+    unsigned resfd;
+};
+
+struct iocb {
+    void *data;
+    unsigned key;
+    int aio_rw_flags;
+    short aio_lio_opcode;
+    short aio_reqprio;
+    int aio_fildes;
+    union {
+        struct io_iocb_common c;
+    } u;
+};
+
+struct io_event {
+    void *data;
+    struct iocb *obj;
+    unsigned long res;
+    unsigned long res2;
+};
+
 int io_setup(int nr_events, io_context_t *ctxp_idp);
 int io_submit(io_context_t ctx, long nr, struct iocb *ios[]);
 int io_getevents(io_context_t ctx_id, long min_nr, long nr,
@@ -59,6 +59,15 @@ __BEGIN_DECLS
 #define BIO_CMD1	0x40	/* Available for local hacks */
 #define BIO_CMD2	0x80	/* Available for local hacks */
 
+/*
+ * Range commands: bio_offset and bio_bcount describe the range and there
+ * is no data buffer. A discarded range reads back as undefined data, a
+ * zeroed one as zeroes. Drivers without support fail them with bio_error
+ * set to EOPNOTSUPP.
+ */
+#define BIO_DISCARD	BIO_DELETE	/* Deallocate (TRIM/UNMAP) the range */
+#define BIO_WRITE_ZEROES	BIO_CMD1	/* Zero the range, may deallocate it */
+
 /* bio_flags */
 #define BIO_ERROR	0x01
 #define BIO_DONE	0x02
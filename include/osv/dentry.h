@@ -14,8 +14,7 @@
 struct vnode;
 
 struct dentry {
-	LIST_ENTRY(dentry) d_link;	/* link for hash list */
-	int		d_refcnt;	/* reference count */
+	int		d_refcnt;	/* reference count (atomic) */
 	char		*d_path;	/* pointer to path in fs */
 	struct vnode	*d_vnode;
 	struct mount	*d_mount;
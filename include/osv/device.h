@@ -128,6 +128,10 @@ struct device {
 	off_t		size;		/* device size */
 	off_t		offset; /* 0 for the main drive, if we have a partition, this is the start address */
 	size_t		max_io_size;
+	unsigned	poll_us;	/* hybrid completion polling budget, 0 = off */
+	size_t		max_discard_size; /* BIO_DISCARD limit, 0 = unsupported */
+	size_t		discard_alignment; /* preferred BIO_DISCARD alignment, 0 = none */
+	size_t		max_write_zeroes_size; /* BIO_WRITE_ZEROES limit, 0 = unsupported */
 	void		*private_data;	/* private storage */
 
 	void *softc;
@@ -208,6 +212,7 @@ struct device *	device_create(struct driver *drv, const char *name, int flags);
 int device_destroy(struct device *dev);
 void device_register(struct device *device, const char *name, int flags);
 void read_partition_table(struct device *device);
+void device_set_poll(struct device *device, unsigned poll_us);
 
 __END_DECLS
 
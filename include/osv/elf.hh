@@ -375,6 +375,8 @@ public:
     void process_headers();
     void unload_segments();
     void fix_permissions();
+    void patch_syscalls();
+    void* syscall_stubs_end() const;
     void* resolve_pltgot(unsigned index);
     const std::vector<Elf64_Phdr> *phdrs();
     std::string soname();
@@ -490,6 +492,9 @@ protected:
     bool _init_called;
     void* _eh_frame;
     void* _headers_start;
+    // Stubs of the system calls patched by patch_syscalls()
+    void* _syscall_stubs;
+    size_t _syscall_stubs_size;
 
     std::unordered_map<std::string,void*> _cached_symbols;
 
@@ -512,6 +517,7 @@ protected:
                             Elf64_Sxword addend);
     bool arch_relocate_jump_slot(symbol_module& sym, void *addr, Elf64_Sxword addend);
     void arch_relocate_tls_desc(u32 sym, void *addr, Elf64_Sxword addend);
+    void arch_patch_syscalls();
     size_t static_tls_end() {
         if (is_core() || _is_dynamically_linked_executable) {
             return 0;
@@ -70,7 +70,12 @@ struct vnode;
 struct file;
 struct pollreq;
 
+/*
+ * FDMAX is the default limit on file descriptor numbers. It can be raised
+ * at run time with setrlimit(RLIMIT_NOFILE), up to FDMAX_HARD.
+ */
 #define FDMAX       (CONF_fs_max_file_descriptors)
+#define FDMAX_HARD  (1 << 20)
 
 #if defined(__cplusplus) && !defined(USE_C_INTERFACE)
 
@@ -109,14 +114,21 @@ struct hash<epoll_key> : private hash<int>, hash<file*> {
 }
 
 struct epoll_file;
+struct epoll_registration;
 
+// Identifies a registration by epoll and key; reg and exclusive are carried
+// along so that waking the epoll up needs no lookup.
 struct epoll_ptr {
     epoll_file* epoll;
     epoll_key key;
+    epoll_registration* reg;
+    // registered with EPOLLEXCLUSIVE
+    bool exclusive;
 };
 
-void epoll_wake(const epoll_ptr& ep);
-void epoll_wake_in_rcu(const epoll_ptr& ep);
+// Return whether the epoll had threads waiting in epoll_wait()
+bool epoll_wake(const epoll_ptr& ep);
+bool epoll_wake_in_rcu(const epoll_ptr& ep);
 
 inline bool operator==(const epoll_ptr& p1, const epoll_ptr& p2) {
     return p1.epoll == p2.epoll && p1.key == p2.key;
@@ -225,6 +237,7 @@ struct tty_file : public special_file {
 #define FD_UNLOCK(fp)	mutex_unlock(&(fp->f_lock))
 
 #define FOF_OFFSET  0x0800    /* Use the offset in uio argument */
+#define FOF_NONBLOCK 0x1000   /* Do not block, whatever the file mode */
 
 /* Alloc an fd for fp */
 int _fdalloc(struct file *fp, int *newfd, int min_fd);
@@ -233,6 +246,10 @@ int fdset(int fd, struct file* fp);
 void fdfree(int fd);
 int fdclose(int fd);
 
+/* Current limit on file descriptor numbers, see FDMAX */
+int fd_limit(void);
+int fd_set_limit(unsigned limit);
+
 __BEGIN_DECLS
 
 filetype_t file_type(struct file *fp);
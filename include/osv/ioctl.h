@@ -42,6 +42,19 @@
 #define SIOCBEGIN   0x8900
 #define SIOCEND     0x89ff
 
+/*
+ * OSv specific block device ioctls, numbered well above the Linux ones.
+ * BLKPOLLSET sets for how many microseconds a thread submitting a request
+ * spins on the completion queue before leaving it to the interrupt driven
+ * completion thread; 0 (the default) disables polling. The setting is one
+ * of the whole disk, set on a partition it applies to the disk and all its
+ * other partitions too. Drivers without a polling mode (currently all but
+ * virtio-blk and nvme) ignore it.
+ */
+#define BLKPOLLGET  _IOR(0x12, 0xf0, unsigned int)
+#define BLKPOLLSET  _IOW(0x12, 0xf1, unsigned int)
+#define BLKPOLL_MAX_US  10000
+
 /*
  * Undef unsupported Linux ioctls.
  */
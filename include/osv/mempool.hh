@@ -219,6 +219,15 @@ namespace stats {
 
     void get_global_l2_stats(pool_stats &stats);
     void get_l1_stats(unsigned int cpu_id, stats::pool_stats &stats);
+
+    struct range_cache_stats {
+        size_t _max_bytes;
+        size_t _bytes;
+        size_t _hits;
+        size_t _misses;
+    };
+
+    void get_range_cache_stats(unsigned int cpu_id, range_cache_stats &stats);
 }
 
 class phys_contiguous_memory final {
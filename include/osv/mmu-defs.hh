@@ -85,6 +85,7 @@ enum {
     mmap_jvm_balloon = 1ul << 6,
     mmap_file        = 1ul << 7,
     mmap_stack       = 1ul << 8,
+    mmap_user        = 1ul << 9,
 };
 
 enum {
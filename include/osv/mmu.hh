@@ -367,8 +367,21 @@ error  advise(void* addr, size_t size, int advice);
 void vm_fault(uintptr_t addr, exception_frame* ef);
 
 std::string procfs_maps();
+std::string procfs_vmstat();
 std::string sysfs_linear_maps();
 
+// Start the thread collapsing small pages of anonymous memory into huge pages
+void start_thp_collapse();
+// Run one pass of that thread right away, return the number of huge pages
+// made. Works whether or not the thread was started.
+unsigned thp_collapse_pass();
+
+// Bracket a transfer done by a device directly to or from application
+// memory, so that its pages are not moved while the transfer is in flight.
+// user_dma_end() may be called from another thread, e.g. on completion.
+void user_dma_begin();
+void user_dma_end();
+
 unsigned long all_vmas_size();
 
 // Synchronize cpu data and instruction caches for specified area of virtual memory
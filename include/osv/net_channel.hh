@@ -44,6 +44,8 @@ private:
 public:
     explicit net_channel(std::function<void (mbuf*)> process_packet)
         : _process_packet(std::move(process_packet)) {}
+    // frees packets nobody consumed
+    ~net_channel();
     // producer: try to push a packet
     bool push(mbuf* m) { return _queue.push(m); }
     // consumer: wake the consumer (best used after multiple push()s)
@@ -58,11 +60,16 @@ public:
     }
     // consumer: consume all available packets using process_packet()
     void process_queue();
+    // producer: is anyone polling or epolling on the channel?
+    bool has_pollers() const { return _pollers || !_epollers.empty(); }
     // add/remove current thread from poller list
     void add_poller(pollreq& pr);
     void del_poller(pollreq& pr);
     void add_epoll(const epoll_ptr& ep);
     void del_epoll(const epoll_ptr& ep);
+    // add/remove the pollers and epolls currently registered on a file
+    void add_file_pollers(file* fp);
+    void del_file_pollers(file* fp);
 private:
     void wake_pollers();
 private:
@@ -105,6 +112,11 @@ struct ipv4_tcp_conn_id {
     }
 };
 
+// UDP flows are keyed the same way. A socket which is bound but not
+// connected has a remote address and port of zero, and a local address of
+// zero too when bound to all addresses.
+using ipv4_udp_conn_id = ipv4_tcp_conn_id;
+
 namespace std {
 
 template <>
@@ -120,10 +132,16 @@ public:
     // consumer side operations
     void add(ipv4_tcp_conn_id id, net_channel* channel);
     void remove(ipv4_tcp_conn_id id);
+    // these two fail if the key is taken already
+    bool add_udp(ipv4_udp_conn_id id, net_channel* channel);
+    void remove_udp(ipv4_udp_conn_id id);
+    // listening sockets, keyed like bound UDP sockets, are only sent SYNs
+    bool add_listener(ipv4_tcp_conn_id id, net_channel* channel);
+    void remove_listener(ipv4_tcp_conn_id id);
     // producer side operations
     bool post_packet(mbuf* m);
 private:
-    net_channel* classify_ipv4_tcp(mbuf* m);
+    net_channel* classify_ipv4(mbuf* m);
 private:
     struct item {
         item(const ipv4_tcp_conn_id& key, net_channel* chan) : key(key), chan(chan) {}
@@ -139,8 +157,15 @@ private:
         }
     };
     using ipv4_tcp_channels = osv::rcu_hashtable<item, item_hash>;
+    static bool add(ipv4_tcp_channels& channels, ipv4_tcp_conn_id id, net_channel* channel);
+    static void remove(ipv4_tcp_channels& channels, ipv4_tcp_conn_id id);
+    static net_channel* find(ipv4_tcp_channels& channels, ipv4_tcp_conn_id id);
+    // bound sockets are looked up by destination address, then by port alone
+    static net_channel* find_bound(ipv4_tcp_channels& channels, in_addr addr, in_port_t port);
     mutex _mtx;
     ipv4_tcp_channels _ipv4_tcp_channels;
+    ipv4_tcp_channels _ipv4_udp_channels;
+    ipv4_tcp_channels _ipv4_tcp_listeners;
 };
 
 #endif /* NETCHANNEL_HH_ */
@@ -35,5 +35,10 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep);
 void sync(vfs_file* fp, off_t start, off_t end);
 void unmap_arc_buf(arc_buf_t* ab);
 void map_arc_buf(hashkey* key, arc_buf_t* ab, void* page);
-void map_read_cached_page(hashkey *key, void *page);
+// Adds a page of a file to the read cache. A writable page belongs to the
+// file itself and is mapped without copy-on-write into shared mappings.
+void map_read_cached_page(hashkey *key, void *page, bool writable = false);
+// Removes a page from the read cache and all mappings of it, to be called
+// by a file system before it frees a page it passed to map_read_cached_page().
+void unmap_read_cached_page(hashkey *key);
 }
@@ -307,7 +307,19 @@ void rcu_hashtable<T, Hash>::resize(size_t new_size)
     auto p = _buckets.read_by_owner();
     _buckets.assign(n._buckets.read_by_owner());
     n._buckets.assign(nullptr);
-    rcu_dispose(p);
+    // Readers may still be walking the old chains, so the old elements
+    // go away together with the old bucket array.
+    rcu_defer([] (bucket_array_type* buckets) {
+        for (auto& b : *buckets) {
+            auto q = b.next.read_by_owner();
+            while (q) {
+                auto e = static_cast<element*>(q);
+                q = e->next.read_by_owner();
+                delete e;
+            }
+        }
+        delete buckets;
+    }, p);
 }
 
 }
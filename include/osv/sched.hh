@@ -36,7 +36,15 @@ typedef float runtime_t;
 enum {
     FUTEX_WAIT           = 0,
     FUTEX_WAKE           = 1,
+    FUTEX_REQUEUE        = 3,
+    FUTEX_CMP_REQUEUE    = 4,
+    FUTEX_WAKE_OP        = 5,
+    FUTEX_LOCK_PI        = 6,
+    FUTEX_UNLOCK_PI      = 7,
+    FUTEX_TRYLOCK_PI     = 8,
     FUTEX_WAIT_BITSET    = 9,
+    FUTEX_WAKE_BITSET    = 10,
+    FUTEX_LOCK_PI2       = 13,
     FUTEX_PRIVATE_FLAG   = 128,
     FUTEX_CLOCK_REALTIME = 256,
     FUTEX_CMD_MASK       = ~(FUTEX_PRIVATE_FLAG|FUTEX_CLOCK_REALTIME),
@@ -370,6 +378,12 @@ constexpr thread_runtime::duration thyst = std::chrono::milliseconds(5);
 constexpr thread_runtime::duration context_switch_penalty =
                                            std::chrono::microseconds(10);
 
+// A thread which ran on a cpu less than "migration_cost" ago probably still
+// has much of its working set in that cpu's caches, so when the scheduler
+// moves a thread to balance the load, it prefers one which did not.
+constexpr thread_runtime::duration migration_cost =
+                                           std::chrono::microseconds(500);
+
 #ifdef __aarch64__
 struct thread_switch_data {
    thread_state* old_thread_state = nullptr;
@@ -909,6 +923,8 @@ public:
     stat_counter stat_migrations;
 private:
     thread_runtime::duration _total_cpu_time {0};
+    // when the thread was last switched out, see migration_cost
+    osv::clock::uptime::time_point _last_ran;
     std::atomic<u64> _cputime_estimator {0}; // for thread_clock()
     inline void cputime_estimator_set(
             osv::clock::uptime::time_point running_since,
@@ -1005,6 +1021,11 @@ struct cpu : private timer_base::client {
     // they should observe changes in the same order
     std::atomic<bool> lazy_flush_tlb = { false };
     std::atomic<bool> app_thread = {false};
+    // The thread this cpu is running, for lock-free mutex spinning. Only
+    // ever compared, never dereferenced, by other cpus.
+    std::atomic<thread*> running_thread = { nullptr };
+    // cpus which went idle and asked to be sent one of our queued threads
+    cpu_set steal_requests;
     // for each cpu, a list of threads that are migrating into this cpu:
     typedef lockless_queue<thread, &thread::_wakeup_link> incoming_wakeup_queue;
     cpu_set incoming_wakeups_mask;
@@ -1013,6 +1034,9 @@ struct cpu : private timer_base::client {
     osv::clock::uptime::time_point running_since;
     char* percpu_base;
     static cpu* current();
+    // The cpu running t right now, or nullptr. t is not dereferenced, so
+    // it may be a thread which has exited already.
+    static cpu* find_running(const thread* t);
     void init_on_cpu();
     static void schedule();
     void handle_incoming_wakeups();
@@ -1024,6 +1048,13 @@ struct cpu : private timer_base::client {
     void send_wakeup_ipi();
     void load_balance();
     unsigned load();
+    bool is_idle();
+    void request_steal();
+    void handle_steal_requests(osv::clock::uptime::time_point now);
+    thread* pick_migratable(osv::clock::uptime::time_point now);
+    void migrate_queued(thread& t, cpu* target);
+    void send_waking(thread& t, cpu* target);
+    bool wake_affine(thread& t, cpu* waker);
     /**
      * Try to reschedule.
      *
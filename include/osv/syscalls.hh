@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef SYSCALLS_HH_
+#define SYSCALLS_HH_
+
+#include <string>
+
+// The implementation of a system call, taking its arguments as the syscall
+// instruction passes them. Returns like the implementation, with errno set.
+typedef long (*syscall_fn)(long, long, long, long, long, long);
+
+// The entries of the dispatch table of syscall(), indexed by system call
+// number. Generated from the syscalls.cc list made by scripts/gen-syscalls,
+// so only the system calls selected with conf_syscalls_list_file are there.
+struct syscall_desc {
+    syscall_fn fn;
+    const char* name;
+};
+
+constexpr long syscall_table_size = 512;
+
+// Returns nullptr for system calls not implemented
+const syscall_desc* syscall_lookup(long number);
+
+// Calls of and time spent in each system call so far
+std::string procfs_syscalls();
+
+#endif
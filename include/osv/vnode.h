@@ -77,10 +77,9 @@ enum vtype {
  */
 struct vnode {
 	uint64_t	v_ino;		/* inode number */
-	LIST_ENTRY(vnode) v_link;	/* link for hash list */
 	struct mount	*v_mount;	/* mounted vfs pointer */
 	struct vnops	*v_op;		/* vnode operations */
-	int		v_refcnt;	/* reference count */
+	int		v_refcnt;	/* reference count (atomic) */
 	int		v_type;		/* vnode type */
 	int		v_flags;	/* vnode flag */
 	mode_t		v_mode;		/* file mode */
@@ -3,9 +3,40 @@
 
 #include <osv/zcopy.h>
 
+#include <atomic>
+#include <functional>
+
 struct ztx_handle {
     ztx_handle() : zh_remained(0) {};
     std::atomic<size_t> zh_remained;
 };
 
+// A region of kernel memory lent to the network stack as external mbuf
+// storage. Each mbuf pointing into the region holds a reference, and so does
+// the lender until it is done handing the region out. The release function
+// runs when the last reference is dropped, which may happen in the network
+// stack's context, so it must not sleep.
+struct zbuf_handle {
+    explicit zbuf_handle(std::function<void ()> release)
+        : zb_refs(1), zb_release(std::move(release)) {}
+    void hold() {
+        zb_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release() {
+        if (zb_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            zb_release();
+            delete this;
+        }
+    }
+    std::atomic<unsigned> zb_refs;
+    std::function<void ()> zb_release;
+};
+
+// Queue len bytes at buf, which must be mapped, on the stream socket s
+// without copying them. With nonblock, s is not waited on even if it is in
+// blocking mode. Returns an errno value, and the number of bytes queued in
+// *sent; EOPNOTSUPP means s is not a stream socket.
+int zcopy_sendbuf(int s, const void *buf, size_t len, zbuf_handle *zb,
+                  bool nonblock, size_t *sent);
+
 #endif
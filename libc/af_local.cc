@@ -71,12 +71,12 @@ void af_local::init()
 
 int af_local::read(uio* data, int flags)
 {
-    return receive->read(data, is_nonblock(this));
+    return receive->read(data, is_nonblock(this) || (flags & FOF_NONBLOCK));
 }
 
 int af_local::write(uio* data, int flags)
 {
-    return send->write(data, is_nonblock(this));
+    return send->write(data, is_nonblock(this) || (flags & FOF_NONBLOCK));
 }
 
 int af_local::poll(int events)
@@ -23,6 +23,7 @@
 #include <sys/ioctl.h>
 #include <osv/clock.hh>
 #include <osv/mempool.hh>
+#include <osv/file.h>
 #include <osv/version.h>
 #include <osv/stubbing.hh>
 
@@ -68,7 +69,8 @@ int getrlimit(int resource, struct rlimit *rlim)
         break;
     }
     case RLIMIT_NOFILE:
-        set(1024*10); // FIXME: larger?
+        rlim->rlim_cur = fd_limit();
+        rlim->rlim_max = FDMAX_HARD;
         break;
     case RLIMIT_CORE:
         set(RLIM_INFINITY);
@@ -98,7 +100,17 @@ int getrlimit(int resource, struct rlimit *rlim)
 
 int setrlimit(int resource, const struct rlimit *rlim)
 {
-    // osv - no limits
+    // osv - no limits, except for the size of the file descriptor table
+    if (resource == RLIMIT_NOFILE) {
+        if (rlim->rlim_cur > rlim->rlim_max) {
+            return libc_error(EINVAL);
+        }
+        // Like raising fs.nr_open on Linux, the hard limit is fixed
+        if (rlim->rlim_max > FDMAX_HARD) {
+            return libc_error(EPERM);
+        }
+        fd_set_limit(rlim->rlim_cur);
+    }
     return 0;
 }
 
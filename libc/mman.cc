@@ -164,7 +164,7 @@ void *mmap(void *addr, size_t length, int prot, int flags,
         }
 #endif
         try {
-            ret = mmu::map_anon(addr, length, mmap_flags, mmap_perm);
+            ret = mmu::map_anon(addr, length, mmap_flags | mmu::mmap_user, mmap_perm);
         } catch (error& err) {
             err.to_libc(); // sets errno
             trace_memory_mmap_err(errno);
@@ -56,12 +56,12 @@ pipe_file::pipe_file(std::unique_ptr<pipe_reader>&& s)
 
 int pipe_file::read(uio *data, int flags)
 {
-    return reader->buf->read(data, is_nonblock(this));
+    return reader->buf->read(data, is_nonblock(this) || (flags & FOF_NONBLOCK));
 }
 
 int pipe_file::write(uio *data, int flags)
 {
-    return writer->buf->write(data, is_nonblock(this));
+    return writer->buf->write(data, is_nonblock(this) || (flags & FOF_NONBLOCK));
 }
 
 int pipe_file::poll(int events)
@@ -11,10 +11,15 @@
 #include <osv/debug.hh>
 #include <osv/sched.hh>
 #include <osv/mutex.h>
-#include <osv/waitqueue.hh>
+#include <osv/wait_record.hh>
 #include <osv/stubbing.hh>
 #include <osv/export.h>
 #include <osv/trace.hh>
+#include <osv/syscalls.hh>
+#include <osv/percpu.hh>
+#include <osv/preempt-lock.hh>
+#include <osv/clock.hh>
+#include <osv/printf.hh>
 #include <memory>
 
 #include <syscall.h>
@@ -55,13 +60,14 @@
 #include "tls-switch.hh"
 #endif
 
-#include <unordered_map>
+#include <boost/intrusive/list.hpp>
 
 #include <musl/src/internal/ksigaction.h>
 
 #include <osv/kernel_config_core_epoll.h>
 #include <osv/kernel_config_networking_stack.h>
 #include <osv/kernel_config_core_syscall.h>
+#include <osv/kernel_config_core_syscall_stats.h>
 
 #include <osv/syscalls_config.h>
 
@@ -72,90 +78,435 @@ extern "C" OSV_LIBC_API long gettid()
     return sched::thread::current()->id();
 }
 
-// We don't expect applications to use the Linux futex() system call (it is
-// normally only used to implement higher-level synchronization mechanisms),
-// but unfortunately gcc's C++ runtime uses a subset of futex in the
-// __cxa__guard_* functions, which safeguard the concurrent initialization
-// of function-scope static objects. We only implement here this subset.
-// The __cxa_guard_* functions only call futex in the rare case of contention,
-// in fact so rarely that OSv existed for a year before anyone noticed futex
-// was missing. So the performance of this implementation is not critical.
-static std::unordered_map<void*, waitqueue> queues;
-static mutex queues_mutex;
+// The futex() system call is the building block of the synchronization
+// primitives of glibc and musl, and of runtimes like Go and the JVM which
+// implement their own. Waiters are kept in a fixed-size table of hash
+// buckets, each with its own lock, so threads blocking on unrelated futexes
+// do not contend with each other. A waiter is only ever linked into the
+// bucket of the address it waits on; FUTEX_REQUEUE moves it to another one
+// with both buckets locked.
+//
+// OSv's scheduler has no notion of priority inheritance, so the PI
+// operations implement the user-space protocol (owner TID and the
+// FUTEX_WAITERS bit in the futex word) without boosting the owner.
 
 #define FUTEX_BITSET_MATCH_ANY  0xffffffff
+#define FUTEX_WAITERS           0x80000000
+#define FUTEX_OWNER_DIED        0x40000000
+#define FUTEX_TID_MASK          0x3fffffff
+
+#define FUTEX_OP_SET            0
+#define FUTEX_OP_ADD            1
+#define FUTEX_OP_OR             2
+#define FUTEX_OP_ANDN           3
+#define FUTEX_OP_XOR            4
+#define FUTEX_OP_OPARG_SHIFT    8
+
+#define FUTEX_OP_CMP_EQ         0
+#define FUTEX_OP_CMP_NE         1
+#define FUTEX_OP_CMP_LT         2
+#define FUTEX_OP_CMP_LE         3
+#define FUTEX_OP_CMP_GT         4
+#define FUTEX_OP_CMP_GE         5
+
+namespace {
+
+struct futex_bucket;
+
+struct futex_waiter : public waiter {
+    futex_waiter(int* uaddr, uint32_t bitset)
+        : waiter(sched::thread::current()), uaddr(uaddr), bitset(bitset) {}
+    int* uaddr;
+    uint32_t bitset;
+    // Only changed with the bucket locks held, but read by a timed out
+    // waiter before it can know which lock to take
+    std::atomic<futex_bucket*> bucket = {nullptr};
+    boost::intrusive::list_member_hook<> hook;
+};
 
-int futex(int *uaddr, int op, int val, const struct timespec *timeout,
-        int *uaddr2, uint32_t val3)
+struct futex_bucket {
+    mutex lock;
+    boost::intrusive::list<futex_waiter,
+        boost::intrusive::member_hook<futex_waiter,
+            boost::intrusive::list_member_hook<>, &futex_waiter::hook>,
+        boost::intrusive::constant_time_size<false>> waiters;
+
+    void enqueue(futex_waiter& w) {
+        w.bucket.store(this, std::memory_order_relaxed);
+        waiters.push_back(w);
+    }
+    int wake(int* uaddr, int nr, uint32_t bitset);
+    bool has_waiters(int* uaddr) const;
+} CACHELINE_ALIGNED;
+
+constexpr unsigned futex_hash_bits = 10;
+futex_bucket futex_buckets[1 << futex_hash_bits];
+
+futex_bucket& futex_hash(int* uaddr)
+{
+    auto key = reinterpret_cast<uintptr_t>(uaddr) >> 2;
+    return futex_buckets[(key * 0x9e3779b97f4a7c15ull) >> (64 - futex_hash_bits)];
+}
+
+int futex_bucket::wake(int* uaddr, int nr, uint32_t bitset)
+{
+    int woken = 0;
+    for (auto it = waiters.begin(); it != waiters.end() && woken < nr;) {
+        auto& w = *it;
+        if (w.uaddr != uaddr || !(w.bitset & bitset)) {
+            ++it;
+            continue;
+        }
+        it = waiters.erase(it);
+        // The waiter may be gone as soon as it is woken
+        w.wake();
+        woken++;
+    }
+    return woken;
+}
+
+bool futex_bucket::has_waiters(int* uaddr) const
 {
-    switch (op & FUTEX_CMD_MASK) {
-    case FUTEX_WAIT_BITSET:
-        if (val3 != FUTEX_BITSET_MATCH_ANY) {
-            abort("Unimplemented futex() operation %d\n", op);
+    for (auto& w : waiters) {
+        if (w.uaddr == uaddr) {
+            return true;
         }
+    }
+    return false;
+}
 
-    case FUTEX_WAIT:
-        WITH_LOCK(queues_mutex) {
-            if (*uaddr == val) {
-                waitqueue &q = queues[uaddr];
-                if (timeout) {
-                    sched::timer tmr(*sched::thread::current());
-                    if ((op & FUTEX_CMD_MASK) == FUTEX_WAIT_BITSET) {
-                        // If FUTEX_WAIT_BITSET we need to interpret timeout as an absolute
-                        // time point. If futex operation FUTEX_CLOCK_REALTIME is set we will use
-                        // real-time clock otherwise we will use monotonic clock
-                        if (op & FUTEX_CLOCK_REALTIME) {
-                            tmr.set(osv::clock::wall::time_point(std::chrono::seconds(timeout->tv_sec) +
-                                                                 std::chrono::nanoseconds(timeout->tv_nsec)));
-                        } else {
-                            tmr.set(osv::clock::uptime::time_point(std::chrono::seconds(timeout->tv_sec) +
-                                                                   std::chrono::nanoseconds(timeout->tv_nsec)));
-                        }
-                    } else {
-                        tmr.set(std::chrono::seconds(timeout->tv_sec) +
-                                std::chrono::nanoseconds(timeout->tv_nsec));
+void lock_buckets(futex_bucket& a, futex_bucket& b)
+{
+    if (&a == &b) {
+        a.lock.lock();
+    } else if (&a < &b) {
+        a.lock.lock();
+        b.lock.lock();
+    } else {
+        b.lock.lock();
+        a.lock.lock();
+    }
+}
+
+void unlock_buckets(futex_bucket& a, futex_bucket& b)
+{
+    a.lock.unlock();
+    if (&a != &b) {
+        b.lock.unlock();
+    }
+}
+
+// Sleep until woken by a FUTEX_WAKE* or until the timer expires. A waiter
+// that times out has to unlink itself, from whichever bucket it was requeued
+// to, unless a wake-up beat it to it.
+int futex_sleep(futex_waiter& w, sched::timer* tmr)
+{
+    w.wait(tmr);
+    if (w.woken()) {
+        return 0;
+    }
+
+    futex_bucket* b;
+    for (;;) {
+        b = w.bucket.load(std::memory_order_relaxed);
+        b->lock.lock();
+        if (b == w.bucket.load(std::memory_order_relaxed)) {
+            break;
+        }
+        b->lock.unlock();
+    }
+    bool woken = w.woken();
+    if (!woken) {
+        b->waiters.erase(b->waiters.iterator_to(w));
+    }
+    b->lock.unlock();
+
+    if (!woken) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+int futex_wait(int* uaddr, int val, uint32_t bitset, sched::timer* tmr)
+{
+    auto& b = futex_hash(uaddr);
+    futex_waiter w(uaddr, bitset);
+    WITH_LOCK(b.lock) {
+        // Checking the value with the bucket lock held orders us against a
+        // waker which changes it before calling FUTEX_WAKE
+        if (*uaddr != val) {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+        b.enqueue(w);
+    }
+    return futex_sleep(w, tmr);
+}
+
+int futex_wake(int* uaddr, int nr, uint32_t bitset)
+{
+    auto& b = futex_hash(uaddr);
+    WITH_LOCK(b.lock) {
+        return b.wake(uaddr, nr, bitset);
+    }
+}
+
+// Wake up to nr_wake waiters of uaddr and move up to nr_requeue of the
+// remaining ones to wait on uaddr2 instead, so that a condition variable
+// broadcast doesn't cause a thundering herd on the associated mutex.
+int futex_requeue(int* uaddr, int nr_wake, int nr_requeue, int* uaddr2,
+                  const int* cmpval)
+{
+    auto& b1 = futex_hash(uaddr);
+    auto& b2 = futex_hash(uaddr2);
+    int woken = 0, requeued = 0;
+
+    lock_buckets(b1, b2);
+    if (cmpval && *uaddr != *cmpval) {
+        unlock_buckets(b1, b2);
+        errno = EAGAIN;
+        return -1;
+    }
+    for (auto it = b1.waiters.begin(); it != b1.waiters.end();) {
+        auto& w = *it;
+        if (w.uaddr != uaddr) {
+            ++it;
+            continue;
+        }
+        if (woken < nr_wake) {
+            it = b1.waiters.erase(it);
+            w.wake();
+            woken++;
+        } else if (requeued < nr_requeue) {
+            it = b1.waiters.erase(it);
+            w.uaddr = uaddr2;
+            b2.enqueue(w);
+            requeued++;
+        } else {
+            break;
+        }
+    }
+    unlock_buckets(b1, b2);
+
+    return woken + requeued;
+}
+
+// Fields of FUTEX_WAKE_OP's val3 are 12-bit two's complement numbers
+inline int futex_op_arg(uint32_t v)
+{
+    return int(v << 20) >> 20;
+}
+
+int futex_wake_op(int* uaddr, int nr_wake, int* uaddr2, int nr_wake2,
+                  uint32_t encoded)
+{
+    int op = (encoded >> 28) & 0xf;
+    int cmp = (encoded >> 24) & 0xf;
+    int oparg = futex_op_arg(encoded >> 12);
+    int cmparg = futex_op_arg(encoded);
+
+    if (op & FUTEX_OP_OPARG_SHIFT) {
+        // Linux masks shift counts out of range rather than failing
+        oparg &= 31;
+        oparg = 1 << oparg;
+        op &= ~FUTEX_OP_OPARG_SHIFT;
+    }
+    if (op > FUTEX_OP_XOR || cmp > FUTEX_OP_CMP_GE) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    auto& b1 = futex_hash(uaddr);
+    auto& b2 = futex_hash(uaddr2);
+    lock_buckets(b1, b2);
+
+    int old;
+    switch (op) {
+    case FUTEX_OP_SET:
+        old = __atomic_exchange_n(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    case FUTEX_OP_ADD:
+        old = __atomic_fetch_add(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    case FUTEX_OP_OR:
+        old = __atomic_fetch_or(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    case FUTEX_OP_ANDN:
+        old = __atomic_fetch_and(uaddr2, ~oparg, __ATOMIC_SEQ_CST);
+        break;
+    default:
+        old = __atomic_fetch_xor(uaddr2, oparg, __ATOMIC_SEQ_CST);
+        break;
+    }
+
+    int ret = b1.wake(uaddr, nr_wake, FUTEX_BITSET_MATCH_ANY);
+
+    bool match;
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ: match = old == cmparg; break;
+    case FUTEX_OP_CMP_NE: match = old != cmparg; break;
+    case FUTEX_OP_CMP_LT: match = old < cmparg; break;
+    case FUTEX_OP_CMP_LE: match = old <= cmparg; break;
+    case FUTEX_OP_CMP_GT: match = old > cmparg; break;
+    default: match = old >= cmparg; break;
+    }
+    if (match) {
+        ret += b2.wake(uaddr2, nr_wake2, FUTEX_BITSET_MATCH_ANY);
+    }
+
+    unlock_buckets(b1, b2);
+    return ret;
+}
+
+int futex_lock_pi(int* uaddr, sched::timer* tmr, bool trylock)
+{
+    int tid = sched::thread::current()->id();
+    auto& b = futex_hash(uaddr);
+
+    for (;;) {
+        futex_waiter w(uaddr, FUTEX_BITSET_MATCH_ANY);
+        WITH_LOCK(b.lock) {
+            int val = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+            for (;;) {
+                int nval;
+                if (!(val & FUTEX_TID_MASK)) {
+                    // Unowned: take it, and keep FUTEX_WAITERS set if
+                    // anybody else is still queued so unlock comes to us
+                    nval = tid | (val & FUTEX_OWNER_DIED);
+                    if (b.has_waiters(uaddr)) {
+                        nval |= FUTEX_WAITERS;
                     }
-                    sched::thread::wait_for(queues_mutex, tmr, q);
-                    // FIXME: testing if tmr was expired isn't quite right -
-                    // we could have had both a wakeup and timer expiration
-                    // racing. It would be more correct to check if we were
-                    // waken by a FUTEX_WAKE. But how?
-                    if (tmr.expired()) {
-                        errno = ETIMEDOUT;
-                        return -1;
+                    if (__atomic_compare_exchange_n(uaddr, &val, nval, false,
+                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                        return 0;
                     }
-                } else {
-                    q.wait(queues_mutex);
+                    continue;
+                }
+                if ((val & FUTEX_TID_MASK) == tid) {
+                    errno = EDEADLK;
+                    return -1;
+                }
+                if (trylock) {
+                    errno = EWOULDBLOCK;
+                    return -1;
                 }
-                return 0;
-            } else {
-                errno = EWOULDBLOCK;
+                if (val & FUTEX_WAITERS) {
+                    break;
+                }
+                nval = val | FUTEX_WAITERS;
+                if (__atomic_compare_exchange_n(uaddr, &val, nval, false,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+            }
+            b.enqueue(w);
+        }
+        if (futex_sleep(w, tmr) < 0) {
+            return -1;
+        }
+    }
+}
+
+int futex_unlock_pi(int* uaddr)
+{
+    int tid = sched::thread::current()->id();
+    auto& b = futex_hash(uaddr);
+    WITH_LOCK(b.lock) {
+        int val = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+        if ((val & FUTEX_TID_MASK) != tid) {
+            errno = EPERM;
+            return -1;
+        }
+        // Rather than handing the lock over, release it and let one waiter
+        // retry; it sets FUTEX_WAITERS again if others remain queued.
+        __atomic_store_n(uaddr, 0, __ATOMIC_RELEASE);
+        b.wake(uaddr, 1, FUTEX_BITSET_MATCH_ANY);
+    }
+    return 0;
+}
+
+void futex_set_timer(sched::timer& tmr, const struct timespec* timeout,
+                     bool absolute, bool realtime)
+{
+    auto d = std::chrono::seconds(timeout->tv_sec) +
+             std::chrono::nanoseconds(timeout->tv_nsec);
+    if (!absolute) {
+        tmr.set(d);
+    } else if (realtime) {
+        tmr.set(osv::clock::wall::time_point(d));
+    } else {
+        tmr.set(osv::clock::uptime::time_point(d));
+    }
+}
+
+}
+
+int futex(int *uaddr, int op, int val, const struct timespec *timeout,
+        int *uaddr2, uint32_t val3)
+{
+    int cmd = op & FUTEX_CMD_MASK;
+    bool realtime = op & FUTEX_CLOCK_REALTIME;
+
+    switch (cmd) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET: {
+        uint32_t bitset = FUTEX_BITSET_MATCH_ANY;
+        if (cmd == FUTEX_WAIT_BITSET) {
+            if (!val3) {
+                errno = EINVAL;
                 return -1;
             }
+            bitset = val3;
+        }
+        if (!timeout) {
+            return futex_wait(uaddr, val, bitset, nullptr);
         }
+        // FUTEX_WAIT_BITSET takes an absolute time point on the monotonic
+        // clock, or the real-time one if FUTEX_CLOCK_REALTIME is set
+        sched::timer tmr(*sched::thread::current());
+        futex_set_timer(tmr, timeout, cmd == FUTEX_WAIT_BITSET, realtime);
+        return futex_wait(uaddr, val, bitset, &tmr);
+    }
     case FUTEX_WAKE:
-        if(val < 0) {
+    case FUTEX_WAKE_BITSET:
+        if (val < 0 || (cmd == FUTEX_WAKE_BITSET && !val3)) {
             errno = EINVAL;
             return -1;
         }
-
-        WITH_LOCK(queues_mutex) {
-            auto i = queues.find(uaddr);
-            if (i != queues.end()) {
-                int waken = 0;
-                while( (val > waken) && !(i->second.empty()) ) {
-                    i->second.wake_one(queues_mutex);
-                    waken++;
-                }
-                if(i->second.empty()) {
-                    queues.erase(i);
-                }
-                return waken;
-            }
+        return futex_wake(uaddr, val,
+                cmd == FUTEX_WAKE ? FUTEX_BITSET_MATCH_ANY : val3);
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE: {
+        // The number of waiters to requeue is passed in place of timeout
+        int nr_requeue = reinterpret_cast<uintptr_t>(timeout);
+        if (val < 0 || nr_requeue < 0) {
+            errno = EINVAL;
+            return -1;
         }
-        return 0;
+        int cmpval = val3;
+        return futex_requeue(uaddr, val, nr_requeue, uaddr2,
+                cmd == FUTEX_CMP_REQUEUE ? &cmpval : nullptr);
+    }
+    case FUTEX_WAKE_OP:
+        return futex_wake_op(uaddr, val, uaddr2,
+                reinterpret_cast<uintptr_t>(timeout), val3);
+    case FUTEX_LOCK_PI:
+    case FUTEX_LOCK_PI2:
+    case FUTEX_TRYLOCK_PI: {
+        if (cmd == FUTEX_TRYLOCK_PI || !timeout) {
+            return futex_lock_pi(uaddr, nullptr, cmd == FUTEX_TRYLOCK_PI);
+        }
+        // FUTEX_LOCK_PI always measures its timeout on the real-time clock
+        sched::timer tmr(*sched::thread::current());
+        futex_set_timer(tmr, timeout, true, cmd == FUTEX_LOCK_PI || realtime);
+        return futex_lock_pi(uaddr, &tmr, false);
+    }
+    case FUTEX_UNLOCK_PI:
+        return futex_unlock_pi(uaddr);
     default:
-        abort("Unimplemented futex() operation %d\n", op);
+        errno = ENOSYS;
+        return -1;
     }
 }
 
@@ -256,109 +607,61 @@ long long_shmat(int shmid, const void *shmaddr, int shmflg) {
 }
 #endif
 
-#define SYSCALL0(fn) case (__NR_##fn): do { long ret = fn(); trace_syscall_##fn(ret); return ret; } while (0)
-
-#define SYSCALL1(fn, __t1)             \
-        case (__NR_##fn): do {         \
-        va_list args;                  \
-        __t1 arg1;                     \
-        va_start(args, number);        \
-        arg1 = va_arg(args, __t1);     \
-        va_end(args);                  \
-        auto ret = fn(arg1);           \
-        trace_syscall_##fn(ret, arg1); \
-        return ret;                    \
-        } while (0)
-
-#define SYSCALL2(fn, __t1, __t2)            \
-        case (__NR_##fn): do {              \
-        va_list args;                       \
-        __t1 arg1;                          \
-        __t2 arg2;                          \
-        va_start(args, number);             \
-        arg1 = va_arg(args, __t1);          \
-        arg2 = va_arg(args, __t2);          \
-        va_end(args);                       \
-        auto ret = fn(arg1, arg2);          \
-        trace_syscall_##fn(ret, arg1, arg2);\
-        return ret;                         \
-        } while (0)
-
-#define SYSCALL3(fn, __t1, __t2, __t3)             \
-        case (__NR_##fn): do {                     \
-        va_list args;                              \
-        __t1 arg1;                                 \
-        __t2 arg2;                                 \
-        __t3 arg3;                                 \
-        va_start(args, number);                    \
-        arg1 = va_arg(args, __t1);                 \
-        arg2 = va_arg(args, __t2);                 \
-        arg3 = va_arg(args, __t3);                 \
-        va_end(args);                              \
-        auto ret = fn(arg1, arg2, arg3);           \
-        trace_syscall_##fn(ret, arg1, arg2, arg3); \
-        return ret;                                \
-        } while (0)
-
-#define SYSCALL4(fn, __t1, __t2, __t3, __t4)             \
-        case (__NR_##fn): do {                           \
-        va_list args;                                    \
-        __t1 arg1;                                       \
-        __t2 arg2;                                       \
-        __t3 arg3;                                       \
-        __t4 arg4;                                       \
-        va_start(args, number);                          \
-        arg1 = va_arg(args, __t1);                       \
-        arg2 = va_arg(args, __t2);                       \
-        arg3 = va_arg(args, __t3);                       \
-        arg4 = va_arg(args, __t4);                       \
-        va_end(args);                                    \
-        auto ret = fn(arg1, arg2, arg3, arg4);           \
-        trace_syscall_##fn(ret, arg1, arg2, arg3, arg4); \
-        return ret;                                      \
-        } while (0)
-
-#define SYSCALL5(fn, __t1, __t2, __t3, __t4, __t5)             \
-        case (__NR_##fn): do {                                 \
-        va_list args;                                          \
-        __t1 arg1;                                             \
-        __t2 arg2;                                             \
-        __t3 arg3;                                             \
-        __t4 arg4;                                             \
-        __t5 arg5;                                             \
-        va_start(args, number);                                \
-        arg1 = va_arg(args, __t1);                             \
-        arg2 = va_arg(args, __t2);                             \
-        arg3 = va_arg(args, __t3);                             \
-        arg4 = va_arg(args, __t4);                             \
-        arg5 = va_arg(args, __t5);                             \
-        va_end(args);                                          \
-        auto ret = fn(arg1, arg2, arg3, arg4, arg5);           \
-        trace_syscall_##fn(ret, arg1, arg2, arg3, arg4, arg5); \
-        return ret;                                            \
-        } while (0)
-
-#define SYSCALL6(fn, __t1, __t2, __t3, __t4, __t5, __t6)             \
-        case (__NR_##fn): do {                                       \
-        va_list args;                                                \
-        __t1 arg1;                                                   \
-        __t2 arg2;                                                   \
-        __t3 arg3;                                                   \
-        __t4 arg4;                                                   \
-        __t5 arg5;                                                   \
-        __t6 arg6;                                                   \
-        va_start(args, number);                                      \
-        arg1 = va_arg(args, __t1);                                   \
-        arg2 = va_arg(args, __t2);                                   \
-        arg3 = va_arg(args, __t3);                                   \
-        arg4 = va_arg(args, __t4);                                   \
-        arg5 = va_arg(args, __t5);                                   \
-        arg6 = va_arg(args, __t6);                                   \
-        va_end(args);                                                \
-        auto ret = fn(arg1, arg2, arg3, arg4, arg5, arg6);           \
-        trace_syscall_##fn(ret, arg1, arg2, arg3, arg4, arg5, arg6); \
-        return ret;                                                  \
-        } while (0)
+// Each SYSCALLn() line of syscalls.cc defines direct_<fn>(), taking the
+// arguments of the system call as longs like its entry points get them
+// and converting them to the types fn() takes.
+#define SYSCALL0(fn)                                                        \
+        static long direct_##fn(long, long, long, long, long, long)        \
+        {                                                                   \
+            long ret = fn();                                                \
+            trace_syscall_##fn(ret);                                        \
+            return ret;                                                     \
+        }
+#define SYSCALL1(fn, __t1)                                                  \
+        static long direct_##fn(long a1, long, long, long, long, long)     \
+        {                                                                   \
+            auto ret = fn((__t1)a1);                                        \
+            trace_syscall_##fn(ret, (__t1)a1);                              \
+            return ret;                                                     \
+        }
+#define SYSCALL2(fn, __t1, __t2)                                            \
+        static long direct_##fn(long a1, long a2, long, long, long, long)  \
+        {                                                                   \
+            auto ret = fn((__t1)a1, (__t2)a2);                              \
+            trace_syscall_##fn(ret, (__t1)a1, (__t2)a2);                    \
+            return ret;                                                     \
+        }
+#define SYSCALL3(fn, __t1, __t2, __t3)                                      \
+        static long direct_##fn(long a1, long a2, long a3, long, long, long) \
+        {                                                                   \
+            auto ret = fn((__t1)a1, (__t2)a2, (__t3)a3);                    \
+            trace_syscall_##fn(ret, (__t1)a1, (__t2)a2, (__t3)a3);          \
+            return ret;                                                     \
+        }
+#define SYSCALL4(fn, __t1, __t2, __t3, __t4)                                \
+        static long direct_##fn(long a1, long a2, long a3, long a4, long, long) \
+        {                                                                   \
+            auto ret = fn((__t1)a1, (__t2)a2, (__t3)a3, (__t4)a4);          \
+            trace_syscall_##fn(ret, (__t1)a1, (__t2)a2, (__t3)a3, (__t4)a4); \
+            return ret;                                                     \
+        }
+#define SYSCALL5(fn, __t1, __t2, __t3, __t4, __t5)                          \
+        static long direct_##fn(long a1, long a2, long a3, long a4, long a5, long) \
+        {                                                                   \
+            auto ret = fn((__t1)a1, (__t2)a2, (__t3)a3, (__t4)a4, (__t5)a5); \
+            trace_syscall_##fn(ret, (__t1)a1, (__t2)a2, (__t3)a3, (__t4)a4, \
+                               (__t5)a5);                                   \
+            return ret;                                                     \
+        }
+#define SYSCALL6(fn, __t1, __t2, __t3, __t4, __t5, __t6)                    \
+        static long direct_##fn(long a1, long a2, long a3, long a4, long a5, long a6) \
+        {                                                                   \
+            auto ret = fn((__t1)a1, (__t2)a2, (__t3)a3, (__t4)a4, (__t5)a5, \
+                          (__t6)a6);                                        \
+            trace_syscall_##fn(ret, (__t1)a1, (__t2)a2, (__t3)a3, (__t4)a4, \
+                               (__t5)a5, (__t6)a6);                         \
+            return ret;                                                     \
+        }
 
 #if CONF_core_syscall
 int rt_sigaction(int sig, const struct k_sigaction * act, struct k_sigaction * oact, size_t sigsetsize)
@@ -700,17 +1003,129 @@ TRACEPOINT(trace_syscall_futex, "%d <= %p %d %d %p %p %d", int, int *, int, int,
 #include <osv/syscall_tracepoints.cc>
 #endif
 
+SYSCALL6(futex, int *, int, int, const struct timespec *, int *, uint32_t);
+#if CONF_core_syscall
+#include <osv/syscalls.cc>
+#endif
+
+#undef SYSCALL0
+#undef SYSCALL1
+#undef SYSCALL2
+#undef SYSCALL3
+#undef SYSCALL4
+#undef SYSCALL5
+#undef SYSCALL6
+
+#define SYSCALL_TABLE_ENTRY(fn)                                             \
+        static_assert(__NR_##fn < syscall_table_size, "syscall_table_size"); \
+        syscall_table[__NR_##fn] = { direct_##fn, #fn }
+#define SYSCALL0(fn) SYSCALL_TABLE_ENTRY(fn)
+#define SYSCALL1(fn, ...) SYSCALL_TABLE_ENTRY(fn)
+#define SYSCALL2(fn, ...) SYSCALL_TABLE_ENTRY(fn)
+#define SYSCALL3(fn, ...) SYSCALL_TABLE_ENTRY(fn)
+#define SYSCALL4(fn, ...) SYSCALL_TABLE_ENTRY(fn)
+#define SYSCALL5(fn, ...) SYSCALL_TABLE_ENTRY(fn)
+#define SYSCALL6(fn, ...) SYSCALL_TABLE_ENTRY(fn)
+
+// Indexed by system call number, with fn null for those not implemented
+static syscall_desc syscall_table[syscall_table_size];
+
+static void __attribute__((constructor)) init_syscall_table()
+{
+    SYSCALL6(futex, int *, int, int, const struct timespec *, int *, uint32_t);
+#if CONF_core_syscall
+#include <osv/syscalls.cc>
+#endif
+}
+
+const syscall_desc* syscall_lookup(long number)
+{
+    if (number < 0 || number >= syscall_table_size || !syscall_table[number].fn) {
+        return nullptr;
+    }
+    return &syscall_table[number];
+}
+
+#if CONF_core_syscall_stats
+struct syscall_stat {
+    u64 calls;
+    u64 nanoseconds;
+};
+// Only updated by the cpu it belongs to, with preemption disabled
+static PERCPU(syscall_stat[syscall_table_size], syscall_stats);
+// Reading the clock twice costs more than many system calls do, so calls
+// are only timed when asked for with --syscall-timing
+extern bool opt_syscall_timing;
+#endif
+
+static inline long invoke_syscall(long number, long a1, long a2, long a3, long a4, long a5, long a6)
+{
+#if CONF_core_syscall_stats
+    if (!opt_syscall_timing) {
+        WITH_LOCK(preempt_lock) {
+            (*syscall_stats)[number].calls++;
+        }
+        return syscall_table[number].fn(a1, a2, a3, a4, a5, a6);
+    }
+    auto start = osv::clock::uptime::now();
+    auto ret = syscall_table[number].fn(a1, a2, a3, a4, a5, a6);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            osv::clock::uptime::now() - start).count();
+    WITH_LOCK(preempt_lock) {
+        auto& stat = (*syscall_stats)[number];
+        stat.calls++;
+        stat.nanoseconds += ns;
+    }
+    return ret;
+#else
+    return syscall_table[number].fn(a1, a2, a3, a4, a5, a6);
+#endif
+}
+
+// Calls and time spent per system call, summed over the cpus, for
+// /proc/syscalls
+std::string procfs_syscalls()
+{
+    std::string out = "number name calls total_ns average_ns\n";
+#if CONF_core_syscall_stats
+    for (long number = 0; number < syscall_table_size; number++) {
+        if (!syscall_table[number].fn) {
+            continue;
+        }
+        u64 calls = 0, ns = 0;
+        for (auto cpu : sched::cpus) {
+            auto& stat = (*syscall_stats.for_cpu(cpu))[number];
+            calls += stat.calls;
+            ns += stat.nanoseconds;
+        }
+        if (calls) {
+            out += osv::sprintf("%ld %s %lu %lu %lu\n", number,
+                                syscall_table[number].name, calls, ns, ns / calls);
+        }
+    }
+#endif
+    return out;
+}
+
 OSV_LIBC_API long syscall(long number, ...)
 {
     // Save FPU state and restore it at the end of this function
     sched::fpu_lock fpu;
     SCOPE_LOCK(fpu);
 
-    switch (number) {
-    SYSCALL6(futex, int *, int, int, const struct timespec *, int *, uint32_t);
-#if CONF_core_syscall
-#include <osv/syscalls.cc>
-#endif
+    if (number >= 0 && number < syscall_table_size && syscall_table[number].fn) {
+        // Take all 6 arguments, like the syscall instruction does;
+        // direct_<fn>() converts them to the types the implementation takes
+        va_list args;
+        va_start(args, number);
+        long a1 = va_arg(args, long);
+        long a2 = va_arg(args, long);
+        long a3 = va_arg(args, long);
+        long a4 = va_arg(args, long);
+        long a5 = va_arg(args, long);
+        long a6 = va_arg(args, long);
+        va_end(args);
+        return invoke_syscall(number, a1, a2, a3, a4, a5, a6);
     }
 
     debug_always("syscall(): unimplemented system call %d\n", number);
@@ -752,6 +1167,34 @@ extern "C" long syscall_wrapper(long p1, long p2, long p3, long p4, long p5, lon
     return ret;
 }
 
+#ifdef __x86_64__
+// Called by syscall_direct_entry like syscall_wrapper() is by syscall_entry,
+// but with the system call's entry of syscall_table instead of its number,
+// skipping the checks of syscall(). The ELF loader patches calls of system
+// calls we implement only, see elf::object::patch_syscalls().
+extern "C" long syscall_direct_wrapper(const syscall_desc* desc, long p1, long p2, long p3, long p4, long p5, long p6)
+{
+    // Switch TLS register if necessary
+    arch::tls_switch tls_switch;
+
+    int errno_backup = errno;
+    long ret;
+    {
+        // Save FPU state and restore it at the end of this scope, as
+        // syscall() does
+        sched::fpu_lock fpu;
+        SCOPE_LOCK(fpu);
+        ret = invoke_syscall(desc - syscall_table, p1, p2, p3, p4, p5, p6);
+    }
+    int result = -errno;
+    errno = errno_backup;
+    if (ret < 0 && ret >= -4096) {
+        return result;
+    }
+    return ret;
+}
+#endif
+
 extern "C" int is_selinux_enabled()
 {
     return 0;
@@ -34,6 +34,7 @@
 #include <osv/power.hh>
 #include <osv/rcu.hh>
 #include <osv/mempool.hh>
+#include <osv/mmu.hh>
 #include <bsd/porting/networking.hh>
 #include <bsd/porting/shrinker.h>
 #include <bsd/porting/route.h>
@@ -97,6 +98,7 @@ extern "C" {
     int mount_rootfs(const char*, const char*, const char*, int, const void*, bool);
     void import_extra_zfs_pools();
     void rofs_disable_cache();
+    void zfs_enable_trim();
 }
 
 void premain()
@@ -162,6 +164,7 @@ static bool opt_pivot = true;
 static std::string opt_rootfs;
 static bool opt_random = true;
 static bool opt_init = true;
+static bool opt_thp_collapse = false;
 static std::string opt_console = "all";
 static bool opt_verbose = false;
 static std::string opt_chdir;
@@ -174,6 +177,9 @@ static std::chrono::nanoseconds boot_delay;
 std::vector<mntent> opt_mount_fs;
 bool opt_maxnic = false;
 int maxnic;
+int opt_nic_queues = 0;
+bool opt_patch_syscalls = false;
+bool opt_syscall_timing = false;
 bool opt_pci_disabled = false;
 
 #if CONF_tracepoints_sampler
@@ -205,10 +211,19 @@ static void usage()
         "  --rootfs=arg          root filesystem to use (zfs, rofs, ramfs or virtiofs)\n"
         "  --assign-net          assign virtio network to the application\n"
         "  --maxnic=arg          maximum NIC number\n"
+        "  --nic-queues=arg      maximum number of queue pairs per multiqueue NIC\n"
+        "                        (default: one per vCPU)\n"
         "  --norandom            don't initialize any random device\n"
         "  --noshutdown          continue running after main() returns\n"
         "  --power-off-on-abort  use poweroff instead of halt if it's aborted\n"
         "  --noinit              don't run commands from /init\n"
+        "  --thp-collapse        collapse small pages of anonymous mmap() memory\n"
+        "                        into huge pages in the background\n"
+        "  --patch-syscalls      turn system call instructions of applications\n"
+        "                        into direct calls\n"
+#if CONF_core_syscall_stats
+        "  --syscall-timing      time each system call for /proc/syscalls\n"
+#endif
         "  --verbose             be verbose, print debug messages\n"
         "  --console=arg         select console driver\n"
         "  --env=arg             set Unix-like environment variable (putenv())\n"
@@ -225,6 +240,7 @@ static void usage()
         "  --disable_rofs_cache  disable ROFS memory cache\n"
         "  --nopci               disable PCI enumeration\n"
         "  --extra-zfs-pools     import extra ZFS pools\n"
+        "  --zfs-trim            discard disk space freed by ZFS\n"
         "  --mount-fs=arg        mount extra filesystem, format:<fs_type,url,path>\n"
         "  --preload-zfs-library preload ZFS library from /usr/lib/fs\n\n");
 }
@@ -267,6 +283,10 @@ static void parse_options(int loader_argc, char** loader_argv)
         opt_extra_zfs_pools = true;
     }
 
+    if (extract_option_flag(options_values, "zfs-trim")) {
+        zfs_enable_trim();
+    }
+
     if (extract_option_flag(options_values, "noshutdown")) {
         opt_noshutdown = true;
     }
@@ -275,11 +295,29 @@ static void parse_options(int loader_argc, char** loader_argv)
         opt_power_off_on_abort = true;
     }
 
+    if (extract_option_flag(options_values, "patch-syscalls")) {
+        opt_patch_syscalls = true;
+    }
+
+    if (extract_option_flag(options_values, "thp-collapse")) {
+        opt_thp_collapse = true;
+    }
+
+#if CONF_core_syscall_stats
+    if (extract_option_flag(options_values, "syscall-timing")) {
+        opt_syscall_timing = true;
+    }
+#endif
+
     if (options::option_value_exists(options_values, "maxnic")) {
         opt_maxnic = true;
         maxnic = options::extract_option_int_value(options_values, "maxnic", handle_parse_error);
     }
 
+    if (options::option_value_exists(options_values, "nic-queues")) {
+        opt_nic_queues = options::extract_option_int_value(options_values, "nic-queues", handle_parse_error);
+    }
+
 #if CONF_tracepoints
     if (extract_option_flag(options_values, "trace-backtrace")) {
         opt_log_backtrace = true;
@@ -851,6 +889,9 @@ void main_cont(int loader_argc, char** loader_argv)
 #endif
     sched::init_detached_threads_reaper();
     elf::setup_missing_symbols_detector();
+    if (opt_thp_collapse) {
+        mmu::start_thp_collapse();
+    }
 
     bsd_init();
 
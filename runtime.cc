@@ -382,7 +382,7 @@ long sysconf(int name)
     case _SC_IOV_MAX: return KERN_IOV_MAX;
     case _SC_THREAD_SAFE_FUNCTIONS: return 1;
     case _SC_GETGR_R_SIZE_MAX: return 1;
-    case _SC_OPEN_MAX: return FDMAX;
+    case _SC_OPEN_MAX: return fd_limit();
     case _SC_MINSIGSTKSZ: return MINSIGSTKSZ;
     case _SC_SIGSTKSZ: return SIGSTKSZ;
     default:
@@ -41,6 +41,13 @@
 # Table of inodes where each specifies type (dir,file,symlink) and data offset
 # (for files it is a block on a disk, for symlinks and directories it is an
 # offset in one of the 2 tables above)
+#
+# Compressed images (version 2, option -c lz4) store each file as a sequence
+# of 32K clusters, each compressed on its own with LZ4 (raw block format) and
+# padded to 512 bytes block. A cluster that would not shrink is stored as is.
+# The data offset of a file i-node is then the index of its first cluster in
+# the table of clusters which follows the table of inodes
+# (each entry holds the first block of a cluster and its size on disk)
 ##################################################################################
 
 import os, optparse, io
@@ -49,6 +56,11 @@ from ctypes import *
 from manifest_common import add_var, expand, unsymlink, read_manifest, defines, strip_file
 
 OSV_BLOCK_SIZE = 512
+CLUSTER_SIZE_IN_BLOCKS = 64
+CLUSTER_SIZE = CLUSTER_SIZE_IN_BLOCKS * OSV_BLOCK_SIZE
+
+COMPRESSION_NONE = 0
+COMPRESSION_LZ4 = 1
 
 DIR_MODE  = int('0x4000', 16)
 REG_MODE  = int('0x8000', 16)
@@ -65,7 +77,17 @@ class SuperBlock(Structure):
         ('structure_info_blocks_count', c_ulonglong),
         ('directory_entries_count', c_ulonglong),
         ('symlinks_count', c_ulonglong),
-        ('inodes_count', c_ulonglong)
+        ('inodes_count', c_ulonglong),
+        ('compression', c_ulonglong),
+        ('cluster_size_in_blocks', c_ulonglong),
+        ('cluster_table_first_block', c_ulonglong),
+        ('clusters_count', c_ulonglong)
+    ]
+
+class Cluster(Structure):
+    _fields_ = [
+        ('block', c_ulonglong),
+        ('compressed_size', c_ulonglong)
     ]
 
 # data_offset and count represent different things depending on mode:
@@ -115,6 +137,9 @@ symlinks_count = 0
 inodes = []
 inodes_count = 1
 
+compression = COMPRESSION_NONE
+clusters = []
+
 def next_directory_entry(filename,inode_no):
     global directory_entries
     global directory_entries_count
@@ -177,6 +202,92 @@ def write_file(fp, path):
 
     return total
 
+# Compresses data into a single LZ4 block (no frame, no size prefix).
+# Uses the lz4 module when it is available, otherwise a simple greedy
+# compressor that produces the same format.
+def lz4_compress(data):
+    try:
+        import lz4.block
+        return lz4.block.compress(data, mode='high_compression', store_size=False)
+    except ImportError:
+        pass
+
+    def length_bytes(length):
+        out = bytearray()
+        while length >= 255:
+            out.append(255)
+            length -= 255
+        out.append(length)
+        return out
+
+    def sequence(literals, offset, match_length):
+        lit_len = len(literals)
+        token = min(lit_len, 15) << 4
+        if match_length:
+            token |= min(match_length - 4, 15)
+        out = bytearray([token])
+        if lit_len >= 15:
+            out += length_bytes(lit_len - 15)
+        out += literals
+        if match_length:
+            out += pack('<H', offset)
+            if match_length - 4 >= 15:
+                out += length_bytes(match_length - 4 - 15)
+        return out
+
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    # The format requires the last 5 bytes to be literals and the last
+    # match to start at least 12 bytes before the end
+    while i < n - 12:
+        key = data[i:i + 4]
+        ref = table.get(key)
+        table[key] = i
+        if ref is None or i - ref > 65535:
+            i += 1
+            continue
+        match_length = 4
+        max_length = n - 5 - i
+        while match_length < max_length and data[ref + match_length] == data[i + match_length]:
+            match_length += 1
+        out += sequence(data[anchor:i], i - ref, match_length)
+        i += match_length
+        anchor = i
+    out += sequence(data[anchor:], 0, 0)
+    return bytes(out)
+
+def write_compressed_file(fp, path):
+    global block
+    global clusters
+
+    total = 0
+
+    with open(path, 'rb') as f:
+        while True:
+            chunk = f.read(CLUSTER_SIZE)
+            if not chunk:
+                break
+            total += len(chunk)
+            compressed = lz4_compress(chunk)
+            if len(compressed) >= len(chunk):
+                compressed = chunk
+
+            cluster = Cluster()
+            cluster.block = block
+            cluster.compressed_size = len(compressed)
+            clusters.append(cluster)
+
+            fp.write(compressed)
+            last = len(compressed) % OSV_BLOCK_SIZE
+            if last > 0:
+                pad(fp, OSV_BLOCK_SIZE - last)
+            block += (len(compressed) + OSV_BLOCK_SIZE - 1) // OSV_BLOCK_SIZE
+
+    return total
+
 def write_inodes(fp):
     global inodes
 
@@ -217,9 +328,13 @@ def write_dir(fp, manifest, dirpath, parent_dir):
                 print('Link %s to %s' % (dirpath + '/' + entry, val[2:]))
             else: #file
                 inode.mode = REG_MODE
-                global block
-                inode.data_offset = block
-                inode.count = write_file(fp, val)
+                if compression == COMPRESSION_LZ4:
+                    inode.data_offset = len(clusters)
+                    inode.count = write_compressed_file(fp, val)
+                else:
+                    global block
+                    inode.data_offset = block
+                    inode.count = write_file(fp, val)
                 print('Adding %s' % (dirpath + '/' + entry))
 
     # This needs to be added so that later we can walk the tree
@@ -275,9 +390,22 @@ def gen_image(out, manifest):
     global inodes
     global directory_entries
     global symlinks
+    global clusters
 
     sb = SuperBlock()
     sb.version = 1
+
+    if compression != COMPRESSION_NONE:
+        sb.version = 2
+        sb.compression = compression
+        sb.cluster_size_in_blocks = CLUSTER_SIZE_IN_BLOCKS
+        sb.cluster_table_first_block = system_structure_block + structure_info_blocks_count
+        sb.clusters_count = len(clusters)
+        for cluster in clusters:
+            fp.write(cluster)
+        cluster_table_last_block_bytes = len(clusters) * sizeof(Cluster) % OSV_BLOCK_SIZE
+        if cluster_table_last_block_bytes > 0:
+            pad(fp, OSV_BLOCK_SIZE - cluster_table_last_block_bytes)
     sb.magic = int('0xDEADBEAD', 16)
     sb.block_size = OSV_BLOCK_SIZE
     sb.structure_info_first_block = system_structure_block
@@ -290,6 +418,8 @@ def gen_image(out, manifest):
     print('Directory entries count %d' % sb.directory_entries_count)
     print('Symlinks count %d' % sb.symlinks_count)
     print('Inodes count %d' % sb.inodes_count)
+    if compression != COMPRESSION_NONE:
+        print('Clusters count %d' % sb.clusters_count)
 
     fp.seek(0)
     fp.write(sb)
@@ -353,6 +483,12 @@ def main():
                         metavar='VAR=DATA',
                         action='callback',
                         callback=add_var),
+            make_option('-c',
+                        dest='compression',
+                        type='choice',
+                        choices=['none', 'lz4'],
+                        default='none',
+                        help='compress file data with none (default) or lz4'),
     ])
 
     (options, args) = opt.parse_args()
@@ -361,6 +497,10 @@ def main():
 
     outfile = os.path.abspath(options.output)
 
+    if options.compression == 'lz4':
+        global compression
+        compression = COMPRESSION_LZ4
+
     manifest = parse_manifest(manifest)
 
     gen_image(outfile, manifest)
@@ -55,6 +55,12 @@ test_files = []
 is_comment = re.compile("^[ \t]*(|#.*|\\[manifest])$")
 is_test = re.compile("^/tests/tst-.*")
 
+# Tests run once more with the given loader options, if they are on the image
+tests_with_options = [
+    ("tst-syscall-patch-on", "--patch-syscalls", "/tests/tst-syscall-patch.so patched"),
+    ("tst-zfs-trim-on", "--zfs-trim", "/tests/tst-zfs-trim.so"),
+]
+
 def running_with_kvm_on(arch, hypervisor):
     if os.path.exists('/dev/kvm') and arch == host_arch and hypervisor in ['qemu', 'qemu_microvm', 'firecracker']:
         return True
@@ -71,6 +77,10 @@ def collect_tests():
             if is_test.match(guestpath):
                 test_files.append(guestpath);
     add_tests((TestRunnerTest(os.path.basename(x)) for x in test_files))
+    if not cmdargs.linux_ld:
+        add_tests((SingleCommandTest(name, options + ' ' + command)
+                   for name, options, command in tests_with_options
+                   if command.split()[0] in test_files))
 
 java_test_commands_file = 'modules/java-tests/test_commands'
 
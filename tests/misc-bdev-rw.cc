@@ -5,6 +5,9 @@
 #include <osv/bio.h>
 #include <osv/prex.h>
 #include <osv/mempool.hh>
+#include <osv/mutex.h>
+#include <osv/sched.hh>
+#include <chrono>
 
 #define MB (1024*1024)
 
@@ -17,13 +20,25 @@ dd if=/dev/zero of=/tmp/test1.raw bs=1M count=512
 qemu-img convert -O qcow2 /tmp/test1.raw /tmp/test1.img
 
 ./scripts/run.py -e '/tests/misc-bdev-rw.so vblk1' --cloud-init-image /tmp/test1.img
+
+An optional second argument sets the number of concurrent submitter
+threads, each pinned to its own CPU, to exercise multiqueue devices:
+
+./scripts/run.py -c 4 -e '/tests/misc-bdev-rw.so vblk1 4' --cloud-init-image /tmp/test1.img
 */
 
 using namespace std;
 
-atomic<int> bio_inflights(0);
 atomic<bool> test_failed(false);
-vector<struct bio *> done_wbio;
+
+// Every submitter thread writes and then reads back its own share of the
+// buffers, so that with a multiqueue device the requests of different
+// submitters go through different queues.
+struct submitter {
+    atomic<int> bio_inflights = {0};
+    ::mutex lock;
+    vector<struct bio *> done_wbio;
+};
 
 static void fill_buffer(void *buff, size_t len)
 {
@@ -39,6 +54,7 @@ static void rbio_done(struct bio* rbio)
 {
     auto err = rbio->bio_flags & BIO_ERROR;
     auto wbio = static_cast<struct bio*>(rbio->bio_caller1);
+    auto sub = static_cast<submitter*>(wbio->bio_caller1);
 
     if (err) {
         cout << endl
@@ -60,12 +76,13 @@ static void rbio_done(struct bio* rbio)
     destroy_bio(wbio);
     delete [] (char*) rbio->bio_data;
     destroy_bio(rbio);
-    bio_inflights--;
+    sub->bio_inflights--;
 }
 
 static void wbio_done(struct bio* wbio)
 {
     auto err = wbio->bio_flags & BIO_ERROR;
+    auto sub = static_cast<submitter*>(wbio->bio_caller1);
 
     if (err) {
         cout << endl
@@ -73,65 +90,66 @@ static void wbio_done(struct bio* wbio)
              << endl;
         test_failed = true;
 
+        delete [] (char*) wbio->bio_data;
         destroy_bio(wbio);
-        bio_inflights--;
+        sub->bio_inflights--;
         return;
     } else {
         cout << ".";
     }
 
-    done_wbio.push_back(wbio);
-    bio_inflights--;
+    WITH_LOCK(sub->lock) {
+        sub->done_wbio.push_back(wbio);
+    }
+    sub->bio_inflights--;
 }
 
-int main(int argc, char const *argv[])
+static void wait_for_inflights(submitter& sub)
 {
-    struct device *dev;
-    if (argc < 2) {
-        cout << "Usage: " << argv[0] << "<dev-name>" << endl;
-        return 1;
-    }
-
-    if (device_open(argv[1], DO_RDWR, &dev)) {
-        cout << "open failed" << endl;
-        return 1;
+    while (sub.bio_inflights != 0) {
+        usleep(2000);
     }
+}
 
-    long written = 0;
+// Buffer i is i pages long and all buffers are laid out back to back
+static long buffer_offset(int i)
+{
+    return (long)(i - 1) * i / 2 * memory::page_size;
+}
 
+static void run_submitter(struct device *dev, submitter& sub, int id,
+                          int nr_submitters)
+{
     //Do all writes
-    for(auto i = 1; i < 511; i++)
+    for (auto i = 1 + id; i < 511; i += nr_submitters)
     {
         const size_t buff_size = i * memory::page_size;
 
         auto bio = alloc_bio();
-        bio_inflights++;
+        sub.bio_inflights++;
         bio->bio_cmd = BIO_WRITE;
         bio->bio_dev = dev;
         bio->bio_data = new char[buff_size];
-        bio->bio_offset = written;
+        bio->bio_offset = buffer_offset(i);
         bio->bio_bcount = buff_size;
-        bio->bio_caller1 = bio;
+        bio->bio_caller1 = &sub;
         bio->bio_done = wbio_done;
 
         fill_buffer(bio->bio_data, buff_size);
 
         dev->driver->devops->strategy(bio);
-        written += buff_size;
     }
 
-    while (bio_inflights != 0) {
-        usleep(2000);
-    }
+    wait_for_inflights(sub);
 
     //Now do all reads and verify
-    while(!done_wbio.empty())
+    while(!sub.done_wbio.empty())
     {
-        auto wbio = done_wbio.back();
-        done_wbio.pop_back();
+        auto wbio = sub.done_wbio.back();
+        sub.done_wbio.pop_back();
 
         auto rbio = alloc_bio();
-        bio_inflights++;
+        sub.bio_inflights++;
 
         rbio->bio_cmd = BIO_READ;
         rbio->bio_dev = wbio->bio_dev;
@@ -144,12 +162,54 @@ int main(int argc, char const *argv[])
         rbio->bio_dev->driver->devops->strategy(rbio);
     }
 
-    while (bio_inflights != 0) {
-        usleep(2000);
+    wait_for_inflights(sub);
+}
+
+int main(int argc, char const *argv[])
+{
+    struct device *dev;
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <dev-name> [<submitters>]" << endl;
+        return 1;
+    }
+
+    int nr_submitters = 1;
+    if (argc > 2) {
+        nr_submitters = atoi(argv[2]);
+        if (nr_submitters < 1 || nr_submitters > 510) {
+            cout << "Number of submitters must be between 1 and 510" << endl;
+            return 1;
+        }
+    }
+
+    if (device_open(argv[1], DO_RDWR, &dev)) {
+        cout << "open failed" << endl;
+        return 1;
+    }
+
+    const long written = buffer_offset(511);
+
+    // Spread the submitters over the CPUs so that each of them feeds the
+    // queue of its own CPU
+    vector<submitter> submitters(nr_submitters);
+    vector<sched::thread*> threads;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < nr_submitters; i++) {
+        threads.push_back(sched::thread::make([&, i] {
+            run_submitter(dev, submitters[i], i, nr_submitters);
+        }, sched::thread::attr().pin(sched::cpus[i % sched::cpus.size()])));
+        threads.back()->start();
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
     }
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
     cout << endl
-         << "Processed " << written / MB << " MB" << endl
+         << "Processed " << written / MB << " MB with " << nr_submitters
+         << " submitter(s) in " << elapsed << " s ("
+         << 2 * written / MB / elapsed << " MB/s)" << endl
          << "Test " << (test_failed.load() ? "FAILED" : "PASSED") << endl;
 
     return test_failed.load() ? 1 : 0;
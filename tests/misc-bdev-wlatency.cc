@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <stdlib.h>
 
 #include "stat.hh"
 #include <osv/device.h>
@@ -16,10 +17,19 @@
 #include <osv/condvar.h>
 #include <osv/mempool.hh>
 #include <osv/clock.hh>
+#include <osv/ioctl.h>
 
 #define MB (1024*1024)
 #define KB (1024)
 
+/*
+Measures the latency of synchronous 4K writes to a raw block device, first
+with interrupt driven completion and then with hybrid polling enabled on
+the device (see BLKPOLLSET), and prints a latency histogram for both:
+
+./scripts/run.py -e '/tests/misc-bdev-wlatency.so vblk1 [<poll_us>]' --cloud-init-image /tmp/test1.img
+*/
+
 void *bio_buffer;
 unsigned long *bio_clock;
 
@@ -27,6 +37,7 @@ std::vector<unsigned long> completions;
 
 condvar wait_bio;
 mutex bio_mutex;
+bool bio_completed;
 
 static void bio_done(struct bio* bio)
 {
@@ -40,32 +51,22 @@ static void bio_done(struct bio* bio)
         auto now = clock::get()->time();
         unsigned long delta = now - *bio_clock;
         completions.push_back(delta);
+        // With polling, this may run on the submitting thread before
+        // it gets to wait
+        bio_completed = true;
         wait_bio.wake_one();
     }
 }
 
-int main(int argc, char const *argv[])
+static void measure(struct device *dev, size_t elements)
 {
-    struct device *dev;
-    if (argc < 2) {
-        printf("Usage: %s <dev-name>\n", argv[0]);
-        return 1;
-    }
-
-    if (device_open(argv[1], DO_RDWR, &dev)) {
-        printf("open failed\n");
-        return 1;
-    }
-
-    size_t elements = 100000;
-    completions.reserve(elements);
+    completions.clear();
 
     auto bio = alloc_bio();
-    bio_buffer = memory::alloc_page();
-    bio_clock = static_cast<unsigned long *>(bio_buffer);
     WITH_LOCK(bio_mutex) {
         for (unsigned int i = 0; i < elements; i++) {
             bio->bio_cmd = BIO_WRITE;
+            bio->bio_flags = 0;
             bio->bio_dev = dev;
             *bio_clock = clock::get()->time();
             bio->bio_data = bio_buffer;
@@ -74,26 +75,107 @@ int main(int argc, char const *argv[])
             bio->bio_caller1 = bio;
             bio->bio_done = bio_done;
 
+            bio_completed = false;
             dev->driver->devops->strategy(bio);
-            wait_bio.wait(&bio_mutex);
+            while (!bio_completed) {
+                wait_bio.wait(&bio_mutex);
+            }
         }
     }
-    memory::free_page(bio_buffer);
+    destroy_bio(bio);
+}
 
+static void print_percentiles()
+{
     auto size = completions.size();
     std::sort(completions.begin(), completions.end());
     int msec = 1000000;
 
-    std::cout << "Min      50%      90%      99%      99.99%   99.999%  Max     [msec]\n";
-    std::cout << "---      ---      ---      ---      ------   -------  ---\n";
+    std::cout << "Min      50%      90%      99%      99.9%    99.99%   Max     [msec]\n";
+    std::cout << "---      ---      ---      ---      -----    ------   ---\n";
     printf("%-8.4f ", float(completions[0]) / msec);
     printf("%-8.4f ", float(completions[size / 2]) / msec );
-    printf("%-8.4f ", float(completions[(9 * size) / 100]) / msec);
+    printf("%-8.4f ", float(completions[(90 * size) / 100]) / msec);
     printf("%-8.4f ", float(completions[(99 * size) / 100]) / msec);
     printf("%-8.4f ", float(completions[(999 * size) / 1000])/ msec);
     printf("%-8.4f ", float(completions[(9999 * size) / 10000])/ msec);
     printf("%-8.4f ", float(completions.back()) / msec);
     printf("\n");
+}
+
+// Log2 buckets in microseconds, empty buckets are skipped
+static void print_histogram()
+{
+    const int buckets = 24;
+    size_t hist[buckets] = {};
+    for (auto ns : completions) {
+        unsigned long us = ns / 1000;
+        int b = 0;
+        while (us >>= 1) {
+            b++;
+        }
+        hist[std::min(b, buckets - 1)]++;
+    }
+
+    std::cout << "usec range          count    %\n";
+    for (int b = 0; b < buckets; b++) {
+        if (!hist[b]) {
+            continue;
+        }
+        printf("[%7lu, %7lu) %8zu %6.2f\n", b ? 1UL << b : 0UL, 2UL << b,
+               hist[b], 100.0 * hist[b] / completions.size());
+    }
+}
+
+static bool set_poll(struct device *dev, unsigned int poll_us)
+{
+    if (device_ioctl(dev, BLKPOLLSET, &poll_us)) {
+        printf("BLKPOLLSET not supported by %s\n", dev->name);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char const *argv[])
+{
+    struct device *dev;
+    if (argc < 2) {
+        printf("Usage: %s <dev-name> [<poll_us>]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int poll_us = argc > 2 ? atoi(argv[2]) : 50;
+
+    if (device_open(argv[1], DO_RDWR, &dev)) {
+        printf("open failed\n");
+        return 1;
+    }
+
+    size_t elements = 100000;
+    completions.reserve(elements);
+
+    bio_buffer = memory::alloc_page();
+    bio_clock = static_cast<unsigned long *>(bio_buffer);
+
+    unsigned int old_poll_us = 0;
+    device_ioctl(dev, BLKPOLLGET, &old_poll_us);
+
+    std::cout << "Interrupt mode:\n";
+    if (set_poll(dev, 0)) {
+        measure(dev, elements);
+        print_percentiles();
+        print_histogram();
+    }
+
+    std::cout << "\nPoll mode (" << poll_us << " usec):\n";
+    if (set_poll(dev, poll_us)) {
+        measure(dev, elements);
+        print_percentiles();
+        print_histogram();
+    }
+
+    set_poll(dev, old_poll_us);
+    memory::free_page(bio_buffer);
 
     return 0;
 }
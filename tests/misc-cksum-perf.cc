@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures the Internet checksum of the network stack, as done in software
+// for interfaces which do not offload it, for packet sizes from 64 bytes
+// to 64K:
+//
+//  in_cksum:       the checksum of a packet, as in_delayed_cksum() does it.
+//  memcpy+cksum:   copying the data of a datagram into an mbuf, as sosend
+//                  does, then checksumming it.
+//  in_cksum_copy:  the two in one pass, as sosend does for sockets whose
+//                  datagrams need a software checksum.
+//
+// Both routines are first checked against a simple byte by byte sum, for
+// all alignments and for data copied in several pieces.
+//
+// Usage: misc-cksum-perf.so [seconds per run]
+
+#include <bsd/porting/netport.h>
+#include <bsd/sys/sys/mbuf.h>
+#include <machine/in_cksum.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static double seconds;
+static bool failed;
+// Keeps the sums measured from being optimized away
+static volatile unsigned sink;
+
+static std::vector<unsigned char> src(65536 + 64), dst(src.size());
+
+// The 16-bit one's complement sum of n bytes, not complemented
+static unsigned ref_sum(const unsigned char* p, size_t n)
+{
+    unsigned long sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += i & 1 ? p[i] << 8 : p[i];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+// 0 and 0xffff are both zero in one's complement
+static bool same_sum(unsigned a, unsigned b)
+{
+    return a % 0xffff == b % 0xffff;
+}
+
+// An mbuf with the len bytes at p as its data
+static struct mbuf* wrap(struct mbuf* m, unsigned char* p, int len)
+{
+    *m = mbuf();
+    m->m_hdr.mh_data = reinterpret_cast<caddr_t>(p);
+    m->m_hdr.mh_len = len;
+    return m;
+}
+
+static void check()
+{
+    struct mbuf m;
+    bool ok = true;
+    for (int n = 0; n <= 1600 && ok; n++) {
+        for (int off = 0; off < 8; off++) {
+            unsigned want = ref_sum(&src[off], n);
+            ok &= same_sum(~in_cksum(wrap(&m, &src[off], n), n) & 0xffff, want);
+            memset(dst.data(), 0, n + 16);
+            ok &= same_sum(in_cksum_copy(&src[off], &dst[7 - off], n, 0, 0), want);
+            ok &= memcmp(&dst[7 - off], &src[off], n) == 0 && dst[7 - off + n] == 0;
+        }
+    }
+    // In three pieces, the second starting at an odd offset
+    for (int n = 2; n <= 9000 && ok; n += 67) {
+        int a = n / 3 | 1, b = n / 2;
+        u_short sum = in_cksum_copy(&src[1], &dst[0], a, 0, 0);
+        sum = in_cksum_copy(&src[1 + a], &dst[a], b - a, sum, a);
+        sum = in_cksum_copy(&src[1 + b], &dst[b], n - b, sum, b);
+        ok &= same_sum(sum, ref_sum(&src[1], n)) && memcmp(&dst[0], &src[1], n) == 0;
+    }
+    if (!ok) {
+        printf("checksums differ from the byte by byte ones\n");
+        failed = true;
+    }
+}
+
+template <typename Func>
+static void run(const char* name, int size, Func func)
+{
+    unsigned long count = 0;
+    auto start = _clock::now();
+    auto end = start + std::chrono::duration<double>(seconds);
+    unsigned sum = 0;
+    do {
+        for (int i = 0; i < 1000; i++) {
+            sum += func();
+        }
+        count += 1000;
+    } while (_clock::now() < end);
+    auto elapsed = std::chrono::duration<double>(_clock::now() - start).count();
+    sink = sum;
+    printf("%-14s %5d bytes: %8.2f GB/s, %7.1f ns per packet\n", name, size,
+           count * size / elapsed / 1e9, elapsed * 1e9 / count);
+}
+
+int main(int argc, char const *argv[])
+{
+    seconds = argc > 1 ? atof(argv[1]) : 0.5;
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = (i * 31) >> 3;
+    }
+
+    check();
+
+    struct mbuf msrc, mdst;
+    for (int size : { 64, 128, 256, 576, 1500, 4096, 9000, 65535 }) {
+        wrap(&msrc, src.data(), size);
+        wrap(&mdst, dst.data(), size);
+        run("in_cksum", size, [&] {
+            return in_cksum(&msrc, size);
+        });
+        run("memcpy+cksum", size, [&] {
+            memcpy(dst.data(), src.data(), size);
+            return in_cksum(&mdst, size);
+        });
+        run("in_cksum_copy", size, [&] {
+            return in_cksum_copy(src.data(), dst.data(), size, 0, 0);
+        });
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures how epoll scales with the number of descriptors and of threads
+// waiting for them, as in a server whose worker threads all wait for
+// events on the same set of connections. One thread makes eventfds
+// readable in turn, the waiters each take one event per epoll_wait() and
+// read the eventfd. Two setups are compared:
+//
+//  shared:    all waiters share one epoll, with the eventfds registered
+//             edge-triggered.
+//  exclusive: each waiter has its own epoll, with all the eventfds
+//             registered in every one of them with EPOLLEXCLUSIVE.
+//
+// Besides events per second it prints the number of epoll_wait() returns
+// per event: any above 1 are threads woken up for an event another thread
+// had already taken (a thundering herd).
+//
+// Usage: misc-epoll-perf.so [descriptors] [seconds per run]
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+using _clock = std::chrono::high_resolution_clock;
+
+static unsigned nr_fds;
+static double seconds;
+static bool failed;
+
+static void fail(const char *what)
+{
+    printf("%s: %s\n", what, strerror(errno));
+    failed = true;
+}
+
+struct counters {
+    std::atomic<unsigned long> events = { 0 };
+    std::atomic<unsigned long> returns = { 0 };
+};
+
+static void waiter(int ep, int stop, counters& c)
+{
+    unsigned long events = 0, returns = 0;
+    for (;;) {
+        struct epoll_event ev;
+        int n = epoll_wait(ep, &ev, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("epoll_wait");
+            break;
+        }
+        if (ev.data.fd == stop) {
+            break;
+        }
+        returns++;
+        eventfd_t value;
+        if (eventfd_read(ev.data.fd, &value) == 0) {
+            events++;
+        } else if (errno != EAGAIN) {
+            fail("eventfd_read");
+            break;
+        }
+    }
+    c.events += events;
+    c.returns += returns;
+}
+
+static void run(const char *name, unsigned nr_threads, bool exclusive)
+{
+    std::vector<int> fds(nr_fds);
+    for (auto& fd : fds) {
+        fd = eventfd(0, EFD_NONBLOCK);
+    }
+    int stop = eventfd(0, EFD_NONBLOCK);
+    std::vector<int> eps(exclusive ? nr_threads : 1);
+    for (auto& ep : eps) {
+        ep = epoll_create1(0);
+        struct epoll_event ev = {};
+        for (auto fd : fds) {
+            ev.events = EPOLLIN | (exclusive ? EPOLLEXCLUSIVE : EPOLLET);
+            ev.data.fd = fd;
+            if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                fail("epoll_ctl");
+            }
+        }
+        // Level-triggered and never read, so it stops every waiter
+        ev.events = EPOLLIN;
+        ev.data.fd = stop;
+        epoll_ctl(ep, EPOLL_CTL_ADD, stop, &ev);
+    }
+
+    counters c;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < nr_threads; i++) {
+        int ep = eps[exclusive ? i : 0];
+        threads.emplace_back([=, &c] { waiter(ep, stop, c); });
+    }
+    auto start = _clock::now();
+    auto end = start + std::chrono::duration<double>(seconds);
+    unsigned long writes = 0;
+    while (_clock::now() < end) {
+        for (unsigned i = 0; i < 1000; i++) {
+            eventfd_write(fds[writes++ % nr_fds], 1);
+        }
+    }
+    eventfd_write(stop, 1);
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto elapsed = std::chrono::duration<double>(_clock::now() - start).count();
+
+    for (auto ep : eps) {
+        close(ep);
+    }
+    for (auto fd : fds) {
+        close(fd);
+    }
+    close(stop);
+
+    if (!c.events) {
+        printf("%s: no events\n", name);
+        failed = true;
+        return;
+    }
+    printf("%-10s %2u threads: %10.0f events/s, %5.2f returns per event\n",
+           name, nr_threads, c.events / elapsed, (double)c.returns / c.events);
+}
+
+int main(int argc, char const *argv[])
+{
+    nr_fds = argc > 1 ? atoi(argv[1]) : 1000;
+    seconds = argc > 2 ? atof(argv[2]) : 2;
+    unsigned ncpus = std::thread::hardware_concurrency();
+    if (nr_fds == 0) {
+        printf("need at least one descriptor\n");
+        return 1;
+    }
+
+    printf("%u descriptors\n", nr_fds);
+    for (unsigned n = 1; n <= 2 * ncpus; n *= 2) {
+        run("shared", n, false);
+    }
+    for (unsigned n = 1; n <= 2 * ncpus; n *= 2) {
+        run("exclusive", n, true);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures the cost of allocating and releasing file descriptors while many
+// of them are open, as in a server holding a large number of connections.
+// First fills the table with dup()s of one file, then closes a random
+// descriptor and dup()s it back in a loop, in 1, 2, 4, ... threads. Since
+// the lowest free descriptor is handed out, each dup() has to find the
+// single hole just made somewhere in the table.
+//
+// Usage: misc-fd-perf.so [descriptors] [seconds per run]
+
+#include <sys/resource.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static double to_seconds(_clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// Each thread churns over its own part of the descriptors in fds
+static double churn(std::vector<int>& fds, int src, unsigned nr_threads,
+                    double seconds)
+{
+    std::atomic<bool> stop(false);
+    std::atomic<long> total(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    auto share = fds.size() / nr_threads;
+
+    for (unsigned t = 0; t < nr_threads; t++) {
+        threads.emplace_back([&, t] {
+            std::default_random_engine rng(t);
+            std::uniform_int_distribution<size_t> pick(t * share, (t + 1) * share - 1);
+            long iterations = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto& fd = fds[pick(rng)];
+                close(fd);
+                // With several threads, another one may fill our hole first
+                // and leave us the one it just made, so keep whatever we get
+                fd = dup(src);
+                if (fd < 0) {
+                    failed = true;
+                    break;
+                }
+                iterations++;
+            }
+            total.fetch_add(iterations, std::memory_order_relaxed);
+        });
+    }
+
+    auto start = _clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto duration = to_seconds(_clock::now() - start);
+
+    if (failed) {
+        printf("dup() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    return total.load() / duration;
+}
+
+int main(int argc, char const *argv[])
+{
+    unsigned nr_fds = argc > 1 ? atoi(argv[1]) : 100000;
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < nr_fds + 64) {
+        rl.rlim_cur = nr_fds + 64;
+        if (rl.rlim_max < rl.rlim_cur) {
+            rl.rlim_max = rl.rlim_cur;
+        }
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            printf("setrlimit(RLIMIT_NOFILE, %u): %s\n", nr_fds + 64, strerror(errno));
+            return 1;
+        }
+    }
+
+    int src = open("/dev/null", O_RDONLY);
+    if (src < 0) {
+        perror("open");
+        return 1;
+    }
+
+    std::vector<int> fds;
+    fds.reserve(nr_fds);
+    auto start = _clock::now();
+    for (unsigned i = 0; i < nr_fds; i++) {
+        int fd = dup(src);
+        if (fd < 0) {
+            printf("dup() failed after %u descriptors: %s\n", i, strerror(errno));
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+    auto duration = to_seconds(_clock::now() - start);
+    printf("Opened %u descriptors in %.3f s, %.0f dup/s\n", nr_fds, duration,
+           nr_fds / duration);
+
+    unsigned ncpus = std::thread::hardware_concurrency();
+    double single = 0;
+    for (unsigned n = 1; n <= ncpus; n *= 2) {
+        auto rate = churn(fds, src, n, seconds);
+        if (n == 1) {
+            single = rate;
+        }
+        printf("close+dup %3u threads: %12.0f ops/s, %10.0f per thread, scaling %.2f\n",
+               n, rate, rate / n, rate / single);
+    }
+
+    start = _clock::now();
+    for (auto fd : fds) {
+        close(fd);
+    }
+    duration = to_seconds(_clock::now() - start);
+    printf("Closed %u descriptors in %.3f s\n", nr_fds, duration);
+    close(src);
+
+    return 0;
+}
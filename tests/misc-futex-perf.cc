@@ -13,14 +13,17 @@
 #include <chrono>
 #include <iostream>
 #include <vector>
+#include <string>
+#include <climits>
 
 // This test is based on misc-mutex2.cc written by Nadav Har'El. But unlike
 // the other one, it focuses on measuring the performance of the futex()
 // syscall implementation. It does it indirectly by implementing mutex based
 // on futex syscall according to the formula specified in the Ulrich Drepper's
 // paper "Futexes Are Tricky".
-// It takes three parameters: mandatory number of threads (nthreads) and
-// a computation length (worklen) and optional number of mutexes (nmutexes).
+// It takes four parameters: mandatory number of threads (nthreads) and
+// a computation length (worklen), optional number of mutexes (nmutexes) and
+// optional mode ("mutex", the default, or "condvar").
 // The test groups all threads (nthreads * nmutexes) into nmutexes sets
 // where nthreads threads loop trying to take the group mutex (one out of nmutexes)
 // and increment the group counter and then do some short computation of the
@@ -31,6 +34,13 @@
 // beneficial for the OS to run the different threads on different CPUs:
 // Without any computation outside the lock, the best performance will be
 // achieved by running all the threads.
+// With many mutexes, the threads of different groups use unrelated futexes,
+// so the number of increments should scale with the number of vCPUs unless
+// the futex implementation serializes them internally.
+// In the "condvar" mode, the threads of each group additionally meet at a
+// barrier built on a futex-based condition variable: the last thread to
+// arrive broadcasts, and the broadcast uses FUTEX_CMP_REQUEUE to move the
+// waiters onto the mutex instead of waking them all at once.
 
 // Turn off optimization, as otherwise the compiler will optimize
 // out calls to fmutex lock() and unlock() as they seem to do nothing
@@ -83,6 +93,26 @@ public:
         }
     }
 
+    // Used by threads which were requeued onto the mutex futex, so we can
+    // not know there are no other waiters
+    void lock_contended()
+    {
+        while (__atomic_exchange_n(&_state, LOCKED_MAYBE_WAITERS, __ATOMIC_SEQ_CST) != UNLOCKED) {
+            syscall(SYS_futex, &_state, FUTEX_WAIT_PRIVATE, LOCKED_MAYBE_WAITERS, 0, 0, 0);
+        }
+    }
+
+    // Called with the mutex held before waiters get requeued onto it
+    void mark_contended()
+    {
+        _state = LOCKED_MAYBE_WAITERS;
+    }
+
+    uint32_t *futex_word()
+    {
+        return &_state;
+    }
+
     void unlock()
     {
         // Let us wake one waiter only if the state was LOCKED_MAYBE_WAITERS
@@ -96,6 +126,32 @@ private:
     uint32_t _state;
 };
 
+// A condition variable along the lines of the original NPTL one: waiters
+// sleep on a sequence number which the signalers bump.
+class fcondvar {
+public:
+    fcondvar() : _seq(0) {}
+    void wait(fmutex &m)
+    {
+        uint32_t seq = _seq;
+        m.unlock();
+        syscall(SYS_futex, &_seq, FUTEX_WAIT_PRIVATE, seq, 0, 0, 0);
+        m.lock_contended();
+    }
+
+    // Must be called with m held
+    void broadcast(fmutex &m)
+    {
+        uint32_t seq = __atomic_add_fetch(&_seq, 1, __ATOMIC_SEQ_CST);
+        m.mark_contended();
+        // Wake one waiter and requeue all the others onto the mutex, where
+        // they will be woken one at a time as it gets unlocked
+        syscall(SYS_futex, &_seq, FUTEX_CMP_REQUEUE_PRIVATE, 1, INT_MAX, m.futex_word(), seq);
+    }
+private:
+    uint32_t _seq;
+};
+
 void loop(int iterations)
 {
     for (register int i=0; i<iterations; i++) {
@@ -106,12 +162,12 @@ void loop(int iterations)
 
 int main(int argc, char** argv) {
     if (argc <= 2) {
-        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes>\n";
+        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <mutex|condvar>\n";
         return 1;
     }
     int nthreads = atoi(argv[1]);
     if (nthreads <= 0) {
-        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes>\n";
+        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <mutex|condvar>\n";
         return 2;
     }
     // "worklen" is the amount of work to do in each loop iteration, outside
@@ -121,7 +177,7 @@ int main(int argc, char** argv) {
     // parallel.
     int worklen = atoi(argv[2]);
     if (worklen < 0) {
-        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes>\n";
+        std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <mutex|condvar>\n";
         return 3;
     }
 
@@ -135,6 +191,17 @@ int main(int argc, char** argv) {
             nmutexes = 1;
     }
 
+    bool condvar = false;
+    if (argc >= 5) {
+        std::string mode(argv[4]);
+        if (mode == "condvar") {
+            condvar = true;
+        } else if (mode != "mutex") {
+            std::cerr << "Usage: " << argv[0] << " nthreads worklen <nmutexes> <mutex|condvar>\n";
+            return 4;
+        }
+    }
+
     int concurrency = 0;
     cpu_set_t cs;
     sched_getaffinity(0, sizeof(cs), &cs);
@@ -145,8 +212,8 @@ int main(int argc, char** argv) {
     }
     std::cerr << "Running " << (nthreads * nmutexes) << " threads on " <<
             concurrency << " cores with " << nmutexes <<
-            " mutexes. Worklen = " <<
-            worklen << "\n";
+            " mutexes" << (condvar ? " and condvars" : "") <<
+            ". Worklen = " << worklen << "\n";
 
     // Set secs to the desired number of seconds a measurement should
     // take. Note that the whole test will take several times longer than
@@ -160,13 +227,35 @@ int main(int argc, char** argv) {
     bool done = false;
 
     fmutex mut[nmutexes];
+    fcondvar cond[nmutexes];
+    long generations[nmutexes] = {0};
     std::vector<std::thread> threads;
     for (int m = 0; m < nmutexes; m++) {
         for (int i = 0; i < nthreads; i++) {
+            if (!condvar) {
+                threads.push_back(std::thread([&, m]() {
+                    while (!done) {
+                        mut[m].lock();
+                        counters[m]++;
+                        mut[m].unlock();
+                        loop(worklen);
+                    }
+                }));
+                continue;
+            }
             threads.push_back(std::thread([&, m]() {
                 while (!done) {
                     mut[m].lock();
                     counters[m]++;
+                    if (counters[m] % nthreads == 0) {
+                        generations[m]++;
+                        cond[m].broadcast(mut[m]);
+                    } else {
+                        long gen = generations[m];
+                        while (gen == generations[m] && !done) {
+                            cond[m].wait(mut[m]);
+                        }
+                    }
                     mut[m].unlock();
                     loop(worklen);
                 }
@@ -176,6 +265,14 @@ int main(int argc, char** argv) {
     threads.push_back(std::thread([&]() {
         std::this_thread::sleep_for(std::chrono::duration<double>(secs));
         done = true;
+        // Release the threads still waiting at a barrier
+        if (condvar) {
+            for (int m = 0; m < nmutexes; m++) {
+                mut[m].lock();
+                cond[m].broadcast(mut[m]);
+                mut[m].unlock();
+            }
+        }
     }));
     for (auto &t : threads) {
         t.join();
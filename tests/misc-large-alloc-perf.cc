@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures how well allocations served by the page range allocator scale
+// when done concurrently from several CPUs: malloc()/free() of multi-page
+// buffers, and populating and unmapping anonymous mappings backed by huge
+// pages. Each scenario runs with 1, 2, 4, ... up to one thread per CPU, so
+// contention on the allocator shows up as a drop in per-thread throughput.
+//
+// Usage: misc-large-alloc-perf.so [seconds per run]
+
+#include <osv/sched.hh>
+#include <osv/latch.hh>
+#include <sys/mman.h>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include "stat.hh"
+
+using _clock = std::chrono::high_resolution_clock;
+
+// Runs func in a loop in nr_threads threads, each pinned to a different CPU,
+// and returns the number of iterations per second across all of them.
+static double run(unsigned nr_threads, float seconds, std::function<void ()> func)
+{
+    std::atomic<bool> stop(false);
+    std::atomic<long> total(0);
+    thread_barrier starting_line(nr_threads + 1);
+    std::vector<sched::thread*> threads;
+
+    for (unsigned i = 0; i < nr_threads; i++) {
+        threads.push_back(sched::thread::make([&] {
+            long iterations = 0;
+            starting_line.arrive();
+            while (!stop.load(std::memory_order_relaxed)) {
+                func();
+                iterations++;
+            }
+            total.fetch_add(iterations, std::memory_order_relaxed);
+        }, sched::thread::attr().pin(sched::cpus[i])));
+    }
+    for (auto t : threads) {
+        t->start();
+    }
+
+    starting_line.arrive();
+    auto start = _clock::now();
+    sched::thread::sleep(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::duration<float>(seconds)));
+    stop.store(true);
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+    auto duration = to_seconds(_clock::now() - start);
+
+    return total.load() / duration;
+}
+
+static void test(const char* name, float seconds, std::function<void ()> func)
+{
+    printf("%s:\n", name);
+    double single = 0;
+    for (unsigned n = 1; n <= sched::cpus.size(); n *= 2) {
+        auto rate = run(n, seconds, func);
+        if (n == 1) {
+            single = rate;
+        }
+        printf("  %3u threads: %12.0f ops/s, %10.0f per thread, scaling %.2f\n",
+               n, rate, rate / n, rate / single);
+        if (n < sched::cpus.size() && n * 2 > sched::cpus.size()) {
+            n = sched::cpus.size() / 2;
+        }
+    }
+}
+
+// Keeps a few buffers alive per thread so that allocations and frees of
+// different sizes interleave, like they would in a real application.
+static void malloc_free(size_t size)
+{
+    constexpr unsigned nr = 4;
+    void* bufs[nr];
+    for (unsigned i = 0; i < nr; i++) {
+        bufs[i] = malloc(size);
+        assert(bufs[i]);
+        *static_cast<char*>(bufs[i]) = 0;
+    }
+    for (unsigned i = 0; i < nr; i++) {
+        free(bufs[i]);
+    }
+}
+
+static void mmap_populate(size_t size)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    assert(p != MAP_FAILED);
+    munmap(p, size);
+}
+
+int main(int argc, char const *argv[])
+{
+    float seconds = argc > 1 ? atof(argv[1]) : 2;
+
+    printf("Running on %d CPUs, %.1f s per run\n", sched::cpus.size(), seconds);
+
+    test("malloc/free 16K", seconds, [] { malloc_free(16 << 10); });
+    test("malloc/free 64K", seconds, [] { malloc_free(64 << 10); });
+    test("malloc/free 256K", seconds, [] { malloc_free(256 << 10); });
+    test("malloc/free 1M", seconds, [] { malloc_free(1 << 20); });
+    test("mmap(MAP_POPULATE)/munmap 8M", seconds, [] { mmap_populate(8 << 20); });
+
+    return 0;
+}
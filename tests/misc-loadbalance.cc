@@ -43,6 +43,12 @@
 //    intermittent thread should take 1/11th of one CPU, and the expected
 //    measurement is x2.1.
 //
+// 7. Bursts of short requests, as in a server with a thread per request:
+//    8 threads sleep until a burst starts, then each busy-loops for 2ms.
+//    Waiting for the periodic load balancer would leave one CPU idle for
+//    much of each burst, so this measures idle-time stealing and wakeup
+//    placement. With the 2 CPUs kept busy, a burst takes 8ms ("x1").
+//
 // Unexpected results in any of these tests should be debugged as follows:
 //
 // 1. Running "top" on the host during all these tests should show 200% CPU
@@ -66,6 +72,8 @@
 #include <chrono>
 #include <iostream>
 #include <vector>
+#include <mutex>
+#include <condition_variable>
 
 void _loop(int iterations)
 {
@@ -161,6 +169,49 @@ private:
     bool _stop = false;
 };
 
+void bursts(int looplen_1ms, int nthreads, int nbursts)
+{
+    std::cout << "\nRunning " << nbursts << " bursts of " << nthreads <<
+            " 2ms requests. Expecting x1.\n";
+    std::mutex mtx;
+    std::condition_variable cv;
+    int burst = 0, done = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.push_back(std::thread([&]() {
+            for (int b = 1; b <= nbursts; b++) {
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv.wait(lock, [&] { return burst >= b; });
+                }
+                _loop(2 * looplen_1ms);
+                std::lock_guard<std::mutex> lock(mtx);
+                if (++done == nthreads) {
+                    cv.notify_all();
+                }
+            }
+        }));
+    }
+    double total = 0;
+    for (int b = 1; b <= nbursts; b++) {
+        auto start = std::chrono::system_clock::now();
+        std::unique_lock<std::mutex> lock(mtx);
+        done = 0;
+        burst = b;
+        cv.notify_all();
+        cv.wait(lock, [&] { return done == nthreads; });
+        std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
+        total += sec.count();
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    // Each CPU has half of the threads to run
+    double ideal = 0.002 * nthreads / 2;
+    double avg = total / nbursts;
+    std::cout << "average burst " << avg * 1000 << "ms [x" << (avg / ideal) << "]\n";
+}
+
 int main()
 {
     // For expected values below, we assume running on 2 cpus.
@@ -225,5 +276,7 @@ int main()
     concurrent_loops(looplen, 4, secs, 2.0*2/(2-1.0/11));
     bi.stop();
 
+    bursts(looplen_1ms, 8, 500);
+
     return 0;
 }
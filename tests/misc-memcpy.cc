@@ -12,12 +12,15 @@
 #include <math.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
 
 
 #define MIN_SIZE 4
 #define MAX_SIZE (32 << 10)
 #define LOOPS 1000000
 #define RUNS 30
+// Fewer loops for the bigger sizes, moving at most this many bytes per run
+#define MAX_BYTES_PER_RUN (256 << 20)
 
 static float vector[RUNS];
 
@@ -59,98 +62,116 @@ void statistics(const char *name, int size)
 
 }
 
-void test_memcpy(size_t size)
+static int loops(size_t size)
 {
-    void *src = malloc(size);
-    void *dest= malloc(size);
-    int r, i;
-
-    memset(src, 'c', size);
-
-    for (r = 0; r < RUNS; ++r) {
-        unsigned long t1 = gtime();
-        for (i= 0; i < LOOPS; ++i) {
-            memcpy(dest, src, size);
-        }
-        unsigned long t2 = gtime();
-
-        vector[r] = (float)(t2-t1) / LOOPS;
-    }
+    size_t n = MAX_BYTES_PER_RUN / (size + 1);
+    return n < 10 ? 10 : n > LOOPS ? LOOPS : n;
+}
 
-    statistics("memcpy", size);
+// Keeps the compiler from dropping calls whose results are unused
+static volatile unsigned long sink;
 
-    free(src);
-    free(dest);
-}
+enum op { op_memcpy, op_memmove, op_memset, op_memcmp, op_memchr, op_strlen };
 
-void test_unaligned_memcpy(size_t size)
+// Times the operation on buffers at the given offsets from 64-byte
+// alignment. memcmp compares equal buffers and memchr and strlen find
+// their byte at the end, so all of them go through the whole size.
+void test(const char *name, enum op op, size_t size, int src_off, int dest_off)
 {
-    void *_src = malloc(size+3);
-    void *_dest= malloc(size+6);
-    void *src = _src + 3;
-    void *dest = _dest + 6;
-    int r, i;
+    char *_src = (char *)malloc(size + 128);
+    char *_dest = (char *)malloc(size + 128);
+    char *src = (char *)(((uintptr_t)_src + 63) & ~63ul) + src_off;
+    char *dest = (char *)(((uintptr_t)_dest + 63) & ~63ul) + dest_off;
+    int r, i, n = loops(size);
 
     memset(src, 'c', size);
+    if (size) {
+        src[size - 1] = 0;
+    }
+    memcpy(dest, src, size);
 
     for (r = 0; r < RUNS; ++r) {
         unsigned long t1 = gtime();
-        for (i= 0; i < LOOPS; ++i) {
-            memcpy(dest, src, size);
+        for (i = 0; i < n; ++i) {
+            switch (op) {
+            case op_memcpy:
+                memcpy(dest, src, size);
+                break;
+            case op_memmove:
+                // Overlapping, copying forwards
+                memmove(src, src + 1, size ? size - 1 : 0);
+                break;
+            case op_memset:
+                memset(dest, 'c', size);
+                break;
+            case op_memcmp:
+                sink += memcmp(dest, src, size);
+                break;
+            case op_memchr:
+                sink += (unsigned long)memchr(src, 0, size);
+                break;
+            case op_strlen:
+                sink += size ? strlen(src) : 0;
+                break;
+            }
         }
         unsigned long t2 = gtime();
 
-        vector[r] = (float)(t2-t1) / LOOPS;
+        vector[r] = (float)(t2-t1) / n;
     }
 
-    statistics("unaligned_memcpy", size);
+    statistics(name, size);
 
     free(_src);
     free(_dest);
 }
 
-
-void test_memset(size_t size)
-{
-    void *buf= malloc(size);
-    int r, i;
-
-
-    for (r = 0; r < RUNS; ++r) {
-        unsigned long t1 = gtime();
-        for (i= 0; i < LOOPS; ++i) {
-            memset(buf, 'c', size);
-        }
-        unsigned long t2 = gtime();
-
-        vector[r] = (float)(t2-t1) / LOOPS;
-    }
-
-    statistics("memset", size);
-
-    free(buf);
-}
-
-int main()
+int main(int argc, char *argv[])
 {
     size_t i;
     size_t sizes[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 15, 16, 17,
-            31, 32, 33, 64, 128, 255, 256, 257, 512, 1024, 2048,
-            4096, 4097, 5000, 8192, 16386, 32768
+            31, 32, 33, 63, 64, 65, 128, 255, 256, 257, 512, 1024, 2048,
+            4095, 4096, 4097, 5000, 8192, 16386, 32768, 65536, 262144,
+            1 << 20, 4 << 20, 16 << 20
     };
     size_t nsizes = sizeof(sizes) / sizeof(*sizes);
-    for (i = 0; i < nsizes; ++i) {
-        test_memcpy(sizes[i]);
-    }
-
-    for (i = 0; i < nsizes; ++i) {
-        test_unaligned_memcpy(sizes[i]);
-    }
-
-    for (i = 0; i < nsizes; ++i) {
-        test_memset(sizes[i]);
+    struct {
+        const char *name;
+        enum op op;
+        int src_off, dest_off;
+    } tests[] = {
+        { "memcpy", op_memcpy, 0, 0 },
+        { "unaligned_memcpy", op_memcpy, 3, 6 },
+        { "src_unaligned_memcpy", op_memcpy, 1, 0 },
+        { "dest_unaligned_memcpy", op_memcpy, 0, 1 },
+        { "memmove", op_memmove, 0, 0 },
+        { "memset", op_memset, 0, 0 },
+        { "unaligned_memset", op_memset, 0, 5 },
+        { "memcmp", op_memcmp, 0, 0 },
+        { "unaligned_memcmp", op_memcmp, 3, 6 },
+        { "memchr", op_memchr, 0, 0 },
+        { "unaligned_memchr", op_memchr, 7, 0 },
+        { "strlen", op_strlen, 0, 0 },
+        { "unaligned_strlen", op_strlen, 7, 0 },
+    };
+    size_t ntests = sizeof(tests) / sizeof(*tests);
+    size_t t;
+
+    // Only run the tests whose name is given, if any
+    for (t = 0; t < ntests; ++t) {
+        int run = argc < 2;
+        int a;
+        for (a = 1; a < argc; ++a) {
+            run |= !strcmp(argv[a], tests[t].name);
+        }
+        if (!run) {
+            continue;
+        }
+        for (i = 0; i < nsizes; ++i) {
+            test(tests[t].name, tests[t].op, sizes[i],
+                 tests[t].src_off, tests[t].dest_off);
+        }
     }
 
-
     return 0;
 }
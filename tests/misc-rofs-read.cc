@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Compares plain and compressed ROFS images. Build the same image once as
+// is and once with rofs_compression=lz4 (see scripts/build) and run this
+// test first thing after boot in both:
+//
+//   ./scripts/build fs=rofs image=tests [rofs_compression=lz4]
+//   ./scripts/run.py -e '/tests/misc-rofs-read.so /usr/lib'
+//
+// It prints how long the kernel took to boot up to main(), how big the
+// file system is on disk and the throughput of reading all files under
+// the given directory twice: the first time from disk (cold cache) and
+// the second time from the cache.
+//
+// Usage: misc-rofs-read.so [directory] [buffer size]
+
+#include <osv/clock.hh>
+#include <sys/statfs.h>
+#include <sys/stat.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static std::vector<char> buf;
+static long files, bytes;
+static bool failed;
+
+static int read_file(const char *path, const struct stat *st, int type, struct FTW *)
+{
+    if (type != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        failed = true;
+        return 0;
+    }
+    ssize_t n;
+    while ((n = read(fd, buf.data(), buf.size())) > 0) {
+        bytes += n;
+    }
+    if (n < 0) {
+        perror(path);
+        failed = true;
+    }
+    close(fd);
+    files++;
+    return 0;
+}
+
+static void read_all(const char *name, const char *dir)
+{
+    files = bytes = 0;
+    auto start = _clock::now();
+    nftw(dir, read_file, 16, FTW_PHYS);
+    auto seconds = std::chrono::duration<double>(_clock::now() - start).count();
+    printf("%s: read %ld files, %.1f MB in %.3f s, %.1f MB/s\n", name, files,
+           bytes / 1e6, seconds, bytes / 1e6 / seconds);
+}
+
+int main(int argc, char const *argv[])
+{
+    auto boot = std::chrono::duration<double, std::milli>(
+        osv::clock::uptime::now().time_since_epoch()).count();
+    const char *dir = argc > 1 ? argv[1] : "/usr/lib";
+    buf.resize(argc > 2 ? atoi(argv[2]) : 64 * 1024);
+
+    printf("Time from boot to main(): %.1f ms\n", boot);
+
+    struct statfs st;
+    if (statfs(dir, &st) == 0) {
+        printf("File system size on disk: %.1f MB\n", st.f_blocks * st.f_bsize / 1e6);
+    }
+
+    read_all("Cold", dir);
+    read_all("Warm", dir);
+
+    return failed ? 1 : 0;
+}
@@ -42,6 +42,23 @@ void call_gettid_syscall()
     assert(tid >= 0);
 }
 
+#ifdef __x86_64__
+// The "mov $number, %eax; syscall" sequence that OSv's ELF loader turns
+// into a direct call of the system call's function when booted with
+// --patch-syscalls. The one above loads the number from memory, so it is
+// never patched and always goes through the syscall instruction.
+void call_gettid_syscall_imm()
+{
+    long tid;
+    asm volatile ("movl %[syscall_no], %%eax\n"
+                  "syscall\n"
+                  : "=a" (tid)
+                  : [syscall_no]"i" (__NR_gettid)
+                  : "rcx", "r11", "memory");
+    assert(tid >= 0);
+}
+#endif
+
 uint64_t nstime()
 {
     struct timeval tv;
@@ -65,6 +82,20 @@ int main(int argc, char **argv)
     long average_syscall_duration = (end - start) / count;
     printf("%lu ns (elapsed %.2f sec) %s\n", average_syscall_duration, (end - start) / 1000000000.0, ": average gettid syscall duration");
 
+#ifdef __x86_64__
+    loop = count;
+    start = nstime();
+
+    while (loop--) {
+        call_gettid_syscall_imm();
+    }
+
+    end = nstime();
+
+    long average_imm_syscall_duration = (end - start) / count;
+    printf("%lu ns (elapsed %.2f sec) %s\n", average_imm_syscall_duration, (end - start) / 1000000000.0, ": average gettid syscall duration, immediate number (patchable)");
+#endif
+
 #ifdef __OSV__
     loop = count;
     start = nstime();
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures the datagram rate over loopback UDP with the different ways of
+// batching datagram I/O: one sendto()/recvfrom() per datagram, vectors of
+// datagrams with sendmmsg()/recvmmsg(), and large sends split by the stack
+// (UDP_SEGMENT) received as runs of datagrams coalesced again (UDP_GRO).
+// Every datagram carries a sequence number; datagrams may be dropped when
+// the receiver falls behind, but must never arrive out of order or
+// corrupted, else the test fails.
+//
+// Usage: misc-udp-perf.so [datagrams per run] [datagram size]
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+using _clock = std::chrono::high_resolution_clock;
+
+enum class mode { single, mmsg, gso };
+
+static constexpr unsigned batch = 64;
+static unsigned count, size;
+static bool failed;
+
+static void fail(const char *what)
+{
+    printf("%s: %s\n", what, strerror(errno));
+    failed = true;
+}
+
+static void fill(char *buf, unsigned seq)
+{
+    memset(buf, seq & 0xff, size);
+    memcpy(buf, &seq, sizeof(seq));
+}
+
+static void sender(int s, mode m)
+{
+    std::vector<char> buf(batch * size);
+    std::vector<struct iovec> iov(batch);
+    std::vector<struct mmsghdr> msgs(batch);
+    unsigned seq = 0;
+
+    // Sends of more than 64K are impossible, so limit the segments per send
+    unsigned per_send = m == mode::single ? 1 :
+        m == mode::mmsg ? batch : std::min(batch, 65000 / size);
+    while (seq < count) {
+        unsigned n = std::min(per_send, count - seq);
+        for (unsigned i = 0; i < n; i++) {
+            fill(&buf[i * size], seq + i);
+        }
+        int ret;
+        switch (m) {
+        case mode::single:
+            ret = send(s, buf.data(), size, 0) == (ssize_t)size ? 1 : -1;
+            break;
+        case mode::mmsg:
+            for (unsigned i = 0; i < n; i++) {
+                iov[i] = { &buf[i * size], size };
+                memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            ret = sendmmsg(s, msgs.data(), n, 0);
+            break;
+        case mode::gso:
+            ret = send(s, buf.data(), n * size, 0) == (ssize_t)(n * size) ? n : -1;
+            break;
+        }
+        if (ret < 0) {
+            if (errno == ENOBUFS) {
+                continue;
+            }
+            fail("send");
+            return;
+        }
+        seq += ret;
+    }
+}
+
+struct receiver {
+    unsigned received = 0;
+    unsigned next = 0;
+
+    // Returns false once the last datagram was seen
+    bool check(const char *data, unsigned len)
+    {
+        unsigned seq;
+        memcpy(&seq, data, sizeof(seq));
+        if (len != size || seq < next || seq >= count ||
+            data[size - 1] != (char)(seq & 0xff)) {
+            printf("bad datagram: seq %u, expected at least %u, length %u\n",
+                   seq, next, len);
+            failed = true;
+            return false;
+        }
+        received++;
+        next = seq + 1;
+        return next < count;
+    }
+
+    void run(int s, mode m)
+    {
+        std::vector<char> buf(m == mode::gso ? 65536 : batch * size);
+        std::vector<struct iovec> iov(batch);
+        std::vector<struct mmsghdr> msgs(batch);
+        char control[CMSG_SPACE(sizeof(int))];
+
+        for (;;) {
+            if (m == mode::single) {
+                auto n = recv(s, buf.data(), size, 0);
+                if (n < 0 || !check(buf.data(), n)) {
+                    break;
+                }
+            } else if (m == mode::mmsg) {
+                for (unsigned i = 0; i < batch; i++) {
+                    iov[i] = { &buf[i * size], size };
+                    memset(&msgs[i], 0, sizeof(msgs[i]));
+                    msgs[i].msg_hdr.msg_iov = &iov[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+                int n = recvmmsg(s, msgs.data(), batch, MSG_WAITFORONE, nullptr);
+                if (n < 0) {
+                    break;
+                }
+                bool more = true;
+                for (int i = 0; i < n && more; i++) {
+                    more = check(&buf[i * size], msgs[i].msg_len);
+                }
+                if (!more) {
+                    break;
+                }
+            } else {
+                struct iovec v = { buf.data(), buf.size() };
+                struct msghdr msg = {};
+                msg.msg_iov = &v;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                auto n = recvmsg(s, &msg, 0);
+                if (n < 0) {
+                    break;
+                }
+                int seg = n;
+                for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                    if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                        memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+                    }
+                }
+                bool more = true;
+                for (int off = 0; off < n && more; off += seg) {
+                    more = check(&buf[off], std::min(seg, (int)n - off));
+                }
+                if (!more) {
+                    break;
+                }
+            }
+        }
+    }
+};
+
+static void run(const char *name, mode m)
+{
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    int bufsize = 4 << 20, one = 1;
+    if (bind(rx, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(rx, (struct sockaddr *)&addr, &addrlen) < 0 ||
+        connect(tx, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fail("socket setup");
+        return;
+    }
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    // Stop waiting if the last datagrams were dropped
+    struct timeval tv = { 1, 0 };
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (m == mode::gso) {
+        int seg = size;
+        if (setsockopt(tx, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg)) < 0 ||
+            setsockopt(rx, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+            fail("setsockopt(UDP_SEGMENT/UDP_GRO)");
+            return;
+        }
+    }
+
+    receiver r;
+    auto start = _clock::now();
+    std::thread t([=] { sender(tx, m); });
+    r.run(rx, m);
+    auto seconds = std::chrono::duration<double>(_clock::now() - start).count();
+    t.join();
+    close(tx);
+    close(rx);
+
+    if (r.received == 0) {
+        printf("%s: nothing received\n", name);
+        failed = true;
+        return;
+    }
+    printf("%-16s %10.0f datagrams/s, %8.1f MB/s, %u of %u lost\n", name,
+           r.received / seconds, (double)r.received * size / seconds / 1e6,
+           count - r.received, count);
+}
+
+int main(int argc, char const *argv[])
+{
+    count = argc > 1 ? atoi(argv[1]) : 1000000;
+    size = argc > 2 ? atoi(argv[2]) : 1024;
+    if (size < sizeof(unsigned) || size > 65000) {
+        printf("datagram size must be between %zu and 65000\n", sizeof(unsigned));
+        return 1;
+    }
+
+    run("send/recv", mode::single);
+    run("sendmmsg/recvmmsg", mode::mmsg);
+    run("UDP_SEGMENT/GRO", mode::gso);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for the Linux-specific libaio API (io_setup(), io_submit(), ...)
+//
+// Requests against a regular file are executed synchronously, requests
+// against a block device go to the driver as bios. The block device part
+// only reads from the boot disk. Writes are only tested on a scratch disk
+// whose contents may be lost, given as the argument:
+//
+//   tst-aio.so [<scratch block device>]
+
+#include <api/libaio.h>
+
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <iostream>
+
+#define TMP_FILE "/tmp/tst-aio"
+#ifdef __OSV__
+#define BLK_DEV "/dev/vblk0"
+#else
+#define BLK_DEV "/dev/nvme0n1"
+#endif
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static void prep(struct iocb* cb, short op, int fd, void* buf,
+                 unsigned long nbytes, long long offset)
+{
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_lio_opcode = op;
+    cb->aio_fildes = fd;
+    cb->u.c.buf = buf;
+    cb->u.c.nbytes = nbytes;
+    cb->u.c.offset = offset;
+}
+
+static void test_bdev(io_context_t ctx)
+{
+    int fd = open(BLK_DEV, O_RDONLY);
+    if (fd < 0) {
+        std::cout << "skipping block device tests, no " BLK_DEV "\n";
+        return;
+    }
+
+    // What the synchronous read path sees
+    static char want[4 * 512] __attribute__((aligned(4096)));
+    report(pread(fd, want, sizeof(want), 0) == sizeof(want), "pread " BLK_DEV);
+
+    // One plain read and one split over two bios, both signalling an eventfd
+    static char buf1[512] __attribute__((aligned(4096)));
+    static char buf2[3 * 512] __attribute__((aligned(4096)));
+    memset(buf1, 0xee, sizeof(buf1));
+    memset(buf2, 0xee, sizeof(buf2));
+    struct iovec riov[] = { { buf2, 512 }, { buf2 + 512, 1024 } };
+    int efd = eventfd(0, 0);
+    struct iocb r1, r2;
+    prep(&r1, IO_CMD_PREAD, fd, buf1, sizeof(buf1), 0);
+    prep(&r2, IO_CMD_PREADV, fd, riov, 2, 512);
+    for (auto cb : { &r1, &r2 }) {
+        cb->u.c.flags = IOCB_FLAG_RESFD;
+        cb->u.c.resfd = efd;
+    }
+    struct iocb* rios[] = { &r1, &r2 };
+    report(io_submit(ctx, 2, rios) == 2, "io_submit block device reads");
+    uint64_t count = 0, total = 0;
+    while (total < 2 && read(efd, &count, sizeof(count)) == sizeof(count)) {
+        total += count;
+    }
+    report(total == 2, "eventfd signalled once per block device read");
+    struct io_event events[4];
+    int n = io_getevents(ctx, 2, 4, events, nullptr);
+    bool ok = n == 2;
+    for (int i = 0; i < n; i++) {
+        ok &= events[i].obj == &r1 ? events[i].res == sizeof(buf1) :
+                                     events[i].res == sizeof(buf2);
+    }
+    report(ok, "block device read completions");
+    report(!memcmp(buf1, want, 512) && !memcmp(buf2, want + 512, sizeof(buf2)),
+           "block device reads match pread");
+
+    // A flush goes to the device even without writes
+    struct iocb f;
+    prep(&f, IO_CMD_FDSYNC, fd, nullptr, 0, 0);
+    struct iocb* fios[] = { &f };
+    report(io_submit(ctx, 1, fios) == 1, "io_submit block device fdsync");
+    n = io_getevents(ctx, 1, 1, events, nullptr);
+    report(n == 1 && events[0].res == 0, "block device fdsync completion");
+
+    // The bio path needs whole sectors
+    struct iocb bad;
+    prep(&bad, IO_CMD_PREAD, fd, buf1, 100, 0);
+    struct iocb* bios[] = { &bad };
+    report(io_submit(ctx, 1, bios) == -EINVAL, "io_submit partial sector");
+    prep(&bad, IO_CMD_PREAD, fd, buf1, 512, 100);
+    report(io_submit(ctx, 1, bios) == -EINVAL, "io_submit unaligned offset");
+
+    close(efd);
+    close(fd);
+}
+
+// Overwrites the start of the given scratch disk
+static void test_bdev_write(const char* dev)
+{
+    int fd = open(dev, O_RDWR);
+    report(fd >= 0, "open scratch block device");
+    if (fd < 0) {
+        return;
+    }
+    io_context_t ctx;
+    bool ok = io_setup(4, &ctx) == 0;
+    report(ok, "io_setup for the scratch block device");
+    if (!ok) {
+        close(fd);
+        return;
+    }
+
+    static char wbuf[8 * 512] __attribute__((aligned(4096)));
+    for (size_t i = 0; i < sizeof(wbuf); i++) {
+        wbuf[i] = i * 7 + 1;
+    }
+    struct iovec wiov[] = { { wbuf, 1024 }, { wbuf + 1024, sizeof(wbuf) - 1024 } };
+    int efd = eventfd(0, 0);
+    struct iocb w1, w2;
+    prep(&w1, IO_CMD_PWRITE, fd, wbuf, 512, 0);
+    prep(&w2, IO_CMD_PWRITEV, fd, wiov, 2, 512);
+    for (auto cb : { &w1, &w2 }) {
+        cb->u.c.flags = IOCB_FLAG_RESFD;
+        cb->u.c.resfd = efd;
+    }
+    struct iocb* wios[] = { &w1, &w2 };
+    report(io_submit(ctx, 2, wios) == 2, "io_submit block device writes");
+    uint64_t count = 0, total = 0;
+    while (total < 2 && read(efd, &count, sizeof(count)) == sizeof(count)) {
+        total += count;
+    }
+    report(total == 2, "eventfd signalled once per block device write");
+    struct io_event events[4];
+    int n = io_getevents(ctx, 2, 4, events, nullptr);
+    ok = n == 2;
+    for (int i = 0; i < n; i++) {
+        ok &= events[i].obj == &w1 ? events[i].res == 512 :
+                                     events[i].res == sizeof(wbuf);
+    }
+    report(ok, "block device write completions");
+
+    struct iocb f;
+    prep(&f, IO_CMD_FDSYNC, fd, nullptr, 0, 0);
+    struct iocb* fios[] = { &f };
+    report(io_submit(ctx, 1, fios) == 1, "io_submit block device fdsync after writes");
+    n = io_getevents(ctx, 1, 1, events, nullptr);
+    report(n == 1 && events[0].res == 0, "block device fdsync after writes completion");
+
+    static char rbuf[9 * 512] __attribute__((aligned(4096)));
+    report(pread(fd, rbuf, sizeof(rbuf), 0) == sizeof(rbuf) &&
+           !memcmp(rbuf, wbuf, 512) && !memcmp(rbuf + 512, wbuf, sizeof(wbuf)),
+           "block device writes read back");
+
+    io_destroy(ctx);
+    close(efd);
+    close(fd);
+}
+
+int main(int argc, char** argv)
+{
+    io_context_t ctx;
+    report(io_setup(0, &ctx) == -EINVAL, "io_setup rejects nr_events == 0");
+    report(io_setup(4, &ctx) == 0, "io_setup");
+
+    int fd = open(TMP_FILE, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    report(fd >= 0, "open");
+
+    // Write two blocks, one of them through the vectored interface
+    char wbuf1[512], wbuf2[512];
+    memset(wbuf1, 'a', sizeof(wbuf1));
+    memset(wbuf2, 'b', sizeof(wbuf2));
+    struct iovec wiov = { wbuf2, sizeof(wbuf2) };
+    struct iocb w1, w2;
+    prep(&w1, IO_CMD_PWRITE, fd, wbuf1, sizeof(wbuf1), 0);
+    prep(&w2, IO_CMD_PWRITEV, fd, &wiov, 1, sizeof(wbuf1));
+    w1.data = &w1;
+    struct iocb* wios[] = { &w1, &w2 };
+    report(io_submit(ctx, 2, wios) == 2, "io_submit two writes");
+
+    struct io_event events[4];
+    int n = io_getevents(ctx, 2, 4, events, nullptr);
+    report(n == 2, "io_getevents returns both writes");
+    bool ok = true;
+    for (int i = 0; i < n; i++) {
+        ok &= events[i].res == 512;
+        ok &= events[i].obj == &w1 || events[i].obj == &w2;
+        ok &= events[i].obj != &w1 || events[i].data == &w1;
+    }
+    report(ok, "write completions");
+
+    // Read back with completion notification through an eventfd
+    int efd = eventfd(0, 0);
+    char rbuf[1024];
+    struct iocb r;
+    prep(&r, IO_CMD_PREAD, fd, rbuf, sizeof(rbuf), 0);
+    r.u.c.flags = IOCB_FLAG_RESFD;
+    r.u.c.resfd = efd;
+    struct iocb* rios[] = { &r };
+    report(io_submit(ctx, 1, rios) == 1, "io_submit read");
+    uint64_t count = 0;
+    report(read(efd, &count, sizeof(count)) == sizeof(count) && count == 1,
+           "eventfd signalled on completion");
+    n = io_getevents(ctx, 1, 1, events, nullptr);
+    report(n == 1 && events[0].res == sizeof(rbuf), "read completion");
+    report(!memcmp(rbuf, wbuf1, 512) && !memcmp(rbuf + 512, wbuf2, 512),
+           "read back written data");
+
+    // Nothing left, a zero timeout must not block
+    struct timespec ts = { 0, 0 };
+    report(io_getevents(ctx, 1, 1, events, &ts) == 0, "io_getevents timeout");
+
+    // Errors are reported in the event, not by io_submit
+    struct iocb bad;
+    prep(&bad, IO_CMD_PREAD, efd, rbuf, 1, 0);
+    struct iocb* bios[] = { &bad };
+    report(io_submit(ctx, 1, bios) == 1, "io_submit short eventfd read");
+    n = io_getevents(ctx, 1, 1, events, nullptr);
+    report(n == 1 && (long)events[0].res < 0, "error reported in event");
+
+    prep(&bad, IO_CMD_PREAD, -1, rbuf, 1, 0);
+    report(io_submit(ctx, 1, bios) == -EBADF, "io_submit bad fd");
+
+    // The context must not accept more requests than it can report
+    struct iocb f[5];
+    struct iocb* fios[5];
+    for (int i = 0; i < 5; i++) {
+        prep(&f[i], IO_CMD_FDSYNC, fd, nullptr, 0, 0);
+        fios[i] = &f[i];
+    }
+    report(io_submit(ctx, 5, fios) == 4, "io_submit limited by nr_events");
+    report(io_submit(ctx, 1, fios) == -EAGAIN, "io_submit on full context");
+    report(io_getevents(ctx, 4, 4, events, nullptr) == 4, "reap fdsyncs");
+
+    test_bdev(ctx);
+
+    report(io_destroy(ctx) == 0, "io_destroy");
+    close(efd);
+    close(fd);
+    unlink(TMP_FILE);
+
+    if (argc > 1) {
+        test_bdev_write(argv[1]);
+    }
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
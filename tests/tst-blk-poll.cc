@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests the completion polling budget of block devices (BLKPOLLSET). The
+// budget is one of the disk, so it must reach the partition the root file
+// system is on whether it is set on the disk or on the partition. On
+// virtio-blk, reads from the partition must then be completed by polling,
+// as counted in /sys/osv/virtio-blk/queues. Nothing is written.
+
+#include <osv/device.h>
+#include <osv/bio.h>
+#include <osv/prex.h>
+#include <osv/ioctl.h>
+#include <osv/mempool.hh>
+
+#include <errno.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static unsigned get_poll(struct device* dev)
+{
+    unsigned poll_us = -1;
+    device_ioctl(dev, BLKPOLLGET, &poll_us);
+    return poll_us;
+}
+
+static bool set_poll(struct device* dev, unsigned poll_us)
+{
+    return device_ioctl(dev, BLKPOLLSET, &poll_us) == 0;
+}
+
+// Requests of the given virtio-blk disk completed by polling so far, or -1
+// if it is not one
+static long polled(const char* disk)
+{
+    std::ifstream f("/sys/osv/virtio-blk/queues");
+    std::string prefix = std::string(disk) + "/";
+    long total = -1;
+    std::string line;
+    while (std::getline(f, line)) {
+        auto pos = line.find(" polled ");
+        if (line.compare(0, prefix.size(), prefix) || pos == std::string::npos) {
+            continue;
+        }
+        total = std::max(total, 0L) + std::stol(line.substr(pos + 8));
+    }
+    return total;
+}
+
+static bool read_sectors(struct device* dev, void* buf, unsigned count)
+{
+    bool ok = true;
+    for (unsigned i = 0; i < count && ok; i++) {
+        auto bio = alloc_bio();
+        bio->bio_cmd = BIO_READ;
+        bio->bio_dev = dev;
+        bio->bio_data = buf;
+        bio->bio_offset = (i % 64) * 4096;
+        bio->bio_bcount = 4096;
+        dev->driver->devops->strategy(bio);
+        ok = bio_wait(bio) == 0;
+        destroy_bio(bio);
+    }
+    return ok;
+}
+
+static void test_poll(struct device* disk, struct device* part)
+{
+    report(set_poll(disk, 5000) && get_poll(part) == 5000,
+           "budget set on the disk reaches the partition");
+    report(set_poll(part, 2000) && get_poll(disk) == 2000,
+           "budget set on the partition reaches the disk");
+    unsigned too_much = BLKPOLL_MAX_US + 1;
+    report(device_ioctl(part, BLKPOLLSET, &too_much) == EINVAL && get_poll(part) == 2000,
+           "budget over the limit rejected");
+
+    auto before = polled(disk->name);
+    if (before < 0) {
+        std::cout << disk->name << " is not a virtio-blk disk, not checking for polled requests\n";
+        return;
+    }
+    auto buf = memory::alloc_page();
+    // Polling only gives up after the budget, 10ms is plenty for reads
+    set_poll(disk, BLKPOLL_MAX_US);
+    report(read_sectors(part, buf, 100), "partition read with polling");
+    report(polled(disk->name) > before, "partition requests completed by polling");
+
+    set_poll(disk, 0);
+    before = polled(disk->name);
+    report(read_sectors(part, buf, 100), "partition read without polling");
+    report(polled(disk->name) == before, "no partition requests polled without a budget");
+    memory::free_page(buf);
+}
+
+int main(int argc, char** argv)
+{
+    struct device *disk, *part;
+    if (device_open("vblk0", DO_RDONLY, &disk)) {
+        std::cout << "no vblk0, skipping\n";
+    } else if (device_open("vblk0.1", DO_RDONLY, &part)) {
+        std::cout << "vblk0 has no partition 1, skipping\n";
+        device_close(disk);
+    } else {
+        auto old_poll_us = get_poll(disk);
+        test_poll(disk, part);
+        set_poll(disk, old_poll_us);
+        device_close(part);
+        device_close(disk);
+    }
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
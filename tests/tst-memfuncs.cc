@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Checks memcpy(), memmove(), memset(), memcmp(), memchr() and strlen()
+// against simple byte by byte versions, for all sizes up to past where the
+// implementations switch strategy and all alignments of their arguments,
+// including strings ending right before an unmapped page. Whichever
+// versions the cpu got (see arch/x64/string.cc) must agree with them and
+// must not touch a byte outside of the range they were given.
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static const size_t max_small = 1100;
+static const size_t big_sizes[] = {
+    4095, 4096, 4097, 8191, 65536 + 33, (4 << 20) - 1, (4 << 20) + 65, 9 << 20,
+};
+static const size_t slack = 128;
+
+static void fill(unsigned char* p, size_t n, unsigned seed)
+{
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (i * 31 + seed) >> 3;
+    }
+}
+
+// Copies n bytes with the given offsets into buffers with slack around
+// them, then checks the copy and that the bytes around it were left alone
+static bool check_copy(unsigned char* src, unsigned char* dst,
+                       size_t n, size_t soff, size_t doff)
+{
+    size_t len = n + 2 * slack;
+    fill(src, len, n + soff);
+    memset(dst, 0xa5, len);
+    auto ret = memcpy(dst + doff, src + soff, n);
+    bool ok = ret == dst + doff;
+    for (size_t i = 0; i < len && ok; i++) {
+        ok = dst[i] == (i >= doff && i < doff + n ? src[soff + i - doff] : 0xa5);
+    }
+    return ok;
+}
+
+static void test_memcpy()
+{
+    std::vector<unsigned char> src((9 << 20) + 2 * slack), dst(src.size());
+    bool ok = true;
+    for (size_t n = 0; n <= max_small && ok; n++) {
+        for (size_t soff = 0; soff < 64 && ok; soff += 5) {
+            for (size_t doff = 0; doff < 64 && ok; doff++) {
+                ok = check_copy(src.data(), dst.data(), n, soff, doff);
+            }
+        }
+    }
+    report(ok, "memcpy all small sizes and alignments");
+
+    ok = true;
+    for (auto n : big_sizes) {
+        for (size_t off : {0, 1, 32, 63}) {
+            ok &= check_copy(src.data(), dst.data(), n, off, slack - off);
+        }
+    }
+    report(ok, "memcpy big sizes");
+}
+
+// memmove() copies forwards with memcpy() when dest < src
+static void test_memmove()
+{
+    std::vector<unsigned char> buf(2 * max_small + 4 * slack), expect(buf.size());
+    bool ok = true;
+    for (size_t n = 0; n <= max_small && ok; n += 3) {
+        for (size_t dist = 1; dist < 2 * slack && ok; dist++) {
+            for (int forward = 0; forward < 2; forward++) {
+                size_t src = forward ? slack + dist : slack;
+                size_t dst = forward ? slack : slack + dist;
+                fill(buf.data(), buf.size(), n + dist);
+                expect = buf;
+                for (size_t i = 0; i < n; i++) {
+                    size_t j = forward ? i : n - 1 - i;
+                    expect[dst + j] = expect[src + j];
+                }
+                memmove(buf.data() + dst, buf.data() + src, n);
+                ok &= buf == expect;
+            }
+        }
+    }
+    report(ok, "memmove overlapping both ways");
+}
+
+static void test_memset()
+{
+    std::vector<unsigned char> buf((9 << 20) + 2 * slack);
+    bool ok = true;
+    auto check = [&] (size_t n, size_t off) {
+        memset(buf.data(), 0xa5, n + 2 * slack);
+        auto ret = memset(buf.data() + off, 0x3c, n);
+        bool good = ret == buf.data() + off;
+        for (size_t i = 0; i < n + 2 * slack; i++) {
+            good &= buf[i] == (i >= off && i < off + n ? 0x3c : 0xa5);
+        }
+        return good;
+    };
+    for (size_t n = 0; n <= max_small && ok; n++) {
+        for (size_t off = 1; off <= 64; off++) {
+            ok &= check(n, off);
+        }
+    }
+    report(ok, "memset all small sizes and alignments");
+    ok = true;
+    for (auto n : big_sizes) {
+        ok &= check(n, 1) && check(n, slack);
+    }
+    report(ok, "memset big sizes");
+}
+
+static int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+static void test_memcmp()
+{
+    std::vector<unsigned char> a(max_small + slack), b(a.size());
+    bool ok = true;
+    for (size_t n = 0; n <= 300 && ok; n++) {
+        for (size_t off = 0; off < 40; off += 3) {
+            fill(a.data(), a.size(), 0);
+            b = a;
+            ok &= memcmp(a.data() + off, b.data() + off, n) == 0;
+            for (size_t pos = 0; pos < n; pos++) {
+                // Differing in the sign bit checks the bytes compare unsigned
+                b[off + pos] = a[off + pos] ^ 0x80;
+                int expect = a[off + pos] < b[off + pos] ? -1 : 1;
+                ok &= sign(memcmp(a.data() + off, b.data() + off, n)) == expect;
+                b[off + pos] = a[off + pos];
+            }
+        }
+    }
+    report(ok, "memcmp finds the first difference");
+
+    fill(a.data(), a.size(), 0);
+    b = a;
+    b[max_small - 1]++;
+    report(memcmp(a.data(), b.data(), max_small - 1) == 0 &&
+           memcmp(a.data(), b.data(), max_small) < 0, "memcmp stops at n");
+}
+
+// A page followed by an unmapped one, to check the functions reading
+// strings do not read past the page the string ends in
+static unsigned char* guarded_page()
+{
+    size_t page = getpagesize();
+    auto p = static_cast<unsigned char*>(mmap(nullptr, 2 * page,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (p == MAP_FAILED || mprotect(p + page, page, PROT_NONE)) {
+        return nullptr;
+    }
+    return p;
+}
+
+static void test_memchr(unsigned char* page)
+{
+    size_t page_size = getpagesize();
+    bool ok = true;
+    for (size_t n = 0; n <= 300 && ok; n++) {
+        // Ending right before the unmapped page
+        auto s = page + page_size - n;
+        memset(page, 1, page_size);
+        ok &= memchr(s, 9, n) == nullptr;
+        for (size_t pos = 0; pos < n; pos++) {
+            s[pos] = 9;
+            ok &= memchr(s, 9, n) == s + pos;
+            // The first match counts, also with a later one
+            if (pos + 1 < n) {
+                s[n - 1] = 9;
+                ok &= memchr(s, 9, n) == s + pos;
+                s[n - 1] = 1;
+            }
+            s[pos] = 1;
+        }
+        // A match right after the range does not
+        for (size_t off = 0; off < 64 && n < page_size - 64; off++) {
+            memset(page, 1, page_size);
+            page[off + n] = 9;
+            ok &= memchr(page + off, 9, n) == nullptr;
+        }
+    }
+    report(ok, "memchr");
+}
+
+static void test_strlen(unsigned char* page)
+{
+    size_t page_size = getpagesize();
+    bool ok = true;
+    for (size_t n = 0; n < 1000 && ok; n++) {
+        memset(page, 'x', page_size);
+        auto s = reinterpret_cast<char*>(page + page_size - n - 1);
+        s[n] = 0;
+        ok &= strlen(s) == n;
+        for (size_t off = 0; off < 64; off++) {
+            memset(page, 'x', page_size);
+            page[off + n] = 0;
+            ok &= strlen(reinterpret_cast<char*>(page + off)) == n;
+        }
+    }
+    report(ok, "strlen");
+}
+
+int main()
+{
+    test_memcpy();
+    test_memmove();
+    test_memset();
+    test_memcmp();
+    auto page = guarded_page();
+    report(page, "map guarded page");
+    if (page) {
+        test_memchr(page);
+        test_strlen(page);
+    }
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
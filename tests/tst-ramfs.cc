@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for ramfs: large directories, renames and mmap() of files, which
+// maps the pages of the file itself. Mounts a fresh ramfs of its own, so
+// it does not depend on the file system of the image.
+
+#include <sys/mount.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <set>
+#include <string>
+
+#define MNT "/tmp/tst-ramfs"
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static std::string file_name(int i)
+{
+    return std::string(MNT "/dir/file-") + std::to_string(i);
+}
+
+static std::set<std::string> list(const char* path)
+{
+    std::set<std::string> names;
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return names;
+    }
+    while (auto e = readdir(dir)) {
+        if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) {
+            names.insert(e->d_name);
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+static void test_directory()
+{
+    constexpr int nr_files = 5000;
+
+    report(mkdir(MNT "/dir", 0777) == 0, "mkdir");
+    bool ok = true;
+    for (int i = 0; i < nr_files; i++) {
+        int fd = open(file_name(i).c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666);
+        ok &= fd >= 0;
+        close(fd);
+    }
+    report(ok, "create many files");
+
+    int fd = open(file_name(nr_files / 2).c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666);
+    report(fd < 0 && errno == EEXIST, "create existing file fails");
+
+    struct stat st;
+    ok = true;
+    for (int i = 0; i < nr_files; i++) {
+        ok &= stat(file_name(i).c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+    report(ok, "look up all files");
+    report(stat(MNT "/dir/file-x", &st) < 0 && errno == ENOENT, "look up missing file");
+    report(list(MNT "/dir").size() == nr_files, "readdir returns all files");
+
+    // Remove every entry right after reading it, like rm -r does, which
+    // must neither skip nor repeat any of them
+    DIR* dir = opendir(MNT "/dir");
+    std::set<std::string> seen;
+    unsigned removed = 0;
+    while (auto e = readdir(dir)) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) {
+            continue;
+        }
+        ok &= seen.insert(e->d_name).second;
+        std::string path = std::string(MNT "/dir/") + e->d_name;
+        if (removed < nr_files / 2) {
+            removed += unlink(path.c_str()) == 0;
+        }
+    }
+    closedir(dir);
+    report(ok && seen.size() == nr_files, "readdir while unlinking");
+    report(list(MNT "/dir").size() == nr_files - removed, "unlinked files are gone");
+
+    // Rename within and across directories
+    auto names = list(MNT "/dir");
+    auto first = std::string(MNT "/dir/") + *names.begin();
+    report(rename(first.c_str(), MNT "/dir/renamed") == 0, "rename");
+    report(stat(first.c_str(), &st) < 0 && stat(MNT "/dir/renamed", &st) == 0,
+           "renamed file found under new name only");
+    report(mkdir(MNT "/other", 0777) == 0, "mkdir other");
+    report(rename(MNT "/dir", MNT "/other/dir") == 0, "rename directory");
+    report(list(MNT "/other/dir").size() == nr_files - removed,
+           "moved directory keeps its entries");
+    report(stat(MNT "/other/dir/renamed", &st) == 0, "look up in moved directory");
+
+    for (auto& name : list(MNT "/other/dir")) {
+        unlink((std::string(MNT "/other/dir/") + name).c_str());
+    }
+    report(rmdir(MNT "/other/dir") == 0 && rmdir(MNT "/other") == 0, "rmdir");
+}
+
+static void test_mmap()
+{
+    const size_t page = getpagesize();
+    const size_t size = 4 * page;
+
+    int fd = open(MNT "/mapped", O_CREAT | O_RDWR, 0666);
+    report(fd >= 0, "create file to map");
+    report(ftruncate(fd, size) == 0, "ftruncate");
+    char buf[16] = "written";
+    // Leave the other pages holes
+    report(pwrite(fd, buf, sizeof(buf), page) == sizeof(buf), "pwrite");
+
+    auto p = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    report(p != MAP_FAILED, "mmap shared");
+    report(!strcmp(p + page, "written"), "mapping sees data written before");
+    report(p[0] == 0 && p[3 * page] == 0, "holes read as zeros");
+
+    strcpy(p + 2 * page, "stored");
+    memset(buf, 0, sizeof(buf));
+    report(pread(fd, buf, sizeof(buf), 2 * page) == sizeof(buf) &&
+           !strcmp(buf, "stored"), "read() sees store through mapping");
+
+    strcpy(buf, "again");
+    report(pwrite(fd, buf, sizeof(buf), page) == sizeof(buf) &&
+           !strcmp(p + page, "again"), "mapping sees write()");
+
+    auto q = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    report(q != MAP_FAILED && !strcmp(q + 2 * page, "stored"), "mmap private");
+    strcpy(q + 2 * page, "private");
+    report(!strcmp(p + 2 * page, "stored"), "private store stays private");
+    munmap(q, size);
+
+    report(msync(p, size, MS_SYNC) == 0, "msync");
+    report(munmap(p, size) == 0, "munmap");
+
+    p = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    report(!strcmp(p + 2 * page, "stored"), "store persists in file");
+
+    // Shrinking the file takes the pages away from the mapping too
+    report(ftruncate(fd, page + 4) == 0, "ftruncate while mapped");
+    report(!strncmp(p + page, "agai", 4) && p[page + 4] == 0,
+           "mapping sees truncated tail");
+    report(ftruncate(fd, size) == 0 && p[2 * page] == 0,
+           "regrown file reads zeros");
+    munmap(p, size);
+
+    close(fd);
+    report(unlink(MNT "/mapped") == 0, "unlink mapped file");
+}
+
+int main()
+{
+    mkdir(MNT, 0777);
+    report(mount("", MNT, "ramfs", 0, nullptr) == 0, "mount ramfs");
+
+    test_directory();
+    test_mmap();
+
+    report(umount(MNT) == 0, "umount");
+    rmdir(MNT);
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
@@ -21,6 +21,11 @@ struct test_element {
     test_element(unsigned val) : _val(val), _state(state::initialized) {
         ctors.fetch_add(1, std::memory_order_relaxed);
     }
+    // Resizing the table copies its elements
+    test_element(const test_element& x) : _val(x._val), _state(state::initialized) {
+        x.validate();
+        ctors.fetch_add(1, std::memory_order_relaxed);
+    }
     ~test_element() {
         dtors.fetch_add(1, std::memory_order_relaxed);
         _state = state::destroyed;
@@ -69,6 +74,33 @@ BOOST_AUTO_TEST_CASE(test_rcu_hashtable_basic) {
     BOOST_REQUIRE(test_element::ctors == test_element::dtors);
 }
 
+BOOST_AUTO_TEST_CASE(test_rcu_hashtable_resize) {
+    {
+        osv::rcu_hashtable<test_element> ht;
+        // Grow the table through several resizes, then shrink it back
+        for (unsigned i = 0; i < 1000; ++i) {
+            ht.emplace(i);
+        }
+        BOOST_REQUIRE(ht.size() == 1000);
+        bool found = true;
+        WITH_LOCK(osv::rcu_read_lock) {
+            for (unsigned i = 0; i < 1000; ++i) {
+                found &= bool(ht.reader_find(test_element(i)));
+            }
+        }
+        BOOST_REQUIRE(found);
+        for (unsigned i = 0; i < 1000; i += 2) {
+            ht.erase(ht.owner_find(test_element(i)));
+        }
+        BOOST_REQUIRE(ht.size() == 500);
+        BOOST_REQUIRE(!ht.owner_find(test_element(2)));
+        BOOST_REQUIRE(ht.owner_find(test_element(3)));
+    }
+    // Elements left behind in old bucket arrays must be freed too
+    osv::rcu_flush();
+    BOOST_REQUIRE(test_element::ctors == test_element::dtors);
+}
+
 struct element_status {
     element_status() {}
     element_status(const element_status& e) :
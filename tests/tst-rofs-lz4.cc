@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for rofs_lz4_decompress(), which decompresses the clusters of
+// compressed rofs images. Valid blocks, hand made and compressed here the
+// way scripts/gen-rofs-img.py does without the lz4 module, must decompress
+// to the original data. Corrupt ones must be rejected, and never make the
+// decoder read or write outside of the buffers it was given.
+
+#include "fs/rofs/rofs.hh"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+typedef std::vector<uint8_t> bytes;
+
+static constexpr size_t cluster_size = ROFS_CLUSTER_SIZE_IN_BLOCKS * 512;
+// Bytes past the end of the output buffer which must stay untouched
+static constexpr size_t guard_size = 64;
+static constexpr uint8_t guard = 0xa5;
+
+// Decompresses in into a buffer of dest_size bytes followed by a guard
+static long decompress(const bytes& in, size_t dest_size, bytes& out, bool& guard_ok)
+{
+    out.assign(dest_size + guard_size, guard);
+    // A copy of exactly the input size, so reading past it can be caught by
+    // the memory debugging allocator
+    std::unique_ptr<uint8_t[]> src(new uint8_t[in.size()]);
+    std::copy(in.begin(), in.end(), src.get());
+    auto ret = rofs_lz4_decompress(src.get(), in.size(), out.data(), dest_size);
+    guard_ok = true;
+    for (size_t i = dest_size; i < out.size(); i++) {
+        guard_ok &= out[i] == guard;
+    }
+    if (ret >= 0) {
+        out.resize(ret);
+    }
+    return ret;
+}
+
+static void length_bytes(bytes& out, size_t length)
+{
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(length);
+}
+
+static void sequence(bytes& out, const uint8_t* literals, size_t lit_len,
+                     size_t offset, size_t match_length)
+{
+    uint8_t token = std::min<size_t>(lit_len, 15) << 4;
+    if (match_length) {
+        token |= std::min<size_t>(match_length - 4, 15);
+    }
+    out.push_back(token);
+    if (lit_len >= 15) {
+        length_bytes(out, lit_len - 15);
+    }
+    out.insert(out.end(), literals, literals + lit_len);
+    if (match_length) {
+        out.push_back(offset & 0xff);
+        out.push_back(offset >> 8);
+        if (match_length - 4 >= 15) {
+            length_bytes(out, match_length - 4 - 15);
+        }
+    }
+}
+
+// The greedy compressor of scripts/gen-rofs-img.py
+static bytes compress(const bytes& data)
+{
+    bytes out;
+    std::unordered_map<uint32_t, size_t> table;
+    size_t n = data.size(), anchor = 0, i = 0;
+    while (i + 12 < n) {
+        uint32_t key;
+        memcpy(&key, &data[i], 4);
+        auto ref = table.find(key);
+        bool found = ref != table.end() && i - ref->second <= 65535;
+        size_t from = found ? ref->second : 0;
+        table[key] = i;
+        if (!found) {
+            i++;
+            continue;
+        }
+        size_t match_length = 4, max_length = n - 5 - i;
+        while (match_length < max_length && data[from + match_length] == data[i + match_length]) {
+            match_length++;
+        }
+        sequence(out, &data[anchor], i - anchor, i - from, match_length);
+        i += match_length;
+        anchor = i;
+    }
+    sequence(out, data.data() + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+static uint32_t rand_state = 1;
+static uint32_t next_rand()
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static void test_hand_made()
+{
+    bytes out;
+    bool guard_ok;
+
+    report(decompress({}, 16, out, guard_ok) == 0, "empty block");
+
+    bytes literals = { 0x50, 'h', 'e', 'l', 'l', 'o' };
+    report(decompress(literals, 16, out, guard_ok) == 5 &&
+           bytes(out) == bytes({ 'h', 'e', 'l', 'l', 'o' }), "literals only");
+
+    // "ab", a match of 10 at offset 2 overlapping its own output, then "x"
+    bytes overlap = { 0x26, 'a', 'b', 2, 0, 0x10, 'x' };
+    std::string want = "ababababababx";
+    report(decompress(overlap, 64, out, guard_ok) == (long)want.size() &&
+           std::string(out.begin(), out.end()) == want, "overlapping match");
+
+    // 300 literals, with a length extension of two bytes
+    bytes long_literals = { 0xf0, 255, 30 };
+    for (int i = 0; i < 300; i++) {
+        long_literals.push_back(i * 7);
+    }
+    bool ok = decompress(long_literals, 300, out, guard_ok) == 300 && guard_ok;
+    for (int i = 0; ok && i < 300; i++) {
+        ok &= out[i] == (uint8_t)(i * 7);
+    }
+    report(ok, "long literal run");
+    report(decompress(long_literals, 299, out, guard_ok) == -1 && guard_ok,
+           "literals not fitting the output rejected");
+
+    // "z" repeated by a match of 284, then "!"
+    bytes long_match = { 0x1f, 'z', 1, 0, 255, 10, 0x10, '!' };
+    ok = decompress(long_match, 286, out, guard_ok) == 286 && guard_ok;
+    for (int i = 0; ok && i < 285; i++) {
+        ok &= out[i] == 'z';
+    }
+    report(ok && out[285] == '!', "long match");
+    report(decompress(long_match, 200, out, guard_ok) == -1 && guard_ok,
+           "match not fitting the output rejected");
+
+    report(decompress({ 0x10, 'a', 0, 0 }, 64, out, guard_ok) == -1, "zero offset rejected");
+    report(decompress({ 0x10, 'a', 2, 0 }, 64, out, guard_ok) == -1,
+           "offset before the output rejected");
+    report(decompress({ 0x50, 'a', 'b' }, 64, out, guard_ok) == -1,
+           "literals past the input rejected");
+    report(decompress({ 0xf0 }, 64, out, guard_ok) == -1 &&
+           decompress({ 0xf0, 255 }, 64, out, guard_ok) == -1,
+           "truncated literal length rejected");
+    report(decompress({ 0x10, 'a', 1 }, 64, out, guard_ok) == -1,
+           "truncated offset rejected");
+    report(decompress({ 0x1f, 'a', 1, 0, 255 }, 64, out, guard_ok) == -1,
+           "truncated match length rejected");
+}
+
+static std::vector<std::pair<std::string, bytes>> clusters()
+{
+    std::vector<std::pair<std::string, bytes>> ret;
+    ret.emplace_back("zeroes", bytes(cluster_size, 0));
+    bytes text;
+    std::string words[] = { "read ", "only ", "file ", "system ", "cluster ", "\n" };
+    while (text.size() < cluster_size) {
+        auto& w = words[next_rand() % 6];
+        text.insert(text.end(), w.begin(), w.end());
+    }
+    text.resize(cluster_size);
+    ret.emplace_back("text", text);
+    bytes random(cluster_size);
+    for (auto& b : random) {
+        b = next_rand();
+    }
+    ret.emplace_back("random", random);
+    // Random runs repeated at distances up to the whole cluster
+    bytes mixed(cluster_size);
+    for (size_t i = 0; i < cluster_size; i++) {
+        mixed[i] = i < 4096 || next_rand() % 8 ? mixed[i % 4096] ^ (i >> 12) : next_rand();
+    }
+    ret.emplace_back("mixed", mixed);
+    // The last cluster of a file is shorter
+    ret.emplace_back("short", bytes(text.begin(), text.begin() + 1000));
+    return ret;
+}
+
+static void test_round_trip()
+{
+    for (auto& c : clusters()) {
+        auto compressed = compress(c.second);
+        bytes out;
+        bool guard_ok;
+        auto ret = decompress(compressed, cluster_size, out, guard_ok);
+        report(ret == (long)c.second.size() && out == c.second && guard_ok,
+               c.first + " cluster decompressed");
+    }
+}
+
+// Whatever the corruption, the decoder must stay within its buffers
+static void test_corrupt()
+{
+    bool ok = true;
+    unsigned rejected = 0, runs = 0;
+    for (auto& c : clusters()) {
+        auto compressed = compress(c.second);
+        for (int i = 0; i < 500; i++) {
+            auto corrupt = compressed;
+            for (int j = 1 + next_rand() % 4; j; j--) {
+                corrupt[next_rand() % corrupt.size()] = next_rand();
+            }
+            if (next_rand() % 4 == 0) {
+                corrupt.resize(next_rand() % corrupt.size());
+            }
+            bytes out;
+            bool guard_ok;
+            auto ret = decompress(corrupt, cluster_size, out, guard_ok);
+            ok &= guard_ok && ret >= -1 && ret <= (long)cluster_size;
+            rejected += ret != (long)c.second.size();
+            runs++;
+        }
+    }
+    report(ok, "corrupt clusters stay within the buffers");
+    std::cout << rejected << " of " << runs << " corrupt clusters detected by size\n";
+}
+
+int main(int argc, char **argv)
+{
+    test_hand_made();
+    test_round_trip();
+    test_corrupt();
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
@@ -180,6 +180,117 @@ int test_extents(int testfile_readfd, size_t offset, size_t count)
     return ret;
 }
 
+/* Moves count bytes from the input file at offset through a pipe into an
+ * output file at out_offset with splice() and verifies them */
+int test_splice_through_pipe(off_t offset, off_t out_offset, size_t count)
+{
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        return -1;
+    }
+    const char *out_file = "/tmp/testdata_splice_output";
+    int write_fd = open(out_file, O_RDWR | O_TRUNC | O_CREAT, S_IRWXU);
+    if (write_fd == -1) {
+        return -1;
+    }
+
+    size_t moved = 0;
+    off_t in_off = offset, out_off = out_offset;
+    while (moved < count) {
+        ssize_t in = splice(testfile_readfd, &in_off, pipefd[1], NULL, count - moved, 0);
+        if (in <= 0) {
+            return -1;
+        }
+        ssize_t out = splice(pipefd[0], NULL, write_fd, &out_off, in, 0);
+        if (out != in) {
+            return -1;
+        }
+        moved += out;
+    }
+    if (in_off != (off_t)(offset + count) || out_off != (off_t)(out_offset + count)) {
+        return -1;
+    }
+
+    char *dst = (char *)malloc(count);
+    if (pread(write_fd, dst, count, out_offset) != (ssize_t)count ||
+        memcmp(dst, src + offset, count)) {
+        moved = -1;
+    }
+    free(dst);
+    close(write_fd);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return moved;
+}
+
+/* Splices the input file with SPLICE_F_NONBLOCK into a blocking socket whose
+ * peer does not read, which must fail with EAGAIN once the socket is full
+ * rather than wait */
+bool test_splice_to_full_socket()
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(1338);
+
+    int optval = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 1) == -1) {
+        printf("could not listen. error = %s\n", strerror(errno));
+        return false;
+    }
+    int write_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(write_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return false;
+    }
+    int conn_fd = accept(listen_fd, NULL, NULL);
+
+    size_t total = 0;
+    ssize_t ret = 0;
+    for (int i = 0; i < 1000 && ret >= 0; i++) {
+        off_t off = 0;
+        ret = splice(testfile_readfd, &off, write_fd, NULL, size_test_file,
+                     SPLICE_F_NONBLOCK);
+        if (ret > 0) {
+            total += ret;
+        }
+    }
+    bool ok = ret == -1 && errno == EAGAIN && total > 0;
+
+    close(write_fd);
+    close(conn_fd);
+    close(listen_fd);
+    return ok;
+}
+
+int test_copy_file_range(off_t offset, off_t out_offset, size_t count)
+{
+    const char *out_file = "/tmp/testdata_copy_file_range_output";
+    int write_fd = open(out_file, O_RDWR | O_TRUNC | O_CREAT, S_IRWXU);
+    if (write_fd == -1) {
+        return -1;
+    }
+    off_t in_off = offset, out_off = out_offset;
+    int ret = copy_file_range(testfile_readfd, &in_off, write_fd, &out_off, count, 0);
+    if (ret != (int)count || out_off != (off_t)(out_offset + count) ||
+        lseek(write_fd, 0, SEEK_CUR) != 0) {
+        return -1;
+    }
+    char *dst = (char *)malloc(count);
+    if (pread(write_fd, dst, count, out_offset) != (ssize_t)count ||
+        memcmp(dst, src + offset, count)) {
+        ret = -1;
+    }
+    free(dst);
+    close(write_fd);
+    return ret;
+}
+
 int main()
 {
     int ret;
@@ -249,6 +360,23 @@ int main()
     report(ret == -1 && errno == EBADF, "test for bad mode of out_fd");
     report(close(write_fd) == 0, "close the dummy testfile");
 
+    report(test_splice_through_pipe(0, 0, 4096) == 4096, "splice file to pipe to file");
+    report(test_splice_through_pipe(100, 3000, size_test_file - 100) == size_test_file - 100,
+           "splice file to pipe to file at offsets");
+    int pipefd[2];
+    report(pipe(pipefd) == 0, "create pipe");
+    off_t off = 0;
+    ret = splice(pipefd[0], &off, testfile_readfd, NULL, 10, 0);
+    report(ret == -1 && errno == ESPIPE, "test for splice offset on a pipe");
+    ret = splice(pipefd[0], NULL, pipefd[1], NULL, 10, SPLICE_F_NONBLOCK);
+    report(ret == -1 && errno == EAGAIN, "test for non-blocking splice from empty pipe");
+    close(pipefd[0]);
+    close(pipefd[1]);
+    report(test_splice_to_full_socket(), "non-blocking splice from file to full socket");
+
+    report(test_copy_file_range(10, 0, 2048) == 2048, "copy_file_range");
+    report(test_copy_file_range(0, 4096, 1000) == 1000, "copy_file_range with non-zero off_out");
+
     report(unlink(test_filename) == 0, "remove the testfile");
     printf("SUMMARY: %d tests, %d failures\n", tests, fails);
     munmap(src, size_test_file);
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for system call instructions turned into direct calls when the
+// kernel is run with --patch-syscalls, see object::arch_patch_syscalls().
+// Without the option nothing is patched, and the same results are expected
+// from the syscall instructions.
+//
+// scripts/test.py runs this test a second time with the option, and the
+// argument "patched" to check the sites we expect to be patched were.
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <iostream>
+
+extern "C" pid_t gettid();
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+// Code bytes of the sites below, to tell whether they were patched
+extern "C" const unsigned char getpid_site[], decoy_site[];
+
+static long raw_getpid()
+{
+    long ret;
+    asm volatile(".globl getpid_site\n\t.hidden getpid_site\n"
+                 "getpid_site:\n\t"
+                 "mov %1, %%eax\n\t"
+                 "syscall"
+                 : "=a"(ret) : "i"(SYS_getpid) : "rcx", "r11", "memory");
+    return ret;
+}
+
+static long raw_gettid()
+{
+    long ret;
+    asm volatile("mov %1, %%eax\n\t"
+                 "syscall"
+                 : "=a"(ret) : "i"(SYS_gettid) : "rcx", "r11", "memory");
+    return ret;
+}
+
+static long raw_write(int fd, const void* buf, size_t len)
+{
+    long ret;
+    asm volatile("mov %1, %%eax\n\t"
+                 "syscall"
+                 : "=a"(ret) : "i"(SYS_write), "D"(fd), "S"(buf), "d"(len)
+                 : "rcx", "r11", "memory");
+    return ret;
+}
+
+// "mov $SYS_gettid, %r8d" (41 b8 imm32) right before a syscall looks like
+// "mov $SYS_gettid, %eax" one byte in, but the call made is getpid
+static long decoy()
+{
+    long ret;
+    asm volatile(".globl decoy_site\n\t.hidden decoy_site\n"
+                 "decoy_site:\n\t"
+                 "mov %1, %%r8d\n\t"
+                 "syscall"
+                 : "=a"(ret) : "i"(SYS_gettid), "a"(SYS_getpid)
+                 : "rcx", "r11", "r8", "memory");
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    bool patched = getpid_site[0] == 0xe9;
+    std::cout << "system call instructions " << (patched ? "" : "not ")
+              << "patched\n";
+    if (argc > 1 && !strcmp(argv[1], "patched")) {
+        report(patched, "getpid site patched");
+    }
+
+    report(raw_getpid() == getpid(), "getpid");
+    report(raw_gettid() == gettid(), "gettid");
+
+    int fds[2];
+    report(pipe(fds) == 0, "pipe");
+    const char msg[] = "hello";
+    report(raw_write(fds[1], msg, sizeof(msg)) == sizeof(msg), "write");
+    char buf[sizeof(msg)] = {};
+    report(read(fds[0], buf, sizeof(buf)) == sizeof(buf) &&
+           !memcmp(buf, msg, sizeof(msg)), "written data read back");
+    report(raw_write(-1, msg, sizeof(msg)) == -EBADF, "write to a bad fd");
+    close(fds[0]);
+    close(fds[1]);
+
+    report(decoy_site[0] == 0x41 && decoy_site[1] == 0xb8, "decoy not patched");
+    report(decoy() == getpid(), "decoy makes the call it encodes");
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
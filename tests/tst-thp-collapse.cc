@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for the collapsing of small pages into huge pages, see
+// thp_collapser in core/mmu.cc. A huge page window is made of small pages
+// by splitting its vma with mprotect() before touching it. The window is
+// then collapsed while another thread keeps reading and writing it, and
+// none of the data may be lost.
+
+#include <osv/mmu.hh>
+#include <osv/align.hh>
+
+#include <sys/mman.h>
+#include <string.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static constexpr size_t pages = mmu::huge_page_size / mmu::page_size;
+// Page whose vma is split off, and offset of the word the other thread
+// writes in each page
+static constexpr size_t split_page = 100;
+static constexpr size_t word_offset = 64;
+
+static bool is_huge(char* addr)
+{
+    struct visitor : public mmu::virt_pte_visitor {
+        bool huge = false;
+        void pte(mmu::pt_element<0> pte) override {}
+        void pte(mmu::pt_element<1> pte) override { huge = true; }
+    } v;
+    mmu::virt_visit_pte_rcu(reinterpret_cast<uintptr_t>(addr), v);
+    return v.huge;
+}
+
+static unsigned long* word(char* window, size_t i)
+{
+    return reinterpret_cast<unsigned long*>(window + i * mmu::page_size + word_offset);
+}
+
+// Map a region holding an aligned huge page window and fill the window with
+// small pages
+static char* map_window(int flags, void*& region, size_t& size)
+{
+    size = 2 * mmu::huge_page_size;
+    region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE | flags, -1, 0);
+    if (region == MAP_FAILED) {
+        return nullptr;
+    }
+    auto window = align_up(static_cast<char*>(region), mmu::huge_page_size);
+    auto split = window + split_page * mmu::page_size;
+    mprotect(split, mmu::page_size, PROT_READ);
+    for (size_t i = 0; i < pages; i++) {
+        if (i != split_page) {
+            memset(window + i * mmu::page_size, i & 0xff, mmu::page_size);
+        }
+    }
+    mprotect(split, mmu::page_size, PROT_READ | PROT_WRITE);
+    memset(split, split_page & 0xff, mmu::page_size);
+    for (size_t i = 0; i < pages; i++) {
+        *word(window, i) = 0;
+    }
+    return window;
+}
+
+static bool collapse(char* window)
+{
+    for (int pass = 0; pass < 100; pass++) {
+        mmu::thp_collapse_pass();
+        if (is_huge(window)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_concurrent_access()
+{
+    void* region;
+    size_t size;
+    auto window = map_window(0, region, size);
+    report(window && !is_huge(window), "window mapped by small pages");
+    if (!window) {
+        return;
+    }
+
+    std::atomic<bool> stop(false);
+    std::vector<unsigned long> expected(pages);
+    unsigned long mismatches = 0;
+    std::atomic<unsigned long> rounds(0);
+    std::thread t([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+            for (size_t i = 0; i < pages; i++) {
+                auto w = word(window, i);
+                mismatches += *w != expected[i];
+                *w = ++expected[i];
+            }
+            rounds++;
+        }
+    });
+    bool collapsed = collapse(window);
+    // Let the other thread go over the huge page a few more times
+    auto after = rounds.load();
+    while (rounds < after + 3) {
+        std::this_thread::yield();
+    }
+    stop.store(true);
+    t.join();
+
+    report(collapsed, "window collapsed while being written to");
+    report(mismatches == 0, "no write of the other thread lost");
+    bool intact = true;
+    for (size_t i = 0; i < pages; i++) {
+        auto page = window + i * mmu::page_size;
+        intact &= *word(window, i) == expected[i];
+        for (size_t j = 0; j < mmu::page_size; j++) {
+            if (j >= word_offset && j < word_offset + sizeof(unsigned long)) {
+                continue;
+            }
+            intact &= static_cast<unsigned char>(page[j]) == (i & 0xff);
+        }
+    }
+    report(intact, "contents of the window kept");
+    munmap(region, size);
+}
+
+// Populated mappings, like those of malloc(), must stay as they are
+static void test_populated_skipped()
+{
+    void* region;
+    size_t size;
+    auto window = map_window(MAP_POPULATE, region, size);
+    report(window && !is_huge(window), "populated window split into small pages");
+    if (!window) {
+        return;
+    }
+    report(!collapse(window), "populated window not collapsed");
+    munmap(region, size);
+}
+
+int main(int argc, char **argv)
+{
+    test_concurrent_access();
+    test_populated_skipped();
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
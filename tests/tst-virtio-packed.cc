@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests for packed virtqueues, see the packed_* methods of virtio::vring.
+// A fake device negotiates VIRTIO_F_RING_PACKED and marks the buffers the
+// driver side makes available as used, in order. Enough buffers go through
+// rings of several sizes, not all of them powers of two, for the ring and
+// the driver's free running u16 counters to wrap around many times.
+
+#include "drivers/virtio.hh"
+#include "drivers/virtio-vring.hh"
+
+#include <osv/mmu.hh>
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <string>
+
+using namespace virtio;
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+class fake_device : public virtio_device {
+public:
+    virtual hw_device_id get_id() { return hw_device_id(VIRTIO_VENDOR_ID, 0); }
+    virtual hw_device_type get_device_type() { return virtio_over_pci_device; }
+    virtual void print() {}
+    virtual void reset() {}
+
+    virtual void init() {}
+    virtual unsigned get_irq() { return 0; }
+    virtual u8 read_and_ack_isr() { return 0; }
+    virtual void register_interrupt(interrupt_factory irq_factory) {}
+
+    virtual void select_queue(int queue) {}
+    virtual u16 get_queue_size() { return 0; }
+    virtual void setup_queue(vring *queue) {}
+    virtual void activate_queue(int queue) {}
+    virtual void kick_queue(int queue) { kicks++; }
+
+    virtual u64 get_available_features() {
+        return (u64)1 << VIRTIO_F_VERSION_1 | (u64)1 << VIRTIO_F_RING_PACKED;
+    }
+    virtual void set_enabled_features(u64 features) {}
+
+    virtual u8 get_status() { return _status; }
+    virtual void set_status(u8 status) { _status = status; }
+
+    virtual u8 read_config(u32 offset) { return 0; }
+    virtual void dump_config() {}
+
+    virtual bool get_shm(u8 id, mmioaddr_t &addr, u64 &length) { return false; }
+
+    virtual bool is_modern() { return true; }
+    virtual size_t get_vring_alignment() { return 4096; }
+
+    unsigned long kicks = 0;
+private:
+    u8 _status = 0;
+};
+
+class fake_driver : public virtio_driver {
+public:
+    explicit fake_driver(fake_device& dev) : virtio_driver(dev) {
+        setup_features();
+    }
+    virtual std::string get_name() const { return "fake-virtio"; }
+};
+
+// The device side of a packed ring: uses the available buffers in order,
+// writing each used descriptor over the head of its chain
+class device_ring {
+public:
+    explicit device_ring(vring* q)
+        : _desc(static_cast<vring_packed_desc*>(mmu::phys_to_virt(q->get_desc_addr())))
+        , _num(q->size()) {}
+
+    bool use_one(u32 len) {
+        auto& head = _desc[_idx];
+        u16 flags = head._flags.load(std::memory_order_acquire);
+        bool avail = flags & vring_packed_desc::VRING_PACKED_DESC_F_AVAIL;
+        bool used = flags & vring_packed_desc::VRING_PACKED_DESC_F_USED;
+        if (avail != _wrap_counter || used == _wrap_counter) {
+            return false;
+        }
+        unsigned n = 1;
+        for (u16 i = _idx; _desc[i]._flags.load(std::memory_order_relaxed) &
+                           vring_desc::VRING_DESC_F_NEXT; n++) {
+            i = i + 1 == _num ? 0 : i + 1;
+        }
+        head._len = len;
+        head._flags.store(_wrap_counter ? vring_packed_desc::VRING_PACKED_DESC_F_AVAIL |
+                                          vring_packed_desc::VRING_PACKED_DESC_F_USED : 0,
+                          std::memory_order_release);
+        _idx += n;
+        if (_idx >= _num) {
+            _idx -= _num;
+            _wrap_counter = !_wrap_counter;
+            wraps++;
+        }
+        return true;
+    }
+
+    unsigned wraps = 0;
+private:
+    vring_packed_desc* _desc;
+    u16 _num;
+    u16 _idx = 0;
+    bool _wrap_counter = true;
+};
+
+static void test_ring(u16 num)
+{
+    constexpr unsigned long total = 70000;
+    auto name = "ring of " + std::to_string(num) + ": ";
+    fake_device dev;
+    fake_driver drv(dev);
+    report(drv.get_packed_ring_cap(), name + "packed ring negotiated");
+    auto q = new vring(&drv, num, 0);
+    device_ring device(q);
+    // Page aligned, so each 512 byte piece takes exactly one descriptor
+    auto buf = static_cast<char*>(aligned_alloc(4096, 4096));
+
+    // Buffers of 1 to 3 descriptors. The device completes a varying number
+    // of them at a time, so the used descriptors are read at every offset.
+    unsigned long added = 0, completed = 0;
+    bool ok = true;
+    while (completed < total && ok) {
+        while (added < total) {
+            q->init_sg();
+            unsigned nsg = 1 + added % 3;
+            for (unsigned i = 0; i < nsg; i++) {
+                q->add_out_sg(buf + i * 512, 512);
+            }
+            if (!q->add_buf(reinterpret_cast<void*>(added + 1))) {
+                break;
+            }
+            added++;
+        }
+        q->kick();
+        unsigned batch = 1 + (added + completed) % 4, used = 0;
+        while (used < batch && device.use_one(completed + used)) {
+            used++;
+        }
+        u32 len;
+        while (auto cookie = q->get_buf_elem(&len)) {
+            ok &= cookie == reinterpret_cast<void*>(completed + 1) && len == completed;
+            q->get_buf_finalize();
+            completed++;
+        }
+        q->get_buf_gc();
+        ok &= completed <= added;
+    }
+    report(ok && completed == total, name + "buffers completed in order");
+    report(device.wraps >= total / num, name + "ring wrapped around");
+    report(q->avail_ring_has_room(num), name + "all descriptors free at the end");
+    report(dev.kicks > 0, name + "device kicked");
+    delete q;
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    for (u16 num : { 256, 6, 5, 3 }) {
+        test_ring(num);
+    }
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
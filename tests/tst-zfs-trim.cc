@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 Reliable System Software, Technische Universität Braunschweig.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests the discarding of space freed by ZFS, see vdev_disk_trim(). A file
+// is written to the ZFS root and removed, and the txgs which put its blocks
+// back into circulation are forced by further writes and sync().
+//
+// scripts/test.py runs this test once as is, when nothing may be discarded,
+// and once with --zfs-trim, when the space of the file must have been
+// discarded if the disk can do it.
+
+#include <osv/device.h>
+#include <osv/prex.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" bool zfs_trim_enabled;
+extern "C" uint64_t zfs_trimmed_bytes;
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static constexpr size_t file_size = 16 << 20;
+
+// Written with random data, so the file takes as much space even if the
+// pool compresses
+static bool write_file(const char* path, size_t size)
+{
+    static uint32_t seed = 1;
+    std::vector<uint32_t> buf(std::min<size_t>(size, 128 * 1024) / sizeof(uint32_t));
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    size_t len = buf.size() * sizeof(uint32_t);
+    for (size_t done = 0; done < size && ok; done += len) {
+        for (auto& w : buf) {
+            seed = seed * 1103515245 + 12345;
+            w = seed;
+        }
+        ok = write(fd, buf.data(), len) == (ssize_t)len;
+    }
+    ok &= fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Deferred frees are only discarded a few txgs after the one which freed
+// them, so keep the pool busy for a while
+static uint64_t trimmed_after_frees(unsigned txgs)
+{
+    auto before = __atomic_load_n(&zfs_trimmed_bytes, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < txgs; i++) {
+        write_file("/tst-zfs-trim.small", 4096);
+        sync();
+    }
+    unlink("/tst-zfs-trim.small");
+    sync();
+    return __atomic_load_n(&zfs_trimmed_bytes, __ATOMIC_RELAXED) - before;
+}
+
+int main(int argc, char** argv)
+{
+    std::cout << "ZFS trim " << (zfs_trim_enabled ? "enabled" : "disabled") << "\n";
+
+    // The disk the ZFS root lives on, see the loader
+    struct device* dev;
+    bool can_discard = false;
+    if (device_open("vblk0.1", DO_RDONLY, &dev) == 0) {
+        can_discard = dev->max_discard_size != 0;
+        device_close(dev);
+    }
+    std::cout << "disk " << (can_discard ? "can" : "can not") << " discard\n";
+
+    report(write_file("/tst-zfs-trim.data", file_size), "file written");
+    sync();
+    report(unlink("/tst-zfs-trim.data") == 0, "file removed");
+    auto trimmed = trimmed_after_frees(8);
+    std::cout << trimmed << " bytes discarded\n";
+
+    if (!zfs_trim_enabled) {
+        report(trimmed == 0, "nothing discarded without --zfs-trim");
+    } else if (can_discard) {
+        report(trimmed >= file_size / 2, "space of the file discarded");
+    } else {
+        report(trimmed == 0, "nothing discarded on a disk which can not");
+    }
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}